@@ -56,6 +56,17 @@ void RenderThread::run()
     timer.stop();
     ss << "Post-processing time: " << timer.elapsed() << "ms";
 
+    Renderer& renderer = _main_window->get_renderer();
+    if (renderer.render_settings().enable_bvh && renderer.render_settings().enable_bvh_statistics)
+    {
+        BVH::Statistics statistics = renderer.get_bvh().statistics();
+
+        std::cout << statistics << std::endl;
+        ss << std::endl << statistics;
+        if (statistics.save(MainWindow::BVH_STATISTICS_FILEPATH))
+            ss << std::endl << "BVH statistics saved to " << MainWindow::BVH_STATISTICS_FILEPATH;
+    }
+
     //Sending a signal to the main window for it to write the logs in the UI console
     emit write_to_main_console(ss.str());
 
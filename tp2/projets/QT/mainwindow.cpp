@@ -1,3 +1,4 @@
+#include "bvhCache.h"
 #include "editMaterialDialog.h"
 #include "graphicsViewZoom.h"
 #include "image_io.h"
@@ -114,24 +115,57 @@ void MainWindow::prepare_bvh()
     int new_bvh_max_obj_count = safe_text_to_int(this->ui->bvh_max_leaf_object_edit->text());
     if (new_bvh_max_obj_count == -1)
         new_bvh_max_obj_count = _renderer.render_settings().bvh_leaf_object_count;
+    //The items of the combo box are in the same order as the BVHBuilder enum
+    RenderSettings::BVHBuilder new_bvh_builder = (RenderSettings::BVHBuilder)this->ui->bvh_builder_combo_box->currentIndex();
+    RenderSettings::BVHLayout new_bvh_layout = (RenderSettings::BVHLayout)this->ui->bvh_layout_combo_box->currentIndex();
+    bool new_bvh_optimize_treelets = this->ui->bvh_optimize_treelets_check_box->isChecked();
+    bool new_bvh_quads = this->ui->bvh_quads_check_box->isChecked();
 
 
-    //The user just enabled the BVH or changed the settings of the BVH
+    //The user just enabled the BVH or changed the settings of the BVH. The BVH built with the interactive
+    //builder when the geometry was edited is also built again with the builder of the UI before the render
     if ((new_bvh_enabled && !_renderer.render_settings().enable_bvh) ||
+        (new_bvh_enabled && _renderer.is_bvh_interactive()) ||
         (new_bvh_max_depth != _renderer.render_settings().bvh_max_depth ||
-         new_bvh_max_obj_count != _renderer.render_settings().bvh_leaf_object_count))
+         new_bvh_max_obj_count != _renderer.render_settings().bvh_leaf_object_count ||
+         new_bvh_builder != _renderer.render_settings().bvh_builder ||
+         new_bvh_layout != _renderer.render_settings().bvh_layout ||
+         new_bvh_optimize_treelets != _renderer.render_settings().bvh_optimize_treelets ||
+         new_bvh_quads != _renderer.render_settings().bvh_quads))
     {
         _renderer.render_settings().bvh_max_depth = new_bvh_max_depth;
         _renderer.render_settings().bvh_leaf_object_count = new_bvh_max_obj_count;
+        _renderer.render_settings().bvh_builder = new_bvh_builder;
+        _renderer.render_settings().bvh_layout = new_bvh_layout;
+        _renderer.render_settings().bvh_optimize_treelets = new_bvh_optimize_treelets;
+        _renderer.render_settings().bvh_quads = new_bvh_quads;
 
         _renderer.reconstruct_bvh_new();
+
+        if (new_bvh_optimize_treelets)
+        {
+            std::stringstream ss;
+            ss << "BVH " << _renderer.get_bvh()._treelet_optimization;
+            write_to_console(ss);
+        }
     }
     else if (!new_bvh_enabled && _renderer.render_settings().enable_bvh)
         _renderer.destroy_bvh(); //The user just disabled the BVH
 
     _renderer.render_settings().bvh_max_depth = new_bvh_max_depth;
     _renderer.render_settings().bvh_leaf_object_count = new_bvh_max_obj_count;
+    _renderer.render_settings().bvh_builder = new_bvh_builder;
+    _renderer.render_settings().bvh_layout = new_bvh_layout;
+    _renderer.render_settings().bvh_optimize_treelets = new_bvh_optimize_treelets;
+    _renderer.render_settings().bvh_quads = new_bvh_quads;
     _renderer.render_settings().enable_bvh = new_bvh_enabled;
+    _renderer.render_settings().enable_bvh_statistics = this->ui->bvh_statistics_check_box->isChecked();
+    _renderer.render_settings().enable_ray_packets = this->ui->ray_packets_check_box->isChecked();
+
+    //The items of the combo box are in the same order as the TriangleIntersectionKernel enum
+    RenderSettings::TriangleIntersectionKernel new_intersection_kernel = (RenderSettings::TriangleIntersectionKernel)this->ui->triangle_intersection_combo_box->currentIndex();
+    if (new_intersection_kernel != _renderer.render_settings().triangle_intersection_kernel)
+        _renderer.set_triangle_intersection_kernel(new_intersection_kernel);
 }
 
 void MainWindow::prepare_renderer_buffers()
@@ -181,6 +215,12 @@ void MainWindow::prepare_renderer_buffers()
             _renderer.destroy_ssao_buffers();
     }
 
+    //The items of the combo box are in the same order as the TileOrder enum
+    _renderer.render_settings().tile_order = (RenderSettings::TileOrder)this->ui->tile_order_combo_box->currentIndex();
+    int new_tile_size = safe_text_to_int(this->ui->tile_size_edit->text());
+    if (new_tile_size > 0)
+        _renderer.render_settings().tile_size = new_tile_size;
+
     _renderer.clear_z_buffer();
     _renderer.clear_normal_buffer();
     //Note that we're clear the image buffer even if we're going to
@@ -198,7 +238,15 @@ void MainWindow::transform_object()
     {
         Transform object_transform = get_object_transform_from_edits();
 
-        _renderer.set_object_transform(object_transform);
+        //Moving an instance only moves its bounding volume, its triangles are shared with the other instances
+        if (_edited_instance != -1)
+            _renderer.set_instance_transform(_edited_instance, object_transform * _edited_instance_load_transform);
+        else if (_renderer.set_object_transform(object_transform))
+        {
+            std::stringstream ss;
+            ss << "BVH Rebuilding time (" << RenderSettings::bvh_builder_name(_renderer.render_settings().bvh_interactive_builder) << "): " << _renderer.get_bvh()._build_time << "ms";
+            write_to_console(ss);
+        }
     }
 }
 
@@ -255,14 +303,56 @@ void MainWindow::load_obj(const char* filepath, Transform transform)
 
     timer.start();
 
+    //The OBJ was already loaded, its triangles are instanced instead of being copied in the scene again.
+    //They are only read again and their BVH built the first time the OBJ is instanced
+    auto loaded_obj = _loaded_objs.find(filepath);
+    if (loaded_obj != _loaded_objs.end())
+    {
+        //The BVH of an instanced mesh is never built again, it is built with the builder of the UI right away
+        if (loaded_obj->second._instanced_mesh == nullptr)
+        {
+            MeshIOData meshData = read_meshio_data(filepath);
+            IndexedMesh mesh = MeshIOUtils::create_indexed_mesh(meshData, loaded_obj->second._material_offset, Identity());
+            loaded_obj->second._instanced_mesh = std::make_shared<const InstancedMesh>(mesh, _renderer.render_settings());
+        }
+
+        //The object transform edits now move the new instance
+        _edited_instance = _renderer.add_mesh_instance(loaded_obj->second._instanced_mesh, transform);
+        _edited_instance_load_transform = transform;
+        _cached_object_transform_translation.x = -INFINITY;
+
+        timer.stop();
+
+        ss << "OBJ Instancing time: " << timer.elapsed() << "ms";
+        write_to_console(ss);
+
+        return;
+    }
+
     MeshIOData meshData = read_meshio_data(filepath);
     meshData.materials.materials.at(0).roughness = 0.0;
     meshData.materials.materials.at(0).reflection = 0.9;
     meshData.materials.materials.at(0).specular = Color(0.2f);
     meshData.materials.materials.at(0).diffuse = Color(0.5f);
-    std::vector<Triangle> triangles = MeshIOUtils::create_triangles(meshData, _renderer.get_materials().count(), transform);
 
-    _renderer.set_triangles(triangles);
+    //The BVH of the triangles of the OBJ is only built if it isn't in the cache already.
+    //It is built with the interactive builder and without optimizing its treelets so that loading a new OBJ
+    //doesn't stall the UI. It is built again with the settings of the UI before the next render, see prepare_bvh()
+    bool bvh_enabled = _renderer.render_settings().enable_bvh;
+    RenderSettings cache_settings = _renderer.render_settings();
+    cache_settings.bvh_builder = cache_settings.bvh_interactive_builder;
+    cache_settings.bvh_optimize_treelets = false;
+    uint64_t cache_key = BVHCache::compute_key(filepath, transform, _renderer.get_materials().count(), cache_settings);
+    bool bvh_loaded_from_cache = bvh_enabled && _renderer.load_bvh_from_cache(cache_key, cache_settings);
+    if (!bvh_loaded_from_cache)
+    {
+        IndexedMesh mesh = MeshIOUtils::create_indexed_mesh(meshData, _renderer.get_materials().count(), transform);
+
+        _renderer.set_mesh(mesh, cache_settings);
+        if (bvh_enabled)
+            _renderer.save_bvh_to_cache(cache_key);
+    }
+    _loaded_objs[filepath] = LoadedOBJ { _renderer.get_materials().count(), nullptr };
     for(const Material& mat : meshData.materials.materials)
         _renderer.get_materials().materials.push_back(mat);
     precompute_materials(_renderer.get_materials());
@@ -273,10 +363,15 @@ void MainWindow::load_obj(const char* filepath, Transform transform)
     //the new OBJ wouldn't be coherent with the transform of the edits of the UI
     _cached_object_transform_translation.x = -INFINITY;
     _renderer.reset_previous_transform();
+    _edited_instance = -1;
 
     timer.stop();
 
     ss << "OBJ Loading time: " << timer.elapsed() << "ms";
+    if (bvh_loaded_from_cache)
+        ss << std::endl << "BVH Loading time (cache): " << _renderer.get_bvh()._build_time << "ms";
+    else if (bvh_enabled)
+        ss << std::endl << "BVH Building time (" << RenderSettings::bvh_builder_name(cache_settings.bvh_interactive_builder) << "): " << _renderer.get_bvh()._build_time << "ms";
     write_to_console(ss);
 }
 
@@ -398,6 +493,12 @@ void MainWindow::on_enable_bvh_check_box_stateChanged(int checked)
     this->ui->bvh_max_depth_label->setEnabled(checked);
     this->ui->bvh_max_leaf_object_edit->setEnabled(checked);
     this->ui->bvh_max_leaf_object_label->setEnabled(checked);
+    this->ui->bvh_builder_combo_box->setEnabled(checked);
+    this->ui->bvh_layout_combo_box->setEnabled(checked);
+    this->ui->bvh_statistics_check_box->setEnabled(checked);
+    this->ui->bvh_optimize_treelets_check_box->setEnabled(checked);
+    this->ui->bvh_quads_check_box->setEnabled(checked);
+    this->ui->ray_packets_check_box->setEnabled(checked);
 }
 
 void MainWindow::on_enable_shadows_check_box_stateChanged(int checked) { _renderer.render_settings().compute_shadows = checked; }
@@ -799,7 +900,13 @@ void MainWindow::on_clear_normal_map_button_clicked() { _renderer.clear_normal_m
 void MainWindow::on_clear_displacement_map_button_clicked() { _renderer.clear_displacement_map(); this->ui->displacement_map_loaded_edit->setText("no map loaded"); }
 void MainWindow::on_clear_roughness_map_button_clicked() { _renderer.clear_roughness_map(); this->ui->roughness_map_loaded_edit->setText("no map loaded"); }
 
-void MainWindow::on_clear_scene_button_clicked() { _renderer.clear_geometry(); }
+void MainWindow::on_clear_scene_button_clicked()
+{
+    _renderer.clear_geometry();
+
+    _loaded_objs.clear();
+    _edited_instance = -1;
+}
 
 void MainWindow::on_add_sphere_button_clicked()
 {
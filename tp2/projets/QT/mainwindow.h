@@ -6,8 +6,11 @@
 #include "graphicsViewZoom.h"
 #include "renderer.h"
 
+#include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
+#include <string>
 #include <thread>
 
 #include <QDir>
@@ -90,6 +93,9 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
+    //File the BVH statistics are written to after each render if they are enabled
+    static constexpr const char* BVH_STATISTICS_FILEPATH = "bvh_statistics.json";
+
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
@@ -306,6 +312,22 @@ private:
 
     Renderer _renderer;
 
+    //OBJ files loaded so far, by file path. Loading one of them again
+    //adds an instance of its triangles instead of copying them, see load_obj()
+    struct LoadedOBJ
+    {
+        //Index of the first material of the OBJ in the materials of the renderer
+        int _material_offset;
+        //Triangles of the OBJ shared by all its instances. Only created once the OBJ is loaded a second time
+        std::shared_ptr<const InstancedMesh> _instanced_mesh;
+    };
+    std::map<std::string, LoadedOBJ> _loaded_objs;
+
+    //Instance moved by the object transform edits, -1 if the edits transform the triangles of the renderer
+    int _edited_instance = -1;
+    //Transform the edited instance was loaded with, the transform of the edits is applied on top of it
+    Transform _edited_instance_load_transform;
+
     //This boolean determines whether or not the signals sent by the display thread
     //will be taken into account and the render display refreshed or not
     bool _enable_progressive_render_refresh = true;
@@ -0,0 +1,128 @@
+#include "m256Quads.h"
+
+__m256Quads::__m256Quads(const Triangle* const triangles[], int count)
+{
+    Vector a[QUADS_COUNT], ab[QUADS_COUNT], ac[QUADS_COUNT], ad[QUADS_COUNT];
+    for (int i = 0; i < QUADS_COUNT; i++)
+    {
+        if (i < count)
+        {
+            const Triangle& first = *triangles[i * 2];
+
+            a[i] = Vector(first._a);
+            ab[i] = first._b - first._a;
+            ac[i] = first._c - first._a;
+            //The null edge of a single triangle makes the second triangle degenerate
+            ad[i] = triangles[i * 2 + 1] == nullptr ? Vector(0, 0, 0) : triangles[i * 2 + 1]->_c - first._a;
+        }
+        else
+        {
+            //Null edges give a null normal and thus a null determinant which is always rejected
+            a[i] = ab[i] = ac[i] = ad[i] = Vector(0, 0, 0);
+        }
+    }
+
+    _a = __m256Vector(a);
+    _ab = __m256Vector(ab);
+    _ac = __m256Vector(ac);
+    _ad = __m256Vector(ad);
+}
+
+void __m256Quads::intersect_lanes(const Ray& ray, float t_max, __m256 lanes_t[2], __m256 lanes_u[2], __m256 lanes_v[2], int valid_masks[2]) const
+{
+    __m256Vector minus_direction(_mm256_set1_ps(-ray._direction.x), _mm256_set1_ps(-ray._direction.y), _mm256_set1_ps(-ray._direction.z));
+    __m256Vector OA(_mm256_sub_ps(_mm256_set1_ps(ray._origin.x), _a._x),
+                    _mm256_sub_ps(_mm256_set1_ps(ray._origin.y), _a._y),
+                    _mm256_sub_ps(_mm256_set1_ps(ray._origin.z), _a._z));
+    __m256Vector minus_d_cross_OA = _mm256_cross_product(minus_direction, OA);
+
+    __m256 zeros = _mm256_setzero_ps();
+    __m256 ones = _mm256_set1_ps(1.0f);
+    __m256 t_max_lanes = _mm256_set1_ps(t_max);
+
+    //The diagonal is the second edge of the first triangle and the first edge of the second triangle
+    __m256 minus_d_cross_OA_dot_ac = _mm256_dot_product(minus_d_cross_OA, _ac);
+    const __m256Vector* first_edges[2] = { &_ab, &_ac };
+    const __m256Vector* second_edges[2] = { &_ac, &_ad };
+    for (int i = 0; i < 2; i++)
+    {
+        const __m256Vector& first_edge = *first_edges[i];
+        const __m256Vector& second_edge = *second_edges[i];
+
+        //Non-normalized normals of the triangles, same as Triangle::_normal
+        __m256Vector normal = _mm256_cross_product(first_edge, second_edge);
+
+        __m256 det = _mm256_dot_product(normal, minus_direction);
+#if BACKFACE_CULLING
+        //Back-facing triangles and triangles parallel to the ray
+        __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_GT_OQ);
+#else
+        __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_NEQ_OQ);
+#endif
+        __m256 inv_det = _mm256_div_ps(ones, det);
+
+        //Cramer's rule
+        __m256 minus_d_cross_OA_dot_first = i == 0 ? _mm256_dot_product(minus_d_cross_OA, first_edge) : minus_d_cross_OA_dot_ac;
+        __m256 minus_d_cross_OA_dot_second = i == 0 ? minus_d_cross_OA_dot_ac : _mm256_dot_product(minus_d_cross_OA, second_edge);
+        lanes_u[i] = _mm256_mul_ps(minus_d_cross_OA_dot_second, inv_det);
+        lanes_v[i] = _mm256_mul_ps(_mm256_sub_ps(zeros, minus_d_cross_OA_dot_first), inv_det);
+        lanes_t[i] = _mm256_mul_ps(_mm256_dot_product(normal, OA), inv_det);
+
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_u[i], zeros, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_u[i], ones, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_v[i], zeros, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(lanes_u[i], lanes_v[i]), ones, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_t[i], zeros, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_t[i], t_max_lanes, _CMP_LT_OQ));
+
+        valid_masks[i] = _mm256_movemask_ps(valid);
+    }
+}
+
+int __m256Quads::intersect(const Ray& ray, float& t, float& u, float& v) const
+{
+    __m256 lanes_t[2], lanes_u[2], lanes_v[2];
+    int valid_masks[2];
+    intersect_lanes(ray, t, lanes_t, lanes_u, lanes_v, valid_masks);
+    if ((valid_masks[0] | valid_masks[1]) == 0)
+        return -1;
+
+    alignas(32) float ts[2][QUADS_COUNT], us[2][QUADS_COUNT], vs[2][QUADS_COUNT];
+    for (int i = 0; i < 2; i++)
+    {
+        _mm256_store_ps(ts[i], lanes_t[i]);
+        _mm256_store_ps(us[i], lanes_u[i]);
+        _mm256_store_ps(vs[i], lanes_v[i]);
+    }
+
+    //Same as __m256Triangles::intersect(), the first of the closest
+    //intersections in the order of the triangles of the pack is kept
+    int closest = -1;
+    float closest_t = t;
+    for (int lane = 0; lane < QUADS_COUNT; lane++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if ((valid_masks[i] & (1 << lane)) && (closest == -1 || ts[i][lane] < closest_t))
+            {
+                closest = lane * 2 + i;
+                closest_t = ts[i][lane];
+            }
+        }
+    }
+
+    t = closest_t;
+    u = us[closest % 2][closest / 2];
+    v = vs[closest % 2][closest / 2];
+
+    return closest;
+}
+
+bool __m256Quads::intersect_any(const Ray& ray, float t_max) const
+{
+    __m256 lanes_t[2], lanes_u[2], lanes_v[2];
+    int valid_masks[2];
+    intersect_lanes(ray, t_max, lanes_t, lanes_u, lanes_v, valid_masks);
+
+    return (valid_masks[0] | valid_masks[1]) != 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __M256_QUADS_H
+#define __M256_QUADS_H
+
+#include <immintrin.h>
+
+#include "m256Vector.h"
+#include "ray.h"
+#include "triangle.h"
+
+/*
+ * 8 quads stored in SoA layout, the SIMD form of the quads of the BVH (see BVH::Primitive).
+ *
+ * A quad ABCD is made of the two triangles ABC and ACD that share the diagonal AC, which is how the
+ * OBJ loader splits a quad face. Both triangles of the 8 quads are intersected at once: the vector from
+ * A to the origin of the ray, its cross product with the direction of the ray and its dot product with
+ * the diagonal are computed once for the two triangles of a quad.
+ * A non-planar quad is intersected as its two triangles, not as a bilinear patch, so that
+ * the hits are the same as when its triangles are intersected separately
+ */
+class alignas(32) __m256Quads
+{
+public:
+    constexpr static int QUADS_COUNT = 8;
+    //Number of triangles of a pack, 2 per quad
+    constexpr static int TRIANGLES_COUNT = QUADS_COUNT * 2;
+
+    /*
+     * Packs the first count quads of the given array. The triangles of the i-th quad are
+     * triangles[2 * i] and triangles[2 * i + 1], the second one being nullptr if the lane
+     * only holds a triangle. The second triangle of a quad must start with the diagonal AC of the first one.
+     * If count < 8, the remaining lanes are filled with degenerate quads that can never be intersected
+     */
+    __m256Quads(const Triangle* const triangles[], int count);
+
+    /*
+     * Intersects the 8 quads with the given ray with the same computations and
+     * conventions as __m256Triangles::intersect() for each of their two triangles.
+     *
+     * @param[in, out] t Only the intersections closer than t are considered. Distance to
+     * the closest intersection if one was found
+     * @param[out] u, v Barycentric coordinates of the closest intersection in its triangle
+     * @return The triangle of the closest intersection, 2 * lane for the first triangle of the
+     * quad of the lane and 2 * lane + 1 for the second one. -1 if nothing closer than t was intersected
+     */
+    int intersect(const Ray& ray, float& t, float& u, float& v) const;
+
+    /*
+     * @return True if any of the 8 quads is intersected closer than t_max
+     */
+    bool intersect_any(const Ray& ray, float t_max) const;
+
+private:
+    /*
+     * Intersects the triangles of the 8 quads. The index 0 of the arrays is for the first
+     * triangle of the quads (ABC), the index 1 for the second one (ACD).
+     *
+     * @param[out] valid_masks Mask of the lanes whose intersection is valid and closer than t_max, for each triangle
+     */
+    void intersect_lanes(const Ray& ray, float t_max, __m256 lanes_t[2], __m256 lanes_u[2], __m256 lanes_v[2], int valid_masks[2]) const;
+
+public:
+    __m256Vector _a, _ab, _ac, _ad;
+};
+
+#endif
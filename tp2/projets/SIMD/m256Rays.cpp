@@ -0,0 +1,14 @@
+#include "m256Rays.h"
+
+__m256Rays::__m256Rays(const Ray rays[RAYS_COUNT])
+{
+    Vector origins[RAYS_COUNT], directions[RAYS_COUNT];
+    for (int i = 0; i < RAYS_COUNT; i++)
+    {
+        origins[i] = Vector(rays[i]._origin);
+        directions[i] = rays[i]._direction;
+    }
+
+    _origin = __m256Vector(origins);
+    _direction = __m256Vector(directions);
+}
@@ -0,0 +1,23 @@
+#ifndef __M256_RAYS_H
+#define __M256_RAYS_H
+
+#include <immintrin.h>
+
+#include "m256Vector.h"
+#include "ray.h"
+
+/*
+ * 8 rays stored in SoA layout so that they can be intersected against
+ * the same triangle at once with AVX2 instructions
+ */
+struct __m256Rays
+{
+    constexpr static int RAYS_COUNT = 8;
+
+    __m256Rays(const Ray rays[RAYS_COUNT]);
+
+    __m256Vector _origin;
+    __m256Vector _direction;
+};
+
+#endif
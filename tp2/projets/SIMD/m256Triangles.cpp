@@ -0,0 +1,143 @@
+#include "m256Triangles.h"
+
+__m256Triangles::__m256Triangles(const Triangle* triangles, int count)
+{
+    Vector a[TRIANGLES_COUNT], ab[TRIANGLES_COUNT], ac[TRIANGLES_COUNT];
+    for (int i = 0; i < TRIANGLES_COUNT; i++)
+    {
+        if (i < count)
+        {
+            const Triangle& triangle = triangles[i];
+
+            a[i] = Vector(triangle._a);
+            ab[i] = triangle._b - triangle._a;
+            ac[i] = triangle._c - triangle._a;
+        }
+        else
+        {
+            //Null edges give a null normal and thus a null determinant which is always rejected
+            a[i] = ab[i] = ac[i] = Vector(0, 0, 0);
+        }
+    }
+
+    _a = __m256Vector(a);
+    _ab = __m256Vector(ab);
+    _ac = __m256Vector(ac);
+}
+
+int __m256Triangles::intersect_lanes(const Ray& ray, float t_max, __m256& lanes_t, __m256& lanes_u, __m256& lanes_v) const
+{
+    //Non-normalized normals of the triangles, same as Triangle::_normal
+    __m256Vector normal = _mm256_cross_product(_ab, _ac);
+    __m256Vector minus_direction(_mm256_set1_ps(-ray._direction.x), _mm256_set1_ps(-ray._direction.y), _mm256_set1_ps(-ray._direction.z));
+    __m256Vector OA(_mm256_sub_ps(_mm256_set1_ps(ray._origin.x), _a._x),
+                    _mm256_sub_ps(_mm256_set1_ps(ray._origin.y), _a._y),
+                    _mm256_sub_ps(_mm256_set1_ps(ray._origin.z), _a._z));
+    __m256Vector minus_d_cross_OA = _mm256_cross_product(minus_direction, OA);
+
+    __m256 zeros = _mm256_setzero_ps();
+    __m256 ones = _mm256_set1_ps(1.0f);
+
+    __m256 det = _mm256_dot_product(normal, minus_direction);
+#if BACKFACE_CULLING
+    //Back-facing triangles and triangles parallel to the ray
+    __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_GT_OQ);
+#else
+    __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_NEQ_OQ);
+#endif
+    __m256 inv_det = _mm256_div_ps(ones, det);
+
+    //Cramer's rule
+    lanes_u = _mm256_mul_ps(_mm256_dot_product(minus_d_cross_OA, _ac), inv_det);
+    lanes_v = _mm256_mul_ps(_mm256_sub_ps(zeros, _mm256_dot_product(minus_d_cross_OA, _ab)), inv_det);
+    lanes_t = _mm256_mul_ps(_mm256_dot_product(normal, OA), inv_det);
+
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_u, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_u, ones, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_v, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(lanes_u, lanes_v), ones, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_t, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(lanes_t, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+
+    return _mm256_movemask_ps(valid);
+}
+
+int __m256Triangles::intersect(const Ray& ray, float& t, float& u, float& v) const
+{
+    __m256 lanes_t, lanes_u, lanes_v;
+    int valid_mask = intersect_lanes(ray, t, lanes_t, lanes_u, lanes_v);
+    if (valid_mask == 0)
+        return -1;
+
+    //Finding the closest of the valid intersections. If several lanes are at the
+    //same distance, the first one is kept, same as when intersecting the triangles one by one
+    alignas(32) float ts[TRIANGLES_COUNT], us[TRIANGLES_COUNT], vs[TRIANGLES_COUNT];
+    _mm256_store_ps(ts, lanes_t);
+    _mm256_store_ps(us, lanes_u);
+    _mm256_store_ps(vs, lanes_v);
+
+    int closest_lane = -1;
+    for (int lane = 0; lane < TRIANGLES_COUNT; lane++)
+    {
+        if ((valid_mask & (1 << lane)) && (closest_lane == -1 || ts[lane] < ts[closest_lane]))
+            closest_lane = lane;
+    }
+
+    t = ts[closest_lane];
+    u = us[closest_lane];
+    v = vs[closest_lane];
+
+    return closest_lane;
+}
+
+bool __m256Triangles::intersect_any(const Ray& ray, float t_max) const
+{
+    __m256 lanes_t, lanes_u, lanes_v;
+
+    return intersect_lanes(ray, t_max, lanes_t, lanes_u, lanes_v) != 0;
+}
+
+int __m256Triangles::intersect_rays(const __m256Rays& rays, int lane, __m256 t_max, __m256& rays_t, __m256& rays_u, __m256& rays_v) const
+{
+    //The triangle of the lane is broadcast to the 8 lanes
+    __m256i lane_index = _mm256_set1_epi32(lane);
+    auto broadcast = [lane_index](const __m256Vector& vector) {
+        return __m256Vector(_mm256_permutevar8x32_ps(vector._x, lane_index), _mm256_permutevar8x32_ps(vector._y, lane_index), _mm256_permutevar8x32_ps(vector._z, lane_index));
+    };
+    __m256Vector a = broadcast(_a);
+    __m256Vector ab = broadcast(_ab);
+    __m256Vector ac = broadcast(_ac);
+    __m256Vector normal = _mm256_cross_product(ab, ac);
+
+    //Flipping the sign bit negates the directions exactly as intersect_lanes() does
+    __m256 sign_bit = _mm256_set1_ps(-0.0f);
+    __m256Vector minus_direction(_mm256_xor_ps(rays._direction._x, sign_bit), _mm256_xor_ps(rays._direction._y, sign_bit), _mm256_xor_ps(rays._direction._z, sign_bit));
+    __m256Vector OA(_mm256_sub_ps(rays._origin._x, a._x),
+                    _mm256_sub_ps(rays._origin._y, a._y),
+                    _mm256_sub_ps(rays._origin._z, a._z));
+    __m256Vector minus_d_cross_OA = _mm256_cross_product(minus_direction, OA);
+
+    __m256 zeros = _mm256_setzero_ps();
+    __m256 ones = _mm256_set1_ps(1.0f);
+
+    __m256 det = _mm256_dot_product(normal, minus_direction);
+#if BACKFACE_CULLING
+    __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_GT_OQ);
+#else
+    __m256 valid = _mm256_cmp_ps(det, zeros, _CMP_NEQ_OQ);
+#endif
+    __m256 inv_det = _mm256_div_ps(ones, det);
+
+    rays_u = _mm256_mul_ps(_mm256_dot_product(minus_d_cross_OA, ac), inv_det);
+    rays_v = _mm256_mul_ps(_mm256_sub_ps(zeros, _mm256_dot_product(minus_d_cross_OA, ab)), inv_det);
+    rays_t = _mm256_mul_ps(_mm256_dot_product(normal, OA), inv_det);
+
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(rays_u, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(rays_u, ones, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(rays_v, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(rays_u, rays_v), ones, _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(rays_t, zeros, _CMP_GE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(rays_t, t_max, _CMP_LT_OQ));
+
+    return _mm256_movemask_ps(valid);
+}
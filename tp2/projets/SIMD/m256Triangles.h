@@ -3,15 +3,67 @@
 
 #include <immintrin.h>
 
+#include "m256Rays.h"
 #include "m256Vector.h"
+#include "ray.h"
+#include "triangle.h"
 
-class __m256Triangles
+/*
+ * 8 triangles stored in SoA layout so that a ray can be intersected
+ * against the 8 of them at once with AVX2 instructions.
+ *
+ * Only the geometry needed by the intersection tests is stored, the rest of the triangles
+ * (normals, materials, texture coordinates) are only looked up once the closest hit is known.
+ * The normals are computed from the edges during the tests, that's cheaper than loading them
+ */
+class alignas(32) __m256Triangles
 {
 public:
     constexpr static double EPSILON = 1.0e-4;
+    constexpr static int TRIANGLES_COUNT = 8;
+
+    /*
+     * Packs the first count triangles of the given array.
+     * If count < 8, the remaining lanes are filled with degenerate triangles
+     * that can never be intersected
+     */
+    __m256Triangles(const Triangle* triangles, int count);
+
+    /*
+     * Intersects the 8 triangles with the given ray using the Moller-Trumbore algorithm
+     * with the same conventions as Triangle::intersect().
+     *
+     * @param[in, out] t Only the intersections closer than t are considered. Distance to
+     * the closest intersection if one was found
+     * @param[out] u, v Barycentric coordinates of the closest intersection
+     * @return The lane of the closest intersection, -1 if no triangle closer than t was intersected
+     */
+    int intersect(const Ray& ray, float& t, float& u, float& v) const;
+
+    /*
+     * @return True if any of the 8 triangles is intersected closer than t_max
+     */
+    bool intersect_any(const Ray& ray, float t_max) const;
+
+    /*
+     * Intersects the triangle of the given lane with the 8 rays at once. The computations are the
+     * same as intersect() so a ray finds exactly the same intersections in both cases.
+     *
+     * @param t_max Only the intersections closer than t_max (one distance per ray) are considered
+     * @param[out] rays_t, rays_u, rays_v Distance and barycentric coordinates of the intersection of each ray
+     * @return Mask whose i-th bit is set if the i-th ray intersects the triangle closer than its t_max
+     */
+    int intersect_rays(const __m256Rays& rays, int lane, __m256 t_max, __m256& rays_t, __m256& rays_u, __m256& rays_v) const;
 
 private:
-    __m256Vector _x, _y, _z;
+    /*
+     * Intersects the 8 triangles and returns the mask of the lanes
+     * whose intersection is valid and closer than t_max
+     */
+    int intersect_lanes(const Ray& ray, float t_max, __m256& lanes_t, __m256& lanes_u, __m256& lanes_v) const;
+
+public:
+    __m256Vector _a, _ab, _ac;
 };
 
 #endif
@@ -5,4 +5,56 @@
 
 float _mm256_reduction_ps(__m256 x);
 
+/*
+ * Maximum/minimum of the 8 lanes of x
+ */
+inline float _mm256_max_reduction_ps(__m256 x)
+{
+    __m128 quad = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    __m128 dual = _mm_max_ps(quad, _mm_movehl_ps(quad, quad));
+
+    return _mm_cvtss_f32(_mm_max_ss(dual, _mm_shuffle_ps(dual, dual, 0x1)));
+}
+
+inline float _mm256_min_reduction_ps(__m256 x)
+{
+    __m128 quad = _mm_min_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    __m128 dual = _mm_min_ps(quad, _mm_movehl_ps(quad, quad));
+
+    return _mm_cvtss_f32(_mm_min_ss(dual, _mm_shuffle_ps(dual, dual, 0x1)));
+}
+
+/*
+ * Reduces the 8 given vectors at once. The i-th lane of the result is
+ * the maximum/minimum of the 8 lanes of x[i]. This is cheaper than 8 separate
+ * reductions as the vectors are transposed while being reduced
+ */
+inline __m256 _mm256_max_reduction8_ps(const __m256 x[8])
+{
+    //Lanes of the 128 bit halves: (max(x0[0], x0[2]), max(x1[0], x1[2]), max(x0[1], x0[3]), max(x1[1], x1[3]))
+    __m256 x01 = _mm256_max_ps(_mm256_unpacklo_ps(x[0], x[1]), _mm256_unpackhi_ps(x[0], x[1]));
+    __m256 x23 = _mm256_max_ps(_mm256_unpacklo_ps(x[2], x[3]), _mm256_unpackhi_ps(x[2], x[3]));
+    __m256 x45 = _mm256_max_ps(_mm256_unpacklo_ps(x[4], x[5]), _mm256_unpackhi_ps(x[4], x[5]));
+    __m256 x67 = _mm256_max_ps(_mm256_unpacklo_ps(x[6], x[7]), _mm256_unpackhi_ps(x[6], x[7]));
+
+    //Lanes of the 128 bit halves: maximum of the 4 lanes of the half of x0, x1, x2, x3
+    __m256 x0123 = _mm256_max_ps(_mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(3, 2, 3, 2)));
+    __m256 x4567 = _mm256_max_ps(_mm256_shuffle_ps(x45, x67, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(x45, x67, _MM_SHUFFLE(3, 2, 3, 2)));
+
+    return _mm256_max_ps(_mm256_permute2f128_ps(x0123, x4567, 0x20), _mm256_permute2f128_ps(x0123, x4567, 0x31));
+}
+
+inline __m256 _mm256_min_reduction8_ps(const __m256 x[8])
+{
+    __m256 x01 = _mm256_min_ps(_mm256_unpacklo_ps(x[0], x[1]), _mm256_unpackhi_ps(x[0], x[1]));
+    __m256 x23 = _mm256_min_ps(_mm256_unpacklo_ps(x[2], x[3]), _mm256_unpackhi_ps(x[2], x[3]));
+    __m256 x45 = _mm256_min_ps(_mm256_unpacklo_ps(x[4], x[5]), _mm256_unpackhi_ps(x[4], x[5]));
+    __m256 x67 = _mm256_min_ps(_mm256_unpacklo_ps(x[6], x[7]), _mm256_unpackhi_ps(x[6], x[7]));
+
+    __m256 x0123 = _mm256_min_ps(_mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(x01, x23, _MM_SHUFFLE(3, 2, 3, 2)));
+    __m256 x4567 = _mm256_min_ps(_mm256_shuffle_ps(x45, x67, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_shuffle_ps(x45, x67, _MM_SHUFFLE(3, 2, 3, 2)));
+
+    return _mm256_min_ps(_mm256_permute2f128_ps(x0123, x4567, 0x20), _mm256_permute2f128_ps(x0123, x4567, 0x31));
+}
+
 #endif
\ No newline at end of file
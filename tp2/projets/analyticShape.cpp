@@ -54,11 +54,37 @@ bool Sphere::intersect(const Ray& ray, HitInfo& hit_info, bool compute_uv) const
         }
 
         hit_info.mat_index = _mat_index;
+        hit_info.mesh = nullptr;
+        hit_info.triangle_index = -1;
+        hit_info.triangle = nullptr;
 
         return true;
     }
 }
 
+bool Sphere::intersect_any(const Ray& ray, float t_max) const
+{
+    Vector L = ray._origin - _center;
+    float b = 2 * dot(ray._direction, L);
+    float c = dot(L, L) - _radius2;
+
+    float delta = b * b - 4 * c;
+    if (delta < 0)
+        return false;
+
+    float sqrt_delta = std::sqrt(delta);
+
+    //Closest intersection in front of the origin of the ray
+    float t = (-b - sqrt_delta) / 2;
+    if (t < 0)
+        t = (-b + sqrt_delta) / 2;
+
+    return t >= 0 && t < t_max;
+}
+
+const Point& Sphere::get_center() const { return _center; }
+float Sphere::get_radius() const { return _radius; }
+
 Plane::Plane(const Point& point, const Vector& normal, int mat_index) : _point(point), _normal(normal), _mat_index(mat_index) {}
 
 bool Plane::intersect(const Ray& ray, HitInfo& hit_info) const
@@ -71,10 +97,20 @@ bool Plane::intersect(const Ray& ray, HitInfo& hit_info) const
     hit_info.t = t;
     hit_info.mat_index = _mat_index;
     hit_info.normal_at_intersection = _normal;
+    hit_info.mesh = nullptr;
+    hit_info.triangle_index = -1;
+    hit_info.triangle = nullptr;
 
     return true;
 }
 
+bool Plane::intersect_any(const Ray& ray, float t_max) const
+{
+    float t = dot(_point - ray._origin, _normal) / dot(ray._direction, _normal);
+
+    return t >= 0 && t < t_max;
+}
+
 std::ostream& operator << (std::ostream& os, const Sphere& sphere)
 {
     os << "Sphere[" << sphere._center << ", r=" << sphere._radius << "]";
@@ -23,6 +23,14 @@ public:
     Sphere(const Point& center, float radius, int mat_index = 0);
 
     bool intersect(const Ray& ray, HitInfo& hit_info, bool compute_uv = false) const;
+    /*
+     * Returns true if the sphere is intersected closer than t_max.
+     * None of the attributes of the intersection are computed
+     */
+    bool intersect_any(const Ray& ray, float t_max) const;
+
+    const Point& get_center() const;
+    float get_radius() const;
 
     friend std::ostream& operator << (std::ostream& os, const Sphere& sphere);
 private:
@@ -41,6 +49,10 @@ public:
     Plane(const Point& point, const Vector& normal, int mat_index = 0);
 
     bool intersect(const Ray& ray, HitInfo& hit_info) const;
+    /*
+     * Returns true if the plane is intersected closer than t_max
+     */
+    bool intersect_any(const Ray& ray, float t_max) const;
 
     friend std::ostream& operator << (std::ostream& os, const Plane& plane);
 private:
@@ -0,0 +1,83 @@
+#include "analyticShapesBVH.h"
+
+//Maximum number of spheres in a leaf of the hierarchy
+static constexpr int SPHERES_LEAF_MAX_SPHERES = 4;
+
+void AnalyticShapesBVH::add_shape(const AnalyticShapesTypes& shape)
+{
+    if (std::holds_alternative<Sphere>(shape))
+    {
+        _spheres.push_back(std::get<Sphere>(shape));
+        build();
+    }
+    else
+        _planes.push_back(std::get<Plane>(shape));
+}
+
+void AnalyticShapesBVH::clear()
+{
+    _spheres.clear();
+    _planes.clear();
+    _nodes.clear();
+    _sphere_indices.clear();
+}
+
+int AnalyticShapesBVH::sphere_count() const { return (int)_spheres.size(); }
+int AnalyticShapesBVH::plane_count() const { return (int)_planes.size(); }
+
+void AnalyticShapesBVH::build()
+{
+    std::vector<BVH::BoundingVolume> volumes(_spheres.size());
+    for (int i = 0; i < (int)_spheres.size(); i++)
+    {
+        //The normals of the planes of the volumes are normalized so the
+        //sphere spans its radius on both sides of its center along each normal
+        for (int plane = 0; plane < BVH::BoundingVolume::PLANES_COUNT; plane++)
+        {
+            float center_distance = dot(BVH::BoundingVolume::PLANE_NORMALS[plane], Vector(_spheres[i].get_center()));
+
+            volumes[i]._d_near[plane] = center_distance - _spheres[i].get_radius();
+            volumes[i]._d_far[plane] = center_distance + _spheres[i].get_radius();
+        }
+    }
+
+    BVH::build_median_split(volumes, SPHERES_LEAF_MAX_SPHERES, _nodes, _sphere_indices);
+}
+
+bool AnalyticShapesBVH::intersect(const Ray& ray, HitInfo& hit_info) const
+{
+    bool hit_found = false;
+
+    HitInfo local_hit_info;
+    for (const Plane& plane : _planes)
+    {
+        if (plane.intersect(ray, local_hit_info) && (local_hit_info.t < hit_info.t || hit_info.t == -1))
+        {
+            hit_info = local_hit_info;
+            hit_found = true;
+        }
+    }
+
+    float closest_t = hit_info.t == -1 ? INFINITY : hit_info.t;
+    BVH::traverse_median_split(_nodes, _sphere_indices, ray, closest_t, [&](int sphere_index, float& closest_hit_t) {
+        if (_spheres[sphere_index].intersect(ray, local_hit_info) && local_hit_info.t < closest_hit_t)
+        {
+            closest_hit_t = local_hit_info.t;
+            hit_info = local_hit_info;
+            hit_found = true;
+        }
+    });
+
+    return hit_found;
+}
+
+bool AnalyticShapesBVH::intersect_any(const Ray& ray, float t_max) const
+{
+    for (const Plane& plane : _planes)
+        if (plane.intersect_any(ray, t_max))
+            return true;
+
+    return BVH::traverse_any_median_split(_nodes, _sphere_indices, ray, t_max, [&](int sphere_index) {
+        return _spheres[sphere_index].intersect_any(ray, t_max);
+    });
+}
@@ -0,0 +1,50 @@
+#ifndef ANALYTIC_SHAPES_BVH_H
+#define ANALYTIC_SHAPES_BVH_H
+
+#include <vector>
+
+#include "analyticShape.h"
+#include "bvh.h"
+#include "hitInfo.h"
+#include "ray.h"
+
+/*
+ * Analytic shapes of the scene. The spheres are bounded, they are indexed by a hierarchy
+ * built the same way as the TopLevelBVH so that a ray only intersects the spheres around it.
+ * The planes are unbounded and cannot be put in a hierarchy, they are kept in a
+ * list that every ray goes through. There usually are very few of them
+ */
+class AnalyticShapesBVH
+{
+public:
+    /*
+     * Adds the shape to the scene. The hierarchy over the spheres is built again
+     */
+    void add_shape(const AnalyticShapesTypes& shape);
+    void clear();
+
+    int sphere_count() const;
+    int plane_count() const;
+
+    /*
+     * Finds the closest intersection of the ray with the shapes. If hit_info.t isn't -1,
+     * only the intersections strictly closer than hit_info.t are considered.
+     * All the attributes of the hit are filled, hit_info.is_triangle_hit() is false
+     *
+     * @return True if an intersection was found and written to hit_info
+     */
+    bool intersect(const Ray& ray, HitInfo& hit_info) const;
+    bool intersect_any(const Ray& ray, float t_max) const;
+
+private:
+    void build();
+
+    std::vector<Sphere> _spheres;
+    std::vector<Plane> _planes;
+
+    std::vector<BVH::FlatNode> _nodes;
+    //The leaves of the hierarchy index this array, the spheres of a leaf are contiguous
+    std::vector<int> _sphere_indices;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "benchmark.h"
+#include "bvhCache.h"
 #include "mainUtils.h"
 #include "renderer.h"
+#include "timer.h"
+#include "triangleIntersection.h"
 
-void Benchmark::benchmark_bvh_parameters(const char* filepath, Transform model_transform, int min_obj_count, int max_obj_count, int min_depth, int max_depth, int iterations, int obj_count_step, int depth_step)
+void Benchmark::benchmark_bvh_parameters(const char* filepath, Transform model_transform, int min_obj_count, int max_obj_count, int min_depth, int max_depth, int iterations, int obj_count_step, int depth_step, RenderSettings::BVHBuilder builder)
 {
 	MeshIOData mesh_data = read_meshio_data(filepath);
     std::vector<Triangle> triangles = MeshIOUtils::create_triangles(mesh_data, 0, model_transform);
@@ -23,6 +26,7 @@ void Benchmark::benchmark_bvh_parameters(const char* filepath, Transform model_t
 
 			render_settings.bvh_leaf_object_count = obj_count;
             render_settings.bvh_max_depth = depth;
+            render_settings.bvh_builder = builder;
             render_settings.shading_method = RenderSettings::ShadingMethod::RT_SHADING;
 
 			Renderer renderer(scene, triangles, render_settings);
@@ -47,5 +51,108 @@ void Benchmark::benchmark_bvh_parameters(const char* filepath, Transform model_t
 		}
 	}
 
-	std::cout << "Best settings found for model [" << filepath << "]: [obj_count, max_depth]=[" << best_obj_count << ", " << best_depth << "] with " << best_timing << "ms\n";
+	std::cout << "Best settings found for model [" << filepath << "]: [obj_count, max_depth]=[" << best_obj_count << ", " << best_depth << "] with " << best_timing << "ms (" << 1920 * 1080 / best_timing / 1000.0f << " Mrays/s)\n";
+}
+
+void Benchmark::benchmark_bvh_builders(const char* filepath, Transform model_transform, int iterations)
+{
+	MeshIOData mesh_data = read_meshio_data(filepath);
+	IndexedMesh mesh = MeshIOUtils::create_indexed_mesh(mesh_data, 0, model_transform);
+
+	Scene scene = Scene(Camera(Point(0, 0, 0), 90), PointLight(Point(2, 0, 2)));
+
+	std::cout << "Quantized BVH nodes bounds on " << BVH_QUANTIZED_NODE_BITS << " bits\n";
+	for (int builder_index = 0; builder_index < RenderSettings::BVH_BUILDER_COUNT; builder_index++)
+	{
+		for (int layout_index = 0; layout_index < RenderSettings::BVH_LAYOUT_COUNT; layout_index++)
+		{
+			RenderSettings::BVHBuilder builder = (RenderSettings::BVHBuilder)builder_index;
+			RenderSettings::BVHLayout layout = (RenderSettings::BVHLayout)layout_index;
+
+			RenderSettings render_settings;
+			render_settings.image_width = 1920;
+			render_settings.image_height = 1080;
+			render_settings.hybrid_rasterization_tracing = false;
+			render_settings.shading_method = RenderSettings::ShadingMethod::RT_SHADING;
+			render_settings.bvh_builder = builder;
+			render_settings.bvh_layout = layout;
+
+			//The BVH is only built on the first run of the benchmark on this model
+			Renderer renderer(scene, std::vector<Triangle>(), render_settings);
+			uint64_t cache_key = BVHCache::compute_key(filepath, model_transform, 0, render_settings);
+			if (!renderer.load_bvh_from_cache(cache_key))
+			{
+				renderer.set_mesh(mesh);
+				renderer.save_bvh_to_cache(cache_key);
+			}
+
+			float best_timing = INFINITY;
+			for (int i = 0; i < iterations; i++)
+				best_timing = std::min(best_timing, render(renderer));
+
+			std::cout << RenderSettings::bvh_builder_name(builder) << " " << RenderSettings::bvh_layout_name(layout) << " BVH on model [" << filepath << "] (built/loaded in " << renderer.get_bvh()._build_time << "ms): " << best_timing << "ms, " << render_settings.image_width * render_settings.image_height / best_timing / 1000.0f << " Mrays/s, "
+					  << renderer.get_bvh().statistics()._nodes_memory_footprint / (1024.0f * 1024.0f) << "MB of nodes\n";
+		}
+	}
+}
+
+void Benchmark::benchmark_triangle_intersection_kernels(const char* filepath, Transform model_transform, int ray_count)
+{
+	MeshIOData mesh_data = read_meshio_data(filepath);
+	std::vector<Triangle> triangles = MeshIOUtils::create_triangles(mesh_data, 0, model_transform);
+
+	std::vector<BaldwinWeberTriangle> transforms;
+	transforms.reserve(triangles.size());
+	for (const Triangle& triangle : triangles)
+		transforms.push_back(BaldwinWeberTriangle(triangle));
+
+	int grid_size = std::max(2, (int)std::sqrt((float)ray_count));
+	std::vector<Ray> rays;
+	for (int y = 0; y < grid_size; y++)
+		for (int x = 0; x < grid_size; x++)
+			rays.push_back(Ray(Point(0, 0, 0), normalize(Vector(x / (grid_size - 1.0f) * 2 - 1, y / (grid_size - 1.0f) * 2 - 1, -1))));
+
+	long long test_count = (long long)rays.size() * triangles.size();
+	//Results of the Moller-Trumbore kernel, the other kernels are compared against them
+	std::vector<bool> reference_hits(test_count);
+	for (int kernel_index = 0; kernel_index < RenderSettings::TRIANGLE_INTERSECTION_KERNEL_COUNT; kernel_index++)
+	{
+		const TriangleIntersection::KernelEntry& kernel = TriangleIntersection::kernel((RenderSettings::TriangleIntersectionKernel)kernel_index);
+		const BaldwinWeberTriangle* kernel_transforms = kernel._needs_transforms ? transforms.data() : nullptr;
+
+		//Single threaded so that the time of a test isn't shared between the threads
+		long long hit_count = 0;
+		Timer timer;
+		timer.start();
+		for (const Ray& ray : rays)
+		{
+			for (size_t i = 0; i < triangles.size(); i++)
+			{
+				float t, u, v;
+				if (kernel._intersect(triangles[i], kernel_transforms == nullptr ? nullptr : &kernel_transforms[i], ray, t, u, v))
+					hit_count++;
+			}
+		}
+		timer.stop();
+
+		//Second, untimed, pass comparing the results with the reference kernel
+		long long agreement_count = 0;
+		for (size_t ray_index = 0; ray_index < rays.size(); ray_index++)
+		{
+			for (size_t i = 0; i < triangles.size(); i++)
+			{
+				float t, u, v;
+				bool hit = kernel._intersect(triangles[i], kernel_transforms == nullptr ? nullptr : &kernel_transforms[i], rays[ray_index], t, u, v);
+
+				size_t test_index = ray_index * triangles.size() + i;
+				if (kernel_index == RenderSettings::MOLLER_TRUMBORE_KERNEL)
+					reference_hits[test_index] = hit;
+				if (reference_hits[test_index] == hit)
+					agreement_count++;
+			}
+		}
+
+		std::cout << kernel._name << " kernel on model [" << filepath << "]: " << timer.elapsed() * 1.0e6 / test_count << "ns per test, "
+				  << hit_count * 100.0 / test_count << "% hit rate, " << agreement_count * 100.0 / test_count << "% agreement with Moller-Trumbore over " << test_count << " tests\n";
+	}
 }
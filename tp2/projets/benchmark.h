@@ -2,11 +2,26 @@
 #define BENCHMARK_H
 
 #include "mat.h"
+#include "rendererSettings.h"
 
 class Benchmark
 {
 public:
-	static void benchmark_bvh_parameters(const char* filepath, Transform model_transform, int min_obj_count, int max_obj_count, int min_depth, int max_depth, int iterations, int obj_count_step = 1, int depth_step = 1);
+	static void benchmark_bvh_parameters(const char* filepath, Transform model_transform, int min_obj_count, int max_obj_count, int min_depth, int max_depth, int iterations, int obj_count_step = 1, int depth_step = 1, RenderSettings::BVHBuilder builder = RenderSettings::OCTREE_BUILDER);
+
+	/**
+	 * @brief Renders the given model with each of the available BVH builders and node layouts
+	 * and prints the best render time and the primary rays/sec of each combination
+	 */
+	static void benchmark_bvh_builders(const char* filepath, Transform model_transform, int iterations);
+
+	/**
+	 * @brief Intersects a grid of ray_count camera rays with every triangle of the given model,
+	 * once per ray-triangle intersection kernel (see TriangleIntersection). Prints the
+	 * time per intersection test of each kernel, its hit rate and the proportion of the
+	 * tests whose result agrees with the Moller-Trumbore kernel
+	 */
+	static void benchmark_triangle_intersection_kernels(const char* filepath, Transform model_transform, int ray_count);
 };
 
-#endif
\ No newline at end of file
+#endif
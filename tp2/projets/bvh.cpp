@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
 #include <vector>
 
 #include <cmath>
+#include <omp.h>
 
 #include "bvh.h"
 #include "timer.h"
@@ -15,58 +21,2858 @@ Vector BVH::BoundingVolume::PLANE_NORMALS[BVH::BoundingVolume::PLANES_COUNT] = {
     Vector(std::sqrt(3.0f) / 3, -std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3),
 };
 
-BVH::BVH() : _root(nullptr), _triangles(nullptr) {}
-BVH::BVH(std::vector<Triangle>* triangles, int max_depth, int leaf_max_obj_count) : _triangles(triangles)
+BVH::BVH() : _mesh(nullptr) {}
+BVH::BVH(IndexedMesh* mesh, const RenderSettings& settings) : BVH(mesh, settings.bvh_max_depth, settings.bvh_leaf_object_count, settings.bvh_builder, settings.bvh_layout, settings.bvh_optimize_treelets, settings.bvh_quads)
+{
+	set_intersection_kernel(settings.triangle_intersection_kernel);
+}
+
+BVH::BVH(IndexedMesh* mesh, int max_depth, int leaf_max_obj_count, RenderSettings::BVHBuilder builder, RenderSettings::BVHLayout layout, bool optimize_treelets, bool quads) : _layout(layout), _mesh(mesh), _quads(quads)
 {
 	Timer timer;
 	timer.start();
 
-	BoundingVolume volume;
-	Point minimum(INFINITY, INFINITY, INFINITY), maximum(-INFINITY, -INFINITY, -INFINITY);
+	_build_triangles = mesh->triangles();
 
-	for (const Triangle& triangle : *triangles)
+	//The traversal stack is sized for hierarchies at most MAX_DEPTH deep
+	max_depth = std::min(max_depth, MAX_DEPTH);
+
+	if (builder == RenderSettings::BINNED_SAH_BUILDER)
+		build_bvh_sah(max_depth, leaf_max_obj_count);
+	else if (builder == RenderSettings::SPATIAL_SPLIT_SAH_BUILDER)
+		build_bvh_spatial(max_depth, leaf_max_obj_count);
+	else if (builder == RenderSettings::LBVH_BUILDER)
+		build_bvh_linear(max_depth, leaf_max_obj_count);
+	else
 	{
-		volume.extend_volume(triangle);
+		float min_x = INFINITY, min_y = INFINITY, min_z = INFINITY;
+		float max_x = -INFINITY, max_y = -INFINITY, max_z = -INFINITY;
 
-		for (int i = 0; i < 3; i++)
+#pragma omp parallel for reduction(min : min_x, min_y, min_z) reduction(max : max_x, max_y, max_z)
+		for (int triangle_index = 0; triangle_index < (int)_build_triangles.size(); triangle_index++)
 		{
-			minimum = min(minimum, triangle[i]);
-			maximum = max(maximum, triangle[i]);
+			const Triangle& triangle = _build_triangles[triangle_index];
+
+			for (int i = 0; i < 3; i++)
+			{
+				min_x = std::min(min_x, triangle[i].x);
+				min_y = std::min(min_y, triangle[i].y);
+				min_z = std::min(min_z, triangle[i].z);
+				max_x = std::max(max_x, triangle[i].x);
+				max_y = std::max(max_y, triangle[i].y);
+				max_z = std::max(max_z, triangle[i].z);
+			}
 		}
+
+		//We now have the extents of the root of the octree to work with
+		build_bvh(max_depth, leaf_max_obj_count, Point(min_x, min_y, min_z), Point(max_x, max_y, max_z));
 	}
 
-	//We now have a bounding volume to work with
-	build_bvh(max_depth, leaf_max_obj_count, minimum, maximum, volume);
+	//The packs are filled, the hierarchy only reads the mesh from now on
+	_build_triangles.clear();
+	_build_triangles.shrink_to_fit();
+
+	if (optimize_treelets)
+		this->optimize_treelets();
+
+	if (layout != RenderSettings::SCALAR_BVH_LAYOUT)
+	{
+		if (layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT)
+			collapse(_wide_kdop_nodes);
+		else if (layout == RenderSettings::WIDE_AABB_BVH_LAYOUT)
+			collapse(_wide_aabb_nodes);
+		else if (layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT)
+			collapse(_quantized_wide_kdop_nodes);
+		else
+			collapse(_quantized_wide_aabb_nodes);
+
+		//The flattened hierarchy isn't needed anymore
+		_nodes.clear();
+		_nodes.shrink_to_fit();
+	}
+
+	_built_sah_cost = sah_cost();
 
 	timer.stop();
-    //std::cout << "BVH Construction Time: " << timer.elapsed() << "ms\n";
+	_build_time = timer.elapsed();
+}
+
+BVH::~BVH() {}
+
+void BVH::operator=(BVH&& bvh)
+{
+	_layout = bvh._layout;
+	_mesh = bvh._mesh;
+	_nodes = std::move(bvh._nodes);
+	_triangle_packs = std::move(bvh._triangle_packs);
+	_quad_packs = std::move(bvh._quad_packs);
+	_pack_triangle_indices = std::move(bvh._pack_triangle_indices);
+	_quads = bvh._quads;
+	_intersection_kernel = bvh._intersection_kernel;
+	_baldwin_weber_triangles = std::move(bvh._baldwin_weber_triangles);
+	_wide_kdop_nodes = std::move(bvh._wide_kdop_nodes);
+	_wide_aabb_nodes = std::move(bvh._wide_aabb_nodes);
+	_quantized_wide_kdop_nodes = std::move(bvh._quantized_wide_kdop_nodes);
+	_quantized_wide_aabb_nodes = std::move(bvh._quantized_wide_aabb_nodes);
+	_build_time = bvh._build_time;
+	_built_sah_cost = bvh._built_sah_cost;
+	_treelet_optimization = bvh._treelet_optimization;
+	_traversal_counters_enabled = bvh._traversal_counters_enabled;
+	_thread_traversal_counters = std::move(bvh._thread_traversal_counters);
 }
 
-BVH::~BVH()
+bool BVH::is_quad(const Triangle& first, const Triangle& second)
 {
-	delete _root;
+	auto same_vertex = [](const Point& a, const Point& b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+
+	return same_vertex(second._a, first._a) && same_vertex(second._b, first._c) && second._materialIndex == first._materialIndex;
 }
 
-void BVH::operator=(BVH&& bvh)
+//First two vertices and material of a triangle, compared bit by bit.
+//A quad is found by looking up the diagonal of its first triangle
+struct QuadEdgeKey
+{
+	float _coordinates[6];
+	int _material_index;
+
+	QuadEdgeKey(const Point& a, const Point& b, int material_index) : _coordinates{ a.x, a.y, a.z, b.x, b.y, b.z }, _material_index(material_index) {}
+
+	bool operator==(const QuadEdgeKey& other) const
+	{
+		return std::memcmp(_coordinates, other._coordinates, sizeof(_coordinates)) == 0 && _material_index == other._material_index;
+	}
+};
+
+struct QuadEdgeKeyHash
+{
+	size_t operator()(const QuadEdgeKey& key) const
+	{
+		uint64_t hash = 1469598103934665603ull;
+		for (int i = 0; i < 6; i++)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &key._coordinates[i], sizeof(bits));
+
+			hash ^= bits;
+			hash *= 1099511628211ull;
+		}
+
+		return (size_t)(hash ^ (uint32_t)key._material_index);
+	}
+};
+
+void BVH::pair_quads()
+{
+	const std::vector<Triangle>& triangles = _build_triangles;
+	int triangle_count = (int)triangles.size();
+
+	//Second triangle of the quad each triangle is the first triangle of, -1 if none.
+	//A triangle is in one quad at most
+	std::vector<int> second_triangles(triangle_count, -1);
+	std::vector<bool> in_quad(triangle_count, false);
+
+	//The quads that are already paired are found first, only the remaining triangles are looked up
+	for (int i = 0; i + 1 < triangle_count; i++)
+	{
+		if (!in_quad[i] && is_quad(triangles[i], triangles[i + 1]))
+		{
+			second_triangles[i] = i + 1;
+			in_quad[i] = in_quad[i + 1] = true;
+		}
+	}
+
+	std::unordered_map<QuadEdgeKey, int, QuadEdgeKeyHash> first_edges;
+	for (int i = 0; i < triangle_count; i++)
+		if (!in_quad[i])
+			first_edges.emplace(QuadEdgeKey(triangles[i]._a, triangles[i]._b, triangles[i]._materialIndex), i);
+
+	bool paired = false;
+	for (int i = 0; i < triangle_count && !first_edges.empty(); i++)
+	{
+		if (in_quad[i])
+			continue;
+
+		auto found = first_edges.find(QuadEdgeKey(triangles[i]._a, triangles[i]._c, triangles[i]._materialIndex));
+		if (found == first_edges.end() || found->second == i || in_quad[found->second] || !is_quad(triangles[i], triangles[found->second]))
+			continue;
+
+		second_triangles[i] = found->second;
+		in_quad[i] = in_quad[found->second] = true;
+		paired = true;
+	}
+
+	if (!paired)
+		return;
+
+	//The second triangles are moved right after their first triangle
+	std::vector<int> order;
+	order.reserve(triangle_count);
+	for (int i = 0; i < triangle_count; i++)
+	{
+		if (in_quad[i] && second_triangles[i] == -1)
+			continue;
+
+		order.push_back(i);
+		if (second_triangles[i] != -1)
+			order.push_back(second_triangles[i]);
+	}
+
+	reorder_triangles(order);
+}
+
+void BVH::reorder_triangles(const std::vector<int>& order)
 {
-	_triangles = bvh._triangles;
-	_root = bvh._root;
+	std::vector<Triangle> reordered_triangles(order.size());
+#pragma omp parallel for
+	for (int i = 0; i < (int)order.size(); i++)
+		reordered_triangles[i] = _build_triangles[order[i]];
 
-	bvh._root = nullptr;
+	_build_triangles = std::move(reordered_triangles);
+	_mesh->reorder_triangles(order);
 }
 
-void BVH::build_bvh(int max_depth, int leaf_max_obj_count, Point min, Point max, const BoundingVolume& volume)
+std::vector<BVH::Primitive> BVH::create_primitives()
 {
-	_root = new OctreeNode(min, max);
+	if (_quads)
+		pair_quads();
+
+	std::vector<Primitive> primitives;
+	primitives.reserve(_build_triangles.size());
+
+	int triangle_count = (int)_build_triangles.size();
+	for (int i = 0; i < triangle_count; i += primitives.back()._triangle_count)
+	{
+		Triangle* triangle = &_build_triangles[i];
+		bool quad = _quads && i + 1 < triangle_count && is_quad(triangle[0], triangle[1]);
 
-	for (Triangle& triangle : *_triangles)
-		_root->insert(&triangle, 0, max_depth, leaf_max_obj_count);
+		primitives.push_back({ triangle, quad ? 2 : 1 });
+	}
 
-	_root->compute_volume();
+	return primitives;
 }
 
-bool BVH::intersect(const Ray& ray, HitInfo& hit_info) const
+void BVH::build_bvh(int max_depth, int leaf_max_obj_count, Point min, Point max)
+{
+	std::vector<Primitive> primitives = create_primitives();
+
+	OctreeNode* root = new OctreeNode(min, max);
+
+#pragma omp parallel
+#pragma omp single
+	root->build(primitives, 0, max_depth, leaf_max_obj_count);
+
+	flatten(root);
+	delete root;
+}
+
+void BVH::build_bvh_sah(int max_depth, int leaf_max_obj_count)
+{
+	std::vector<Primitive> primitives = create_primitives();
+
+	BinaryNode* root = new BinaryNode();
+
+#pragma omp parallel
+#pragma omp single
+	root->build(primitives, 0, max_depth, leaf_max_obj_count);
+
+	flatten(root);
+	delete root;
+}
+
+void BVH::build_bvh_spatial(int max_depth, int leaf_max_obj_count)
+{
+	std::vector<Primitive> primitives = create_primitives();
+	std::vector<BinaryNode::TriangleReference> references;
+	references.reserve(primitives.size());
+
+	Point root_min(INFINITY, INFINITY, INFINITY), root_max(-INFINITY, -INFINITY, -INFINITY);
+	for (const Primitive& primitive : primitives)
+	{
+		BinaryNode::TriangleReference reference = { primitive, Point(INFINITY, INFINITY, INFINITY), Point(-INFINITY, -INFINITY, -INFINITY) };
+		for (int triangle_index = 0; triangle_index < primitive._triangle_count; triangle_index++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				reference._min = min(reference._min, primitive._triangle[triangle_index][i]);
+				reference._max = max(reference._max, primitive._triangle[triangle_index][i]);
+			}
+		}
+
+		root_min = min(root_min, reference._min);
+		root_max = max(root_max, reference._max);
+		references.push_back(reference);
+	}
+
+	Vector root_extent = root_max - root_min;
+	float root_half_area = root_extent.x * root_extent.y + root_extent.y * root_extent.z + root_extent.z * root_extent.x;
+	int duplication_budget = (int)(primitives.size() * BinaryNode::SBVH_DUPLICATION_BUDGET);
+
+	BinaryNode* root = new BinaryNode();
+
+#pragma omp parallel
+#pragma omp single
+	root->build_spatial(references, 0, max_depth, leaf_max_obj_count, root_half_area, duplication_budget);
+
+	flatten(root);
+	delete root;
+}
+
+/*
+ * Spreads the 10 lowest bits of the value so that there are 2 zero bits between each of them
+ */
+static uint32_t expand_bits(uint32_t value)
+{
+	value = (value * 0x00010001u) & 0xFF0000FFu;
+	value = (value * 0x00000101u) & 0x0F00F00Fu;
+	value = (value * 0x00000011u) & 0xC30C30C3u;
+	value = (value * 0x00000005u) & 0x49249249u;
+
+	return value;
+}
+
+/*
+ * 30-bit Morton code of a point whose coordinates are in [0, 1023]
+ */
+static uint32_t morton_code(int x, int y, int z)
+{
+	return (expand_bits(x) << 2) | (expand_bits(y) << 1) | expand_bits(z);
+}
+
+/*
+ * Sorts the keys (and their values alongside) with a least significant digit radix sort.
+ * Each thread counts the digits of its own chunk of the keys. The offsets of every
+ * (digit, thread) pair are then known and the threads scatter their chunk without synchronization
+ */
+static void radix_sort(std::vector<uint32_t>& keys, std::vector<int>& values, int key_bits)
+{
+	constexpr int RADIX_BITS = 10;
+	constexpr int BUCKET_COUNT = 1 << RADIX_BITS;
+
+	int count = (int)keys.size();
+	std::vector<uint32_t> sorted_keys(count);
+	std::vector<int> sorted_values(count);
+	std::vector<int> offsets(omp_get_max_threads() * BUCKET_COUNT);
+
+	for (int shift = 0; shift < key_bits; shift += RADIX_BITS)
+	{
+#pragma omp parallel
+		{
+			int thread_count = omp_get_num_threads();
+			int thread = omp_get_thread_num();
+			int chunk_start = (int)((long long)count * thread / thread_count);
+			int chunk_end = (int)((long long)count * (thread + 1) / thread_count);
+
+			int* thread_offsets = &offsets[thread * BUCKET_COUNT];
+			std::fill(thread_offsets, thread_offsets + BUCKET_COUNT, 0);
+			for (int i = chunk_start; i < chunk_end; i++)
+				thread_offsets[(keys[i] >> shift) & (BUCKET_COUNT - 1)]++;
+
+#pragma omp barrier
+#pragma omp single
+			{
+				//The keys of a digit are placed after the keys of the smaller digits and
+				//the keys of a thread after the keys of the same digit of the previous threads
+				int offset = 0;
+				for (int bucket = 0; bucket < BUCKET_COUNT; bucket++)
+				{
+					for (int i = 0; i < thread_count; i++)
+					{
+						int bucket_count = offsets[i * BUCKET_COUNT + bucket];
+						offsets[i * BUCKET_COUNT + bucket] = offset;
+						offset += bucket_count;
+					}
+				}
+			}
+
+			for (int i = chunk_start; i < chunk_end; i++)
+			{
+				int& offset = thread_offsets[(keys[i] >> shift) & (BUCKET_COUNT - 1)];
+				sorted_keys[offset] = keys[i];
+				sorted_values[offset] = values[i];
+				offset++;
+			}
+		}
+
+		keys.swap(sorted_keys);
+		values.swap(sorted_values);
+	}
+}
+
+void BVH::build_bvh_linear(int max_depth, int leaf_max_obj_count)
+{
+	std::vector<Primitive> primitives = create_primitives();
+	int primitive_count = (int)primitives.size();
+
+	float min_x = INFINITY, min_y = INFINITY, min_z = INFINITY;
+	float max_x = -INFINITY, max_y = -INFINITY, max_z = -INFINITY;
+
+#pragma omp parallel for reduction(min : min_x, min_y, min_z) reduction(max : max_x, max_y, max_z)
+	for (int i = 0; i < primitive_count; i++)
+	{
+		Point centroid = primitives[i].bbox_centroid();
+
+		min_x = std::min(min_x, centroid.x);
+		min_y = std::min(min_y, centroid.y);
+		min_z = std::min(min_z, centroid.z);
+		max_x = std::max(max_x, centroid.x);
+		max_y = std::max(max_y, centroid.y);
+		max_z = std::max(max_z, centroid.z);
+	}
+
+	//The centroids are quantized on a grid of 1024 cells along each axis
+	Point centroids_min(min_x, min_y, min_z);
+	Vector centroids_extent = Point(max_x, max_y, max_z) - centroids_min;
+	Vector scale(centroids_extent.x > 0.0f ? 1024.0f / centroids_extent.x : 0.0f,
+				 centroids_extent.y > 0.0f ? 1024.0f / centroids_extent.y : 0.0f,
+				 centroids_extent.z > 0.0f ? 1024.0f / centroids_extent.z : 0.0f);
+
+	std::vector<uint32_t> morton_codes(primitive_count);
+	std::vector<int> sorted_indices(primitive_count);
+#pragma omp parallel for
+	for (int i = 0; i < primitive_count; i++)
+	{
+		Vector cell = (primitives[i].bbox_centroid() - centroids_min) * scale;
+
+		morton_codes[i] = morton_code(std::min((int)cell.x, 1023), std::min((int)cell.y, 1023), std::min((int)cell.z, 1023));
+		sorted_indices[i] = i;
+	}
+
+	radix_sort(morton_codes, sorted_indices, 30);
+
+	//The triangles of every leaf are contiguous in Morton order. first_triangles[i]
+	//is the index of the first triangle of the i-th sorted primitive
+	std::vector<int> first_triangles(primitive_count + 1, 0);
+	for (int i = 0; i < primitive_count; i++)
+		first_triangles[i + 1] = first_triangles[i] + primitives[sorted_indices[i]]._triangle_count;
+
+	std::vector<int> order(_build_triangles.size());
+#pragma omp parallel for
+	for (int i = 0; i < primitive_count; i++)
+	{
+		const Primitive& primitive = primitives[sorted_indices[i]];
+		for (int j = 0; j < primitive._triangle_count; j++)
+			order[first_triangles[i] + j] = (int)(primitive._triangle - _build_triangles.data()) + j;
+	}
+	reorder_triangles(order);
+
+	std::vector<LinearLeaf> leaves;
+	_nodes.clear();
+	_nodes.emplace_back();
+	_triangle_packs.clear();
+	_quad_packs.clear();
+	_pack_triangle_indices.clear();
+	build_linear_node(morton_codes, 0, primitive_count, 0, 0, max_depth, leaf_max_obj_count, leaves);
+
+	//The packs of each leaf were allocated by build_linear_node(), their triangles can be indexed independently
+	constexpr int PACK_SIZE = __m256Triangles::TRIANGLES_COUNT;
+	int slot_count = pack_slot_count();
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int leaf_index = 0; leaf_index < (int)leaves.size(); leaf_index++)
+	{
+		const LinearLeaf& leaf = leaves[leaf_index];
+		const FlatNode& node = _nodes[leaf._node_index];
+
+		for (int i = 0; i < leaf._primitive_count; i++)
+		{
+			int primitive_index = leaf._first_primitive + i;
+			int pack_index = node._first + i / PACK_SIZE;
+			int lane = i % PACK_SIZE;
+
+			//The second slot of the lanes of the quad packs is left to -1 for the single triangles
+			int primitive_triangle_count = first_triangles[primitive_index + 1] - first_triangles[primitive_index];
+			for (int j = 0; j < primitive_triangle_count; j++)
+				_pack_triangle_indices[pack_index * slot_count + (_quads ? lane * 2 + j : lane)] = first_triangles[primitive_index] + j;
+		}
+	}
+	fill_packs();
+
+	//Computing the bounding volumes bottom-up is the same as refitting the hierarchy
+	refit_scalar();
+}
+
+void BVH::build_linear_node(const std::vector<uint32_t>& morton_codes, int first, int last, int node_index, int current_depth, int max_depth, int leaf_max_obj_count, std::vector<LinearLeaf>& leaves)
+{
+	int primitive_count = last - first;
+	if (primitive_count <= leaf_max_obj_count || current_depth == max_depth)
+	{
+		constexpr int PACK_SIZE = __m256Triangles::TRIANGLES_COUNT;
+
+		//Only the range of packs of the leaf is reserved here, the packs are filled by build_bvh_linear()
+		int first_pack = (int)_pack_triangle_indices.size() / pack_slot_count();
+		_nodes[node_index]._is_leaf = 1;
+		_nodes[node_index]._first = first_pack;
+		_nodes[node_index]._count = (unsigned int)(primitive_count + PACK_SIZE - 1) / PACK_SIZE;
+		_pack_triangle_indices.resize((first_pack + _nodes[node_index]._count) * pack_slot_count(), -1);
+
+		leaves.push_back(LinearLeaf{ node_index, first, primitive_count });
+
+		return;
+	}
+
+	int split;
+	uint32_t differing_bits = morton_codes[first] ^ morton_codes[last - 1];
+	if (differing_bits == 0)
+		//All the primitives have the same Morton code, they are split in two halves
+		split = first + primitive_count / 2;
+	else
+	{
+		//Keeping only the highest differing bit. The codes are sorted so the primitives
+		//whose code has this bit set are after the ones whose code doesn't
+		uint32_t highest_bit = differing_bits;
+		highest_bit |= highest_bit >> 1;
+		highest_bit |= highest_bit >> 2;
+		highest_bit |= highest_bit >> 4;
+		highest_bit |= highest_bit >> 8;
+		highest_bit |= highest_bit >> 16;
+		highest_bit ^= highest_bit >> 1;
+
+		split = (int)(std::partition_point(morton_codes.begin() + first, morton_codes.begin() + last, [highest_bit](uint32_t code) { return !(code & highest_bit); }) - morton_codes.begin());
+	}
+
+	//The children of the node are allocated contiguously before recursing into each one of them
+	int first_child = (int)_nodes.size();
+	_nodes[node_index]._is_leaf = 0;
+	_nodes[node_index]._first = first_child;
+	_nodes[node_index]._count = BinaryNode::CHILDREN_COUNT;
+	_nodes.resize(_nodes.size() + BinaryNode::CHILDREN_COUNT);
+
+	build_linear_node(morton_codes, first, split, first_child, current_depth + 1, max_depth, leaf_max_obj_count, leaves);
+	build_linear_node(morton_codes, split, last, first_child + 1, current_depth + 1, max_depth, leaf_max_obj_count, leaves);
+}
+
+template <typename NodeType>
+void BVH::flatten(const NodeType* root)
+{
+	std::vector<int> order;
+	order.reserve(_build_triangles.size());
+	std::vector<int> reordered_indices(_build_triangles.size(), -1);
+
+	_nodes.clear();
+	_nodes.emplace_back();
+	_triangle_packs.clear();
+	_quad_packs.clear();
+	_pack_triangle_indices.clear();
+	flatten_node(root, 0, order, reordered_indices);
+
+	//The triangles that no leaf references stay in the mesh, after the others
+	for (int i = 0; i < (int)reordered_indices.size(); i++)
+		if (reordered_indices[i] == -1)
+			order.push_back(i);
+
+	reorder_triangles(order);
+	fill_packs();
+}
+
+template <typename NodeType>
+void BVH::flatten_node(const NodeType* node, int node_index, std::vector<int>& order, std::vector<int>& reordered_indices)
+{
+	_nodes[node_index]._bounding_volume = node->_bounding_volume;
+	_nodes[node_index]._is_leaf = node->_is_leaf;
+
+	if (node->_is_leaf)
+	{
+		constexpr int PACK_SIZE = __m256Triangles::TRIANGLES_COUNT;
+
+		int primitive_count = (int)node->_primitives.size();
+		_nodes[node_index]._first = (int)_pack_triangle_indices.size() / pack_slot_count();
+		_nodes[node_index]._count = (unsigned int)(primitive_count + PACK_SIZE - 1) / PACK_SIZE;
+
+		//Only the indices of the triangles are known until the triangles have all
+		//been reordered, the packs are filled by flatten()
+		for (int i = 0; i < primitive_count; i += PACK_SIZE)
+		{
+			int pack_count = std::min(PACK_SIZE, primitive_count - i);
+			int indices[__m256Quads::TRIANGLES_COUNT];
+			std::fill(indices, indices + pack_slot_count(), -1);
+			for (int j = 0; j < pack_count; j++)
+			{
+				//The triangles of a quad are kept consecutive
+				const Primitive& primitive = node->_primitives[i + j];
+				int first_triangle = (int)(primitive._triangle - _build_triangles.data());
+				if (reordered_indices[first_triangle] == -1)
+				{
+					for (int k = 0; k < primitive._triangle_count; k++)
+					{
+						reordered_indices[first_triangle + k] = (int)order.size();
+						order.push_back(first_triangle + k);
+					}
+				}
+
+				for (int k = 0; k < primitive._triangle_count; k++)
+					indices[_quads ? j * 2 + k : j] = reordered_indices[first_triangle] + k;
+			}
+
+			_pack_triangle_indices.insert(_pack_triangle_indices.end(), indices, indices + pack_slot_count());
+		}
+	}
+	else
+	{
+		//The children of the node are allocated contiguously
+		//before recursing into each one of them
+		int first_child = (int)_nodes.size();
+		_nodes[node_index]._first = first_child;
+		_nodes[node_index]._count = node->children_count();
+		_nodes.resize(_nodes.size() + node->children_count());
+
+		for (int i = 0; i < node->children_count(); i++)
+			flatten_node(node->child(i), first_child + i, order, reordered_indices);
+	}
+}
+
+template <typename WideNodeType>
+void BVH::collapse(std::vector<WideNodeType>& wide_nodes) const
+{
+	wide_nodes.clear();
+	wide_nodes.emplace_back();
+	collapse_node(0, 0, wide_nodes);
+}
+
+/*
+ * Surface area of the axis aligned bounding box of a k-DOP, used to decide
+ * which node to open first when collapsing the hierarchy
+ */
+static float volume_half_area(const BVH::BoundingVolume& volume)
+{
+	float extent_x = volume._d_far[0] - volume._d_near[0];
+	float extent_y = volume._d_far[1] - volume._d_near[1];
+	float extent_z = volume._d_far[2] - volume._d_near[2];
+
+	return extent_x * extent_y + extent_y * extent_z + extent_z * extent_x;
+}
+
+template <typename WideNodeType>
+void BVH::collapse_node(int node_index, int wide_node_index, std::vector<WideNodeType>& wide_nodes) const
+{
+	constexpr int CHILDREN_COUNT = WideNodeType::CHILDREN_COUNT;
+
+	int children[CHILDREN_COUNT];
+	int children_count = 0;
+
+	//Empty leaves (octants without triangles for example) don't need a child slot
+	auto add_child = [&](int child_index) {
+		if (!_nodes[child_index]._is_leaf || _nodes[child_index]._count > 0)
+			children[children_count++] = child_index;
+	};
+
+	const FlatNode& node = _nodes[node_index];
+	if (node._is_leaf)
+		add_child(node_index);
+	else
+		for (int i = node._first; i < node._first + (int)node._count; i++)
+			add_child(i);
+
+	while (true)
+	{
+		//Looking for the largest inner child whose children can replace it
+		//without exceeding the number of children of the wide node
+		int largest = -1;
+		float largest_area = -INFINITY;
+		for (int i = 0; i < children_count; i++)
+		{
+			const FlatNode& child = _nodes[children[i]];
+			if (child._is_leaf || children_count - 1 + (int)child._count > CHILDREN_COUNT)
+				continue;
+
+			float area = volume_half_area(child._bounding_volume);
+			if (area > largest_area)
+			{
+				largest_area = area;
+				largest = i;
+			}
+		}
+
+		if (largest == -1)
+			break;
+
+		const FlatNode& opened = _nodes[children[largest]];
+		children[largest] = children[--children_count];
+		for (int i = opened._first; i < opened._first + (int)opened._count; i++)
+			add_child(i);
+	}
+
+	BoundingVolume volumes[CHILDREN_COUNT];
+	for (int lane = 0; lane < children_count; lane++)
+		volumes[lane] = _nodes[children[lane]]._bounding_volume;
+	wide_nodes[wide_node_index].set_children_volumes(volumes, children_count);
+
+	//The inner children are allocated contiguously before recursing into each one of them
+	int inner_children[CHILDREN_COUNT];
+	for (int lane = 0; lane < children_count; lane++)
+	{
+		const FlatNode& child = _nodes[children[lane]];
+		WideNodeType& wide_node = wide_nodes[wide_node_index];
+
+		if (child._is_leaf)
+		{
+			wide_node._first[lane] = child._first;
+			wide_node._count[lane] = child._count;
+			wide_node._leaf_mask |= 1 << lane;
+		}
+		else
+		{
+			inner_children[lane] = (int)wide_nodes.size();
+			wide_node._first[lane] = inner_children[lane];
+			wide_nodes.emplace_back();
+		}
+	}
+
+	for (int lane = 0; lane < children_count; lane++)
+		if (!_nodes[children[lane]]._is_leaf)
+			collapse_node(children[lane], inner_children[lane], wide_nodes);
+}
+
+BVH::BoundingVolume BVH::leaf_volume(int first_pack, int pack_count) const
+{
+	BoundingVolume volume;
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+		for (int slot = 0; slot < pack_slot_count(); slot++)
+			if (pack_triangle_index(i, slot) != -1)
+				for (int corner = 0; corner < 3; corner++)
+					volume.extend_volume(_mesh->vertex(pack_triangle_index(i, slot), corner));
+
+	return volume;
+}
+
+void BVH::fill_pack(int pack_index)
+{
+	if (_quads)
+	{
+		Triangle triangles[__m256Quads::TRIANGLES_COUNT];
+		const Triangle* pack_triangles[__m256Quads::TRIANGLES_COUNT];
+		int count = 0;
+		for (int lane = 0; lane < __m256Quads::QUADS_COUNT && pack_triangle_index(pack_index, lane * 2) != -1; lane++, count++)
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				int triangle_index = pack_triangle_index(pack_index, lane * 2 + i);
+				if (triangle_index != -1)
+					triangles[lane * 2 + i] = _mesh->triangle_geometry(triangle_index);
+				pack_triangles[lane * 2 + i] = triangle_index == -1 ? nullptr : &triangles[lane * 2 + i];
+			}
+		}
+
+		_quad_packs[pack_index] = __m256Quads(pack_triangles, count);
+	}
+	else
+	{
+		Triangle pack_triangles[__m256Triangles::TRIANGLES_COUNT];
+		int count = pack_triangle_count(pack_index);
+		for (int lane = 0; lane < count; lane++)
+			pack_triangles[lane] = _mesh->triangle_geometry(pack_triangle_index(pack_index, lane));
+
+		_triangle_packs[pack_index] = __m256Triangles(pack_triangles, count);
+	}
+}
+
+void BVH::fill_packs()
+{
+	int pack_count = (int)_pack_triangle_indices.size() / pack_slot_count();
+	if (_quads)
+		_quad_packs.resize(pack_count, __m256Quads(nullptr, 0));
+	else
+		_triangle_packs.resize(pack_count, __m256Triangles(nullptr, 0));
+
+#pragma omp parallel for
+	for (int i = 0; i < pack_count; i++)
+		fill_pack(i);
+}
+
+bool BVH::refit()
+{
+	if (_mesh == nullptr)
+		return true;
+
+	//The packs hold copies of the triangles, they have to be packed again from the moved vertices
+	fill_packs();
+	set_intersection_kernel(_intersection_kernel);
+
+	if (_layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT)
+		refit_wide(_wide_kdop_nodes);
+	else if (_layout == RenderSettings::WIDE_AABB_BVH_LAYOUT)
+		refit_wide(_wide_aabb_nodes);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT)
+		refit_wide(_quantized_wide_kdop_nodes);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT)
+		refit_wide(_quantized_wide_aabb_nodes);
+	else
+		refit_scalar();
+
+	return sah_cost() <= _built_sah_cost * REFIT_MAX_COST_RATIO;
+}
+
+void BVH::set_intersection_kernel(RenderSettings::TriangleIntersectionKernel kernel)
+{
+	_intersection_kernel = kernel;
+
+	_baldwin_weber_triangles.clear();
+	if (!TriangleIntersection::kernel(kernel)._needs_transforms || _mesh == nullptr)
+		return;
+
+	_baldwin_weber_triangles.resize(_mesh->triangle_count());
+#pragma omp parallel for
+	for (int i = 0; i < _mesh->triangle_count(); i++)
+		_baldwin_weber_triangles[i] = BaldwinWeberTriangle(_mesh->triangle_geometry(i));
+}
+
+void BVH::refit_scalar()
+{
+	//The leaves are independent from each other
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)_nodes.size(); i++)
+		if (_nodes[i]._is_leaf)
+			_nodes[i]._bounding_volume = leaf_volume(_nodes[i]._first, _nodes[i]._count);
+
+	//The children of a node are always stored after their parent so going
+	//through the nodes backwards visits the children before their parent
+	for (int i = (int)_nodes.size() - 1; i >= 0; i--)
+	{
+		FlatNode& node = _nodes[i];
+		if (node._is_leaf)
+			continue;
+
+		node._bounding_volume = BoundingVolume();
+		for (int child = node._first; child < node._first + (int)node._count; child++)
+			node._bounding_volume.extend_volume(_nodes[child]._bounding_volume);
+	}
+}
+
+template <typename WideNodeType>
+void BVH::refit_wide(std::vector<WideNodeType>& wide_nodes)
+{
+	constexpr int CHILDREN_COUNT = WideNodeType::CHILDREN_COUNT;
+
+	//Exact volume of each child of each node. The volumes of the inner children are computed from
+	//these and not from the bounds stored in the nodes which may be quantized, and thus enlarged
+	std::vector<BoundingVolume> volumes(wide_nodes.size() * CHILDREN_COUNT);
+
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)wide_nodes.size(); i++)
+	{
+		const WideNodeType& node = wide_nodes[i];
+		for (int lane = 0; lane < CHILDREN_COUNT; lane++)
+			if (node._leaf_mask & (1 << lane))
+				volumes[i * CHILDREN_COUNT + lane] = leaf_volume(node._first[lane], node._count[lane]);
+	}
+
+	//Same as the flattened hierarchy, the inner children are stored after
+	//their parent. The volume of an inner child is the union of the volumes of its children.
+	//The used children of a node are its first lanes
+	for (int i = (int)wide_nodes.size() - 1; i >= 0; i--)
+	{
+		WideNodeType& node = wide_nodes[i];
+		int children_count = 0;
+		for (int lane = 0; lane < CHILDREN_COUNT && node.has_child(lane); lane++, children_count++)
+		{
+			if (node._leaf_mask & (1 << lane))
+				continue;
+
+			const WideNodeType& child = wide_nodes[node._first[lane]];
+			for (int child_lane = 0; child_lane < CHILDREN_COUNT && child.has_child(child_lane); child_lane++)
+				volumes[i * CHILDREN_COUNT + lane].extend_volume(volumes[node._first[lane] * CHILDREN_COUNT + child_lane]);
+		}
+
+		node.set_children_volumes(&volumes[i * CHILDREN_COUNT], children_count);
+	}
+}
+
+float BVH::sah_cost() const
 {
-	return _root->intersect(ray, hit_info);
+	if (_layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT)
+		return sah_cost_wide(_wide_kdop_nodes);
+	else if (_layout == RenderSettings::WIDE_AABB_BVH_LAYOUT)
+		return sah_cost_wide(_wide_aabb_nodes);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT)
+		return sah_cost_wide(_quantized_wide_kdop_nodes);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT)
+		return sah_cost_wide(_quantized_wide_aabb_nodes);
+	else
+		return sah_cost_scalar();
 }
 
+float BVH::sah_cost_scalar() const
+{
+	if (_nodes.empty() || (_nodes[0]._is_leaf && _nodes[0]._count == 0))
+		return 0.0f;
+
+	//The packs of a leaf are intersected at the cost of about one triangle each
+	float cost = 0.0f;
+	for (const FlatNode& node : _nodes)
+	{
+		if (node._is_leaf && node._count == 0)
+			continue;//Empty volume
+
+		float cost_factor = node._is_leaf ? BinaryNode::SAH_INTERSECTION_COST * node._count : BinaryNode::SAH_TRAVERSAL_COST;
+		cost += volume_half_area(node._bounding_volume) * cost_factor;
+	}
+
+	return cost / volume_half_area(_nodes[0]._bounding_volume);
+}
+
+template <typename WideNodeType>
+float BVH::sah_cost_wide(const std::vector<WideNodeType>& wide_nodes) const
+{
+	constexpr int CHILDREN_COUNT = WideNodeType::CHILDREN_COUNT;
+
+	//Area of the axis aligned box of a lane, the first 3 planes being the axis aligned ones
+	auto lane_half_area = [](const WideNodeType& node, int lane) {
+		float extent_x = node.child_far(0, lane) - node.child_near(0, lane);
+		float extent_y = node.child_far(1, lane) - node.child_near(1, lane);
+		float extent_z = node.child_far(2, lane) - node.child_near(2, lane);
+
+		return extent_x * extent_y + extent_y * extent_z + extent_z * extent_x;
+	};
+
+	if (wide_nodes.empty() || !wide_nodes[0].has_child(0))
+		return 0.0f;
+
+	//The root isn't the child of any wide node, its cost is the same for all the hierarchies
+	float root_extents[3];
+	for (int plane = 0; plane < 3; plane++)
+	{
+		float d_near = INFINITY, d_far = -INFINITY;
+		for (int lane = 0; lane < CHILDREN_COUNT && wide_nodes[0].has_child(lane); lane++)
+		{
+			d_near = std::min(d_near, wide_nodes[0].child_near(plane, lane));
+			d_far = std::max(d_far, wide_nodes[0].child_far(plane, lane));
+		}
+
+		root_extents[plane] = d_far - d_near;
+	}
+	float root_area = root_extents[0] * root_extents[1] + root_extents[1] * root_extents[2] + root_extents[2] * root_extents[0];
+
+	float cost = root_area * BinaryNode::SAH_TRAVERSAL_COST;
+	for (const WideNodeType& node : wide_nodes)
+	{
+		for (int lane = 0; lane < CHILDREN_COUNT; lane++)
+		{
+			if (!node.has_child(lane))
+				continue;
+
+			float cost_factor = (node._leaf_mask & (1 << lane)) ? BinaryNode::SAH_INTERSECTION_COST * node._count[lane] : BinaryNode::SAH_TRAVERSAL_COST;
+			cost += lane_half_area(node, lane) * cost_factor;
+		}
+	}
+
+	return cost / root_area;
+}
+
+void BVH::optimize_treelets()
+{
+	Timer timer;
+	timer.start();
+
+	_treelet_optimization = TreeletOptimizationReport();
+	_treelet_optimization._enabled = true;
+	_treelet_optimization._sah_cost_before = sah_cost_scalar();
+	_treelet_optimization._sah_cost_after = _treelet_optimization._sah_cost_before;
+
+	std::vector<TreeletNode> treelet_nodes;
+	int root = _nodes.empty() ? -1 : create_treelet_node(0, treelet_nodes);
+	if (root == -1 || treelet_nodes[root]._children_count == 0)
+	{
+		timer.stop();
+		_treelet_optimization._time = timer.elapsed();
+
+		return;
+	}
+
+	//Every inner node of a restructured treelet has 2 children and the other inner nodes at
+	//least 2 so the hierarchy never has more than 2 * leaf_count - 1 nodes. The treelets
+	//allocate the additional nodes they need in the free space at the end of the array
+	int leaf_count = 0;
+	for (const TreeletNode& node : treelet_nodes)
+		leaf_count += node._children_count == 0;
+	int treelet_node_count = (int)treelet_nodes.size();
+	treelet_nodes.resize(std::max(treelet_node_count, 2 * leaf_count - 1));
+
+	int restructured_treelets = 0;
+	//A restructured treelet changes the treelets of the nodes above it, and the nodes it
+	//created haven't been the root of a treelet yet so a few passes keep improving the hierarchy
+	for (int pass = 0; pass < TREELET_OPTIMIZATION_PASSES; pass++)
+	{
+#pragma omp parallel
+#pragma omp single
+		optimize_treelet_node(treelet_nodes, root, treelet_node_count, restructured_treelets);
+	}
+
+	std::vector<FlatNode> nodes(1);
+	int stack_size = flatten_treelet_node(treelet_nodes, root, 0, nodes);
+	//The restructured treelets can make the hierarchy deeper than the traversal
+	//stack allows in which case the hierarchy is kept as built
+	if (stack_size <= TRAVERSAL_STACK_SIZE)
+	{
+		_nodes = std::move(nodes);
+		_treelet_optimization._restructured_treelets = restructured_treelets;
+		_treelet_optimization._sah_cost_after = sah_cost_scalar();
+	}
+
+	timer.stop();
+	_treelet_optimization._time = timer.elapsed();
+}
+
+int BVH::create_treelet_node(int node_index, std::vector<TreeletNode>& treelet_nodes) const
+{
+	const FlatNode& node = _nodes[node_index];
+
+	TreeletNode treelet_node;
+	treelet_node._bounding_volume = node._bounding_volume;
+	if (node._is_leaf)
+	{
+		if (node._count == 0)
+			return -1;
+
+		treelet_node._first_pack = node._first;
+		treelet_node._pack_count = node._count;
+		treelet_node._subtree_pack_count = node._count;
+	}
+	else
+	{
+		for (int i = node._first; i < node._first + (int)node._count; i++)
+		{
+			int child = create_treelet_node(i, treelet_nodes);
+			if (child == -1)
+				continue;
+
+			treelet_node._children[treelet_node._children_count++] = child;
+			treelet_node._subtree_pack_count += treelet_nodes[child]._subtree_pack_count;
+		}
+
+		if (treelet_node._children_count == 0)
+			return -1;
+		else if (treelet_node._children_count == 1)
+			return treelet_node._children[0];
+	}
+
+	treelet_nodes.push_back(treelet_node);
+
+	return (int)treelet_nodes.size() - 1;
+}
+
+void BVH::optimize_treelet_node(std::vector<TreeletNode>& treelet_nodes, int node_index, int& treelet_node_count, int& restructured_treelets)
+{
+	const TreeletNode& node = treelet_nodes[node_index];
+	if (node._children_count == 0)
+		return;
+
+	for (int i = 0; i < node._children_count; i++)
+	{
+		int child = node._children[i];
+#pragma omp task shared(treelet_nodes, treelet_node_count, restructured_treelets) if (treelet_nodes[child]._subtree_pack_count * __m256Triangles::TRIANGLES_COUNT >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+		optimize_treelet_node(treelet_nodes, child, treelet_node_count, restructured_treelets);
+	}
+
+#pragma omp taskwait
+	if (restructure_treelet(treelet_nodes, node_index, treelet_node_count))
+	{
+#pragma omp atomic
+		restructured_treelets++;
+	}
+}
+
+bool BVH::restructure_treelet(std::vector<TreeletNode>& treelet_nodes, int root_index, int& treelet_node_count)
+{
+	constexpr int SUBSETS_COUNT = 1 << TREELET_MAX_LEAVES;
+
+	const TreeletNode& root = treelet_nodes[root_index];
+	if (root._children_count > TREELET_MAX_LEAVES)
+		return false;
+
+	//Growing the treelet by opening its largest inner leaf, as long as its children fit
+	int leaves[TREELET_MAX_LEAVES];
+	int leaf_count = root._children_count;
+	std::copy(root._children, root._children + root._children_count, leaves);
+
+	int inner_nodes[TREELET_MAX_LEAVES - 1] = { root_index };
+	int inner_count = 1;
+	float inner_area = volume_half_area(root._bounding_volume);
+	while (true)
+	{
+		int largest = -1;
+		float largest_area = -INFINITY;
+		for (int i = 0; i < leaf_count; i++)
+		{
+			const TreeletNode& leaf = treelet_nodes[leaves[i]];
+			if (leaf._children_count == 0 || leaf_count - 1 + leaf._children_count > TREELET_MAX_LEAVES)
+				continue;
+
+			float area = volume_half_area(leaf._bounding_volume);
+			if (area > largest_area)
+			{
+				largest_area = area;
+				largest = i;
+			}
+		}
+
+		if (largest == -1)
+			break;
+
+		const TreeletNode& opened = treelet_nodes[leaves[largest]];
+		inner_nodes[inner_count++] = leaves[largest];
+		inner_area += largest_area;
+		leaves[largest] = leaves[--leaf_count];
+		for (int i = 0; i < opened._children_count; i++)
+			leaves[leaf_count++] = opened._children[i];
+	}
+
+	if (leaf_count < 3)
+		return false;//Two leaves can only be arranged one way
+
+	//The cost of the subtrees below the leaves doesn't depend on the topology of the treelet.
+	//The cost of a topology is the area of its inner nodes, all intersected at the same cost
+	int full_subset = (1 << leaf_count) - 1;
+	BoundingVolume subset_volumes[SUBSETS_COUNT];
+	float subset_costs[SUBSETS_COUNT];
+	int subset_partitions[SUBSETS_COUNT];
+	for (int subset = 1; subset <= full_subset; subset++)
+	{
+		//The subsets of a subset are all smaller than the subset so their cost is already known
+		int lowest_leaf = subset & -subset;
+		if (subset == lowest_leaf)
+		{
+			int leaf_index = 0;
+			while (!(lowest_leaf & (1 << leaf_index)))
+				leaf_index++;
+
+			subset_volumes[subset] = treelet_nodes[leaves[leaf_index]]._bounding_volume;
+			subset_costs[subset] = 0.0f;
+
+			continue;
+		}
+
+		subset_volumes[subset] = subset_volumes[subset ^ lowest_leaf];
+		subset_volumes[subset].extend_volume(subset_volumes[lowest_leaf]);
+
+		//Each partition is only visited once by keeping the lowest leaf on the same side
+		float best_cost = INFINITY;
+		for (int partition = (subset - 1) & subset; partition > 0; partition = (partition - 1) & subset)
+		{
+			if (!(partition & lowest_leaf))
+				continue;
+
+			float cost = subset_costs[partition] + subset_costs[subset ^ partition];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				subset_partitions[subset] = partition;
+			}
+		}
+
+		subset_costs[subset] = volume_half_area(subset_volumes[subset]) + best_cost;
+	}
+
+	//Small relative margin so that equivalent topologies aren't swapped because of the rounding
+	if (subset_costs[full_subset] >= inner_area * (1.0f - 1.0e-5f))
+		return false;
+
+	//The inner nodes of the treelet are reused, the root first so that its parent still
+	//points to it. A binary treelet needs more inner nodes than a wider one
+	int new_inner_count = leaf_count - 1 - inner_count;
+	if (new_inner_count > 0)
+	{
+		int first_new_inner;
+#pragma omp atomic capture
+		{ first_new_inner = treelet_node_count; treelet_node_count += new_inner_count; }
+
+		for (int i = 0; i < new_inner_count; i++)
+			inner_nodes[inner_count++] = first_new_inner + i;
+	}
+
+	//Creating the inner nodes top-down, the index of the node created for each subset is stacked
+	int subsets_stack[TREELET_MAX_LEAVES - 1] = { full_subset };
+	int nodes_stack[TREELET_MAX_LEAVES - 1] = { inner_nodes[0] };
+	int stack_size = 1;
+	int used_inner_count = 1;
+	int creation_order[TREELET_MAX_LEAVES - 1];
+	int created_count = 0;
+	while (stack_size > 0)
+	{
+		stack_size--;
+		int subset = subsets_stack[stack_size];
+		TreeletNode& node = treelet_nodes[nodes_stack[stack_size]];
+		creation_order[created_count++] = nodes_stack[stack_size];
+
+		node._bounding_volume = subset_volumes[subset];
+		node._children_count = 2;
+
+		int halves[2] = { subset_partitions[subset], subset ^ subset_partitions[subset] };
+		for (int i = 0; i < 2; i++)
+		{
+			if ((halves[i] & (halves[i] - 1)) == 0)
+			{
+				//A single leaf
+				int leaf_index = 0;
+				while (!(halves[i] & (1 << leaf_index)))
+					leaf_index++;
+
+				node._children[i] = leaves[leaf_index];
+			}
+			else
+			{
+				node._children[i] = inner_nodes[used_inner_count++];
+				subsets_stack[stack_size] = halves[i];
+				nodes_stack[stack_size] = node._children[i];
+				stack_size++;
+			}
+		}
+	}
+
+	//Children were created after their parent
+	for (int i = created_count - 1; i >= 0; i--)
+	{
+		TreeletNode& node = treelet_nodes[creation_order[i]];
+		node._subtree_pack_count = treelet_nodes[node._children[0]]._subtree_pack_count + treelet_nodes[node._children[1]]._subtree_pack_count;
+	}
+
+	return true;
+}
+
+int BVH::flatten_treelet_node(const std::vector<TreeletNode>& treelet_nodes, int treelet_node_index, int node_index, std::vector<FlatNode>& nodes)
+{
+	const TreeletNode& treelet_node = treelet_nodes[treelet_node_index];
+
+	nodes[node_index]._bounding_volume = treelet_node._bounding_volume;
+	nodes[node_index]._is_leaf = treelet_node._children_count == 0;
+	if (treelet_node._children_count == 0)
+	{
+		nodes[node_index]._first = treelet_node._first_pack;
+		nodes[node_index]._count = treelet_node._pack_count;
+
+		return 1;
+	}
+
+	int first_child = (int)nodes.size();
+	nodes[node_index]._first = first_child;
+	nodes[node_index]._count = treelet_node._children_count;
+	nodes.resize(first_child + treelet_node._children_count);
+
+	//All the children but the one being visited wait on the stack
+	int stack_size = 0;
+	for (int i = 0; i < treelet_node._children_count; i++)
+		stack_size = std::max(stack_size, flatten_treelet_node(treelet_nodes, treelet_node._children[i], first_child + i, nodes));
+
+	return stack_size + treelet_node._children_count - 1;
+}
+
+void BVH::OctreeNode::build(std::vector<Primitive>& primitives, int current_depth, int max_depth, int leaf_max_obj_count)
+{
+	int primitive_count = (int)primitives.size();
+
+	if (primitive_count <= leaf_max_obj_count || current_depth == max_depth)
+	{
+		_primitives = primitives;
+		for (const Primitive& primitive : _primitives)
+			_bounding_volume.extend_volume(primitive);
+
+		return;
+	}
+
+	float middle_x = (_min.x + _max.x) / 2;
+	float middle_y = (_min.y + _max.y) / 2;
+	float middle_z = (_min.z + _max.z) / 2;
+
+	//Distributing the primitives to the octants. The order of the primitives
+	//is preserved so that the hierarchy doesn't depend on the number of threads
+	std::vector<Primitive> children_primitives[CHILDREN_COUNT];
+	int children_mask = 0;
+	for (const Primitive& primitive : primitives)
+	{
+		Point bbox_centroid = primitive.bbox_centroid();
+
+		int octant_index = 0;
+		if (bbox_centroid.x > middle_x) octant_index += 1;
+		if (bbox_centroid.y > middle_y) octant_index += 2;
+		if (bbox_centroid.z > middle_z) octant_index += 4;
+
+		children_primitives[octant_index].push_back(primitive);
+		children_mask |= 1 << octant_index;
+	}
+	primitives.clear();
+	primitives.shrink_to_fit();
+
+	_is_leaf = false;
+	create_children(children_mask);
+
+	//The children only exist for the non-empty octants
+	int child_index = 0;
+	for (int i = 0; i < CHILDREN_COUNT; i++)
+	{
+		if (children_primitives[i].empty())
+			continue;
+
+		OctreeNode* child = &_children[child_index++];
+#pragma omp task shared(children_primitives) if ((int)children_primitives[i].size() >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+		child->build(children_primitives[i], current_depth + 1, max_depth, leaf_max_obj_count);
+	}
+
+#pragma omp taskwait
+	for (int i = 0; i < _children_count; i++)
+		_bounding_volume.extend_volume(_children[i]._bounding_volume);
+}
+
+/*
+ * Axis aligned bounding box used to evaluate the surface area heuristic
+ */
+struct SAHBin
+{
+	void extend(const Point& point)
+	{
+		_min = min(_min, point);
+		_max = max(_max, point);
+	}
+
+	void extend(const BVH::Primitive& primitive)
+	{
+		for (int i = 0; i < primitive._triangle_count; i++)
+			for (int j = 0; j < 3; j++)
+				extend(primitive._triangle[i][j]);
+	}
+
+	void extend(const SAHBin& bin)
+	{
+		extend(bin._min);
+		extend(bin._max);
+	}
+
+	float half_area() const
+	{
+		if (_count == 0)
+			return 0.0f;
+
+		Vector extent = _max - _min;
+
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	Point _min = Point(INFINITY, INFINITY, INFINITY);
+	Point _max = Point(-INFINITY, -INFINITY, -INFINITY);
+
+	int _count = 0;
+};
+
+void BVH::BinaryNode::build(std::vector<Primitive>& primitives, int current_depth, int max_depth, int leaf_max_obj_count)
+{
+	int primitive_count = (int)primitives.size();
+
+	SAHBin node_box, centroid_box;
+	for (const Primitive& primitive : primitives)
+	{
+		node_box.extend(primitive);
+		centroid_box.extend(primitive.bbox_centroid());
+	}
+	node_box._count = primitive_count;
+
+	if (primitive_count <= 1 || current_depth == max_depth)
+	{
+		_primitives = primitives;
+		for (const Primitive& primitive : _primitives)
+			_bounding_volume.extend_volume(primitive);
+
+		return;
+	}
+
+	//Looking for the split plane with the lowest cost along all 3 axes
+	int best_axis = -1, best_bin = -1;
+	float best_cost = INFINITY;
+	Vector centroid_extent = centroid_box._max - centroid_box._min;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (centroid_extent(axis) <= 0.0f)
+			continue;//All the centroids are on the same plane, we cannot split along this axis
+
+		SAHBin bins[SAH_BIN_COUNT];
+		float bin_scale = SAH_BIN_COUNT / centroid_extent(axis);
+		for (const Primitive& primitive : primitives)
+		{
+			int bin_index = std::min(SAH_BIN_COUNT - 1, (int)((primitive.bbox_centroid()(axis) - centroid_box._min(axis)) * bin_scale));
+
+			bins[bin_index].extend(primitive);
+			bins[bin_index]._count++;
+		}
+
+		//Sweeping from the right to compute the cost of the right side of every split plane
+		float right_costs[SAH_BIN_COUNT];
+		SAHBin right_box;
+		for (int i = SAH_BIN_COUNT - 1; i > 0; i--)
+		{
+			right_box.extend(bins[i]);
+			right_box._count += bins[i]._count;
+
+			right_costs[i] = right_box.half_area() * right_box._count;
+		}
+
+		//Sweeping from the left, the split plane i is between bins[i - 1] and bins[i]
+		SAHBin left_box;
+		for (int i = 1; i < SAH_BIN_COUNT; i++)
+		{
+			left_box.extend(bins[i - 1]);
+			left_box._count += bins[i - 1]._count;
+
+			float cost = left_box.half_area() * left_box._count + right_costs[i];
+			if (cost < best_cost && left_box._count > 0 && left_box._count < primitive_count)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = i;
+			}
+		}
+	}
+
+	best_cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * best_cost / node_box.half_area();
+	float leaf_cost = SAH_INTERSECTION_COST * primitive_count;
+	if (primitive_count <= leaf_max_obj_count && (best_axis == -1 || leaf_cost <= best_cost))
+	{
+		//Splitting this node wouldn't be cheaper than keeping it as a leaf
+		_primitives = primitives;
+		for (const Primitive& primitive : _primitives)
+			_bounding_volume.extend_volume(primitive);
+
+		return;
+	}
+
+	std::vector<Primitive>::iterator middle;
+	if (best_axis == -1)
+		//All the centroids are at the same position, we cannot
+		//do anything better than splitting the primitives in two halves
+		middle = primitives.begin() + primitive_count / 2;
+	else
+	{
+		float bin_scale = SAH_BIN_COUNT / centroid_extent(best_axis);
+		middle = std::partition(primitives.begin(), primitives.end(), [&](const Primitive& primitive) {
+			int bin_index = std::min(SAH_BIN_COUNT - 1, (int)((primitive.bbox_centroid()(best_axis) - centroid_box._min(best_axis)) * bin_scale));
+
+			return bin_index < best_bin;
+		});
+	}
+
+	std::vector<Primitive> left_primitives(primitives.begin(), middle);
+	std::vector<Primitive> right_primitives(middle, primitives.end());
+	primitives.clear();
+	primitives.shrink_to_fit();
+
+	_is_leaf = false;
+	_children[0] = new BinaryNode();
+	_children[1] = new BinaryNode();
+
+#pragma omp task shared(left_primitives) if ((int)left_primitives.size() >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+	_children[0]->build(left_primitives, current_depth + 1, max_depth, leaf_max_obj_count);
+#pragma omp task shared(right_primitives) if ((int)right_primitives.size() >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+	_children[1]->build(right_primitives, current_depth + 1, max_depth, leaf_max_obj_count);
+
+#pragma omp taskwait
+	_bounding_volume.extend_volume(_children[0]->_bounding_volume);
+	_bounding_volume.extend_volume(_children[1]->_bounding_volume);
+}
+
+/*
+ * Clips the triangle to the given axis aligned box with the Sutherland-Hodgman algorithm.
+ * Each of the 6 planes of the box adds at most one vertex to the polygon.
+ * The vertices are clamped to the box to absorb the rounding errors of the clipping
+ *
+ * @return The number of vertices of the clipped polygon, 0 if the triangle doesn't cross the box
+ */
+static int clip_triangle_to_box(const Triangle& triangle, const Point& box_min, const Point& box_max, Point polygon[9])
+{
+	Point buffer[9];
+	Point* input = buffer;
+	Point* output = polygon;
+
+	int vertex_count = 3;
+	for (int i = 0; i < 3; i++)
+		output[i] = triangle[i];
+
+	for (int plane = 0; plane < 6 && vertex_count > 0; plane++)
+	{
+		std::swap(input, output);
+
+		int axis = plane % 3;
+		bool keep_greater = plane < 3;
+		float bound = keep_greater ? box_min(axis) : box_max(axis);
+		auto inside = [&](const Point& point) { return keep_greater ? point(axis) >= bound : point(axis) <= bound; };
+
+		int input_count = vertex_count;
+		vertex_count = 0;
+		for (int i = 0; i < input_count; i++)
+		{
+			const Point& current = input[i];
+			const Point& next = input[(i + 1) % input_count];
+
+			if (inside(current))
+				output[vertex_count++] = current;
+
+			if (inside(current) != inside(next))
+			{
+				Point intersection = current + (next - current) * ((bound - current(axis)) / (next(axis) - current(axis)));
+				intersection(axis) = bound;
+
+				output[vertex_count++] = intersection;
+			}
+		}
+	}
+
+	if (output != polygon)
+		std::copy(output, output + vertex_count, polygon);
+	for (int i = 0; i < vertex_count; i++)
+		polygon[i] = min(max(polygon[i], box_min), box_max);
+
+	return vertex_count;
+}
+
+/*
+ * Splits the reference at the given position along the given axis and computes the
+ * boxes of the parts of the primitive on each side of the split, inside the box of the reference.
+ * A box is empty (_count is 0) if the primitive doesn't cross its side of the split
+ */
+static void split_reference(const BVH::BinaryNode::TriangleReference& reference, int axis, float position, SAHBin& left_box, SAHBin& right_box)
+{
+	left_box = SAHBin();
+	right_box = SAHBin();
+
+	//The vertices of the triangles go to their side of the split and the
+	//intersections of the edges with the split plane go to both sides
+	for (int triangle_index = 0; triangle_index < reference._primitive._triangle_count; triangle_index++)
+	{
+		const Triangle& triangle = reference._primitive._triangle[triangle_index];
+		for (int i = 0; i < 3; i++)
+		{
+			const Point& vertex = triangle[i];
+			const Point& next = triangle[(i + 1) % 3];
+
+			if (vertex(axis) <= position)
+				left_box.extend(vertex);
+			if (vertex(axis) >= position)
+				right_box.extend(vertex);
+
+			if ((vertex(axis) < position && next(axis) > position) || (vertex(axis) > position && next(axis) < position))
+			{
+				Point intersection = vertex + (next - vertex) * ((position - vertex(axis)) / (next(axis) - vertex(axis)));
+				intersection(axis) = position;
+
+				left_box.extend(intersection);
+				right_box.extend(intersection);
+			}
+		}
+	}
+
+	//Restricting the boxes to the part of the primitive covered by the reference
+	Point left_max = reference._max, right_min = reference._min;
+	left_max(axis) = std::min(left_max(axis), position);
+	right_min(axis) = std::max(right_min(axis), position);
+
+	left_box._min = max(left_box._min, reference._min);
+	left_box._max = min(left_box._max, left_max);
+	right_box._min = max(right_box._min, right_min);
+	right_box._max = min(right_box._max, reference._max);
+
+	auto is_empty = [](const SAHBin& box) { return box._min.x > box._max.x || box._min.y > box._max.y || box._min.z > box._max.z; };
+	left_box._count = is_empty(left_box) ? 0 : 1;
+	right_box._count = is_empty(right_box) ? 0 : 1;
+}
+
+void BVH::BinaryNode::build_spatial(std::vector<TriangleReference>& references, int current_depth, int max_depth, int leaf_max_obj_count, float root_half_area, int duplication_budget)
+{
+	int reference_count = (int)references.size();
+
+	SAHBin node_box, centroid_box;
+	for (const TriangleReference& reference : references)
+	{
+		node_box.extend(reference._min);
+		node_box.extend(reference._max);
+		centroid_box.extend(center(reference._min, reference._max));
+	}
+	node_box._count = reference_count;
+
+	//The volume of a leaf only covers the parts of its primitives that are referenced
+	auto make_leaf = [&]() {
+		for (const TriangleReference& reference : references)
+		{
+			_primitives.push_back(reference._primitive);
+
+			int clipped_vertex_count = 0;
+			for (int triangle_index = 0; triangle_index < reference._primitive._triangle_count; triangle_index++)
+			{
+				Point polygon[9];
+				int vertex_count = clip_triangle_to_box(reference._primitive._triangle[triangle_index], reference._min, reference._max, polygon);
+				for (int i = 0; i < vertex_count; i++)
+					_bounding_volume.extend_volume(polygon[i]);
+
+				clipped_vertex_count += vertex_count;
+			}
+
+			if (clipped_vertex_count == 0)
+				//The clipping lost the primitive to rounding errors, falling back to the whole primitive
+				_bounding_volume.extend_volume(reference._primitive);
+		}
+	};
+
+	if (reference_count <= 1 || current_depth == max_depth)
+	{
+		make_leaf();
+
+		return;
+	}
+
+	//Best object split, same as in build() but with the boxes of the references
+	int best_axis = -1, best_bin = -1;
+	float best_cost = INFINITY;
+	SAHBin best_left_box, best_right_box;
+	Vector centroid_extent = centroid_box._max - centroid_box._min;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (centroid_extent(axis) <= 0.0f)
+			continue;
+
+		SAHBin bins[SAH_BIN_COUNT];
+		float bin_scale = SAH_BIN_COUNT / centroid_extent(axis);
+		for (const TriangleReference& reference : references)
+		{
+			int bin_index = std::min(SAH_BIN_COUNT - 1, (int)((center(reference._min, reference._max)(axis) - centroid_box._min(axis)) * bin_scale));
+
+			bins[bin_index].extend(reference._min);
+			bins[bin_index].extend(reference._max);
+			bins[bin_index]._count++;
+		}
+
+		SAHBin right_boxes[SAH_BIN_COUNT];
+		SAHBin right_box;
+		for (int i = SAH_BIN_COUNT - 1; i > 0; i--)
+		{
+			right_box.extend(bins[i]);
+			right_box._count += bins[i]._count;
+			right_boxes[i] = right_box;
+		}
+
+		SAHBin left_box;
+		for (int i = 1; i < SAH_BIN_COUNT; i++)
+		{
+			left_box.extend(bins[i - 1]);
+			left_box._count += bins[i - 1]._count;
+
+			float cost = left_box.half_area() * left_box._count + right_boxes[i].half_area() * right_boxes[i]._count;
+			if (cost < best_cost && left_box._count > 0 && left_box._count < reference_count)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = i;
+				best_left_box = left_box;
+				best_right_box = right_boxes[i];
+			}
+		}
+	}
+
+	//Spatial splits are only worth it if the children of the object split overlap a lot
+	float overlap_half_area = 0.0f;
+	if (best_axis != -1)
+	{
+		SAHBin overlap;
+		overlap._min = max(best_left_box._min, best_right_box._min);
+		overlap._max = min(best_left_box._max, best_right_box._max);
+		overlap._count = 1;
+
+		Vector overlap_extent = overlap._max - overlap._min;
+		if (overlap_extent.x > 0 && overlap_extent.y > 0 && overlap_extent.z > 0)
+			overlap_half_area = overlap.half_area();
+	}
+
+	int best_spatial_axis = -1;
+	float best_spatial_position = 0.0f;
+	float best_spatial_cost = INFINITY;
+	if (duplication_budget > 0 && (best_axis == -1 || overlap_half_area / root_half_area > SBVH_OVERLAP_THRESHOLD))
+	{
+		Vector node_extent = node_box._max - node_box._min;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (node_extent(axis) <= 0.0f)
+				continue;
+
+			//The bins are slabs of the node of equal width. A reference is chopped into
+			//all the slabs it spans and counted as entering its first slab and exiting its last
+			SAHBin bins[SAH_BIN_COUNT];
+			int entries[SAH_BIN_COUNT] = { 0 };
+			int exits[SAH_BIN_COUNT] = { 0 };
+			float bin_width = node_extent(axis) / SAH_BIN_COUNT;
+			for (const TriangleReference& reference : references)
+			{
+				int first_bin = std::clamp((int)((reference._min(axis) - node_box._min(axis)) / bin_width), 0, SAH_BIN_COUNT - 1);
+				int last_bin = std::clamp((int)((reference._max(axis) - node_box._min(axis)) / bin_width), first_bin, SAH_BIN_COUNT - 1);
+
+				//Chopping the reference at the boundary of each bin it spans.
+				//_count only marks the bins as non empty, the references are counted by the entries and exits
+				TriangleReference remaining = reference;
+				for (int bin = first_bin; bin < last_bin; bin++)
+				{
+					SAHBin left_box, right_box;
+					split_reference(remaining, axis, node_box._min(axis) + (bin + 1) * bin_width, left_box, right_box);
+
+					if (left_box._count > 0)
+					{
+						bins[bin].extend(left_box);
+						bins[bin]._count = 1;
+					}
+					if (right_box._count == 0)
+						break;
+
+					remaining._min = right_box._min;
+					remaining._max = right_box._max;
+				}
+				bins[last_bin].extend(remaining._min);
+				bins[last_bin].extend(remaining._max);
+				bins[last_bin]._count = 1;
+
+				entries[first_bin]++;
+				exits[last_bin]++;
+			}
+
+			float right_costs[SAH_BIN_COUNT];
+			int right_counts[SAH_BIN_COUNT];
+			SAHBin right_box;
+			int right_count = 0;
+			for (int i = SAH_BIN_COUNT - 1; i > 0; i--)
+			{
+				right_box.extend(bins[i]);
+				right_box._count |= bins[i]._count;
+				right_count += exits[i];
+
+				right_counts[i] = right_count;
+				right_costs[i] = right_box.half_area() * right_count;
+			}
+
+			SAHBin left_box;
+			int left_count = 0;
+			for (int i = 1; i < SAH_BIN_COUNT; i++)
+			{
+				left_box.extend(bins[i - 1]);
+				left_box._count |= bins[i - 1]._count;
+				left_count += entries[i - 1];
+
+				//The references straddling the split are counted on both sides
+				int duplicated_count = left_count + right_counts[i] - reference_count;
+				if (duplicated_count > duplication_budget)
+					continue;
+
+				float cost = left_box.half_area() * left_count + right_costs[i];
+				if (cost < best_spatial_cost && left_count > 0 && right_counts[i] > 0)
+				{
+					best_spatial_cost = cost;
+					best_spatial_axis = axis;
+					best_spatial_position = node_box._min(axis) + i * bin_width;
+				}
+			}
+		}
+	}
+
+	bool spatial_split = best_spatial_axis != -1 && best_spatial_cost < best_cost;
+	best_cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST * std::min(best_cost, best_spatial_cost) / node_box.half_area();
+	float leaf_cost = SAH_INTERSECTION_COST * reference_count;
+	if (reference_count <= leaf_max_obj_count && ((best_axis == -1 && !spatial_split) || leaf_cost <= best_cost))
+	{
+		make_leaf();
+
+		return;
+	}
+
+	std::vector<TriangleReference> left_references, right_references;
+	if (spatial_split)
+	{
+		//The references straddling the split position are chopped in two
+		for (const TriangleReference& reference : references)
+		{
+			if (reference._max(best_spatial_axis) <= best_spatial_position)
+				left_references.push_back(reference);
+			else if (reference._min(best_spatial_axis) >= best_spatial_position)
+				right_references.push_back(reference);
+			else
+			{
+				SAHBin left_box, right_box;
+				split_reference(reference, best_spatial_axis, best_spatial_position, left_box, right_box);
+				if (left_box._count > 0)
+					left_references.push_back({ reference._primitive, left_box._min, left_box._max });
+				if (right_box._count > 0)
+					right_references.push_back({ reference._primitive, right_box._min, right_box._max });
+				if (left_box._count == 0 && right_box._count == 0)
+					//Lost to rounding errors, keeping the reference whole on one side
+					left_references.push_back(reference);
+			}
+		}
+
+		if (left_references.empty() || right_references.empty())
+		{
+			//The split doesn't separate anything, reverting to a median split
+			left_references.clear();
+			right_references.clear();
+			spatial_split = false;
+		}
+	}
+
+	if (!spatial_split)
+	{
+		std::vector<TriangleReference>::iterator middle;
+		if (best_axis == -1)
+			middle = references.begin() + reference_count / 2;
+		else
+		{
+			float bin_scale = SAH_BIN_COUNT / centroid_extent(best_axis);
+			middle = std::partition(references.begin(), references.end(), [&](const TriangleReference& reference) {
+				int bin_index = std::min(SAH_BIN_COUNT - 1, (int)((center(reference._min, reference._max)(best_axis) - centroid_box._min(best_axis)) * bin_scale));
+
+				return bin_index < best_bin;
+			});
+		}
+
+		left_references.assign(references.begin(), middle);
+		right_references.assign(middle, references.end());
+	}
+	references.clear();
+	references.shrink_to_fit();
+
+	int left_count = (int)left_references.size();
+	int right_count = (int)right_references.size();
+	int remaining_budget = std::max(0, duplication_budget - (left_count + right_count - reference_count));
+	int left_budget = (int)((long long)remaining_budget * left_count / (left_count + right_count));
+	int right_budget = remaining_budget - left_budget;
+
+	_is_leaf = false;
+	_children[0] = new BinaryNode();
+	_children[1] = new BinaryNode();
+
+#pragma omp task shared(left_references) if (left_count >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+	_children[0]->build_spatial(left_references, current_depth + 1, max_depth, leaf_max_obj_count, root_half_area, left_budget);
+#pragma omp task shared(right_references) if (right_count >= BVH::PARALLEL_BUILD_MIN_TRIANGLES)
+	_children[1]->build_spatial(right_references, current_depth + 1, max_depth, leaf_max_obj_count, root_half_area, right_budget);
+
+#pragma omp taskwait
+	_bounding_volume.extend_volume(_children[0]->_bounding_volume);
+	_bounding_volume.extend_volume(_children[1]->_bounding_volume);
+}
+
+void BVH::intersect_leaf(int first_pack, int pack_count, const Ray& ray, ClosestHit& closest_hit) const
+{
+	if (_intersection_kernel != RenderSettings::MOLLER_TRUMBORE_KERNEL)
+	{
+		intersect_leaf_kernel(first_pack, pack_count, ray, closest_hit);
+		return;
+	}
+
+	if (_quads)
+	{
+		//A quad is counted as one test, both its triangles being intersected at once
+		closest_hit._counters._triangles_tested += pack_count * __m256Quads::QUADS_COUNT;
+
+		for (int i = first_pack; i < first_pack + pack_count; i++)
+		{
+			int slot = _quad_packs[i].intersect(ray, closest_hit._t, closest_hit._u, closest_hit._v);
+			if (slot != -1)
+				closest_hit._triangle_index = pack_triangle_index(i, slot);
+		}
+
+		return;
+	}
+
+	closest_hit._counters._triangles_tested += pack_count * __m256Triangles::TRIANGLES_COUNT;
+
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+	{
+		const __m256Triangles& pack = _triangle_packs[i];
+
+		//A triangle duplicated in several leaves by the spatial splits is hit at the same
+		//distance every time. Only hits strictly closer than the closest one are kept so
+		//the duplicates never replace the first hit
+		int lane = pack.intersect(ray, closest_hit._t, closest_hit._u, closest_hit._v);
+		if (lane != -1)
+			closest_hit._triangle_index = pack_triangle_index(i, lane);
+	}
+}
+
+void BVH::intersect_leaf_kernel(int first_pack, int pack_count, const Ray& ray, ClosestHit& closest_hit) const
+{
+	TriangleIntersection::Kernel kernel = TriangleIntersection::kernel(_intersection_kernel)._intersect;
+	const BaldwinWeberTriangle* transforms = _baldwin_weber_triangles.empty() ? nullptr : _baldwin_weber_triangles.data();
+	//The kernels given a precomputed transform don't read the triangle, it
+	//is then not assembled from the mesh
+	Triangle triangle;
+
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+	{
+		closest_hit._counters._triangles_tested += pack_triangle_count(i);
+
+		for (int slot = 0; slot < pack_slot_count(); slot++)
+		{
+			int triangle_index = pack_triangle_index(i, slot);
+			if (triangle_index == -1)
+				continue;
+
+			//Strictly closer hits only, same as the packs
+			if (transforms == nullptr)
+				triangle = _mesh->triangle_geometry(triangle_index);
+
+			float t, u, v;
+			if (kernel(triangle, transforms == nullptr ? nullptr : &transforms[triangle_index], ray, t, u, v) && t < closest_hit._t)
+			{
+				closest_hit._t = t;
+				closest_hit._u = u;
+				closest_hit._v = v;
+				closest_hit._triangle_index = triangle_index;
+			}
+		}
+	}
+}
+
+bool BVH::intersect(const Ray& ray, HitInfo& hit_info) const
+{
+	ClosestHit closest_hit;
+	if (hit_info.t != -1)
+		closest_hit._t = hit_info.t;
+
+	if (_layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT)
+		intersect_wide(_wide_kdop_nodes, ray, closest_hit);
+	else if (_layout == RenderSettings::WIDE_AABB_BVH_LAYOUT)
+		intersect_wide(_wide_aabb_nodes, ray, closest_hit);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT)
+		intersect_wide(_quantized_wide_kdop_nodes, ray, closest_hit);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT)
+		intersect_wide(_quantized_wide_aabb_nodes, ray, closest_hit);
+	else
+		intersect_scalar(ray, closest_hit);
+
+	if (_traversal_counters_enabled)
+		add_traversal_counters(closest_hit._counters);
+
+	if (closest_hit._triangle_index == -1)
+		return false;
+
+	hit_info.t = closest_hit._t;
+	hit_info.u = closest_hit._u;
+	hit_info.v = closest_hit._v;
+	hit_info.mesh = _mesh;
+	hit_info.triangle_index = closest_hit._triangle_index;
+	hit_info.triangle = nullptr;
+
+	return true;
+}
+
+void BVH::intersect_scalar(const Ray& ray, ClosestHit& closest_hit, int root_index) const
+{
+	if (_nodes.empty())
+		return;
+
+	BoundingVolume::VolumeRay volume_ray(ray);
+
+	float t_near, t_far;
+	if (!_nodes[root_index]._bounding_volume.intersect(volume_ray, t_near, t_far))
+		return;
+
+	StackElement stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { root_index, t_near };
+
+	while (stack_size > 0)
+	{
+		StackElement element = stack[--stack_size];
+		//We already found an intersection that is closer than this node
+		if (element._t_near > closest_hit._t)
+			continue;
+
+		closest_hit._counters._nodes_visited++;
+		const FlatNode& node = _nodes[element._node_index];
+		if (node._is_leaf)
+		{
+			intersect_leaf(node._first, node._count, ray, closest_hit);
+
+			continue;
+		}
+
+		//Intersecting all the children at once and sorting the ones
+		//that are hit from the farthest to the closest
+		const BoundingVolume* children_volumes[MAX_CHILDREN_COUNT];
+		for (int i = 0; i < (int)node._count; i++)
+			children_volumes[i] = &_nodes[node._first + i]._bounding_volume;
+
+		__m256 children_t_near;
+		int hit_mask = BoundingVolume::intersect_batch(volume_ray, children_volumes, node._count, closest_hit._t, children_t_near);
+		if (hit_mask == 0)
+			continue;
+
+		alignas(32) float t_nears[MAX_CHILDREN_COUNT];
+		_mm256_store_ps(t_nears, children_t_near);
+
+		StackElement hit_children[MAX_CHILDREN_COUNT];
+		int hit_count = 0;
+		for (int i = 0; i < (int)node._count; i++)
+		{
+			if (!(hit_mask & (1 << i)))
+				continue;
+
+			int insert_index = hit_count++;
+			while (insert_index > 0 && hit_children[insert_index - 1]._t_near < t_nears[i])
+			{
+				hit_children[insert_index] = hit_children[insert_index - 1];
+				insert_index--;
+			}
+			hit_children[insert_index] = { node._first + i, t_nears[i] };
+		}
+
+		//Pushing the farthest child first so that the closest is visited first
+		for (int i = 0; i < hit_count; i++)
+			stack[stack_size++] = hit_children[i];
+	}
+}
+
+int BVH::intersect_packet(const Ray rays[PACKET_SIZE], int active_mask, HitInfo hit_infos[PACKET_SIZE]) const
+{
+	if (active_mask == 0)
+		return 0;
+
+	//The packets intersect the triangle packs with Moller-Trumbore, the other kernels and the quad packs intersect the rays one by one
+	if (_layout != RenderSettings::SCALAR_BVH_LAYOUT || _intersection_kernel != RenderSettings::MOLLER_TRUMBORE_KERNEL || _quads)
+	{
+		int hit_mask = 0;
+		for (int i = 0; i < PACKET_SIZE; i++)
+			if ((active_mask & (1 << i)) && intersect(rays[i], hit_infos[i]))
+				hit_mask |= 1 << i;
+
+		return hit_mask;
+	}
+
+	//The inactive lanes are given the ray of an active lane so that the
+	//packet only holds valid rays. Their hits are discarded
+	int first_active = 0;
+	while (!(active_mask & (1 << first_active)))
+		first_active++;
+
+	Ray packet_rays[PACKET_SIZE];
+	ClosestHit closest_hits[PACKET_SIZE];
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		packet_rays[i] = rays[(active_mask & (1 << i)) ? i : first_active];
+		if ((active_mask & (1 << i)) && hit_infos[i].t != -1)
+			closest_hits[i]._t = hit_infos[i].t;
+	}
+
+	TraversalCounters counters;
+	intersect_packet_scalar(packet_rays, active_mask, closest_hits, counters);
+
+	int hit_mask = 0;
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		if (!(active_mask & (1 << i)))
+			continue;
+
+		counters._nodes_visited += closest_hits[i]._counters._nodes_visited;
+		counters._triangles_tested += closest_hits[i]._counters._triangles_tested;
+
+		if (closest_hits[i]._triangle_index == -1)
+			continue;
+
+		hit_infos[i].t = closest_hits[i]._t;
+		hit_infos[i].u = closest_hits[i]._u;
+		hit_infos[i].v = closest_hits[i]._v;
+		hit_infos[i].mesh = _mesh;
+		hit_infos[i].triangle_index = closest_hits[i]._triangle_index;
+		hit_infos[i].triangle = nullptr;
+		hit_mask |= 1 << i;
+	}
+
+	if (_traversal_counters_enabled)
+		add_traversal_counters(counters, (int)std::bitset<PACKET_SIZE>(active_mask).count());
+
+	return hit_mask;
+}
+
+void BVH::intersect_packet_scalar(const Ray rays[PACKET_SIZE], int active_mask, ClosestHit closest_hits[PACKET_SIZE], TraversalCounters& counters) const
+{
+	if (_nodes.empty())
+		return;
+
+	BoundingVolume::PacketRay packet_ray(rays);
+	__m256Rays m256_rays(rays);
+
+	//Closest hit of each ray, kept in registers during the traversal. The closest
+	//hits of the rays that leave the packet are merged back before they leave
+	alignas(32) float closest_t[PACKET_SIZE];
+	alignas(32) int triangle_indices[PACKET_SIZE];
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		closest_t[i] = closest_hits[i]._t;
+		triangle_indices[i] = closest_hits[i]._triangle_index;
+	}
+	__m256 packet_t = _mm256_load_ps(closest_t);
+	__m256 packet_u = _mm256_setzero_ps();
+	__m256 packet_v = _mm256_setzero_ps();
+
+	__m256 root_t_near;
+	int root_mask = _nodes[0]._bounding_volume.intersect_packet(packet_ray, packet_t, root_t_near) & active_mask;
+	if (root_mask == 0)
+		return;
+
+	PacketStackElement stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, root_mask, _mm256_min_reduction_ps(root_t_near) };
+
+	alignas(32) float lanes_u[PACKET_SIZE], lanes_v[PACKET_SIZE];
+	while (stack_size > 0)
+	{
+		PacketStackElement element = stack[--stack_size];
+
+		//All the rays of the packet that hit the node already found an intersection closer than the node
+		_mm256_store_ps(closest_t, packet_t);
+		bool node_needed = false;
+		for (int i = 0; i < PACKET_SIZE && !node_needed; i++)
+			node_needed = (element._rays_mask & (1 << i)) && element._t_near <= closest_t[i];
+		if (!node_needed)
+			continue;
+
+		if ((int)std::bitset<PACKET_SIZE>(element._rays_mask).count() < PACKET_MIN_ACTIVE_RAYS)
+		{
+			//The packet diverged, the remaining rays traverse the subtree one by one
+			_mm256_store_ps(lanes_u, packet_u);
+			_mm256_store_ps(lanes_v, packet_v);
+			for (int i = 0; i < PACKET_SIZE; i++)
+			{
+				if (!(element._rays_mask & (1 << i)))
+					continue;
+
+				ClosestHit& closest_hit = closest_hits[i];
+				closest_hit._t = closest_t[i];
+				closest_hit._u = lanes_u[i];
+				closest_hit._v = lanes_v[i];
+				closest_hit._triangle_index = triangle_indices[i];
+
+				intersect_scalar(rays[i], closest_hit, element._node_index);
+
+				closest_t[i] = closest_hit._t;
+				lanes_u[i] = closest_hit._u;
+				lanes_v[i] = closest_hit._v;
+				triangle_indices[i] = closest_hit._triangle_index;
+			}
+
+			packet_t = _mm256_load_ps(closest_t);
+			packet_u = _mm256_load_ps(lanes_u);
+			packet_v = _mm256_load_ps(lanes_v);
+
+			continue;
+		}
+
+		counters._nodes_visited++;
+		const FlatNode& node = _nodes[element._node_index];
+		if (node._is_leaf)
+		{
+			int rays_count = (int)std::bitset<PACKET_SIZE>(element._rays_mask).count();
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+			{
+				const __m256Triangles& pack = _triangle_packs[i];
+
+				int triangles_count = pack_triangle_count(i);
+
+				if (rays_count <= triangles_count)
+				{
+					//Fewer rays than triangles, the rays are intersected with the 8 triangles of the pack one by one
+					_mm256_store_ps(closest_t, packet_t);
+					_mm256_store_ps(lanes_u, packet_u);
+					_mm256_store_ps(lanes_v, packet_v);
+					for (int j = 0; j < PACKET_SIZE; j++)
+					{
+						if (!(element._rays_mask & (1 << j)))
+							continue;
+
+						counters._triangles_tested += __m256Triangles::TRIANGLES_COUNT;
+						int lane = pack.intersect(rays[j], closest_t[j], lanes_u[j], lanes_v[j]);
+						if (lane != -1)
+							triangle_indices[j] = pack_triangle_index(i, lane);
+					}
+					packet_t = _mm256_load_ps(closest_t);
+					packet_u = _mm256_load_ps(lanes_u);
+					packet_v = _mm256_load_ps(lanes_v);
+
+					continue;
+				}
+
+				//Otherwise, each triangle is intersected with the whole packet. The triangles are intersected in the order
+				//of their lanes with the same strict comparison as __m256Triangles::intersect() so that the rays keep the same hits
+				for (int lane = 0; lane < triangles_count; lane++)
+				{
+					counters._triangles_tested++;
+
+					__m256 t, u, v;
+					int hit_mask = pack.intersect_rays(m256_rays, lane, packet_t, t, u, v) & element._rays_mask;
+					if (hit_mask == 0)
+						continue;
+
+					__m256 hits = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(hit_mask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256()));
+					packet_t = _mm256_blendv_ps(packet_t, t, hits);
+					packet_u = _mm256_blendv_ps(packet_u, u, hits);
+					packet_v = _mm256_blendv_ps(packet_v, v, hits);
+					for (int j = 0; j < PACKET_SIZE; j++)
+						if (hit_mask & (1 << j))
+							triangle_indices[j] = pack_triangle_index(i, lane);
+				}
+			}
+
+			continue;
+		}
+
+		//Intersecting the children with the whole packet and sorting
+		//the ones that are hit from the farthest to the closest
+		PacketStackElement hit_children[MAX_CHILDREN_COUNT];
+		int hit_count = 0;
+		for (int i = 0; i < (int)node._count; i++)
+		{
+			__m256 t_near;
+			int hit_mask = _nodes[node._first + i]._bounding_volume.intersect_packet(packet_ray, packet_t, t_near) & element._rays_mask;
+			if (hit_mask == 0)
+				continue;
+
+			__m256 hits = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(hit_mask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256()));
+			float child_t_near = _mm256_min_reduction_ps(_mm256_blendv_ps(_mm256_set1_ps(INFINITY), t_near, hits));
+
+			int insert_index = hit_count++;
+			while (insert_index > 0 && hit_children[insert_index - 1]._t_near < child_t_near)
+			{
+				hit_children[insert_index] = hit_children[insert_index - 1];
+				insert_index--;
+			}
+			hit_children[insert_index] = { node._first + i, hit_mask, child_t_near };
+		}
+
+		for (int i = 0; i < hit_count; i++)
+			stack[stack_size++] = hit_children[i];
+	}
+
+	_mm256_store_ps(closest_t, packet_t);
+	_mm256_store_ps(lanes_u, packet_u);
+	_mm256_store_ps(lanes_v, packet_v);
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		if (!(active_mask & (1 << i)))
+			continue;
+
+		closest_hits[i]._t = closest_t[i];
+		closest_hits[i]._u = lanes_u[i];
+		closest_hits[i]._v = lanes_v[i];
+		closest_hits[i]._triangle_index = triangle_indices[i];
+	}
+}
+
+template <typename WideNodeType>
+void BVH::intersect_wide(const std::vector<WideNodeType>& wide_nodes, const Ray& ray, ClosestHit& closest_hit) const
+{
+	constexpr int CHILDREN_COUNT = WideNodeType::CHILDREN_COUNT;
+
+	if (wide_nodes.empty())
+		return;
+
+	WideRay<WideNodeType::PLANES_COUNT> wide_ray(ray);
+
+	StackElement stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, -INFINITY };
+
+	while (stack_size > 0)
+	{
+		StackElement element = stack[--stack_size];
+		if (element._t_near > closest_hit._t)
+			continue;
+
+		closest_hit._counters._nodes_visited++;
+		const WideNodeType& node = wide_nodes[element._node_index];
+
+		__m256 t_near;
+		int hit_mask = node.intersect(wide_ray, closest_hit._t, t_near);
+		if (hit_mask == 0)
+			continue;
+
+		alignas(32) float t_nears[CHILDREN_COUNT];
+		_mm256_store_ps(t_nears, t_near);
+
+		//Sorting the children that are hit from the farthest to the closest
+		StackElement hit_children[CHILDREN_COUNT];
+		int hit_count = 0;
+		for (int lane = 0; lane < CHILDREN_COUNT; lane++)
+		{
+			if (!(hit_mask & (1 << lane)))
+				continue;
+
+			int insert_index = hit_count++;
+			while (insert_index > 0 && hit_children[insert_index - 1]._t_near < t_nears[lane])
+			{
+				hit_children[insert_index] = hit_children[insert_index - 1];
+				insert_index--;
+			}
+			//_node_index is the lane of the child here
+			hit_children[insert_index] = { lane, t_nears[lane] };
+		}
+
+		//The leaves are intersected right away from the closest to the farthest
+		for (int i = hit_count - 1; i >= 0; i--)
+		{
+			int lane = hit_children[i]._node_index;
+			if ((node._leaf_mask & (1 << lane)) && hit_children[i]._t_near <= closest_hit._t)
+				intersect_leaf(node._first[lane], node._count[lane], ray, closest_hit);
+		}
+
+		//and the inner children are pushed farthest first so that the closest is visited first
+		for (int i = 0; i < hit_count; i++)
+		{
+			int lane = hit_children[i]._node_index;
+			if (!(node._leaf_mask & (1 << lane)))
+				stack[stack_size++] = { node._first[lane], hit_children[i]._t_near };
+		}
+	}
+}
+
+bool BVH::intersect_leaf_any(int first_pack, int pack_count, const Ray& ray, float t_max, TraversalCounters& counters) const
+{
+	if (_intersection_kernel != RenderSettings::MOLLER_TRUMBORE_KERNEL)
+		return intersect_leaf_any_kernel(first_pack, pack_count, ray, t_max, counters);
+
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+	{
+		if (_quads)
+		{
+			counters._triangles_tested += __m256Quads::QUADS_COUNT;
+			if (_quad_packs[i].intersect_any(ray, t_max))
+				return true;
+
+			continue;
+		}
+
+		counters._triangles_tested += __m256Triangles::TRIANGLES_COUNT;
+		if (_triangle_packs[i].intersect_any(ray, t_max))
+			return true;
+	}
+
+	return false;
+}
+
+bool BVH::intersect_leaf_any_kernel(int first_pack, int pack_count, const Ray& ray, float t_max, TraversalCounters& counters) const
+{
+	TriangleIntersection::Kernel kernel = TriangleIntersection::kernel(_intersection_kernel)._intersect;
+	const BaldwinWeberTriangle* transforms = _baldwin_weber_triangles.empty() ? nullptr : _baldwin_weber_triangles.data();
+	//The kernels given a precomputed transform don't read the triangle, it
+	//is then not assembled from the mesh
+	Triangle triangle;
+
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+	{
+		counters._triangles_tested += pack_triangle_count(i);
+
+		for (int slot = 0; slot < pack_slot_count(); slot++)
+		{
+			int triangle_index = pack_triangle_index(i, slot);
+			if (triangle_index == -1)
+				continue;
+
+			if (transforms == nullptr)
+				triangle = _mesh->triangle_geometry(triangle_index);
+
+			float t, u, v;
+			if (kernel(triangle, transforms == nullptr ? nullptr : &transforms[triangle_index], ray, t, u, v) && t < t_max)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+bool BVH::intersect_any(const Ray& ray, float t_max) const
+{
+	TraversalCounters counters;
+
+	bool hit;
+	if (_layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT)
+		hit = intersect_any_wide(_wide_kdop_nodes, ray, t_max, counters);
+	else if (_layout == RenderSettings::WIDE_AABB_BVH_LAYOUT)
+		hit = intersect_any_wide(_wide_aabb_nodes, ray, t_max, counters);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT)
+		hit = intersect_any_wide(_quantized_wide_kdop_nodes, ray, t_max, counters);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT)
+		hit = intersect_any_wide(_quantized_wide_aabb_nodes, ray, t_max, counters);
+	else
+		hit = intersect_any_scalar(ray, t_max, counters);
+
+	if (_traversal_counters_enabled)
+		add_traversal_counters(counters);
+
+	return hit;
+}
+
+bool BVH::intersect_any_scalar(const Ray& ray, float t_max, TraversalCounters& counters, int root_index) const
+{
+	if (_nodes.empty())
+		return false;
+
+	BoundingVolume::VolumeRay volume_ray(ray);
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = root_index;
+
+	while (stack_size > 0)
+	{
+		const FlatNode& node = _nodes[stack[--stack_size]];
+		counters._nodes_visited++;
+
+		float t_near, t_far;
+		if (!node._bounding_volume.intersect(volume_ray, t_near, t_far) || t_near > t_max || t_far < 0)
+			continue;
+
+		if (node._is_leaf)
+		{
+			if (intersect_leaf_any(node._first, node._count, ray, t_max, counters))
+				return true;
+		}
+		else
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+				stack[stack_size++] = i;
+	}
+
+	return false;
+}
+
+int BVH::intersect_any_packet(const Ray rays[PACKET_SIZE], const float t_max[PACKET_SIZE], int active_mask) const
+{
+	if (active_mask == 0)
+		return 0;
+
+	if (_layout != RenderSettings::SCALAR_BVH_LAYOUT || _intersection_kernel != RenderSettings::MOLLER_TRUMBORE_KERNEL || _quads)
+	{
+		int occluded_mask = 0;
+		for (int i = 0; i < PACKET_SIZE; i++)
+			if ((active_mask & (1 << i)) && intersect_any(rays[i], t_max[i]))
+				occluded_mask |= 1 << i;
+
+		return occluded_mask;
+	}
+
+	int first_active = 0;
+	while (!(active_mask & (1 << first_active)))
+		first_active++;
+
+	Ray packet_rays[PACKET_SIZE];
+	float packet_t_max[PACKET_SIZE];
+	for (int i = 0; i < PACKET_SIZE; i++)
+	{
+		int ray_index = (active_mask & (1 << i)) ? i : first_active;
+
+		packet_rays[i] = rays[ray_index];
+		packet_t_max[i] = t_max[ray_index];
+	}
+
+	TraversalCounters counters;
+	int occluded_mask = intersect_any_packet_scalar(packet_rays, packet_t_max, active_mask, counters);
+
+	if (_traversal_counters_enabled)
+		add_traversal_counters(counters, (int)std::bitset<PACKET_SIZE>(active_mask).count());
+
+	return occluded_mask;
+}
+
+int BVH::intersect_any_packet_scalar(const Ray rays[PACKET_SIZE], const float t_max[PACKET_SIZE], int active_mask, TraversalCounters& counters) const
+{
+	if (_nodes.empty())
+		return 0;
+
+	BoundingVolume::PacketRay packet_ray(rays);
+	__m256Rays m256_rays(rays);
+	__m256 packet_t_max = _mm256_loadu_ps(t_max);
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int masks_stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size] = 0;
+	masks_stack[stack_size++] = active_mask;
+
+	int occluded_mask = 0;
+	while (stack_size > 0 && occluded_mask != active_mask)
+	{
+		stack_size--;
+		const FlatNode& node = _nodes[stack[stack_size]];
+		//The rays already occluded are done with the traversal
+		int rays_mask = masks_stack[stack_size] & ~occluded_mask;
+
+		if ((int)std::bitset<PACKET_SIZE>(rays_mask).count() < PACKET_MIN_ACTIVE_RAYS)
+		{
+			for (int i = 0; i < PACKET_SIZE; i++)
+				if ((rays_mask & (1 << i)) && intersect_any_scalar(rays[i], t_max[i], counters, stack[stack_size]))
+					occluded_mask |= 1 << i;
+
+			continue;
+		}
+
+		counters._nodes_visited++;
+
+		__m256 t_near;
+		rays_mask &= node._bounding_volume.intersect_packet(packet_ray, packet_t_max, t_near);
+		if (rays_mask == 0)
+			continue;
+
+		if (node._is_leaf)
+		{
+			for (int i = node._first; i < node._first + (int)node._count && rays_mask != 0; i++)
+			{
+				const __m256Triangles& pack = _triangle_packs[i];
+
+				int triangles_count = pack_triangle_count(i);
+
+				//Same as intersect_packet_scalar(), whichever of the rays or the triangles are the fewest are intersected one by one
+				if ((int)std::bitset<PACKET_SIZE>(rays_mask).count() <= triangles_count)
+				{
+					for (int j = 0; j < PACKET_SIZE; j++)
+					{
+						if (!(rays_mask & (1 << j)))
+							continue;
+
+						counters._triangles_tested += __m256Triangles::TRIANGLES_COUNT;
+						if (pack.intersect_any(rays[j], t_max[j]))
+						{
+							occluded_mask |= 1 << j;
+							rays_mask &= ~(1 << j);
+						}
+					}
+
+					continue;
+				}
+
+				for (int lane = 0; lane < triangles_count && rays_mask != 0; lane++)
+				{
+					counters._triangles_tested++;
+
+					__m256 t, u, v;
+					int hit_mask = pack.intersect_rays(m256_rays, lane, packet_t_max, t, u, v) & rays_mask;
+
+					occluded_mask |= hit_mask;
+					rays_mask &= ~hit_mask;
+				}
+			}
+		}
+		else
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+			{
+				stack[stack_size] = i;
+				masks_stack[stack_size++] = rays_mask;
+			}
+	}
+
+	return occluded_mask;
+}
+
+template <typename WideNodeType>
+bool BVH::intersect_any_wide(const std::vector<WideNodeType>& wide_nodes, const Ray& ray, float t_max, TraversalCounters& counters) const
+{
+	if (wide_nodes.empty())
+		return false;
+
+	WideRay<WideNodeType::PLANES_COUNT> wide_ray(ray);
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0)
+	{
+		const WideNodeType& node = wide_nodes[stack[--stack_size]];
+		counters._nodes_visited++;
+
+		__m256 t_near;
+		int hit_mask = node.intersect(wide_ray, t_max, t_near);
+
+		if (hit_mask == 0)
+			continue;
+
+		//The leaves are intersected first as they may end the traversal right away
+		int leaves_mask = hit_mask & node._leaf_mask;
+		for (int lane = 0; lane < WideNodeType::CHILDREN_COUNT; lane++)
+			if ((leaves_mask & (1 << lane)) && intersect_leaf_any(node._first[lane], node._count[lane], ray, t_max, counters))
+				return true;
+
+		int inner_mask = hit_mask & ~node._leaf_mask;
+		for (int lane = 0; lane < WideNodeType::CHILDREN_COUNT; lane++)
+			if (inner_mask & (1 << lane))
+				stack[stack_size++] = node._first[lane];
+	}
+
+	return false;
+}
+
+void BVH::build_median_split(const std::vector<BoundingVolume>& volumes, int leaf_max_primitives, std::vector<FlatNode>& nodes, std::vector<int>& primitive_indices)
+{
+	primitive_indices.resize(volumes.size());
+	for (int i = 0; i < (int)volumes.size(); i++)
+		primitive_indices[i] = i;
+
+	nodes.clear();
+	nodes.emplace_back();
+	build_median_split_node(volumes, leaf_max_primitives, 0, 0, (int)volumes.size(), nodes, primitive_indices);
+}
+
+void BVH::build_median_split_node(const std::vector<BoundingVolume>& volumes, int leaf_max_primitives, int node_index, int first, int count, std::vector<FlatNode>& nodes, std::vector<int>& primitive_indices)
+{
+	if (count <= leaf_max_primitives)
+	{
+		BoundingVolume volume;
+		for (int i = first; i < first + count; i++)
+			volume.extend_volume(volumes[primitive_indices[i]]);
+
+		nodes[node_index]._bounding_volume = volume;
+		nodes[node_index]._first = first;
+		nodes[node_index]._count = count;
+		nodes[node_index]._is_leaf = 1;
+
+		return;
+	}
+
+	//Centroid of the axis aligned box of the primitive, the first 3 planes being the axis aligned ones
+	auto centroid = [&volumes](int primitive_index, int axis) {
+		return (volumes[primitive_index]._d_near[axis] + volumes[primitive_index]._d_far[axis]) / 2;
+	};
+
+	float centroids_min[3] = { INFINITY, INFINITY, INFINITY };
+	float centroids_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (int i = first; i < first + count; i++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			centroids_min[axis] = std::min(centroids_min[axis], centroid(primitive_indices[i], axis));
+			centroids_max[axis] = std::max(centroids_max[axis], centroid(primitive_indices[i], axis));
+		}
+	}
+
+	int split_axis = 0;
+	for (int axis = 1; axis < 3; axis++)
+		if (centroids_max[axis] - centroids_min[axis] > centroids_max[split_axis] - centroids_min[split_axis])
+			split_axis = axis;
+
+	//Splitting the primitives in two halves at the median of the centroids
+	int half = count / 2;
+	std::nth_element(primitive_indices.begin() + first, primitive_indices.begin() + first + half, primitive_indices.begin() + first + count, [&](int a, int b) {
+		return centroid(a, split_axis) < centroid(b, split_axis);
+	});
+
+	//The children of the node are allocated contiguously
+	//before recursing into each one of them
+	int first_child = (int)nodes.size();
+	nodes.resize(nodes.size() + 2);
+	nodes[node_index]._first = first_child;
+	nodes[node_index]._count = 2;
+	nodes[node_index]._is_leaf = 0;
+
+	build_median_split_node(volumes, leaf_max_primitives, first_child, first, half, nodes, primitive_indices);
+	build_median_split_node(volumes, leaf_max_primitives, first_child + 1, first + half, count - half, nodes, primitive_indices);
+
+	BoundingVolume volume;
+	volume.extend_volume(nodes[first_child]._bounding_volume);
+	volume.extend_volume(nodes[first_child + 1]._bounding_volume);
+	nodes[node_index]._bounding_volume = volume;
+}
+
+void BVH::add_traversal_counters(const TraversalCounters& counters, int ray_count) const
+{
+	TraversalCounters& thread_counters = _thread_traversal_counters[omp_get_thread_num()]._counters;
+
+	thread_counters._rays += ray_count;
+	thread_counters._nodes_visited += counters._nodes_visited;
+	thread_counters._triangles_tested += counters._triangles_tested;
+}
+
+void BVH::reset_traversal_counters(bool enabled)
+{
+	_traversal_counters_enabled = enabled;
+
+	_thread_traversal_counters.clear();
+	_thread_traversal_counters.resize(omp_get_max_threads());
+}
+
+BVH::TraversalCounters BVH::traversal_counters() const
+{
+	TraversalCounters total;
+	for (const ThreadTraversalCounters& thread_counters : _thread_traversal_counters)
+	{
+		total._rays += thread_counters._counters._rays;
+		total._nodes_visited += thread_counters._counters._nodes_visited;
+		total._triangles_tested += thread_counters._counters._triangles_tested;
+	}
+
+	return total;
+}
+
+void BVH::statistics_leaf(int first_pack, int pack_count, int depth, Statistics& statistics) const
+{
+	int triangle_count = 0;
+	for (int i = first_pack; i < first_pack + pack_count; i++)
+		triangle_count += pack_triangle_count(i);
+
+	if ((int)statistics._leaf_sizes.size() <= triangle_count)
+		statistics._leaf_sizes.resize(triangle_count + 1, 0);
+	if ((int)statistics._leaf_depths.size() <= depth)
+		statistics._leaf_depths.resize(depth + 1, 0);
+
+	statistics._leaf_sizes[triangle_count]++;
+	statistics._leaf_depths[depth]++;
+	statistics._leaf_triangle_count += triangle_count;
+	statistics._leaf_count++;
+	statistics._node_count++;
+}
+
+void BVH::statistics_node(int node_index, int depth, Statistics& statistics) const
+{
+	const FlatNode& node = _nodes[node_index];
+	if (node._is_leaf)
+	{
+		statistics_leaf(node._first, node._count, depth, statistics);
+
+		return;
+	}
+
+	statistics._node_count++;
+	for (int i = node._first; i < node._first + (int)node._count; i++)
+		statistics_node(i, depth + 1, statistics);
+}
+
+template <typename WideNodeType>
+void BVH::statistics_wide_node(const std::vector<WideNodeType>& wide_nodes, int node_index, int depth, Statistics& statistics) const
+{
+	const WideNodeType& node = wide_nodes[node_index];
+
+	statistics._node_count++;
+	for (int lane = 0; lane < WideNodeType::CHILDREN_COUNT; lane++)
+	{
+		if (!node.has_child(lane))
+			continue;
+
+		if (node._leaf_mask & (1 << lane))
+			statistics_leaf(node._first[lane], node._count[lane], depth + 1, statistics);
+		else
+			statistics_wide_node(wide_nodes, node._first[lane], depth + 1, statistics);
+	}
+}
+
+BVH::Statistics BVH::statistics() const
+{
+	Statistics statistics;
+
+	if (_layout == RenderSettings::WIDE_KDOP_BVH_LAYOUT && !_wide_kdop_nodes.empty())
+		statistics_wide_node(_wide_kdop_nodes, 0, 0, statistics);
+	else if (_layout == RenderSettings::WIDE_AABB_BVH_LAYOUT && !_wide_aabb_nodes.empty())
+		statistics_wide_node(_wide_aabb_nodes, 0, 0, statistics);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT && !_quantized_wide_kdop_nodes.empty())
+		statistics_wide_node(_quantized_wide_kdop_nodes, 0, 0, statistics);
+	else if (_layout == RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT && !_quantized_wide_aabb_nodes.empty())
+		statistics_wide_node(_quantized_wide_aabb_nodes, 0, 0, statistics);
+	else if (_layout == RenderSettings::SCALAR_BVH_LAYOUT && !_nodes.empty())
+		statistics_node(0, 0, statistics);
+
+	statistics._sah_cost = sah_cost();
+	statistics._nodes_memory_footprint = _nodes.size() * sizeof(FlatNode)
+		+ _wide_kdop_nodes.size() * sizeof(WideNode<BoundingVolume::PLANES_COUNT>)
+		+ _wide_aabb_nodes.size() * sizeof(WideNode<3>)
+		+ _quantized_wide_kdop_nodes.size() * sizeof(QuantizedWideNode<BoundingVolume::PLANES_COUNT>)
+		+ _quantized_wide_aabb_nodes.size() * sizeof(QuantizedWideNode<3>);
+	statistics._memory_footprint = statistics._nodes_memory_footprint
+		+ _triangle_packs.size() * sizeof(__m256Triangles)
+		+ _quad_packs.size() * sizeof(__m256Quads)
+		+ _pack_triangle_indices.size() * sizeof(int)
+		+ _baldwin_weber_triangles.size() * sizeof(BaldwinWeberTriangle)
+		+ (_mesh == nullptr ? 0 : _mesh->memory_footprint());
+	statistics._build_time = _build_time;
+	statistics._treelet_optimization = _treelet_optimization;
+
+	statistics._traversal_counters_enabled = _traversal_counters_enabled;
+	statistics._traversal_counters = traversal_counters();
+
+	return statistics;
+}
+
+std::ostream& operator << (std::ostream& os, const BVH::Statistics& statistics)
+{
+	os << "BVH statistics:" << std::endl;
+	os << "\tNodes: " << statistics._node_count << " (" << statistics._leaf_count << " leaves)" << std::endl;
+	os << "\tTriangles in leaves: " << statistics._leaf_triangle_count << " (" << (statistics._leaf_count > 0 ? (float)statistics._leaf_triangle_count / statistics._leaf_count : 0.0f) << " per leaf)" << std::endl;
+
+	//The leaf sizes are grouped by powers of 2 to keep the report short, the JSON file has them all
+	os << "\tLeaf sizes:";
+	for (int range_start = 0; range_start < (int)statistics._leaf_sizes.size(); range_start = range_start == 0 ? 1 : range_start * 2)
+	{
+		int range_end = std::min(range_start == 0 ? 1 : range_start * 2, (int)statistics._leaf_sizes.size());
+
+		int leaf_count = 0;
+		for (int size = range_start; size < range_end; size++)
+			leaf_count += statistics._leaf_sizes[size];
+
+		if (leaf_count == 0)
+			continue;
+
+		if (range_end - range_start == 1)
+			os << " [" << range_start << "]=" << leaf_count;
+		else
+			os << " [" << range_start << "-" << range_end - 1 << "]=" << leaf_count;
+	}
+	os << std::endl;
+
+	os << "\tLeaf depths:";
+	for (int depth = 0; depth < (int)statistics._leaf_depths.size(); depth++)
+		if (statistics._leaf_depths[depth] > 0)
+			os << " [" << depth << "]=" << statistics._leaf_depths[depth];
+	os << std::endl;
+
+	os << "\tSAH cost: " << statistics._sah_cost << std::endl;
+	os << "\tMemory footprint: " << statistics._memory_footprint / (1024.0f * 1024.0f) << "MB (nodes: " << statistics._nodes_memory_footprint / (1024.0f * 1024.0f) << "MB)" << std::endl;
+	os << "\tBuild time: " << statistics._build_time << "ms" << std::endl;
+	if (statistics._treelet_optimization._enabled)
+		os << "\t" << statistics._treelet_optimization << std::endl;
+
+	const BVH::TraversalCounters& counters = statistics._traversal_counters;
+	if (!statistics._traversal_counters_enabled)
+		os << "\tTraversal counters disabled";
+	else if (counters._rays == 0)
+		os << "\tNo ray traversed the BVH";
+	else
+		os << "\tRays: " << counters._rays << ", nodes visited per ray: " << (double)counters._nodes_visited / counters._rays
+		   << ", triangles tested per ray: " << (double)counters._triangles_tested / counters._rays;
+
+	return os;
+}
+
+std::ostream& operator << (std::ostream& os, const BVH::TreeletOptimizationReport& report)
+{
+	os << "Treelet optimization: SAH cost " << report._sah_cost_before << " -> " << report._sah_cost_after
+	   << " (" << report._restructured_treelets << " treelets restructured in " << report._time << "ms)";
+
+	return os;
+}
+
+bool BVH::Statistics::save(const std::string& filepath) const
+{
+	std::ofstream file(filepath);
+	if (!file)
+		return false;
+
+	auto write_array = [&file](const std::vector<int>& values) {
+		file << "[";
+		for (int i = 0; i < (int)values.size(); i++)
+			file << (i > 0 ? ", " : "") << values[i];
+		file << "]";
+	};
+
+	file << "{" << std::endl;
+	file << "\t\"node_count\": " << _node_count << "," << std::endl;
+	file << "\t\"leaf_count\": " << _leaf_count << "," << std::endl;
+	file << "\t\"leaf_triangle_count\": " << _leaf_triangle_count << "," << std::endl;
+	file << "\t\"leaf_sizes\": "; write_array(_leaf_sizes); file << "," << std::endl;
+	file << "\t\"leaf_depths\": "; write_array(_leaf_depths); file << "," << std::endl;
+	file << "\t\"sah_cost\": " << _sah_cost << "," << std::endl;
+	file << "\t\"memory_footprint\": " << _memory_footprint << "," << std::endl;
+	file << "\t\"nodes_memory_footprint\": " << _nodes_memory_footprint << "," << std::endl;
+	file << "\t\"build_time_ms\": " << _build_time << "," << std::endl;
+	if (_treelet_optimization._enabled)
+	{
+		file << "\t\"treelet_optimization_sah_cost_before\": " << _treelet_optimization._sah_cost_before << "," << std::endl;
+		file << "\t\"treelet_optimization_sah_cost_after\": " << _treelet_optimization._sah_cost_after << "," << std::endl;
+		file << "\t\"treelet_optimization_restructured_treelets\": " << _treelet_optimization._restructured_treelets << "," << std::endl;
+		file << "\t\"treelet_optimization_time_ms\": " << _treelet_optimization._time << "," << std::endl;
+	}
+	file << "\t\"traversal_counters_enabled\": " << (_traversal_counters_enabled ? "true" : "false") << "," << std::endl;
+	file << "\t\"rays\": " << _traversal_counters._rays << "," << std::endl;
+	file << "\t\"nodes_visited\": " << _traversal_counters._nodes_visited << "," << std::endl;
+	file << "\t\"triangles_tested\": " << _traversal_counters._triangles_tested << std::endl;
+	file << "}" << std::endl;
+
+	return file.good();
+}
@@ -1,17 +1,63 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <cmath>
+#include <cstdint>
+#include <immintrin.h>
 #include <limits>
-#include <queue>
-
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "hitInfo.h"
+#include "indexedMesh.h"
+#include "m256Quads.h"
+#include "m256Triangles.h"
+#include "m256Utils.h"
+#include "rendererSettings.h"
 #include "triangle.h"
+#include "triangleIntersection.h"
 #include "ray.h"
 
+//Number of bits the QuantizedWideNodes store the bounds of their children with, 8 or 16.
+//Selected at build time (-DBVH_QUANTIZED_NODE_BITS=16). 8 bits give the smallest nodes,
+//16 bits bound the children more tightly so that the rays visit fewer of them
+#ifndef BVH_QUANTIZED_NODE_BITS
+#define BVH_QUANTIZED_NODE_BITS 8
+#endif
+
+static_assert(BVH_QUANTIZED_NODE_BITS == 8 || BVH_QUANTIZED_NODE_BITS == 16, "BVH_QUANTIZED_NODE_BITS must be 8 or 16");
+
 class BVH
 {
 public:
+	/*
+	 * Primitive referenced by the leaves of the hierarchy: a triangle or a quad.
+	 * The two triangles of a quad are consecutive in the mesh and share
+	 * their diagonal, see is_quad(). A quad is built and packed as a single primitive
+	 */
+	struct Primitive
+	{
+		Triangle* _triangle;
+		//2 for a quad whose second triangle is _triangle[1], 1 otherwise
+		int _triangle_count;
+
+		Point bbox_centroid() const
+		{
+			if (_triangle_count == 1)
+				return _triangle->bbox_centroid();
+
+			const Triangle& first = _triangle[0];
+			const Triangle& second = _triangle[1];
+
+			return (min(min(first._a, first._b), min(first._c, second._c)) + max(max(first._a, first._b), max(first._c, second._c))) / 2;
+		}
+	};
+
 	struct BoundingVolume
 	{
         static constexpr int PLANES_COUNT = 7;
@@ -58,6 +104,17 @@ public:
 			extend_volume(volume._d_near, volume._d_far);
 		}
 
+		void extend_volume(const Point& point)
+		{
+			for (int i = 0; i < PLANES_COUNT; i++)
+			{
+				float dist = dot(BoundingVolume::PLANE_NORMALS[i], Vector(point));
+
+				_d_near[i] = std::min(_d_near[i], dist);
+				_d_far[i] = std::max(_d_far[i], dist);
+			}
+		}
+
 		void extend_volume(const Triangle& triangle)
 		{
             float d_near[PLANES_COUNT];
@@ -73,246 +130,1209 @@ public:
 			extend_volume(d_near, d_far);
 		}
 
-		/**
-		 * @params denoms Precomputed denominators
-		 */
-		bool intersect(const Ray& ray, float& t_near, float& t_far, float* denoms, float* numers) const
+		void extend_volume(const Primitive& primitive)
 		{
-            t_near = -INFINITY;
-            t_far = INFINITY;
+			for (int i = 0; i < primitive._triangle_count; i++)
+				extend_volume(primitive._triangle[i]);
+		}
 
-            for (int i = 0; i < PLANES_COUNT; i++)
+		/*
+		 * Per-ray values needed to intersect bounding volumes, computed once per ray.
+		 * The planes are evaluated 8 at a time with AVX2 instructions, the 8th lane being padding.
+		 * The planes parallel to the ray (and the padding lane) are ignored
+		 */
+		struct VolumeRay
+		{
+			VolumeRay(const Ray& ray)
 			{
-				float denom = denoms[i];
-				if (denom == 0.0)
-					continue;
-
-				//inverse denom to avoid division
-				float d_near_i = (_d_near[i] - numers[i]) / denom;
-				float d_far_i = (_d_far[i] - numers[i]) / denom;
-				if (denom < 0)
-					std::swap(d_near_i, d_far_i);
+				alignas(32) float inv_denoms[8];
+				alignas(32) float numers[8];
+				alignas(32) int ignored_planes[8];
+				for (int i = 0; i < 8; i++)
+				{
+					float denom = i < PLANES_COUNT ? dot(PLANE_NORMALS[i], ray._direction) : 0.0f;
 
-				t_near = std::max(t_near, d_near_i);
-				t_far = std::min(t_far, d_far_i);
+					ignored_planes[i] = denom == 0.0f ? -1 : 0;
+					inv_denoms[i] = denom == 0.0f ? 0.0f : 1.0f / denom;
+					numers[i] = i < PLANES_COUNT ? dot(PLANE_NORMALS[i], Vector(ray._origin)) : 0.0f;
+				}
 
-				if (t_far < t_near)
-					return false;
+				_inv_denoms = _mm256_load_ps(inv_denoms);
+				_numers = _mm256_load_ps(numers);
+				_ignored_planes = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(ignored_planes)));
 			}
 
+			//Reciprocal of the denominators so that the distances are computed without divisions
+			__m256 _inv_denoms;
+			__m256 _numers;
+			__m256 _ignored_planes;
+		};
 
-			return true;
+		/*
+		 * Computes the distances to the entry and exit points of the ray in each slab of the volume.
+		 * The ray enters the slab through the far plane if it travels in the opposite direction
+		 * of the normal of the plane, that is, if the reciprocal of the denominator is negative
+		 */
+		void slab_distances(const VolumeRay& ray, __m256& t_entries, __m256& t_exits) const
+		{
+			//The masked loads don't read past the 7 planes of the volume
+			const __m256i planes_mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, -1, 0);
+			__m256 d_near = _mm256_maskload_ps(_d_near, planes_mask);
+			__m256 d_far = _mm256_maskload_ps(_d_far, planes_mask);
+
+			__m256 d_entry = _mm256_blendv_ps(d_near, d_far, ray._inv_denoms);
+			__m256 d_exit = _mm256_blendv_ps(d_far, d_near, ray._inv_denoms);
+
+			t_entries = _mm256_mul_ps(_mm256_sub_ps(d_entry, ray._numers), ray._inv_denoms);
+			t_exits = _mm256_mul_ps(_mm256_sub_ps(d_exit, ray._numers), ray._inv_denoms);
+
+			t_entries = _mm256_blendv_ps(t_entries, _mm256_set1_ps(-INFINITY), ray._ignored_planes);
+			t_exits = _mm256_blendv_ps(t_exits, _mm256_set1_ps(INFINITY), ray._ignored_planes);
 		}
-	};
 
-	struct OctreeNode
-	{
-		struct QueueElement
+		bool intersect(const VolumeRay& ray, float& t_near, float& t_far) const
 		{
-			QueueElement(const BVH::OctreeNode* node, float t_near) : _node(node), _t_near(t_near) {}
+			__m256 t_entries, t_exits;
+			slab_distances(ray, t_entries, t_exits);
+
+			t_near = _mm256_max_reduction_ps(t_entries);
+			t_far = _mm256_min_reduction_ps(t_exits);
+
+			return t_near <= t_far;
+		}
 
-			bool operator > (const QueueElement& a) const
+		/*
+		 * Intersects the ray with up to 8 volumes at once.
+		 *
+		 * @param t_max Volumes whose entry distance is farther than t_max are not considered hit
+		 * @param[out] t_near Entry distance of the ray in each volume
+		 * @return Mask whose i-th bit is set if the i-th volume is hit
+		 */
+		static int intersect_batch(const VolumeRay& ray, const BoundingVolume* const volumes[8], int count, float t_max, __m256& t_near)
+		{
+			__m256 t_entries[8], t_exits[8];
+			for (int i = 0; i < count; i++)
+				volumes[i]->slab_distances(ray, t_entries[i], t_exits[i]);
+			for (int i = count; i < 8; i++)
 			{
-				return _t_near > a._t_near;
+				t_entries[i] = _mm256_set1_ps(INFINITY);
+				t_exits[i] = _mm256_set1_ps(-INFINITY);
 			}
 
-			const OctreeNode* _node;//Reference on the node
+			t_near = _mm256_max_reduction8_ps(t_entries);
+			__m256 t_far = _mm256_min_reduction8_ps(t_exits);
+
+			__m256 hit = _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ);
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_near, _mm256_set1_ps(t_max), _CMP_LE_OQ));
 
-			float _t_near;//Intersection distance used to order the elements in the priority queue used
-			//by the OctreeNode to compute the intersection with a ray
+			return _mm256_movemask_ps(hit);
+		}
+
+		/*
+		 * Per-ray values of VolumeRay for a packet of 8 rays. The values of a plane are
+		 * stored for the 8 rays at once so that the 8 rays are intersected with a volume together
+		 */
+		struct PacketRay
+		{
+			PacketRay(const Ray rays[8])
+			{
+				for (int i = 0; i < PLANES_COUNT; i++)
+				{
+					alignas(32) float inv_denoms[8];
+					alignas(32) float numers[8];
+					alignas(32) int ignored_planes[8];
+					for (int j = 0; j < 8; j++)
+					{
+						//Same computations as VolumeRay so that a ray hits the same volumes alone or in a packet
+						float denom = dot(PLANE_NORMALS[i], rays[j]._direction);
+
+						ignored_planes[j] = denom == 0.0f ? -1 : 0;
+						inv_denoms[j] = denom == 0.0f ? 0.0f : 1.0f / denom;
+						numers[j] = dot(PLANE_NORMALS[i], Vector(rays[j]._origin));
+					}
+
+					_inv_denoms[i] = _mm256_load_ps(inv_denoms);
+					_numers[i] = _mm256_load_ps(numers);
+					_ignored_planes[i] = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(ignored_planes)));
+				}
+			}
+
+			__m256 _inv_denoms[PLANES_COUNT];
+			__m256 _numers[PLANES_COUNT];
+			__m256 _ignored_planes[PLANES_COUNT];
 		};
 
-        OctreeNode(Point min, Point max) : _min(min), _max(max) {}
-		~OctreeNode()
+		/*
+		 * Intersects the 8 rays of the packet with the volume at once.
+		 *
+		 * @param t_max Distance beyond which the volume isn't considered hit, for each ray
+		 * @param[out] t_near Entry distance of each ray in the volume
+		 * @return Mask whose i-th bit is set if the i-th ray hits the volume
+		 */
+		int intersect_packet(const PacketRay& rays, __m256 t_max, __m256& t_near) const
 		{
-			if (_is_leaf)
-				return;
-			else
+			t_near = _mm256_set1_ps(-INFINITY);
+			__m256 t_far = _mm256_set1_ps(INFINITY);
+			for (int i = 0; i < PLANES_COUNT; i++)
 			{
-				for (int i = 0; i < 8; i++)
-					delete _children[i];
+				__m256 d_near = _mm256_set1_ps(_d_near[i]);
+				__m256 d_far = _mm256_set1_ps(_d_far[i]);
+
+				__m256 d_entry = _mm256_blendv_ps(d_near, d_far, rays._inv_denoms[i]);
+				__m256 d_exit = _mm256_blendv_ps(d_far, d_near, rays._inv_denoms[i]);
+
+				__m256 t_entry = _mm256_mul_ps(_mm256_sub_ps(d_entry, rays._numers[i]), rays._inv_denoms[i]);
+				__m256 t_exit = _mm256_mul_ps(_mm256_sub_ps(d_exit, rays._numers[i]), rays._inv_denoms[i]);
+
+				t_near = _mm256_max_ps(t_near, _mm256_blendv_ps(t_entry, _mm256_set1_ps(-INFINITY), rays._ignored_planes[i]));
+				t_far = _mm256_min_ps(t_far, _mm256_blendv_ps(t_exit, _mm256_set1_ps(INFINITY), rays._ignored_planes[i]));
 			}
+
+			__m256 hit = _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ);
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_near, t_max, _CMP_LE_OQ));
+
+			return _mm256_movemask_ps(hit);
 		}
+	};
+
+	struct OctreeNode
+	{
+		static constexpr int CHILDREN_COUNT = 8;
+
+		OctreeNode() {}
+        OctreeNode(Point min, Point max) : _min(min), _max(max) {}
+		~OctreeNode() { delete[] _children; }
 
- 		 /*
-		  * Once the objects have been inserted in the hierarchy, this function computes
-		  * the bounding volume of all the node in the hierarchy
-		  */
-		BoundingVolume compute_volume()
+		/*
+		 * Creates the children of the octants whose bit is set in the occupancy mask.
+		 * The bit i of the mask is the octant whose x, y and z are in the upper half of the
+		 * node if the bits 0, 1 and 2 of i are set. Only these children are allocated,
+		 * contiguously, in the order of their octants
+		 */
+		void create_children(int children_mask)
 		{
-			if (_is_leaf)
-				for (const Triangle* triangle : _triangles)
-					_bounding_volume.extend_volume(*triangle);
-			else
-				for (int i = 0; i < 8; i++)
-					_bounding_volume.extend_volume(_children[i]->compute_volume());
+			Point middle = center(_min, _max);
 
-			return _bounding_volume;
+			_children_mask = children_mask;
+			_children_count = (int)std::bitset<CHILDREN_COUNT>(children_mask).count();
+			_children = new OctreeNode[_children_count];
+
+			int child_index = 0;
+			for (int octant = 0; octant < CHILDREN_COUNT; octant++)
+			{
+				if (!(children_mask & (1 << octant)))
+					continue;
+
+				OctreeNode& child = _children[child_index++];
+				child._min = Point(octant & 1 ? middle.x : _min.x, octant & 2 ? middle.y : _min.y, octant & 4 ? middle.z : _min.z);
+				child._max = Point(octant & 1 ? _max.x : middle.x, octant & 2 ? _max.y : middle.y, octant & 4 ? _max.z : middle.z);
+			}
 		}
 
-		void create_children(int max_depth, int leaf_max_obj_count)
+		int children_count() const { return _children_count; }
+		const OctreeNode* child(int index) const { return &_children[index]; }
+
+		/*
+		 * Recursively builds the hierarchy below this node with the given primitives.
+		 * A node is subdivided as long as it holds more than leaf_max_obj_count primitives
+		 * and the maximum depth hasn't been reached. The primitives are then distributed
+		 * to the octants that contain their bounding box centroid.
+		 * The bounding volume of the node is computed once its subtree has been built.
+		 *
+		 * The subtrees of the node are built in parallel as OpenMP tasks. This function
+		 * must thus be called from inside an OpenMP parallel region
+		 */
+		void build(std::vector<Primitive>& primitives, int current_depth, int max_depth, int leaf_max_obj_count);
+
+		//If this node has been subdivided (and thus cannot accept any triangles), 
+		//this boolean will be set to false
+		bool _is_leaf = true;
+
+		std::vector<Primitive> _primitives;
+
+		//Bit i is set if the octant i holds primitives, see create_children()
+		uint8_t _children_mask = 0;
+		//Children of the non-empty octants. The empty octants have no child so
+		//that they cost neither memory nor intersection tests once flattened
+		BVH::OctreeNode* _children = nullptr;
+		int _children_count = 0;
+
+		Point _min, _max;
+		BVH::BoundingVolume _bounding_volume;
+	};
+
+	/*
+	 * Node of a binary hierarchy built top-down with the binned surface area heuristic.
+	 * Contrary to the OctreeNode, the split position is chosen by minimizing the
+	 * expected cost of traversing the node instead of being the middle of the node
+	 */
+	struct BinaryNode
+	{
+		static constexpr int CHILDREN_COUNT = 2;
+
+		//Number of bins the centroid range of a node is split into along each axis
+		//when looking for the best split
+		static constexpr int SAH_BIN_COUNT = 16;
+
+		//Estimated cost of traversing a node relative to the cost of intersecting a triangle
+		static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+		static constexpr float SAH_INTERSECTION_COST = 1.0f;
+
+		BinaryNode() {}
+		~BinaryNode()
 		{
-			float middle_x = (_min.x + _max.x) / 2;
-			float middle_y = (_min.y + _max.y) / 2;
-			float middle_z = (_min.z + _max.z) / 2;
-
-			_children[0] = new OctreeNode(_min, Point(middle_x, middle_y, middle_z));
-			_children[1] = new OctreeNode(Point(middle_x, _min.y, _min.z), Point(_max.x, middle_y, middle_z));
-			_children[2] = new OctreeNode(_min + Point(0, middle_y, 0), Point(middle_x, _max.y, middle_z));
-			_children[3] = new OctreeNode(Point(middle_x, middle_y, _min.z), Point(_max.x, _max.y, middle_z));
-			_children[4] = new OctreeNode(_min + Point(0, 0, middle_z), Point(middle_x, middle_y, _max.z));
-			_children[5] = new OctreeNode(Point(middle_x, _min.y, middle_z), Point(_max.x, middle_y, _max.z));
-			_children[6] = new OctreeNode(_min + Point(0, middle_y, middle_z), Point(middle_x, _max.y, _max.z));
-			_children[7] = new OctreeNode(Point(middle_x, middle_y, middle_z), Point(_max.x, _max.y, _max.z));
+			if (_is_leaf)
+				return;
+
+			delete _children[0];
+			delete _children[1];
 		}
 
-		void insert(Triangle* triangle, int current_depth, int max_depth, int leaf_max_obj_count)
+		int children_count() const { return CHILDREN_COUNT; }
+		const BinaryNode* child(int index) const { return _children[index]; }
+
+		/*
+		 * Recursively builds the hierarchy below this node with the given primitives
+		 * and computes the bounding volume of the node.
+		 * Same as OctreeNode::build(), the subtrees are built as OpenMP tasks
+		 */
+		void build(std::vector<Primitive>& primitives, int current_depth, int max_depth, int leaf_max_obj_count);
+
+		/*
+		 * Reference to a primitive during the build of a spatial split hierarchy.
+		 * A primitive straddling a spatial split is referenced on both sides of the split,
+		 * each reference only covering the part of the primitive on its side
+		 */
+		struct TriangleReference
 		{
-			bool depth_exceeded = current_depth == max_depth;
+			Primitive _primitive;
 
-			if (_is_leaf || depth_exceeded)
-			{
-				_triangles.push_back(triangle);
+			//Box of the part of the primitive covered by the reference
+			Point _min, _max;
+		};
 
-				if (_triangles.size() > leaf_max_obj_count && !depth_exceeded)
-				{
-					_is_leaf = false;//This node isn't a leaf anymore
+		//Spatial splits are only considered when the children of the best object split overlap
+		//by more than this fraction of the area of the root. Otherwise, the object split is good enough
+		static constexpr float SBVH_OVERLAP_THRESHOLD = 1.0e-5f;
 
-					create_children(max_depth, leaf_max_obj_count);
+		//Maximum number of additional references the spatial splits can create,
+		//relative to the number of triangles
+		static constexpr float SBVH_DUPLICATION_BUDGET = 0.3f;
 
-					for (Triangle* triangle : _triangles)
-						insert_to_children(triangle, current_depth, max_depth, leaf_max_obj_count);
+		/*
+		 * Same as build() but evaluates spatial splits in addition to the object splits.
+		 * The duplication budget is the number of references the spatial splits of the subtree
+		 * may still add. It is shared between the children in proportion of their number of
+		 * references so that the hierarchy doesn't depend on the order the subtrees are built in
+		 */
+		void build_spatial(std::vector<TriangleReference>& references, int current_depth, int max_depth, int leaf_max_obj_count, float root_half_area, int duplication_budget);
 
-					_triangles.clear();
-					_triangles.shrink_to_fit();
-				}
-			}
-			else
-				insert_to_children(triangle, current_depth, max_depth, leaf_max_obj_count);
+		bool _is_leaf = true;
 
-		}
+		//The same primitive may be in several leaves of a spatial split hierarchy
+		std::vector<Primitive> _primitives;
+		BVH::BinaryNode* _children[2] = { nullptr, nullptr };
 
-		void insert_to_children(Triangle* triangle, int current_depth, int max_depth, int leaf_max_obj_count)
-		{
-			Point bbox_centroid = triangle->bbox_centroid();
+		BVH::BoundingVolume _bounding_volume;
+	};
 
-			float middle_x = (_min.x + _max.x) / 2;
-			float middle_y = (_min.y + _max.y) / 2;
-			float middle_z = (_min.z + _max.z) / 2;
+	/*
+	 * Node of the flattened hierarchy. Once built by one of the builders, the hierarchy is
+	 * compacted into a single array of these nodes. The children of a node are stored
+	 * contiguously and the blocks of children are laid out in depth-first order.
+	 * A node is exactly one cache line
+	 */
+	struct alignas(64) FlatNode
+	{
+		BVH::BoundingVolume _bounding_volume;
 
-			int octant_index = 0;
+		//Index of the first child of the node in the node array if this node is an inner node.
+		//Index of the first triangle pack of the leaf in the triangle pack array otherwise
+		int _first = 0;
+		//Number of children if this node is an inner node, number of triangle packs otherwise
+		unsigned int _count : 31;
+		unsigned int _is_leaf : 1;
+	};
 
-			if (bbox_centroid.x > middle_x) octant_index += 1;
-			if (bbox_centroid.y > middle_y) octant_index += 2;
-			if (bbox_centroid.z > middle_z) octant_index += 4;
+	/*
+	 * Per-ray values needed to intersect the children of the wide nodes, computed once per ray.
+	 * Same as BoundingVolume::intersect, the planes parallel to the ray are ignored.
+	 * For the other planes, the ray enters the slab through the far plane if
+	 * it travels in the opposite direction of the normal of the plane
+	 */
+	template <int PlanesCount>
+	struct WideRay
+	{
+		WideRay(const Ray& ray)
+		{
+			for (int i = 0; i < PlanesCount; i++)
+			{
+				float denom = dot(BoundingVolume::PLANE_NORMALS[i], ray._direction);
+				if (denom == 0.0f)
+					continue;
 
-			_children[octant_index]->insert(triangle, current_depth + 1, max_depth, leaf_max_obj_count);
+				_planes[_plane_count] = i;
+				_entry_sides[_plane_count] = denom < 0 ? 1 : 0;
+				_inv_denoms[_plane_count] = _mm256_set1_ps(1.0f / denom);
+				_numers[_plane_count] = _mm256_set1_ps(dot(BoundingVolume::PLANE_NORMALS[i], Vector(ray._origin)));
+				_plane_count++;
+			}
 		}
 
-		bool intersect(const Ray& ray, HitInfo& hit_info) const
-		{
-			float trash;
+		int _planes[PlanesCount];
+		int _entry_sides[PlanesCount];
+		//Reciprocal of the denominators so that the distances are computed without divisions
+		__m256 _inv_denoms[PlanesCount];
+		__m256 _numers[PlanesCount];
+		int _plane_count = 0;
+	};
 
-			float denoms[BVH::BoundingVolume::PLANES_COUNT];
-			float numers[BVH::BoundingVolume::PLANES_COUNT];
+	/*
+	 * Node of the 8-wide hierarchy collapsed from the flattened hierarchy.
+	 * The bounding volumes of the children are stored in SoA layout so that
+	 * a ray can be intersected against the 8 of them with AVX2 instructions.
+	 *
+	 * PlanesCount is BoundingVolume::PLANES_COUNT for k-DOPs and 3 for axis aligned
+	 * bounding boxes (the first 3 planes of the k-DOPs are the axis aligned ones)
+	 */
+	template <int PlanesCount>
+	struct alignas(32) WideNode
+	{
+		static constexpr int CHILDREN_COUNT = 8;
+		static constexpr int PLANES_COUNT = PlanesCount;
 
-			for (int i = 0; i < BVH::BoundingVolume::PLANES_COUNT; i++)
+		WideNode()
+		{
+			//Unused children have an empty volume that cannot be intersected
+			for (int plane = 0; plane < PlanesCount; plane++)
 			{
-				denoms[i] = dot(BoundingVolume::PLANE_NORMALS[i], ray._direction);
-				numers[i] = dot(BoundingVolume::PLANE_NORMALS[i], Vector(ray._origin));
+				for (int i = 0; i < CHILDREN_COUNT; i++)
+				{
+					_slabs[plane][0][i] = INFINITY;
+					_slabs[plane][1][i] = -INFINITY;
+				}
 			}
-
-			return intersect(ray, hit_info, trash, denoms, numers);
 		}
 
-		bool intersect(const Ray& ray, HitInfo& hit_info, float& t_near, float* denoms, float* numers) const
+		/*
+		 * Intersects the 8 children of the node at once.
+		 *
+		 * @param t_max Children whose entry distance is farther than t_max are not considered hit
+		 * @param[out] t_near Entry distance of the ray in each child
+		 * @return Mask whose i-th bit is set if the i-th child is hit
+		 */
+		int intersect(const WideRay<PlanesCount>& ray, float t_max, __m256& t_near) const
 		{
-			float t_far, trash;
+			t_near = _mm256_set1_ps(-INFINITY);
+			__m256 t_far = _mm256_set1_ps(INFINITY);
+			for (int i = 0; i < ray._plane_count; i++)
+			{
+				__m256 d_entry = _mm256_load_ps(_slabs[ray._planes[i]][ray._entry_sides[i]]);
+				__m256 d_exit = _mm256_load_ps(_slabs[ray._planes[i]][1 - ray._entry_sides[i]]);
 
-			if (!_bounding_volume.intersect(ray, trash, t_far, denoms, numers))
-				return false;
+				t_near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(d_entry, ray._numers[i]), ray._inv_denoms[i]), t_near);
+				t_far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(d_exit, ray._numers[i]), ray._inv_denoms[i]), t_far);
+			}
 
-			if (_is_leaf)
+			//A child is hit if the ray is in all its slabs at the same time,
+			//in front of the origin of the ray and before t_max
+			__m256 hit = _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ);
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_near, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+
+			return _mm256_movemask_ps(hit);
+		}
+
+		/*
+		 * Sets the bounding volumes of the first children_count children of the node.
+		 * The other children are unused
+		 */
+		void set_children_volumes(const BoundingVolume volumes[CHILDREN_COUNT], int children_count)
+		{
+			for (int plane = 0; plane < PlanesCount; plane++)
 			{
-				for (Triangle* triangle : _triangles)
+				for (int i = 0; i < CHILDREN_COUNT; i++)
 				{
-					HitInfo local_hit_info;
-					if (triangle->intersect(ray, local_hit_info))
-						if (local_hit_info.t < hit_info.t || hit_info.t == -1)
-							hit_info = local_hit_info;
+					_slabs[plane][0][i] = i < children_count ? volumes[i]._d_near[plane] : INFINITY;
+					_slabs[plane][1][i] = i < children_count ? volumes[i]._d_far[plane] : -INFINITY;
 				}
+			}
+		}
+
+		bool has_child(int child) const { return _slabs[0][0][child] <= _slabs[0][1][child]; }
+		float child_near(int plane, int child) const { return _slabs[plane][0][child]; }
+		float child_far(int plane, int child) const { return _slabs[plane][1][child]; }
+
+		//_slabs[plane][0][child] is the near distance of the child along the normal of
+		//the plane, _slabs[plane][1][child] is the far distance
+		float _slabs[PlanesCount][2][CHILDREN_COUNT];
+
+		//Index of the child in the wide node array if the child is an inner node.
+		//Index of the first triangle pack of the leaf in the triangle pack array otherwise
+		int _first[CHILDREN_COUNT] = { 0 };
+		//Number of triangle packs of the child if the child is a leaf
+		int _count[CHILDREN_COUNT] = { 0 };
+		//The i-th bit is set if the i-th child is a leaf
+		int _leaf_mask = 0;
+	};
 
-				t_near = hit_info.t;
+	/*
+	 * Same as WideNode but the bounds of the children are quantized to BVH_QUANTIZED_NODE_BITS
+	 * bits relative to the bounds of the node. Along each plane, the quantized value q decodes
+	 * to the distance fma(q, scale, origin). The near bounds are rounded down and the far bounds
+	 * up so that the decoded volume of a child always contains its exact volume: the rays may visit
+	 * a few more children than with the WideNode but never miss one.
+	 *
+	 * A k-DOP node is 256 bytes against 544 for the WideNode with 8 bits (352 with 16 bits),
+	 * an AABB node 160 bytes against 288 (192 with 16 bits)
+	 */
+	template <int PlanesCount>
+	struct alignas(32) QuantizedWideNode
+	{
+		static constexpr int CHILDREN_COUNT = 8;
+		static constexpr int PLANES_COUNT = PlanesCount;
 
-				return t_near > 0;
-			}
+		using QuantizedType = std::conditional_t<BVH_QUANTIZED_NODE_BITS == 8, uint8_t, uint16_t>;
+		static constexpr int QUANTIZED_MAX = (1 << BVH_QUANTIZED_NODE_BITS) - 1;
 
-			std::priority_queue<QueueElement, std::vector<QueueElement>, std::greater<QueueElement>> intersection_queue;
-			for (int i = 0; i < 8; i++)
+		int intersect(const WideRay<PlanesCount>& ray, float t_max, __m256& t_near) const
+		{
+			t_near = _mm256_set1_ps(-INFINITY);
+			__m256 t_far = _mm256_set1_ps(INFINITY);
+			for (int i = 0; i < ray._plane_count; i++)
 			{
-				float inter_distance;
-				if (_children[i]->_bounding_volume.intersect(ray, inter_distance, t_far, denoms, numers))
-					intersection_queue.emplace(QueueElement(_children[i], inter_distance));
+				int plane = ray._planes[i];
+
+				//(q * scale + origin - numer) * inv_denom computed as q * (scale * inv_denom) + (origin - numer) * inv_denom
+				//so that the decoding of the bounds is folded into the distance computation
+				__m256 t_scale = _mm256_mul_ps(_mm256_set1_ps(_scales[plane]), ray._inv_denoms[i]);
+				__m256 t_origin = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(_origins[plane]), ray._numers[i]), ray._inv_denoms[i]);
+
+				t_near = _mm256_max_ps(_mm256_fmadd_ps(load_quantized(_slabs[plane][ray._entry_sides[i]]), t_scale, t_origin), t_near);
+				t_far = _mm256_min_ps(_mm256_fmadd_ps(load_quantized(_slabs[plane][1 - ray._entry_sides[i]]), t_scale, t_origin), t_far);
 			}
 
-            float closest_inter = INFINITY, inter_distance = INFINITY;
-			while (!intersection_queue.empty())
-			{
-				QueueElement top_element = intersection_queue.top();
-				intersection_queue.pop();
+			__m256 hit = _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ);
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_near, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+
+			//The quantized bounds of the unused children can't be made empty if the scale is 0
+			return _mm256_movemask_ps(hit) & _children_mask;
+		}
 
-				if (top_element._node->intersect(ray, hit_info, inter_distance, denoms, numers))
+		void set_children_volumes(const BoundingVolume volumes[CHILDREN_COUNT], int children_count)
+		{
+			_children_mask = (1 << children_count) - 1;
+			for (int plane = 0; plane < PlanesCount; plane++)
+			{
+				float d_near = INFINITY;
+				float d_far = -INFINITY;
+				for (int i = 0; i < children_count; i++)
 				{
-					closest_inter = std::min(closest_inter, inter_distance);
+					d_near = std::min(d_near, volumes[i]._d_near[plane]);
+					d_far = std::max(d_far, volumes[i]._d_far[plane]);
+				}
 
-					//If we found an intersection that is closer than 
-					//the next element in the queue, we can stop intersecting further
-					if (intersection_queue.empty() || closest_inter < intersection_queue.top()._t_near)
+				if (children_count == 0)
+					d_near = d_far = 0.0f;
+
+				//The largest quantized value must decode to at least the far bound of the node
+				//despite the roundings of the division and of the decoding
+				float scale = (d_far - d_near) / QUANTIZED_MAX;
+				while (std::fma((float)QUANTIZED_MAX, scale, d_near) < d_far)
+					scale *= 1.0001f;
+
+				_origins[plane] = d_near;
+				_scales[plane] = scale;
+
+				for (int i = 0; i < CHILDREN_COUNT; i++)
+				{
+					if (i >= children_count)
 					{
-						t_near = closest_inter;
+						_slabs[plane][0][i] = QUANTIZED_MAX;
+						_slabs[plane][1][i] = 0;
 
-						return true;
+						continue;
 					}
+
+					_slabs[plane][0][i] = quantize(volumes[i]._d_near[plane], plane, false);
+					_slabs[plane][1][i] = quantize(volumes[i]._d_far[plane], plane, true);
 				}
 			}
+		}
+
+		bool has_child(int child) const { return _children_mask & (1 << child); }
+		float child_near(int plane, int child) const { return std::fma((float)_slabs[plane][0][child], _scales[plane], _origins[plane]); }
+		float child_far(int plane, int child) const { return std::fma((float)_slabs[plane][1][child], _scales[plane], _origins[plane]); }
+
+		/*
+		 * Quantized value that decodes to a distance lower than the given distance if round_up is
+		 * false, greater than the distance otherwise, as close as possible to the distance
+		 */
+		QuantizedType quantize(float distance, int plane, bool round_up) const
+		{
+			if (_scales[plane] == 0.0f)
+				return 0;
 
-            if (closest_inter == INFINITY)
-				return false;
+			float scaled = (distance - _origins[plane]) / _scales[plane];
+			int quantized = (int)std::min(std::max(round_up ? std::ceil(scaled) : std::floor(scaled), 0.0f), (float)QUANTIZED_MAX);
+
+			//The division is rounded too, the decoded distance is checked against the exact one
+			if (round_up)
+				while (quantized < QUANTIZED_MAX && std::fma((float)quantized, _scales[plane], _origins[plane]) < distance)
+					quantized++;
 			else
-			{
-				t_near = closest_inter;
+				while (quantized > 0 && std::fma((float)quantized, _scales[plane], _origins[plane]) > distance)
+					quantized--;
 
-				return true;
-			}
+			return (QuantizedType)quantized;
 		}
 
-		//If this node has been subdivided (and thus cannot accept any triangles), 
-		//this boolean will be set to false
-		bool _is_leaf = true;
+		static __m256 load_quantized(const uint8_t* quantized)
+		{
+			return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantized))));
+		}
+
+		static __m256 load_quantized(const uint16_t* quantized)
+		{
+			return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(quantized))));
+		}
 
-		std::vector<Triangle*> _triangles;
-		BVH::OctreeNode* _children[8];
+		//Distance along the normal of each plane that the quantized value 0 decodes to
+		//and distance between two consecutive quantized values
+		float _origins[PlanesCount];
+		float _scales[PlanesCount];
 
-		Point _min, _max;
-		BVH::BoundingVolume _bounding_volume;
+		//Same as WideNode::_slabs but quantized
+		QuantizedType _slabs[PlanesCount][2][CHILDREN_COUNT];
+
+		int _first[CHILDREN_COUNT] = { 0 };
+		int _count[CHILDREN_COUNT] = { 0 };
+		int _leaf_mask = 0;
+		//The i-th bit is set if the i-th child is used
+		int _children_mask = 0;
+	};
+
+	/*
+	 * Element of the fixed size stack used to traverse the hierarchy
+	 */
+	struct StackElement
+	{
+		int _node_index;//Index of the node in the node array
+
+		float _t_near;//Distance to the entry point of the ray in the bounding volume of the node.
+		//The node doesn't need to be visited if an intersection closer than this has already been found
+	};
+
+	/*
+	 * Element of the traversal stack of the ray packets
+	 */
+	struct PacketStackElement
+	{
+		int _node_index;
+		//Rays of the packet that hit the bounding volume of the node
+		int _rays_mask;
+
+		//Closest entry distance of these rays in the bounding volume of the node
+		float _t_near;
+	};
+
+	/*
+	 * Work done by the traversals of the hierarchy. The triangles are intersected 8 at a time
+	 * so the padding lanes of the triangle packs are counted as tested triangles. The quads of
+	 * the quad packs are counted as one tested triangle each. A node or a
+	 * triangle intersected with a whole ray packet at once is counted once for the packet
+	 */
+	struct TraversalCounters
+	{
+		long long _rays = 0;
+		long long _nodes_visited = 0;
+		long long _triangles_tested = 0;
+	};
+
+	/*
+	 * Outcome of the treelet optimization pass, see BVH::optimize_treelets()
+	 */
+	struct TreeletOptimizationReport
+	{
+		bool _enabled = false;
+
+		//SAH cost of the flattened hierarchy before and after the pass
+		float _sah_cost_before = 0.0f;
+		float _sah_cost_after = 0.0f;
+		//Number of treelets whose topology was changed
+		int _restructured_treelets = 0;
+		//Time the pass took in milliseconds, included in the build time of the BVH
+		float _time = 0.0f;
+
+		friend std::ostream& operator << (std::ostream& os, const TreeletOptimizationReport& report);
+	};
+
+	/*
+	 * Statistics on the quality and the size of the hierarchy, see BVH::statistics()
+	 */
+	struct Statistics
+	{
+		//Number of nodes of the hierarchy in its layout, leaves included
+		int _node_count = 0;
+		int _leaf_count = 0;
+		//Number of triangles in the leaves. Triangles referenced by several leaves are counted once per leaf
+		int _leaf_triangle_count = 0;
+		//_leaf_sizes[i] is the number of leaves that hold i triangles
+		std::vector<int> _leaf_sizes;
+		//_leaf_depths[i] is the number of leaves at depth i
+		std::vector<int> _leaf_depths;
+
+		float _sah_cost = 0.0f;
+		//Size of the nodes, the triangle packs and the triangles in bytes
+		size_t _memory_footprint = 0;
+		//Size of the nodes alone in bytes, included in _memory_footprint
+		size_t _nodes_memory_footprint = 0;
+		float _build_time = 0.0f;
+
+		TreeletOptimizationReport _treelet_optimization;
+
+		//Only filled if the traversal counters were enabled, see BVH::reset_traversal_counters()
+		bool _traversal_counters_enabled = false;
+		TraversalCounters _traversal_counters;
+
+		/*
+		 * Writes the statistics to the given file in JSON format
+		 * @return False if the file couldn't be written
+		 */
+		bool save(const std::string& filepath) const;
+
+		friend std::ostream& operator << (std::ostream& os, const Statistics& statistics);
 	};
 
+	//The builders never create nodes deeper than this
+	static constexpr int MAX_DEPTH = 32;
+	//Maximum number of children of a node of the flattened hierarchy
+	static constexpr int MAX_CHILDREN_COUNT = 8;
+	//At each level of the hierarchy, all the children but the one being visited
+	//can be waiting on the traversal stack
+	static constexpr int TRAVERSAL_STACK_SIZE = MAX_DEPTH * (MAX_CHILDREN_COUNT - 1) + 1;
+
+	//Subtrees with fewer triangles than this are built by the thread that created them.
+	//Spawning an OpenMP task for them would cost more than building them
+	static constexpr int PARALLEL_BUILD_MIN_TRIANGLES = 4096;
+
+	//Maximum number of leaves of the treelets restructured by optimize_treelets().
+	//The search for the best topology of a treelet is in O(3^n)
+	static constexpr int TREELET_MAX_LEAVES = 7;
+	//Number of bottom-up passes of optimize_treelets() over the hierarchy
+	static constexpr int TREELET_OPTIMIZATION_PASSES = 3;
+
+	//Number of rays traversing the hierarchy together in a packet
+	static constexpr int PACKET_SIZE = 8;
+	//The rays of a packet that has fewer active rays than this finish
+	//the traversal of the current subtree alone. Below that, intersecting the
+	//nodes for the whole packet costs more than traversing the rays one by one
+	static constexpr int PACKET_MIN_ACTIVE_RAYS = 3;
+
 public:
 	BVH();
-	BVH(std::vector<Triangle>* triangles, int max_depth = 10, int leaf_max_obj_count = 8);
+	/*
+	 * Builds the BVH over the triangles of the given mesh. The triangles of the mesh
+	 * are reordered by the build, its vertices are left untouched
+	 *
+	 * @param optimize_treelets Whether or not to run optimize_treelets() on the built hierarchy
+	 * @param quads Whether or not the consecutive triangles that form a quad (see is_quad())
+	 * are built and intersected as a single primitive. The leaves then hold quad packs
+	 */
+	BVH(IndexedMesh* mesh, int max_depth = 10, int leaf_max_obj_count = 8, RenderSettings::BVHBuilder builder = RenderSettings::OCTREE_BUILDER, RenderSettings::BVHLayout layout = RenderSettings::SCALAR_BVH_LAYOUT, bool optimize_treelets = false, bool quads = false);
+	/*
+	 * Builds the BVH using the BVH settings (max depth, leaf object count, builder, layout, ...)
+	 * of the given render settings
+	 */
+	BVH(IndexedMesh* mesh, const RenderSettings& settings);
 	~BVH();
 
 	void operator=(BVH&& bvh);
 
+	/*
+	 * Whether or not the two given triangles are the two halves ABC and ACD of a quad ABCD,
+	 * which is how MeshIOUtils::create_triangles() splits the quad faces of a model.
+	 * The vertices are compared exactly and both triangles must have the same material
+	 */
+	static bool is_quad(const Triangle& first, const Triangle& second);
+
+	/*
+	 * Finds the closest intersection of the ray with the triangles of the BVH.
+	 * If hit_info.t isn't -1, only the intersections closer than hit_info.t are considered.
+	 *
+	 * Only t, u, v and the triangle of hit_info (assembled from the mesh) are filled. The attributes of the hit
+	 * (normal, tangent, material) are left to Triangle::compute_hit_attributes() so that
+	 * they are only computed for the intersection that is eventually shaded
+	 */
 	bool intersect(const Ray& ray, HitInfo& hit_info) const;
 
+	/*
+	 * Returns true as soon as any intersection closer than t_max is found.
+	 * The children of the nodes are visited in no particular order. This is
+	 * meant for shadow rays which only need to know if something is in the way
+	 */
+	bool intersect_any(const Ray& ray, float t_max) const;
+
+	/*
+	 * Same as intersect() for a packet of coherent rays (the primary rays of neighboring pixels
+	 * for example) that traverse the hierarchy together. A node is intersected with the 8 rays at once
+	 * and is visited if any of them hits it. When too few rays of the packet remain active in a subtree
+	 * (see PACKET_MIN_ACTIVE_RAYS), these rays finish the subtree one by one.
+	 *
+	 * Each ray finds exactly the same intersection as with intersect().
+	 * Only the SCALAR_BVH_LAYOUT is traversed by packets, the rays are intersected one by one with the other layouts
+	 *
+	 * @param active_mask The i-th ray is only intersected if the i-th bit of the mask is set
+	 * @return Mask whose i-th bit is set if the i-th ray hit a triangle. Only the hit infos of these rays are modified
+	 */
+	int intersect_packet(const Ray rays[PACKET_SIZE], int active_mask, HitInfo hit_infos[PACKET_SIZE]) const;
+
+	/*
+	 * Same as intersect_any() for a packet of coherent rays, the shadow rays of
+	 * neighboring pixels for example. See intersect_packet()
+	 *
+	 * @return Mask whose i-th bit is set if something is in the way of the i-th ray
+	 */
+	int intersect_any_packet(const Ray rays[PACKET_SIZE], const float t_max[PACKET_SIZE], int active_mask) const;
+
+	/*
+	 * Recomputes the bounding volumes of the nodes bottom-up after the vertices of the mesh
+	 * have been modified in place (by a transform for example). The topology of the hierarchy
+	 * is kept as is so this is much cheaper than building the BVH again but the
+	 * hierarchy degrades if the triangles move too much relative to each other.
+	 *
+	 * @return False if the SAH cost of the refitted hierarchy is more than REFIT_MAX_COST_RATIO
+	 * times the cost of the hierarchy when it was built. The BVH should be built again in this case
+	 */
+	bool refit();
+
+	/*
+	 * Selects the algorithm the rays are intersected with the triangles of the leaves with.
+	 * The triangle packs are intersected with AVX2 by the MOLLER_TRUMBORE_KERNEL (default),
+	 * their triangles are intersected one by one by the other kernels.
+	 * The kernel is kept across refits but isn't saved in the BVH cache
+	 */
+	void set_intersection_kernel(RenderSettings::TriangleIntersectionKernel kernel);
+
+	/*
+	 * Expected cost of intersecting a ray with the hierarchy according
+	 * to the surface area heuristic, relative to the area of the root
+	 */
+	float sah_cost() const;
+
+	/*
+	 * Builds a binary hierarchy over primitives given by their bounding volumes by
+	 * recursively splitting them at the median of their centroids. Meant for the small
+	 * hierarchies over the instances or the analytic shapes of the scene, which are
+	 * cheap enough to build again every time a primitive is added or moved.
+	 *
+	 * @param[out] primitive_indices The leaves of the hierarchy index this array,
+	 * the primitives of a leaf are contiguous
+	 */
+	static void build_median_split(const std::vector<BoundingVolume>& volumes, int leaf_max_primitives, std::vector<FlatNode>& nodes, std::vector<int>& primitive_indices);
+
+	/*
+	 * Traverses a hierarchy built by build_median_split(), the closest children first.
+	 * intersect_primitive(int primitive_index, float& closest_t) is called for the primitives of
+	 * the leaves the ray reaches before closest_t and lowers closest_t when it finds a closer
+	 * intersection. closest_t is INFINITY if no intersection is known before the traversal
+	 */
+	template <typename PrimitiveFunction>
+	static void traverse_median_split(const std::vector<FlatNode>& nodes, const std::vector<int>& primitive_indices, const Ray& ray, float& closest_t, PrimitiveFunction&& intersect_primitive);
+	/*
+	 * Same as traverse_median_split() for occlusion queries. The children of the nodes are visited in
+	 * no particular order and the traversal stops as soon as intersect_primitive(int primitive_index) returns true
+	 *
+	 * @return True if intersect_primitive() returned true for a primitive
+	 */
+	template <typename PrimitiveFunction>
+	static bool traverse_any_median_split(const std::vector<FlatNode>& nodes, const std::vector<int>& primitive_indices, const Ray& ray, float t_max, PrimitiveFunction&& intersect_primitive);
+
+	/*
+	 * Walks the hierarchy to compute its statistics. The traversal
+	 * counters are the ones collected since the last reset
+	 */
+	Statistics statistics() const;
+
+	/*
+	 * Clears the traversal counters of all the threads and enables or disables their collection.
+	 * The counters are disabled by default. When disabled, the traversals only pay for one
+	 * branch per ray, the counters of a ray being kept in registers during the traversal
+	 */
+	void reset_traversal_counters(bool enabled);
+	TraversalCounters traversal_counters() const;
+
+	//A refitted hierarchy whose SAH cost grew by more than this
+	//ratio compared to the built hierarchy should be built again
+	static constexpr float REFIT_MAX_COST_RATIO = 1.5f;
+
 private:
-	void build_bvh(int max_depth, int leaf_max_obj_count, Point min, Point max, const BoundingVolume& volume);
+	/*
+	 * Closest intersection found so far during a traversal
+	 */
+	struct ClosestHit
+	{
+		float _t = INFINITY;
+		float _u = 0.0f, _v = 0.0f;
 
-public:
-	OctreeNode* _root;
+		//Index of the triangle in the mesh, -1 if no intersection has been found
+		int _triangle_index = -1;
+
+		TraversalCounters _counters;
+	};
+
+	//Traversal counters of a thread, alone on their cache line so that the threads don't share lines
+	struct alignas(64) ThreadTraversalCounters
+	{
+		TraversalCounters _counters;
+	};
+
+	/*
+	 * Adds the counters of a traversal of ray_count rays to the counters of the calling thread
+	 */
+	void add_traversal_counters(const TraversalCounters& counters, int ray_count = 1) const;
+
+	/*
+	 * Moves the second triangle of each quad of the mesh right after its first triangle.
+	 * That's already the case of the quads of the models loaded by MeshIOUtils::create_indexed_mesh()
+	 * but not of the triangles reordered by a previous build without quads
+	 */
+	void pair_quads();
+	/*
+	 * Primitives of the build triangles in their order in the mesh. The pairs of triangles
+	 * that form a quad are paired and become a single primitive if _quads is set
+	 */
+	std::vector<Primitive> create_primitives();
+	/*
+	 * Reorders the triangles of the mesh and the build triangles the same way,
+	 * see IndexedMesh::reorder_triangles()
+	 */
+	void reorder_triangles(const std::vector<int>& order);
+
+	void build_bvh(int max_depth, int leaf_max_obj_count, Point min, Point max);
+	void build_bvh_sah(int max_depth, int leaf_max_obj_count);
+	void build_bvh_spatial(int max_depth, int leaf_max_obj_count);
+
+	/*
+	 * Leaf of a linear hierarchy whose triangle packs haven't been created yet.
+	 * The primitives of the leaf are a range of the primitives sorted by Morton code
+	 */
+	struct LinearLeaf
+	{
+		int _node_index;
+		int _first_primitive;
+		int _primitive_count;
+	};
+
+	/*
+	 * Builds the hierarchy from the 30-bit Morton codes of the centroids of the primitives.
+	 * The primitives are radix sorted by Morton code and each node is split where the highest
+	 * bit that differs between the codes of its primitives flips. No bounding volume is
+	 * evaluated during the build, they are computed bottom-up once the hierarchy is complete
+	 */
+	void build_bvh_linear(int max_depth, int leaf_max_obj_count);
+	/*
+	 * Creates the subtree of the node at node_index for the range [first, last) of the sorted Morton codes
+	 */
+	void build_linear_node(const std::vector<uint32_t>& morton_codes, int first, int last, int node_index, int current_depth, int max_depth, int leaf_max_obj_count, std::vector<LinearLeaf>& leaves);
+
+	/*
+	 * Compacts the hierarchy whose root is given into the node array, reorders
+	 * the triangles of the mesh so that the triangles of each leaf are contiguous and packs
+	 * the primitives of each leaf by 8 into the triangle (or quad) pack array.
+	 * A primitive referenced by several leaves is only stored once in the mesh,
+	 * the packs of the leaves all use its index
+	 */
+	template <typename NodeType>
+	void flatten(const NodeType* root);
+	/*
+	 * @param order Triangles of the mesh in their new order, see IndexedMesh::reorder_triangles()
+	 * @param reordered_indices Index of each triangle in the new order,
+	 * -1 if the triangle hasn't been reordered yet
+	 */
+	template <typename NodeType>
+	void flatten_node(const NodeType* node, int node_index, std::vector<int>& order, std::vector<int>& reordered_indices);
+
+	/*
+	 * Collapses the flattened hierarchy into a hierarchy of nodes of up to 8 children.
+	 * The children of a wide node are gathered by repeatedly replacing the largest inner
+	 * node gathered so far by its children until the 8 children slots are filled
+	 */
+	template <typename WideNodeType>
+	void collapse(std::vector<WideNodeType>& wide_nodes) const;
+	template <typename WideNodeType>
+	void collapse_node(int node_index, int wide_node_index, std::vector<WideNodeType>& wide_nodes) const;
+
+	/*
+	 * Node of the hierarchy restructured by optimize_treelets(). Unlike the flattened
+	 * hierarchy, the children of a node don't need to be contiguous so that the
+	 * treelets can be restructured in place, in parallel
+	 */
+	struct TreeletNode
+	{
+		BoundingVolume _bounding_volume;
+
+		int _children[MAX_CHILDREN_COUNT];
+		//0 if the node is a leaf
+		int _children_count = 0;
+
+		//Triangle packs of the leaf
+		int _first_pack = 0;
+		int _pack_count = 0;
+
+		//Number of triangle packs in the subtree of the node, to decide which subtrees get their own task
+		int _subtree_pack_count = 0;
+	};
 
-	std::vector<Triangle>* _triangles;
+	/*
+	 * Restructures the treelets of the flattened hierarchy bottom-up to lower its SAH cost.
+	 * A treelet is grown from each inner node by repeatedly opening its largest inner leaf until it
+	 * has TREELET_MAX_LEAVES leaves. The binary topology of the treelet over these leaves with the lowest SAH
+	 * cost is found by dynamic programming over the subsets of leaves and replaces the treelet if it
+	 * is cheaper. The subtrees hanging from the leaves of the treelet are untouched so only the
+	 * inner nodes of the treelet have their bounding volume recomputed.
+	 *
+	 * Empty leaves and inner nodes with a single child are removed along the way. The triangles and
+	 * the triangle packs are not modified, the nodes are laid out again in depth-first order
+	 */
+	void optimize_treelets();
+	/*
+	 * Converts the subtree of the flattened node to treelet nodes.
+	 * @return The index of the treelet node, -1 if the subtree has no triangles
+	 */
+	int create_treelet_node(int node_index, std::vector<TreeletNode>& treelet_nodes) const;
+	/*
+	 * Optimizes the treelets of the subtrees of the children of the node
+	 * and then the treelet of the node itself
+	 */
+	static void optimize_treelet_node(std::vector<TreeletNode>& treelet_nodes, int node_index, int& treelet_node_count, int& restructured_treelets);
+	/*
+	 * @return True if the topology of the treelet was changed
+	 */
+	static bool restructure_treelet(std::vector<TreeletNode>& treelet_nodes, int root_index, int& treelet_node_count);
+	/*
+	 * @return The traversal stack size needed by the subtree of the node
+	 */
+	static int flatten_treelet_node(const std::vector<TreeletNode>& treelet_nodes, int treelet_node_index, int node_index, std::vector<FlatNode>& nodes);
+
+	/*
+	 * Intersects the triangle packs of a leaf and updates the closest
+	 * hit if an intersection closer than the closest hit is found
+	 */
+	void intersect_leaf(int first_pack, int pack_count, const Ray& ray, ClosestHit& closest_hit) const;
+	bool intersect_leaf_any(int first_pack, int pack_count, const Ray& ray, float t_max, TraversalCounters& counters) const;
+	/*
+	 * Same as intersect_leaf() and intersect_leaf_any() with the kernels other than
+	 * Moller-Trumbore, the triangles of the packs are intersected one by one
+	 */
+	void intersect_leaf_kernel(int first_pack, int pack_count, const Ray& ray, ClosestHit& closest_hit) const;
+	bool intersect_leaf_any_kernel(int first_pack, int pack_count, const Ray& ray, float t_max, TraversalCounters& counters) const;
+
+	/*
+	 * @param root_index Index of the node whose subtree is traversed
+	 */
+	void intersect_scalar(const Ray& ray, ClosestHit& closest_hit, int root_index = 0) const;
+	/*
+	 * @param rays The rays of the inactive lanes must be valid rays, they are intersected but their hits are discarded
+	 */
+	void intersect_packet_scalar(const Ray rays[PACKET_SIZE], int active_mask, ClosestHit closest_hits[PACKET_SIZE], TraversalCounters& counters) const;
+	template <typename WideNodeType>
+	void intersect_wide(const std::vector<WideNodeType>& wide_nodes, const Ray& ray, ClosestHit& closest_hit) const;
+
+	/*
+	 * Number of triangles a pack holds, padding included: 8 for a triangle pack, 16 for a quad pack
+	 */
+	int pack_slot_count() const { return _quads ? __m256Quads::TRIANGLES_COUNT : __m256Triangles::TRIANGLES_COUNT; }
+	static_assert(__m256Quads::QUADS_COUNT == __m256Triangles::TRIANGLES_COUNT, "The leaves are packed by 8 primitives whatever the type of their packs");
+	/*
+	 * @param slot Lane of a triangle pack. For a quad pack, 2 * lane for the first triangle of
+	 * the quad of the lane and 2 * lane + 1 for its second triangle
+	 */
+	int pack_triangle_index(int pack_index, int slot) const { return _pack_triangle_indices[pack_index * pack_slot_count() + slot]; }
+	/*
+	 * Number of triangles of a pack, the padding excluded
+	 */
+	int pack_triangle_count(int pack_index) const
+	{
+		int count = 0;
+		for (int slot = 0; slot < pack_slot_count(); slot++)
+			if (pack_triangle_index(pack_index, slot) != -1)
+				count++;
+
+		return count;
+	}
+
+	/*
+	 * Packs again the triangles of the pack_index-th pack from the mesh.
+	 * The indices of the triangles of the pack must already be in _pack_triangle_indices
+	 */
+	void fill_pack(int pack_index);
+	/*
+	 * Allocates the packs of all the triangle indices of _pack_triangle_indices and fills them
+	 */
+	void fill_packs();
+
+	/*
+	 * Bounding volume of the triangles of the triangle packs of a leaf
+	 */
+	BoundingVolume leaf_volume(int first_pack, int pack_count) const;
+
+	void refit_scalar();
+	template <typename WideNodeType>
+	void refit_wide(std::vector<WideNodeType>& wide_nodes);
+
+	float sah_cost_scalar() const;
+	template <typename WideNodeType>
+	float sah_cost_wide(const std::vector<WideNodeType>& wide_nodes) const;
+
+	bool intersect_any_scalar(const Ray& ray, float t_max, TraversalCounters& counters, int root_index = 0) const;
+	int intersect_any_packet_scalar(const Ray rays[PACKET_SIZE], const float t_max[PACKET_SIZE], int active_mask, TraversalCounters& counters) const;
+	template <typename WideNodeType>
+	bool intersect_any_wide(const std::vector<WideNodeType>& wide_nodes, const Ray& ray, float t_max, TraversalCounters& counters) const;
+
+	static void build_median_split_node(const std::vector<BoundingVolume>& volumes, int leaf_max_primitives, int node_index, int first, int count, std::vector<FlatNode>& nodes, std::vector<int>& primitive_indices);
+
+	/*
+	 * Adds the leaves of the subtree of the given node to the statistics
+	 */
+	void statistics_node(int node_index, int depth, Statistics& statistics) const;
+	template <typename WideNodeType>
+	void statistics_wide_node(const std::vector<WideNodeType>& wide_nodes, int node_index, int depth, Statistics& statistics) const;
+	void statistics_leaf(int first_pack, int pack_count, int depth, Statistics& statistics) const;
+
+public:
+	RenderSettings::BVHLayout _layout = RenderSettings::SCALAR_BVH_LAYOUT;
+
+	//Nodes of the hierarchy for the SCALAR_BVH_LAYOUT. Also used as the
+	//intermediate representation the wide hierarchies are collapsed from
+	std::vector<FlatNode> _nodes;
+	//Nodes of the hierarchy for the WIDE_KDOP_BVH_LAYOUT and WIDE_AABB_BVH_LAYOUT
+	std::vector<WideNode<BoundingVolume::PLANES_COUNT>> _wide_kdop_nodes;
+	std::vector<WideNode<3>> _wide_aabb_nodes;
+	//Nodes of the hierarchy for the QUANTIZED_WIDE_KDOP_BVH_LAYOUT and QUANTIZED_WIDE_AABB_BVH_LAYOUT
+	std::vector<QuantizedWideNode<BoundingVolume::PLANES_COUNT>> _quantized_wide_kdop_nodes;
+	std::vector<QuantizedWideNode<3>> _quantized_wide_aabb_nodes;
+
+	//Mesh the hierarchy is built over. Its triangles are reordered when the BVH is built
+	IndexedMesh* _mesh;
+	//Triangles of the mesh assembled once for the builders, in the same order as the
+	//triangles of the mesh. Only kept during the construction of the BVH
+	std::vector<Triangle> _build_triangles;
+	//Triangles of the leaves packed by 8 for the intersection tests. The triangles
+	//of a leaf are padded with empty lanes to a multiple of 8 triangles
+	std::vector<__m256Triangles> _triangle_packs;
+	//Primitives of the leaves packed by 8 if the hierarchy was built with quads, _triangle_packs is empty in this case
+	std::vector<__m256Quads> _quad_packs;
+	//Index in the mesh of the triangle of each lane of each triangle pack (of each triangle of each lane of each quad pack),
+	//-1 for the padding. Kept apart from the packs as they are only read once a triangle has been hit
+	std::vector<int> _pack_triangle_indices;
+
+	//Whether or not the quads are primitives of the hierarchy, see BVH(). The leaves index _quad_packs if so
+	bool _quads = false;
+
+	RenderSettings::TriangleIntersectionKernel _intersection_kernel = RenderSettings::MOLLER_TRUMBORE_KERNEL;
+	//Precomputed transforms of the triangles in the same order as the triangles
+	//of the mesh, only for the BALDWIN_WEBER_KERNEL. Empty with the other kernels
+	std::vector<BaldwinWeberTriangle> _baldwin_weber_triangles;
+
+	//Time it took to build the BVH (or to load it from the cache, see BVHCache) in milliseconds
+	float _build_time = 0.0f;
+	TreeletOptimizationReport _treelet_optimization;
+
+	//SAH cost of the hierarchy right after it was built. Refits are compared against
+	//this cost and not against the previous refit so that the degradation doesn't accumulate unnoticed
+	float _built_sah_cost = 0.0f;
+
+	bool _traversal_counters_enabled = false;
+	//Indexed by the OpenMP thread number. Mutable as the traversals are const
+	mutable std::vector<ThreadTraversalCounters> _thread_traversal_counters;
 };
 
+
+template <typename PrimitiveFunction>
+void BVH::traverse_median_split(const std::vector<FlatNode>& nodes, const std::vector<int>& primitive_indices, const Ray& ray, float& closest_t, PrimitiveFunction&& intersect_primitive)
+{
+	if (nodes.empty())
+		return;
+
+	BoundingVolume::VolumeRay volume_ray(ray);
+
+	float t_near, t_far;
+	if (!nodes[0]._bounding_volume.intersect(volume_ray, t_near, t_far))
+		return;
+
+	StackElement stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, t_near };
+
+	while (stack_size > 0)
+	{
+		StackElement element = stack[--stack_size];
+		if (element._t_near > closest_t)
+			continue;
+
+		const FlatNode& node = nodes[element._node_index];
+		if (node._is_leaf)
+		{
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+				intersect_primitive(primitive_indices[i], closest_t);
+
+			continue;
+		}
+
+		//Pushing the farthest child first so that the closest is visited first
+		StackElement hit_children[2];
+		int hit_count = 0;
+		for (int i = node._first; i < node._first + (int)node._count; i++)
+		{
+			if (!nodes[i]._bounding_volume.intersect(volume_ray, t_near, t_far) || t_near > closest_t || t_far < 0)
+				continue;
+
+			hit_children[hit_count++] = { i, t_near };
+		}
+
+		if (hit_count == 2 && hit_children[0]._t_near < hit_children[1]._t_near)
+			std::swap(hit_children[0], hit_children[1]);
+		for (int i = 0; i < hit_count; i++)
+			stack[stack_size++] = hit_children[i];
+	}
+}
+
+template <typename PrimitiveFunction>
+bool BVH::traverse_any_median_split(const std::vector<FlatNode>& nodes, const std::vector<int>& primitive_indices, const Ray& ray, float t_max, PrimitiveFunction&& intersect_primitive)
+{
+	if (nodes.empty())
+		return false;
+
+	BoundingVolume::VolumeRay volume_ray(ray);
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0)
+	{
+		const FlatNode& node = nodes[stack[--stack_size]];
+
+		float t_near, t_far;
+		if (!node._bounding_volume.intersect(volume_ray, t_near, t_far) || t_near > t_max || t_far < 0)
+			continue;
+
+		if (node._is_leaf)
+		{
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+				if (intersect_primitive(primitive_indices[i]))
+					return true;
+		}
+		else
+			for (int i = node._first; i < node._first + (int)node._count; i++)
+				stack[stack_size++] = i;
+	}
+
+	return false;
+}
+
 #endif
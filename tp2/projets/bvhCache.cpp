@@ -0,0 +1,313 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+
+#include "bvhCache.h"
+#include "timer.h"
+
+//The arrays are copied as raw bytes to and from the cache files
+static_assert(std::is_trivially_copyable<Point>::value, "Vertices must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<vec2>::value, "Texture coordinates must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<BVH::FlatNode>::value, "BVH nodes must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<BVH::WideNode<BVH::BoundingVolume::PLANES_COUNT>>::value, "BVH nodes must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<BVH::WideNode<3>>::value, "BVH nodes must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<BVH::QuantizedWideNode<BVH::BoundingVolume::PLANES_COUNT>>::value, "BVH nodes must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<BVH::QuantizedWideNode<3>>::value, "BVH nodes must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<__m256Triangles>::value, "Triangle packs must be trivially copyable to be cached");
+static_assert(std::is_trivially_copyable<__m256Quads>::value, "Quad packs must be trivially copyable to be cached");
+
+static const char CACHE_FILE_MAGIC[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 'H', 'E' };
+
+struct CacheFileHeader
+{
+    char _magic[8];
+    uint32_t _version;
+
+    //Sizes of the serialized structures. They change with the compiler
+    //or the code and would make the arrays unreadable
+    uint32_t _vertex_size;
+    uint32_t _tex_coords_size;
+    uint32_t _flat_node_size;
+    uint32_t _wide_kdop_node_size;
+    uint32_t _wide_aabb_node_size;
+    //Depend on BVH_QUANTIZED_NODE_BITS too
+    uint32_t _quantized_wide_kdop_node_size;
+    uint32_t _quantized_wide_aabb_node_size;
+    uint32_t _triangle_pack_size;
+    uint32_t _quad_pack_size;
+
+    uint64_t _key;
+
+    uint32_t _layout;
+    uint32_t _quads;
+    float _built_sah_cost;
+
+    //Number of elements and offset in the file of each array
+    uint64_t _counts[12];
+    uint64_t _offsets[12];
+};
+
+enum CacheFileArray { VERTICES_ARRAY, TEX_COORDS_ARRAY, INDICES_ARRAY, MATERIAL_INDICES_ARRAY, FLAT_NODES_ARRAY, WIDE_KDOP_NODES_ARRAY, WIDE_AABB_NODES_ARRAY, QUANTIZED_WIDE_KDOP_NODES_ARRAY, QUANTIZED_WIDE_AABB_NODES_ARRAY, TRIANGLE_PACKS_ARRAY, QUAD_PACKS_ARRAY, PACK_TRIANGLE_INDICES_ARRAY, ARRAYS_COUNT };
+
+static void fill_structure_sizes(CacheFileHeader& header)
+{
+    header._vertex_size = sizeof(Point);
+    header._tex_coords_size = sizeof(vec2);
+    header._flat_node_size = sizeof(BVH::FlatNode);
+    header._wide_kdop_node_size = sizeof(BVH::WideNode<BVH::BoundingVolume::PLANES_COUNT>);
+    header._wide_aabb_node_size = sizeof(BVH::WideNode<3>);
+    header._quantized_wide_kdop_node_size = sizeof(BVH::QuantizedWideNode<BVH::BoundingVolume::PLANES_COUNT>);
+    header._quantized_wide_aabb_node_size = sizeof(BVH::QuantizedWideNode<3>);
+    header._triangle_pack_size = sizeof(__m256Triangles);
+    header._quad_pack_size = sizeof(__m256Quads);
+}
+
+/*
+ * 64 bit FNV-1a hash
+ */
+static void hash_bytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+uint64_t BVHCache::compute_key(const char* obj_filepath, const Transform& transform, int material_offset, const RenderSettings& settings)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    std::ifstream obj_file(obj_filepath, std::ios::binary);
+    char buffer[1 << 16];
+    while (obj_file.read(buffer, sizeof(buffer)) || obj_file.gcount() > 0)
+        hash_bytes(hash, buffer, obj_file.gcount());
+
+    int settings_values[6] = { settings.bvh_max_depth, settings.bvh_leaf_object_count, settings.bvh_builder, settings.bvh_layout, settings.bvh_optimize_treelets, settings.bvh_quads };
+    hash_bytes(hash, transform.m, sizeof(transform.m));
+    hash_bytes(hash, &material_offset, sizeof(material_offset));
+    hash_bytes(hash, settings_values, sizeof(settings_values));
+
+    return hash;
+}
+
+std::string BVHCache::cache_filepath(uint64_t key)
+{
+    std::stringstream ss;
+    ss << CACHE_DIRECTORY << "/" << std::hex << key << ".bvh";
+
+    return ss.str();
+}
+
+bool BVHCache::save(const std::string& filepath, uint64_t key, const BVH& bvh)
+{
+    CacheFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header._magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+    header._version = VERSION;
+    fill_structure_sizes(header);
+    header._key = key;
+    header._layout = bvh._layout;
+    header._quads = bvh._quads;
+    header._built_sah_cost = bvh._built_sah_cost;
+
+    const IndexedMesh& mesh = *bvh._mesh;
+    const void* arrays[ARRAYS_COUNT] = { mesh._vertices.data(), mesh._tex_coords.data(), mesh._indices.data(), mesh._material_indices.data(), bvh._nodes.data(), bvh._wide_kdop_nodes.data(), bvh._wide_aabb_nodes.data(), bvh._quantized_wide_kdop_nodes.data(), bvh._quantized_wide_aabb_nodes.data(), bvh._triangle_packs.data(), bvh._quad_packs.data(), bvh._pack_triangle_indices.data() };
+    header._counts[VERTICES_ARRAY] = mesh._vertices.size();
+    header._counts[TEX_COORDS_ARRAY] = mesh._tex_coords.size();
+    header._counts[INDICES_ARRAY] = mesh._indices.size();
+    header._counts[MATERIAL_INDICES_ARRAY] = mesh._material_indices.size();
+    header._counts[FLAT_NODES_ARRAY] = bvh._nodes.size();
+    header._counts[WIDE_KDOP_NODES_ARRAY] = bvh._wide_kdop_nodes.size();
+    header._counts[WIDE_AABB_NODES_ARRAY] = bvh._wide_aabb_nodes.size();
+    header._counts[QUANTIZED_WIDE_KDOP_NODES_ARRAY] = bvh._quantized_wide_kdop_nodes.size();
+    header._counts[QUANTIZED_WIDE_AABB_NODES_ARRAY] = bvh._quantized_wide_aabb_nodes.size();
+    header._counts[TRIANGLE_PACKS_ARRAY] = bvh._triangle_packs.size();
+    header._counts[QUAD_PACKS_ARRAY] = bvh._quad_packs.size();
+    header._counts[PACK_TRIANGLE_INDICES_ARRAY] = bvh._pack_triangle_indices.size();
+    uint64_t element_sizes[ARRAYS_COUNT] = { header._vertex_size, header._tex_coords_size, sizeof(uint32_t), sizeof(int), header._flat_node_size, header._wide_kdop_node_size, header._wide_aabb_node_size, header._quantized_wide_kdop_node_size, header._quantized_wide_aabb_node_size, header._triangle_pack_size, header._quad_pack_size, sizeof(int) };
+
+    uint64_t offset = sizeof(CacheFileHeader);
+    for (int i = 0; i < ARRAYS_COUNT; i++)
+    {
+        header._offsets[i] = offset;
+        offset += header._counts[i] * element_sizes[i];
+    }
+
+    std::error_code error;
+    std::filesystem::path path(filepath);
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), error);
+
+    //Writing to a temporary file first so that a file being
+    //read is never seen in a partially written state
+    std::string temporary_filepath = filepath + ".tmp";
+    {
+        std::ofstream file(temporary_filepath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int i = 0; i < ARRAYS_COUNT; i++)
+            file.write(static_cast<const char*>(arrays[i]), header._counts[i] * element_sizes[i]);
+
+        if (!file)
+            return false;
+    }
+
+    std::filesystem::rename(temporary_filepath, filepath, error);
+
+    return !error;
+}
+
+/*
+ * Reads an array of the file straight into the given vector
+ *
+ * @param value The value the vector is resized with before being overwritten, for the types that have no default constructor
+ */
+template <typename T>
+static bool read_array(std::ifstream& file, const CacheFileHeader& header, CacheFileArray array, std::vector<T>& out, const T& value = T())
+{
+    out.resize(header._counts[array], value);
+    file.seekg(header._offsets[array]);
+
+    return (bool)file.read(reinterpret_cast<char*>(out.data()), out.size() * sizeof(T));
+}
+
+/*
+ * Whether or not the inner children of the nodes index nodes stored after them (so that a
+ * traversal always ends) and the leaves index packs that exist. Only the children
+ * used by the wide nodes are checked, see has_child()
+ */
+static bool valid_nodes(const std::vector<BVH::FlatNode>& nodes, int pack_count)
+{
+    for (int i = 0; i < (int)nodes.size(); i++)
+    {
+        int end = nodes[i]._is_leaf ? pack_count : (int)nodes.size();
+        if (nodes[i]._first < 0 || nodes[i]._first > end || (int)nodes[i]._count > end - nodes[i]._first || (!nodes[i]._is_leaf && nodes[i]._first <= i))
+            return false;
+    }
+
+    return true;
+}
+
+template <typename WideNodeType>
+static bool valid_nodes(const std::vector<WideNodeType>& nodes, int pack_count)
+{
+    for (int i = 0; i < (int)nodes.size(); i++)
+    {
+        for (int lane = 0; lane < WideNodeType::CHILDREN_COUNT; lane++)
+        {
+            if (!nodes[i].has_child(lane))
+                continue;
+
+            int first = nodes[i]._first[lane];
+            int count = nodes[i]._count[lane];
+            if (nodes[i]._leaf_mask & (1 << lane))
+            {
+                if (first < 0 || count < 0 || first > pack_count || count > pack_count - first)
+                    return false;
+            }
+            else if (first <= i || first >= (int)nodes.size())
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Checks that the indices of the given cached mesh and BVH are all within the bounds of the arrays
+ * they index. A file that was truncated or corrupted after its header was written is rejected
+ * here instead of reading out of the arrays during the traversals
+ */
+static bool valid_cached_bvh(const IndexedMesh& mesh, const BVH& bvh)
+{
+    if (mesh._indices.size() % 3 != 0 || mesh._tex_coords.size() != mesh._vertices.size() || (int)mesh._material_indices.size() != mesh.triangle_count())
+        return false;
+
+    for (uint32_t index : mesh._indices)
+        if (index >= mesh._vertices.size())
+            return false;
+
+    int pack_count = bvh._quads ? (int)bvh._quad_packs.size() : (int)bvh._triangle_packs.size();
+    int slot_count = bvh._quads ? __m256Quads::TRIANGLES_COUNT : __m256Triangles::TRIANGLES_COUNT;
+    if (bvh._pack_triangle_indices.size() != (size_t)pack_count * slot_count)
+        return false;
+
+    for (int triangle_index : bvh._pack_triangle_indices)
+        if (triangle_index < -1 || triangle_index >= mesh.triangle_count())
+            return false;
+
+    return valid_nodes(bvh._nodes, pack_count)
+        && valid_nodes(bvh._wide_kdop_nodes, pack_count) && valid_nodes(bvh._wide_aabb_nodes, pack_count)
+        && valid_nodes(bvh._quantized_wide_kdop_nodes, pack_count) && valid_nodes(bvh._quantized_wide_aabb_nodes, pack_count);
+}
+
+bool BVHCache::load(const std::string& filepath, uint64_t key, IndexedMesh& mesh, BVH& bvh)
+{
+    Timer timer;
+    timer.start();
+
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    uint64_t file_size = file.tellg();
+    file.seekg(0);
+
+    CacheFileHeader header;
+    if (file_size < sizeof(CacheFileHeader) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+
+    CacheFileHeader expected_sizes;
+    fill_structure_sizes(expected_sizes);
+    if (std::memcmp(header._magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC)) != 0 || header._version != VERSION || header._key != key
+        || header._vertex_size != expected_sizes._vertex_size || header._tex_coords_size != expected_sizes._tex_coords_size || header._flat_node_size != expected_sizes._flat_node_size
+        || header._wide_kdop_node_size != expected_sizes._wide_kdop_node_size || header._wide_aabb_node_size != expected_sizes._wide_aabb_node_size
+        || header._quantized_wide_kdop_node_size != expected_sizes._quantized_wide_kdop_node_size || header._quantized_wide_aabb_node_size != expected_sizes._quantized_wide_aabb_node_size
+        || header._triangle_pack_size != expected_sizes._triangle_pack_size || header._quad_pack_size != expected_sizes._quad_pack_size
+        || header._layout >= RenderSettings::BVH_LAYOUT_COUNT)
+        return false;
+
+    uint64_t element_sizes[ARRAYS_COUNT] = { header._vertex_size, header._tex_coords_size, sizeof(uint32_t), sizeof(int), header._flat_node_size, header._wide_kdop_node_size, header._wide_aabb_node_size, header._quantized_wide_kdop_node_size, header._quantized_wide_aabb_node_size, header._triangle_pack_size, header._quad_pack_size, sizeof(int) };
+    for (int i = 0; i < ARRAYS_COUNT; i++)
+        if (header._offsets[i] > file_size || header._counts[i] > (file_size - header._offsets[i]) / element_sizes[i])
+            return false;//Truncated or corrupted file
+
+    //The arrays are read into a new mesh and a new BVH so that the
+    //given mesh and BVH are untouched if a read fails
+    IndexedMesh cached_mesh;
+    BVH cached_bvh;
+    if (!read_array(file, header, VERTICES_ARRAY, cached_mesh._vertices)
+        || !read_array(file, header, TEX_COORDS_ARRAY, cached_mesh._tex_coords)
+        || !read_array(file, header, INDICES_ARRAY, cached_mesh._indices)
+        || !read_array(file, header, MATERIAL_INDICES_ARRAY, cached_mesh._material_indices)
+        || !read_array(file, header, FLAT_NODES_ARRAY, cached_bvh._nodes)
+        || !read_array(file, header, WIDE_KDOP_NODES_ARRAY, cached_bvh._wide_kdop_nodes)
+        || !read_array(file, header, WIDE_AABB_NODES_ARRAY, cached_bvh._wide_aabb_nodes)
+        || !read_array(file, header, QUANTIZED_WIDE_KDOP_NODES_ARRAY, cached_bvh._quantized_wide_kdop_nodes)
+        || !read_array(file, header, QUANTIZED_WIDE_AABB_NODES_ARRAY, cached_bvh._quantized_wide_aabb_nodes)
+        || !read_array(file, header, TRIANGLE_PACKS_ARRAY, cached_bvh._triangle_packs, __m256Triangles(nullptr, 0))
+        || !read_array(file, header, QUAD_PACKS_ARRAY, cached_bvh._quad_packs, __m256Quads(nullptr, 0))
+        || !read_array(file, header, PACK_TRIANGLE_INDICES_ARRAY, cached_bvh._pack_triangle_indices))
+        return false;
+
+    cached_bvh._layout = static_cast<RenderSettings::BVHLayout>(header._layout);
+    cached_bvh._quads = header._quads != 0;
+    cached_bvh._built_sah_cost = header._built_sah_cost;
+    if (!valid_cached_bvh(cached_mesh, cached_bvh))
+        return false;
+
+    mesh = std::move(cached_mesh);
+    cached_bvh._mesh = &mesh;
+
+    timer.stop();
+    cached_bvh._build_time = timer.elapsed();
+    bvh = std::move(cached_bvh);
+
+    return true;
+}
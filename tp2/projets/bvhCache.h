@@ -0,0 +1,59 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "indexedMesh.h"
+#include "mat.h"
+#include "rendererSettings.h"
+
+/*
+ * Saves built BVHs along with the indexed mesh they were built over (whose triangles
+ * were reordered by the build) to binary files so that
+ * the next load of the same model doesn't have to build the BVH again.
+ *
+ * A file is identified by a key computed from everything the BVH depends on. The file
+ * starts with a header (magic, version, key, sizes of the serialized structures) followed
+ * by the raw arrays of the BVH so that loading a file is only a matter of reading
+ * the arrays straight into the vectors of the BVH. A file whose header doesn't match the current
+ * version of the code is simply ignored and overwritten by the next save
+ */
+class BVHCache
+{
+public:
+    //Must be incremented whenever the layout of the serialized structures changes
+    static constexpr uint32_t VERSION = 6;
+
+    //Directory the cache files are stored in, relative to the working directory
+    static constexpr const char* CACHE_DIRECTORY = "bvh_cache";
+
+    /*
+     * Computes the key of the BVH built over the triangles of the given OBJ file.
+     * Any change to the content of the file, the transform, the material offset
+     * of the triangles or the BVH settings gives another key
+     *
+     * @param material_offset See MeshIOUtils::create_triangles()
+     */
+    static uint64_t compute_key(const char* obj_filepath, const Transform& transform, int material_offset, const RenderSettings& settings);
+
+    static std::string cache_filepath(uint64_t key);
+
+    /*
+     * @return False if the file couldn't be written
+     */
+    static bool save(const std::string& filepath, uint64_t key, const BVH& bvh);
+
+    /*
+     * Replaces the given mesh and BVH with the ones saved in the given file.
+     * The BVH uses the given mesh once loaded
+     *
+     * @return False if the file doesn't exist or isn't a valid cache file for this key
+     * and this version of the code. The mesh and the BVH are left untouched in this case
+     */
+    static bool load(const std::string& filepath, uint64_t key, IndexedMesh& mesh, BVH& bvh);
+};
+
+#endif
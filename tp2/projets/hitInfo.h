@@ -1,12 +1,18 @@
 #ifndef HIT_INFO_H
 #define HIT_INFO_H
 
+#include "indexedMesh.h"
+#include "triangle.h"
 #include "vec.h"
 
-class Triangle;
-
 struct HitInfo
 {
+    //Mesh of the triangle that was hit by a BVH, nullptr otherwise. The triangle
+    //is only assembled from the mesh when it is needed, see hit_triangle()
+    const IndexedMesh* mesh = nullptr;
+    //Index of the triangle in its mesh, -1 if the hit isn't on a triangle of a mesh
+    int triangle_index = -1;
+    //Triangle that was intersected on its own (see Triangle::intersect()), nullptr otherwise
     const Triangle* triangle = nullptr;
 
     //Intersection distance to the triangle
@@ -25,6 +31,17 @@ struct HitInfo
     //the u texture coordinate and is orthogonal to the geometry normal
     Vector tangent = Vector(0, 0, 0);
 
+    //False if the hit is on an analytic shape
+    bool is_triangle_hit() const { return mesh != nullptr || triangle != nullptr; }
+    //Triangle that was hit. Only valid if is_triangle_hit()
+    Triangle hit_triangle() const { return triangle != nullptr ? *triangle : mesh->triangle(triangle_index); }
+
+    /*
+     * Interpolates the texture coordinates of the triangle that was hit at the
+     * barycentric coordinates u and v. These are returned as is if the hit isn't on a triangle
+     */
+    void interpolate_tex_coords(float u, float v, float& tex_coord_u, float& tex_coord_v) const;
+
     friend std::ostream& operator <<(std::ostream& os, const HitInfo& infos);
 };
 
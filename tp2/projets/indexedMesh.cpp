@@ -0,0 +1,138 @@
+#include "indexedMesh.h"
+
+#include <cstring>
+#include <unordered_map>
+
+//Position and texture coordinates of a corner of a triangle. Compared
+//bit by bit so that welding the vertices never alters a triangle
+struct WeldKey
+{
+    float _coordinates[5];
+
+    bool operator==(const WeldKey& other) const
+    {
+        return std::memcmp(_coordinates, other._coordinates, sizeof(_coordinates)) == 0;
+    }
+};
+
+struct WeldKeyHash
+{
+    size_t operator()(const WeldKey& key) const
+    {
+        uint64_t hash = 1469598103934665603ull;
+        for (int i = 0; i < 5; i++)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &key._coordinates[i], sizeof(bits));
+
+            hash ^= bits;
+            hash *= 1099511628211ull;
+        }
+
+        return (size_t)hash;
+    }
+};
+
+IndexedMesh::IndexedMesh(const std::vector<Triangle>& triangles)
+{
+    std::unordered_map<WeldKey, uint32_t, WeldKeyHash> vertex_indices;
+    vertex_indices.reserve(triangles.size());
+
+    _indices.reserve(triangles.size() * 3);
+    _material_indices.reserve(triangles.size());
+    for (const Triangle& triangle : triangles)
+    {
+        const Point* corners[3] = { &triangle._a, &triangle._b, &triangle._c };
+        for (int corner = 0; corner < 3; corner++)
+        {
+            const Point& position = *corners[corner];
+            WeldKey key = { { position.x, position.y, position.z, triangle._tex_coords_u(corner), triangle._tex_coords_v(corner) } };
+
+            auto found = vertex_indices.emplace(key, (uint32_t)_vertices.size());
+            if (found.second)
+            {
+                _vertices.push_back(position);
+                _tex_coords.push_back(vec2(key._coordinates[3], key._coordinates[4]));
+            }
+
+            _indices.push_back(found.first->second);
+        }
+
+        _material_indices.push_back(triangle._materialIndex);
+    }
+}
+
+int IndexedMesh::triangle_count() const
+{
+    return (int)_material_indices.size();
+}
+
+Triangle IndexedMesh::triangle(int index) const
+{
+    uint32_t index0 = _indices[index * 3 + 0];
+    uint32_t index1 = _indices[index * 3 + 1];
+    uint32_t index2 = _indices[index * 3 + 2];
+
+    return Triangle(_vertices[index0], _vertices[index1], _vertices[index2], _material_indices[index],
+                    Point(_tex_coords[index0].x, _tex_coords[index1].x, _tex_coords[index2].x),
+                    Point(_tex_coords[index0].y, _tex_coords[index1].y, _tex_coords[index2].y));
+}
+
+Triangle IndexedMesh::triangle_geometry(int index) const
+{
+    return Triangle(_vertices[_indices[index * 3 + 0]], _vertices[_indices[index * 3 + 1]], _vertices[_indices[index * 3 + 2]]);
+}
+
+void IndexedMesh::interpolate_tex_coords(int index, float u, float v, float& tex_coord_u, float& tex_coord_v) const
+{
+    const vec2& a = _tex_coords[_indices[index * 3 + 0]];
+    const vec2& b = _tex_coords[_indices[index * 3 + 1]];
+    const vec2& c = _tex_coords[_indices[index * 3 + 2]];
+
+    //Barycentric coordinates are: P = wA + uB + vC
+    tex_coord_u = (1 - u - v) * a.x + u * b.x + v * c.x;
+    tex_coord_v = (1 - u - v) * a.y + u * b.y + v * c.y;
+}
+
+std::vector<Triangle> IndexedMesh::triangles() const
+{
+    std::vector<Triangle> triangles(triangle_count());
+
+#pragma omp parallel for
+    for (int i = 0; i < triangle_count(); i++)
+        triangles[i] = triangle(i);
+
+    return triangles;
+}
+
+void IndexedMesh::reorder_triangles(const std::vector<int>& order)
+{
+    std::vector<uint32_t> reordered_indices(order.size() * 3);
+    std::vector<int> reordered_material_indices(order.size());
+
+#pragma omp parallel for
+    for (int i = 0; i < (int)order.size(); i++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+            reordered_indices[i * 3 + corner] = _indices[order[i] * 3 + corner];
+        reordered_material_indices[i] = _material_indices[order[i]];
+    }
+
+    _indices = std::move(reordered_indices);
+    _material_indices = std::move(reordered_material_indices);
+}
+
+void IndexedMesh::transform(const Transform& transform)
+{
+#pragma omp parallel for
+    for (int i = 0; i < (int)_vertices.size(); i++)
+        _vertices[i] = transform(_vertices[i]);
+}
+
+size_t IndexedMesh::memory_footprint() const
+{
+    return _vertices.size() * sizeof(Point)
+         + _tex_coords.size() * sizeof(vec2)
+         + _indices.size() * sizeof(uint32_t)
+         + _material_indices.size() * sizeof(int);
+}
@@ -0,0 +1,78 @@
+#ifndef INDEXED_MESH_H
+#define INDEXED_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "mat.h"
+#include "triangle.h"
+#include "vec.h"
+
+/*
+ * Triangle mesh stored as one buffer of unique vertices and
+ * a triple of 32-bit indices into that buffer per triangle.
+ * Vertices shared by several triangles (almost all of them in a
+ * closed mesh) are only stored and transformed once
+ */
+struct IndexedMesh
+{
+    IndexedMesh() {}
+
+    /*
+     * Welds the vertices of the given triangles: two corners with the exact
+     * same position and texture coordinates become the same vertex.
+     * The i-th triangle of the mesh is the i-th triangle given
+     */
+    IndexedMesh(const std::vector<Triangle>& triangles);
+
+    int triangle_count() const;
+
+    /*
+     * Assembles the index-th triangle of the mesh from its vertices.
+     * The normal of the triangle is computed on the fly
+     */
+    Triangle triangle(int index) const;
+    /*
+     * Same as triangle() without the material and the texture coordinates,
+     * enough for the intersection kernels
+     */
+    Triangle triangle_geometry(int index) const;
+    std::vector<Triangle> triangles() const;
+
+    /*
+     * Same as Triangle::interpolate_texcoords() for the index-th triangle
+     */
+    void interpolate_tex_coords(int index, float u, float v, float& tex_coord_u, float& tex_coord_v) const;
+
+    /*
+     * Position of the given corner (0, 1 or 2) of the index-th triangle
+     */
+    const Point& vertex(int triangle_index, int corner) const { return _vertices[_indices[triangle_index * 3 + corner]]; }
+
+    /*
+     * Reorders the triangles of the mesh, the i-th triangle becomes the order[i]-th
+     * triangle of the mesh before the call. The vertices are untouched
+     */
+    void reorder_triangles(const std::vector<int>& order);
+
+    /*
+     * Transforms each vertex of the mesh, only once, with the given transform
+     */
+    void transform(const Transform& transform);
+
+    /*
+     * Returns the size in bytes of the buffers of the mesh
+     */
+    size_t memory_footprint() const;
+
+    std::vector<Point> _vertices;
+    //Texture coordinates of each vertex. (-1, -1) if the mesh has no
+    //texture coordinates
+    std::vector<vec2> _tex_coords;
+
+    //3 indices per triangle into _vertices
+    std::vector<uint32_t> _indices;
+    std::vector<int> _material_indices;
+};
+
+#endif
@@ -6,6 +6,7 @@
 class Ray
 {
 public:
+    Ray() {}
     Ray(Point origin, Vector direction);
 
     friend std::ostream& operator << (std::ostream& os, const Ray& ray);
@@ -1,9 +1,12 @@
+#include "bvhCache.h"
 #include "imageUtils.h"
 #include "m256Point.h"
 #include "m256Vector.h"
 #include "m256Utils.h"
 #include "mat.h"
 #include "renderer.h"
+#include "tileScheduler.h"
+#include "triangleIntersection.h"
 #include "xorshift.h"
 
 #include <cmath>
@@ -79,11 +82,12 @@ Material Renderer::get_random_diffuse_pastel_material()
 
 Renderer::Renderer() : Renderer(Scene(), std::vector<Triangle>(), RenderSettings()) { }
 
-Renderer::Renderer(Scene scene, std::vector<Triangle> triangles, RenderSettings render_settings) : _triangles(triangles),
+Renderer::Renderer(Scene scene, std::vector<Triangle> triangles, RenderSettings render_settings) : _mesh(triangles),
     _render_settings(render_settings), _scene(scene)
 {
     if (render_settings.enable_bvh)
-        _bvh = BVH(&triangles, render_settings.bvh_max_depth);
+        _bvh = BVH(&_mesh, render_settings);
+    update_brute_force_transforms();
 
     //Accounting for the SSAA scaling
     int render_width, render_height;
@@ -134,16 +138,61 @@ void Renderer::init_buffers(int width, int height)
             _image.setPixel(j, i, ImageUtils::gkit_color_to_Qt_ARGB32_uint(Renderer::BACKGROUND_COLOR));
 }
 
-void Renderer::set_triangles(const std::vector<Triangle>& triangles)
+void Renderer::set_mesh(const IndexedMesh& mesh)
+{
+    set_mesh(mesh, _render_settings);
+}
 
+void Renderer::set_mesh(const IndexedMesh& mesh, const RenderSettings& bvh_settings)
 {
-    _triangles = triangles;
+    _mesh = mesh;
+    _bvh_interactive = false;
 
     if (_render_settings.enable_bvh)
-        _bvh = BVH(&_triangles, _render_settings.bvh_max_depth, _render_settings.bvh_leaf_object_count);
+    {
+        _bvh = BVH(&_mesh, bvh_settings);
+        _bvh.set_intersection_kernel(_render_settings.triangle_intersection_kernel);
+        _bvh_interactive = is_interactive_build(bvh_settings);
+    }
+    else
+        _bvh = BVH();
+
+    update_brute_force_transforms();
+}
+
+void Renderer::set_triangles(const std::vector<Triangle>& triangles)
+{
+    set_mesh(IndexedMesh(triangles));
+}
+
+void Renderer::set_triangles(const std::vector<Triangle>& triangles, const RenderSettings& bvh_settings)
+{
+    set_mesh(IndexedMesh(triangles), bvh_settings);
+}
+
+bool Renderer::load_bvh_from_cache(uint64_t cache_key)
+{
+    return load_bvh_from_cache(cache_key, _render_settings);
+}
+
+bool Renderer::load_bvh_from_cache(uint64_t cache_key, const RenderSettings& bvh_settings)
+{
+    if (!BVHCache::load(BVHCache::cache_filepath(cache_key), cache_key, _mesh, _bvh))
+        return false;
+
+    _bvh_interactive = is_interactive_build(bvh_settings);
+
+    _bvh.set_intersection_kernel(_render_settings.triangle_intersection_kernel);
+    update_brute_force_transforms();
+    return true;
 }
 
-void Renderer::add_analytic_shape(const AnalyticShapesTypes& shape) {  _analytic_shapes.push_back(shape); }
+bool Renderer::save_bvh_to_cache(uint64_t cache_key) const { return BVHCache::save(BVHCache::cache_filepath(cache_key), cache_key, _bvh); }
+
+void Renderer::add_analytic_shape(const AnalyticShapesTypes& shape) { _analytic_shapes.add_shape(shape); }
+
+int Renderer::add_mesh_instance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world) { return _top_level_bvh.add_instance(mesh, object_to_world); }
+void Renderer::set_instance_transform(int instance_index, const Transform& object_to_world) { _top_level_bvh.set_instance_transform(instance_index, object_to_world); }
 
 Materials& Renderer::get_materials() { return _materials; }
 
@@ -181,8 +230,9 @@ void Renderer::clear_image()
 
 void Renderer::clear_geometry()
 {
-    set_triangles(std::vector<Triangle>());
-    _analytic_shapes = std::vector<AnalyticShapesTypes>();
+    set_mesh(IndexedMesh());
+    _analytic_shapes.clear();
+    _top_level_bvh.clear();
 }
 
 void Renderer::change_camera_fov(float fov) { _scene._camera.set_fov(fov); }
@@ -211,16 +261,35 @@ Color Renderer::sample_texture(const Image& texture, float tex_coord_u, float te
 
 void Renderer::reset_previous_transform() { _previous_object_transform = Identity(); }
 
-void Renderer::set_object_transform(const Transform& object_transform)
+bool Renderer::set_object_transform(const Transform& object_transform)
 {
     _previous_object_transform = _previous_object_transform.inverse();
     Transform transform = object_transform(_previous_object_transform);
 
-    for (Triangle& triangle : _triangles)
-        triangle = transform(triangle);
-    _bvh = BVH(&_triangles, _render_settings.bvh_max_depth, _render_settings.bvh_leaf_object_count);
+    //Each shared vertex is only transformed once. The triangles
+    //assembled from the transformed vertices are transformed too
+    _mesh.transform(transform);
+
+    //The vertices are transformed in place so the hierarchy only has to be refitted.
+    //It is built again if the transform degraded it too much (non uniform scaling for example)
+    bool bvh_rebuilt = false;
+    if (_render_settings.enable_bvh && !_bvh.refit())
+    {
+        //The treelets are not optimized to keep the rebuild latency low. The
+        //BVH is built again with the render settings before the next final render
+        RenderSettings rebuild_settings = _render_settings;
+        rebuild_settings.bvh_builder = _render_settings.bvh_interactive_builder;
+        rebuild_settings.bvh_optimize_treelets = false;
+
+        _bvh = BVH(&_mesh, rebuild_settings);
+        _bvh_interactive = is_interactive_build(rebuild_settings);
+        bvh_rebuilt = true;
+    }
+    update_brute_force_transforms();
 
     _previous_object_transform = object_transform;
+
+    return bvh_rebuilt;
 }
 
 void Renderer::set_camera_transform(const Transform& camera_transform)
@@ -242,10 +311,50 @@ void Renderer::apply_transformation_to_camera(const Transform& additional_transf
 
 void Renderer::reconstruct_bvh_new()
 {
-    _bvh = BVH(&_triangles, _render_settings.bvh_max_depth, _render_settings.bvh_leaf_object_count);
+    _bvh = BVH(&_mesh, _render_settings);
+    _bvh_interactive = false;
+    update_brute_force_transforms();
+}
+
+bool Renderer::is_bvh_interactive() const { return _bvh_interactive; }
+
+bool Renderer::is_interactive_build(const RenderSettings& bvh_settings) const
+{
+    return bvh_settings.bvh_builder != _render_settings.bvh_builder || bvh_settings.bvh_optimize_treelets != _render_settings.bvh_optimize_treelets;
 }
 
-void Renderer::destroy_bvh() { _bvh = BVH();/* Empty BVH basically destroying the previous one */ }
+const BVH& Renderer::get_bvh() const { return _bvh; }
+
+void Renderer::set_triangle_intersection_kernel(RenderSettings::TriangleIntersectionKernel kernel)
+{
+    _render_settings.triangle_intersection_kernel = kernel;
+    _bvh.set_intersection_kernel(kernel);
+    update_brute_force_transforms();
+}
+
+void Renderer::destroy_bvh()
+{
+    _bvh = BVH();/* Empty BVH basically destroying the previous one */
+    _bvh_interactive = false;
+    update_brute_force_transforms();
+}
+
+void Renderer::update_brute_force_transforms()
+{
+    _brute_force_transforms.clear();
+    if (_bvh._mesh != nullptr || !TriangleIntersection::kernel(_render_settings.triangle_intersection_kernel)._needs_transforms)
+        return;
+
+    _brute_force_transforms.resize(_mesh.triangle_count());
+#pragma omp parallel for
+    for (int i = 0; i < _mesh.triangle_count(); i++)
+        _brute_force_transforms[i] = BaldwinWeberTriangle(_mesh.triangle_geometry(i));
+}
+
+const BaldwinWeberTriangle* Renderer::brute_force_transform(int triangle_index) const
+{
+    return _brute_force_transforms.empty() ? nullptr : &_brute_force_transforms[triangle_index];
+}
 
 void Renderer::change_render_size(int width, int height)
 {
@@ -301,7 +410,7 @@ Color Renderer::compute_reflection(const Ray& ray, const Point& inter_point, con
         if (_render_settings.enable_roughness_mapping)
         {
             float tex_coord_u, tex_coord_v;
-            get_tex_coords(hit_info.triangle, hit_info.u, hit_info.v, tex_coord_u, tex_coord_v);
+            get_tex_coords(hit_info, hit_info.u, hit_info.v, tex_coord_u, tex_coord_v);
 
             roughness = sample_texture(_roughness_map, tex_coord_u, tex_coord_v).r;
         }
@@ -337,68 +446,93 @@ Color Renderer::compute_reflection(const Ray& ray, const Point& inter_point, con
     return total_reflection_color / Color(sample_count) * Color(hit_material.reflection);
 }
 
+Ray Renderer::shadow_ray(const Point& inter_point, const Vector& normal_at_intersection, const Point& light_position, float& t_max) const
+{
+    Ray ray(inter_point + normal_at_intersection * Renderer::EPSILON, normalize(light_position - inter_point));
+    //Only the objects between the point and the light can shadow the point.
+    //Any of them is enough, we don't need to find the closest one
+    t_max = length(light_position - ray._origin);
+
+    return ray;
+}
+
 bool Renderer::is_shadowed(const Point& inter_point, const Vector& normal_at_intersection, const Point& light_position) const
 {
-    if (_render_settings.compute_shadows)
-    {
-        Ray ray(inter_point + normal_at_intersection * Renderer::EPSILON, normalize(light_position - inter_point));
-        HitInfo hitInfo;
+    if (!_render_settings.compute_shadows)
+        return false;
 
-        if (_render_settings.enable_bvh)
-        {
-            if (_bvh.intersect(ray, hitInfo))
-            {
-                Point new_inter_point = ray._origin + ray._direction * hitInfo.t;
+    float t_max;
+    Ray ray = shadow_ray(inter_point, normal_at_intersection, light_position, t_max);
 
-                //If we found an object that is between the light and the current inter_point: the point is shadowed
-                if (length2(Point(inter_point) - Point(new_inter_point)) < length2(Point(inter_point) - Point(light_position)))
-                    return true;
-            }
-        }
-        else
+    if (_render_settings.enable_bvh)
+    {
+        if (_bvh.intersect_any(ray, t_max))
+            return true;
+    }
+    else
+    {
+        for (int i = 0; i < _mesh.triangle_count(); i++)
         {
-            for (const Triangle& triangle : _triangles)
-            {
-                if (triangle.intersect(ray, hitInfo))
-                {
-                    Point new_inter_point = ray._origin + ray._direction * hitInfo.t;
+            float t, u, v;
+            if (TriangleIntersection::intersect(_render_settings.triangle_intersection_kernel, _mesh.triangle_geometry(i), brute_force_transform(i), ray, t, u, v) && t < t_max)
+                return true;
+        }
+    }
 
-                    if (length2(Point(inter_point) - Point(new_inter_point)) < length2(Point(inter_point) - Point(light_position)))
-                    {
-                        //We found an object that is between the light and the current inter_point: the point is shadowed
+    if (_top_level_bvh.intersect_any(ray, t_max))
+        return true;
 
-                        return true;
-                    }
-                }
-            }
-        }
+    if (_analytic_shapes.intersect_any(ray, t_max))
+        return true;
 
-        for (AnalyticShapesTypes analytic_shape : _analytic_shapes)
+    //We haven't found any object between the light source and the intersection point, the point isn't shadowed
+    return false;
+}
+
+int Renderer::is_shadowed_packet(const Point inter_points[BVH::PACKET_SIZE], const Vector normals_at_intersection[BVH::PACKET_SIZE], const Point& light_position, int points_mask) const
+{
+    if (!_render_settings.compute_shadows || points_mask == 0)
+        return 0;
+
+    Ray rays[BVH::PACKET_SIZE];
+    float t_max[BVH::PACKET_SIZE];
+    for (int i = 0; i < BVH::PACKET_SIZE; i++)
+        if (points_mask & (1 << i))
+            rays[i] = shadow_ray(inter_points[i], normals_at_intersection[i], light_position, t_max[i]);
+
+    int shadowed_mask = 0;
+    if (_render_settings.enable_bvh)
+        shadowed_mask = _bvh.intersect_any_packet(rays, t_max, points_mask);
+    else
+    {
+        for (int i = 0; i < BVH::PACKET_SIZE; i++)
         {
-            bool inter_found = false;
+            if (!(points_mask & (1 << i)))
+                continue;
 
-            std::visit([&] (auto& shape)
+            for (int triangle_index = 0; triangle_index < _mesh.triangle_count(); triangle_index++)
             {
-                if (shape.intersect(ray, hitInfo))
+                float t, u, v;
+                if (TriangleIntersection::intersect(_render_settings.triangle_intersection_kernel, _mesh.triangle_geometry(triangle_index), brute_force_transform(triangle_index), rays[i], t, u, v) && t < t_max[i])
                 {
-                    Point new_inter_point = ray._origin + ray._direction * hitInfo.t;
-
-                    if (length2(Point(inter_point) - Point(new_inter_point)) < length2(Point(inter_point) - Point(light_position)))
-                    {
-                        //We found an object that is between the light and the current inter_point: the point is shadowed
-
-                        inter_found = true;
-                    }
+                    shadowed_mask |= 1 << i;
+                    break;
                 }
-            }, analytic_shape);
-
-            if (inter_found)
-                return true;
+            }
         }
+    }
 
-    }	//We haven't found any object between the light source and the intersection point, the point isn't shadowed
+    //The instances and the analytic shapes are only tested by the rays not shadowed by the triangles
+    for (int i = 0; i < BVH::PACKET_SIZE; i++)
+    {
+        if (!(points_mask & (1 << i)) || (shadowed_mask & (1 << i)))
+            continue;
 
-    return false;
+        if (_top_level_bvh.intersect_any(rays[i], t_max[i]) || _analytic_shapes.intersect_any(rays[i], t_max[i]))
+            shadowed_mask |= 1 << i;
+    }
+
+    return shadowed_mask;
 }
 
 Color Renderer::shade_abs_normals(const Vector& normalized_normal) const
@@ -416,7 +550,7 @@ Color Renderer::shade_barycentric_coordinates(float u, float v) const
     return Color(1, 0, 0) * u + Color(0, 1.0, 0) * v + Color(0, 0, 1) * (1 - u - v);
 }
 
-Color Renderer::shade_visualize_ao(const Triangle& triangle, float u, float v) const
+Color Renderer::shade_visualize_ao(const HitInfo& hit_info, float u, float v) const
 {
     Color color;
 
@@ -425,7 +559,7 @@ Color Renderer::shade_visualize_ao(const Triangle& triangle, float u, float v) c
     if (_render_settings.enable_ao_mapping)
     {
         float tex_coord_u, tex_coord_v;
-        triangle.interpolate_texcoords(u, v, tex_coord_u, tex_coord_v);
+        get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
         color = color * Color(sample_texture(_ao_map, tex_coord_u, tex_coord_v).r);
     }
@@ -433,21 +567,15 @@ Color Renderer::shade_visualize_ao(const Triangle& triangle, float u, float v) c
     return color;
 }
 
-void Renderer::get_tex_coords(const Triangle* triangle, float u, float v, float& tex_coord_u, float& tex_coord_v) const
+void Renderer::get_tex_coords(const HitInfo& hit_info, float u, float v, float& tex_coord_u, float& tex_coord_v) const
 {
-    if (triangle != nullptr)
-        triangle->interpolate_texcoords(u, v, tex_coord_u, tex_coord_v);
-    else
-    {
-        tex_coord_u = u;
-        tex_coord_v = v;
-    }
+    hit_info.interpolate_tex_coords(u, v, tex_coord_u, tex_coord_v);
 }
 
 float Renderer::ao_mapping(const HitInfo& hit_info, float u, float v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(hit_info.triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     return sample_texture(_ao_map, tex_coord_u, tex_coord_v).r;
 }
@@ -455,7 +583,7 @@ float Renderer::ao_mapping(const HitInfo& hit_info, float u, float v) const
 Color Renderer::diffuse_mapping(const HitInfo& hit_info, float u, float v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(hit_info.triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     return sample_texture(_diffuse_map, tex_coord_u, tex_coord_v);
 }
@@ -464,7 +592,7 @@ Color Renderer::diffuse_mapping(const HitInfo& hit_info, float u, float v) const
 Vector Renderer::normal_mapping(const HitInfo& hit_info, float u, float v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(hit_info.triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     Vector tangent = hit_info.tangent;
     Vector bitangent = cross(tangent, hit_info.normal_at_intersection);
@@ -477,10 +605,10 @@ Vector Renderer::normal_mapping(const HitInfo& hit_info, float u, float v) const
     return normalize(perturbed_normal);
 }
 
-void Renderer::parallax_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
+void Renderer::parallax_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     float inter_point_depth = sample_texture(_displacement_map, tex_coord_u, tex_coord_v).r;
 
@@ -488,10 +616,10 @@ void Renderer::parallax_mapping(const Triangle* triangle, float u, float v, cons
     new_v = v - view_dir.y * inter_point_depth * _render_settings.displacement_mapping_strength;
 }
 
-void Renderer::steep_parallax_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
+void Renderer::steep_parallax_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     float current_depth;
     float depth_step = 1.0f / _render_settings.parallax_mapping_steps;
@@ -515,10 +643,10 @@ void Renderer::steep_parallax_mapping(const Triangle* triangle, float u, float v
     }
 }
 
-void Renderer::parallax_occlusion_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
+void Renderer::parallax_occlusion_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const
 {
     float tex_coord_u, tex_coord_v;
-    get_tex_coords(triangle, u, v, tex_coord_u, tex_coord_v);
+    get_tex_coords(hit_info, u, v, tex_coord_u, tex_coord_v);
 
     float current_depth;
     float depth_step = 1.0f / _render_settings.parallax_mapping_steps;
@@ -553,24 +681,44 @@ void Renderer::parallax_occlusion_mapping(const Triangle* triangle, float u, flo
     new_v = (1 - interpolation_weight) * new_v + interpolation_weight * previous_v_coord;
 }
 
+void Renderer::prepare_shading(const Ray& ray, HitInfo& hit_info, float& u, float& v) const
+{
+    //UV coordinates
+    u = hit_info.u;
+    v = hit_info.v;
+
+    if (_render_settings.shading_method != RenderSettings::ShadingMethod::RT_SHADING)
+        return;
+
+    Point inter_point = ray._origin + ray._direction * hit_info.t;
+    if (_render_settings.enable_displacement_mapping)
+        parallax_occlusion_mapping(hit_info, hit_info.u, hit_info.v, inter_point, normalize(_scene._camera._position - inter_point), u, v);
+
+    if (_render_settings.enable_normal_mapping)
+        hit_info.normal_at_intersection = normal_mapping(hit_info, u, v);
+}
+
 Color Renderer::shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, int current_recursion_depth) const
+{
+    float u, v;
+    prepare_shading(ray, hit_info, u, v);
+
+    bool shadowed = false;
+    if (_render_settings.shading_method == RenderSettings::ShadingMethod::RT_SHADING)
+        shadowed = is_shadowed(ray._origin + ray._direction * hit_info.t, hit_info.normal_at_intersection, _scene._point_light._position);
+
+    return shade_ray_inter_point(ray, hit_info, u, v, shadowed, current_recursion_depth);
+}
+
+Color Renderer::shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, float u, float v, bool shadowed, int current_recursion_depth) const
 {
     Color final_color = Color(0.0f, 0.0f, 0.0f);
 
     if (_render_settings.shading_method == RenderSettings::ShadingMethod::RT_SHADING)
     {
-        //UV coordinates
-        float u = hit_info.u, v = hit_info.v;
-
         Point inter_point = ray._origin + ray._direction * hit_info.t;
-        if (_render_settings.enable_displacement_mapping)
-            parallax_occlusion_mapping(hit_info.triangle, hit_info.u, hit_info.v, inter_point, normalize(_scene._camera._position - inter_point), u, v);
-
         Vector direction_to_light = normalize(_scene._point_light._position - inter_point);
 
-        if (_render_settings.enable_normal_mapping)
-            hit_info.normal_at_intersection = normal_mapping(hit_info, u, v);
-
         Material hit_material = _materials(hit_info.mat_index);
 
         float ao_map_contribution = 1.0f;
@@ -588,7 +736,7 @@ Color Renderer::shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, int cur
 
         final_color = final_color + diffuse_color * ao_map_contribution * _render_settings.enable_diffuse;
         final_color = final_color + compute_specular(hit_material, ray._direction, hit_info.normal_at_intersection, direction_to_light) * _render_settings.enable_specular;
-        if (is_shadowed(inter_point, hit_info.normal_at_intersection, _scene._point_light._position))
+        if (shadowed)
             final_color = final_color * Color(Renderer::SHADOW_INTENSITY);
         final_color = final_color + hit_material.emission * _render_settings.enable_emissive;
         if (hit_material.reflection > 0.0f)
@@ -606,7 +754,7 @@ Color Renderer::shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, int cur
         //Color triangles with barycentric coordinates
         final_color = shade_barycentric_coordinates(hit_info.u, hit_info.v);
     else if (_render_settings.shading_method == RenderSettings::ShadingMethod::VISUALIZE_AO)
-        final_color = shade_visualize_ao(*hit_info.triangle, hit_info.u, hit_info.v);
+        final_color = shade_visualize_ao(hit_info, hit_info.u, hit_info.v);
 
 
     final_color.r = std::clamp(final_color.r, 0.0f, 1.0f);
@@ -868,6 +1016,8 @@ float Renderer::matrix_transform_z(const Transform& m, const Point& vertex)
 
 void Renderer::raster_trace()
 {
+    _bvh.reset_traversal_counters(_render_settings.enable_bvh_statistics);
+
     Transform perspective_projection = _scene._camera._perspective_proj_mat;
     Transform perspective_projection_inv = _scene._camera._perspective_proj_mat_inv;
 
@@ -877,64 +1027,168 @@ void Renderer::raster_trace()
     const float render_height_scaling = 1.0f / render_height * 2;
     const float render_width_scaling = 1.0f / render_width * 2;
 
+    //The vertices shared by several triangles are only projected once
+    std::vector<vec4> clip_space_vertices(_mesh._vertices.size());
+#pragma omp parallel for
+    for (int i = 0; i < (int)_mesh._vertices.size(); i++)
+        clip_space_vertices[i] = perspective_projection(vec4(_scene._camera._world_to_camera_mat(_mesh._vertices[i])));
+
+    //A clipped triangle projected on the image plane, ready to be rasterized
+    struct RasterTriangle
+    {
+        //Clipped triangle in NDC space
+        Triangle _ndc;
+        float _inv_area;
+
+        //Depth of the vertices of the clipped triangle in world space
+        float _a_z, _b_z, _c_z;
+
+        //Bounding box of the triangle in pixels
+        int _min_x, _min_y, _max_x, _max_y;
+
+        //Normal of the triangle before it was clipped, in world space
+        Vector _normal;
+    };
+
+    //The triangles are binned in the tiles they overlap and the tiles are then rasterized and shaded
+    //independently of each other: the pixels of the z-buffer are only ever written by one thread.
+    //The triangles are clipped in order by the threads (static schedule) and the triangles of a tile are
+    //sorted by thread so they stay in their original order and the depth ties are always resolved the same way
+    TileScheduler scheduler(render_width, render_height, _render_settings);
+    int thread_count = omp_get_max_threads();
+    int tile_count = scheduler.tile_count();
+    std::vector<std::vector<RasterTriangle>> thread_triangles(thread_count);
+    //Number of triangles of each thread in each tile, then the position
+    //of the next triangle of the thread in the tile in tile_triangles
+    std::vector<std::vector<int>> thread_tile_offsets(thread_count, std::vector<int>(tile_count, 0));
+    //The triangles of the tile i are tile_triangles[tile_first_triangles[i]] to tile_triangles[tile_first_triangles[i + 1] - 1]
+    std::vector<int> tile_first_triangles(tile_count + 1);
+    std::vector<const RasterTriangle*> tile_triangles;
+
+    //Calls function(tile_index) for every tile overlapped by the given triangle
+    auto for_each_overlapped_tile = [&](const RasterTriangle& raster_triangle, auto&& function) {
+        int tile_size = scheduler.tile_size();
+        for (int tile_y = raster_triangle._min_y / tile_size; tile_y <= raster_triangle._max_y / tile_size; tile_y++)
+            for (int tile_x = raster_triangle._min_x / tile_size; tile_x <= raster_triangle._max_x / tile_size; tile_x++)
+                function(tile_y * scheduler.tile_count_x() + tile_x);
+    };
+
     std::array<Triangle4, 12> to_clip_triangles;
     std::array<Triangle4, 12> clipped_triangles;
 
-#pragma omp parallel for schedule(dynamic) private(to_clip_triangles, clipped_triangles)
-    for (int triangle_index = 0; triangle_index < _triangles.size(); triangle_index++)
+#pragma omp parallel private(to_clip_triangles, clipped_triangles)
     {
-        Triangle& original_triangle = _triangles[triangle_index];//World space
-        Triangle transformed_triangle = _scene._camera._world_to_camera_mat(original_triangle);
+        std::vector<RasterTriangle>& raster_triangles = thread_triangles[omp_get_thread_num()];
+        std::vector<int>& tile_offsets = thread_tile_offsets[omp_get_thread_num()];
+        //Most triangles aren't clipped
+        raster_triangles.reserve(_mesh.triangle_count() / omp_get_num_threads() + 1);
+
+#pragma omp for schedule(static)
+        for (int triangle_index = 0; triangle_index < _mesh.triangle_count(); triangle_index++)
+        {
+            Triangle original_triangle = _mesh.triangle(triangle_index);//World space
 
-        vec4 a_clip_space = perspective_projection(vec4(transformed_triangle._a));
-        vec4 b_clip_space = perspective_projection(vec4(transformed_triangle._b));
-        vec4 c_clip_space = perspective_projection(vec4(transformed_triangle._c));
+            vec4 a_clip_space = clip_space_vertices[_mesh._indices[triangle_index * 3 + 0]];
+            vec4 b_clip_space = clip_space_vertices[_mesh._indices[triangle_index * 3 + 1]];
+            vec4 c_clip_space = clip_space_vertices[_mesh._indices[triangle_index * 3 + 2]];
 
-        to_clip_triangles[0] = Triangle4(a_clip_space, b_clip_space, c_clip_space, transformed_triangle._tex_coords_u, transformed_triangle._tex_coords_v);
-        int nb_clipped = clip_triangle(to_clip_triangles, clipped_triangles);
+            to_clip_triangles[0] = Triangle4(a_clip_space, b_clip_space, c_clip_space, original_triangle._tex_coords_u, original_triangle._tex_coords_v);
+            int nb_clipped = clip_triangle(to_clip_triangles, clipped_triangles);
 
-        for (int clipped_triangle_index = 0; clipped_triangle_index < nb_clipped; clipped_triangle_index++)
+            for (int clipped_triangle_index = 0; clipped_triangle_index < nb_clipped; clipped_triangle_index++)
+            {
+                Triangle4 clipped_triangle = clipped_triangles[clipped_triangle_index];
+
+                RasterTriangle raster_triangle;
+                raster_triangle._ndc = Triangle(clipped_triangle, original_triangle._materialIndex, clipped_triangle._tex_coords_u, clipped_triangle._tex_coords_v);
+                raster_triangle._normal = original_triangle._normal;
+
+                Point a_image_plane = raster_triangle._ndc._a;
+                Point b_image_plane = raster_triangle._ndc._b;
+                Point c_image_plane = raster_triangle._ndc._c;
+
+                //We don't care about the z coordinate here
+                raster_triangle._inv_area = 1 / ((b_image_plane.x - a_image_plane.x) * (c_image_plane.y - a_image_plane.y) - (b_image_plane.y - a_image_plane.y) * (c_image_plane.x - a_image_plane.x));
+
+                //Inverse projecting the z coordinates (because only the z coordinate is interesting here)
+                //of the vertices of the triangle back into camera space (from NDC)
+                //These will be used to interpolate the z coordinate at the "intersection" point
+                //We're using the clipped triangle but non-transformed by the camera matrix because
+                //we want our z-buffer to represent "true" depth, not the depth of the triangles that we
+                //transformed by the camera matrix just for rasterizing purposes
+                raster_triangle._a_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(a_image_plane));
+                raster_triangle._b_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(b_image_plane));
+                raster_triangle._c_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(c_image_plane));
+
+                //Computing the bounding box of the triangle so that next, we only test pixels that are in the bounding box of the triangle
+                float boundingMinX = std::min(a_image_plane.x, std::min(b_image_plane.x, c_image_plane.x));
+                float boundingMinY = std::min(a_image_plane.y, std::min(b_image_plane.y, c_image_plane.y));
+                float boundingMaxX = std::max(a_image_plane.x, std::max(b_image_plane.x, c_image_plane.x));
+                float boundingMaxY = std::max(a_image_plane.y, std::max(b_image_plane.y, c_image_plane.y));
+
+                raster_triangle._min_x = std::max((int)((boundingMinX + 1) * 0.5 * render_width), 0);
+                raster_triangle._min_y = std::max((int)((boundingMinY + 1) * 0.5 * render_height), 0);
+                raster_triangle._max_x = std::min(render_width - 1, (int)((boundingMaxX + 1) * 0.5 * render_width));
+                raster_triangle._max_y = std::min(render_height - 1, (int)((boundingMaxY + 1) * 0.5 * render_height));
+                if (raster_triangle._min_x > raster_triangle._max_x || raster_triangle._min_y > raster_triangle._max_y)
+                    continue;
+
+                for_each_overlapped_tile(raster_triangle, [&](int tile_index) { tile_offsets[tile_index]++; });
+                raster_triangles.push_back(raster_triangle);
+            }
+        }
+
+#pragma omp single
         {
-            Triangle4 clipped_triangle = clipped_triangles[clipped_triangle_index];
-            Triangle clipped_triangle_NDC = Triangle(clipped_triangle, original_triangle._materialIndex, clipped_triangle._tex_coords_u, clipped_triangle._tex_coords_v);
-            Triangle clipped_triangle_cam_space = perspective_projection_inv(clipped_triangle_NDC);
+            int triangle_count = 0;
+            for (int tile_index = 0; tile_index < tile_count; tile_index++)
+            {
+                tile_first_triangles[tile_index] = triangle_count;
+                for (int thread = 0; thread < thread_count; thread++)
+                {
+                    int thread_triangle_count = thread_tile_offsets[thread][tile_index];
+                    thread_tile_offsets[thread][tile_index] = triangle_count;
+                    triangle_count += thread_triangle_count;
+                }
+            }
+
+            tile_first_triangles[tile_count] = triangle_count;
+            tile_triangles.resize(triangle_count);
+        }
+
+        for (const RasterTriangle& raster_triangle : raster_triangles)
+            for_each_overlapped_tile(raster_triangle, [&](int tile_index) { tile_triangles[tile_offsets[tile_index]++] = &raster_triangle; });
+    }
+
+    scheduler.for_each_tile([&](const TileScheduler::Tile& tile) {
+        for (int i = tile_first_triangles[tile._index]; i < tile_first_triangles[tile._index + 1]; i++)
+        {
+            const RasterTriangle& raster_triangle = *tile_triangles[i];
+            const Triangle& clipped_triangle_NDC = raster_triangle._ndc;
 
             Point a_image_plane = clipped_triangle_NDC._a;
             Point b_image_plane = clipped_triangle_NDC._b;
             Point c_image_plane = clipped_triangle_NDC._c;
 
-            //We don't care about the z coordinate here
-            float invTriangleArea = 1 / ((b_image_plane.x - a_image_plane.x) * (c_image_plane.y - a_image_plane.y) - (b_image_plane.y - a_image_plane.y) * (c_image_plane.x - a_image_plane.x));
-
-            //Computing the bounding box of the triangle so that next, we only test pixels that are in the bounding box of the triangle
-            float boundingMinX = std::min(a_image_plane.x, std::min(b_image_plane.x, c_image_plane.x));
-            float boundingMinY = std::min(a_image_plane.y, std::min(b_image_plane.y, c_image_plane.y));
-            float boundingMaxX = std::max(a_image_plane.x, std::max(b_image_plane.x, c_image_plane.x));
-            float boundingMaxY = std::max(a_image_plane.y, std::max(b_image_plane.y, c_image_plane.y));
-		
-            int minXPixels = (int)((boundingMinX + 1) * 0.5 * render_width);
-            int minYPixels = (int)((boundingMinY + 1) * 0.5 * render_height);
-            int maxXPixels = (int)((boundingMaxX + 1) * 0.5 * render_width);
-            int maxYPixels = (int)((boundingMaxY + 1) * 0.5 * render_height);
+            //Only the part of the bounding box of the triangle that is in the tile is rasterized
+            int minXPixels = std::max(raster_triangle._min_x, tile._x);
+            int minYPixels = std::max(raster_triangle._min_y, tile._y);
+            int maxXPixels = std::min(raster_triangle._max_x, tile._x + tile._width - 1);
+            int maxYPixels = std::min(raster_triangle._max_y, tile._y + tile._height - 1);
 
-            minXPixels = std::max(minXPixels, 0);
-            minYPixels = std::max(minYPixels, 0);
-            maxXPixels = std::min(render_width - 1, maxXPixels);
-            maxYPixels = std::min(render_height - 1, maxYPixels);
-
-            float image_y = minYPixels * render_height_scaling - 1;
+            //The clipped triangle in world space is only needed to shade
+            //the pixels, it is computed once for all the pixels of the tile
+            bool world_space_computed = false;
+            Triangle clipped_triangle_world_space;
 
             float image_x_increment = render_width_scaling;
             float image_y_increment = render_height_scaling;
-            for (int py = minYPixels; py <= maxYPixels; py++, image_y += image_y_increment)
+            for (int py = minYPixels; py <= maxYPixels; py++)
             {
-                float image_x = minXPixels * render_width_scaling - 1;
-                for (int px = minXPixels; px <= maxXPixels; px++, image_x += image_x_increment)
+                float image_y = py * render_height_scaling - 1;
+                for (int px = minXPixels; px <= maxXPixels; px++)
                 {
-                    //NOTE If there are still issues with the clipping algorithm creating new points
-                    //just a little over the edge of the view frustum, consider using a simple std::max(0, ...)
-                    assert(px >= 0 && px < render_width);
-                    assert(py >= 0 && py < render_height);
+                    float image_x = px * render_width_scaling - 1;
 
                     //Adding 0.5*increment to consider the center of the pixel
                     Point pixel_point(image_x + image_x_increment * 0.5f, image_y + image_y_increment * 0.5f, -1);
@@ -951,58 +1205,59 @@ void Renderer::raster_trace()
                     if (w < 0)
                         continue;
 
-                    u *= invTriangleArea;
-                    v *= invTriangleArea;
-                    w *= invTriangleArea;
-
-                    //Inverse projecting the z coordinates (because only the z coordinate is interesting here)
-                    //of the vertices of the triangle back into camera space (from NDC)
-                    //These will be used to interpolate the z coordinate at the "intersection" point
-                    //We're using the clipped triangle but non-transformed by the camera matrix because
-                    //we want our z-buffer to represent "true" depth, not the depth of the triangles that we
-                    //transformed by the camera matrix just for rasterizing purposes
-                    float clipped_triangle_world_space_a_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(clipped_triangle_NDC._a));
-                    float clipped_triangle_world_space_b_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(clipped_triangle_NDC._b));
-                    float clipped_triangle_world_space_c_z = matrix_transform_z(_scene._camera._camera_to_world_mat, perspective_projection_inv(clipped_triangle_NDC._c));
+                    u *= raster_triangle._inv_area;
+                    v *= raster_triangle._inv_area;
+                    w *= raster_triangle._inv_area;
 
                     //Z coordinate of the point on the "real 3D" (not the triangle projected on the image plane) triangle
                     //by interpolating the z coordinates of the 3 vertices
                     //Interpolating the z coordinate is going to give a positive z. The bigger the z, the farther away the point
                     //on the triangle from the camera
-                    float zTriangle = -1 / (1 / clipped_triangle_world_space_a_z * w + 1 / clipped_triangle_world_space_b_z * u + 1 / clipped_triangle_world_space_c_z * v);
+                    float zTriangle = -1 / (1 / raster_triangle._a_z * w + 1 / raster_triangle._b_z * u + 1 / raster_triangle._c_z * v);
 
                     if (zTriangle < _z_buffer(py, px))
                     {
                         _z_buffer(py, px) = zTriangle;
 
                         if (_render_settings.enable_ssao)
-                            _normal_buffer(py, px) = original_triangle._normal;
+                            _normal_buffer(py, px) = raster_triangle._normal;
 
                         Color final_color;
                         if (_render_settings.shading_method == RenderSettings::ShadingMethod::RT_SHADING)
                         {
+                            if (!world_space_computed)
+                            {
+                                clipped_triangle_world_space = _scene._camera._camera_to_world_mat(perspective_projection_inv(clipped_triangle_NDC));
+                                world_space_computed = true;
+                            }
+
                             final_color = trace_triangle(Ray(_scene._camera._position,
                                                              normalize(_scene._camera._camera_to_world_mat(perspective_projection_inv(pixel_point)) - _scene._camera._position)),
-                                                            _scene._camera._camera_to_world_mat(clipped_triangle_cam_space), 0);
+                                                            clipped_triangle_world_space, 0);
                         }
                         else if (_render_settings.shading_method == RenderSettings::ShadingMethod::ABS_NORMALS_SHADING)
                             //Color triangles with std::abs(normal)
-                            final_color = shade_abs_normals(normalize(original_triangle._normal));
+                            final_color = shade_abs_normals(normalize(raster_triangle._normal));
                         else if (_render_settings.shading_method == RenderSettings::ShadingMethod::PASTEL_NORMALS_SHADING)
                             //Color triangles with (normal + 1) * 0.5
-                            final_color = shade_pastel_normals(normalize(original_triangle._normal));
+                            final_color = shade_pastel_normals(normalize(raster_triangle._normal));
                         else if (_render_settings.shading_method == RenderSettings::ShadingMethod::BARYCENTRIC_COORDINATES_SHADING)
                             final_color = shade_barycentric_coordinates(u, v);
                         else if (_render_settings.shading_method == RenderSettings::ShadingMethod::VISUALIZE_AO)
-                            final_color = shade_visualize_ao(perspective_projection_inv(clipped_triangle_NDC), u, v);
+                        {
+                            Triangle camera_space_triangle = perspective_projection_inv(clipped_triangle_NDC);
+
+                            HitInfo hit_info;
+                            hit_info.triangle = &camera_space_triangle;
+                            final_color = shade_visualize_ao(hit_info, u, v);
+                        }
 
                         _image.setPixel(px, py, ImageUtils::gkit_color_to_Qt_ARGB32_uint(final_color));
                     }
-
                 }
             }
         }
-    }
+    });
 }
 
 Color Renderer::trace_ray(const Ray& ray, HitInfo& final_hit_info, int current_recursion_depth, bool& intersection_found) const
@@ -1012,30 +1267,43 @@ Color Renderer::trace_ray(const Ray& ray, HitInfo& final_hit_info, int current_r
     if (current_recursion_depth > _render_settings.max_recursion_depth)
         return Color(0.0f);
 
+    //Only t, u, v and the triangle are known for the triangles intersected here.
+    //The attributes of the hit are computed once we know which intersection is the closest
+    bool triangle_hit_found = false;
     if (_render_settings.enable_bvh)
     {
         if (_bvh.intersect(ray, local_hit_info))
+        {
             if (local_hit_info.t < final_hit_info.t || final_hit_info.t == -1)
+            {
                 final_hit_info = local_hit_info;
+                triangle_hit_found = true;
+            }
+        }
     }
     else
     {
-        for (const Triangle& triangle : _triangles)
-            if (triangle.intersect(ray, local_hit_info))
-                if (local_hit_info.t < final_hit_info.t || final_hit_info.t == -1)
-                    final_hit_info = local_hit_info;
-    }
-    
-    for (AnalyticShapesTypes analytic_shape : _analytic_shapes)
-    {
-        std::visit([&] (auto& shape)
+        for (int i = 0; i < _mesh.triangle_count(); i++)
         {
-            if (shape.intersect(ray, local_hit_info))
-                if (local_hit_info.t < final_hit_info.t || final_hit_info.t == -1)
-                    final_hit_info = local_hit_info;
-        }, analytic_shape);
+            float t, u, v;
+            if (TriangleIntersection::intersect(_render_settings.triangle_intersection_kernel, _mesh.triangle_geometry(i), brute_force_transform(i), ray, t, u, v))
+            {
+                if (t < final_hit_info.t || final_hit_info.t == -1)
+                {
+                    final_hit_info.t = t;
+                    final_hit_info.u = u;
+                    final_hit_info.v = v;
+                    final_hit_info.mesh = &_mesh;
+                    final_hit_info.triangle_index = i;
+                    final_hit_info.triangle = nullptr;
+                    triangle_hit_found = true;
+                }
+            }
+        }
     }
 
+    complete_closest_hit(ray, final_hit_info, triangle_hit_found);
+
     float min_t = 0.1;//TODO pass as argument
     if (final_hit_info.t > min_t)//We found an intersection
     {
@@ -1050,23 +1318,84 @@ Color Renderer::trace_ray(const Ray& ray, HitInfo& final_hit_info, int current_r
         return final_color;
     }
     else
+        return background_color(ray);
+}
+
+void Renderer::complete_closest_hit(const Ray& ray, HitInfo& hit_info, bool triangle_hit_found) const
+{
+    //Index of the instance hit, -1 if the closest hit isn't on an instance
+    int instance_index = -1;
+    if (_top_level_bvh.intersect(ray, hit_info, instance_index))
+        triangle_hit_found = false;
+
+    if (_analytic_shapes.intersect(ray, hit_info))
+    {
+        triangle_hit_found = false;
+        instance_index = -1;
+    }
+
+    if (triangle_hit_found)
+        hit_info.hit_triangle().compute_hit_attributes(hit_info);
+    else if (instance_index != -1)
+        _top_level_bvh.compute_hit_attributes(instance_index, hit_info);
+}
+
+Color Renderer::background_color(const Ray& ray) const
+{
+    if (_render_settings.enable_skysphere)
+    {
+        float u = 0.5 + std::atan2(-ray._direction.z, -ray._direction.x) / (2 * M_PI);
+        float v = 0.5 + std::asin(-ray._direction.y) / M_PI;
+
+        return sample_texture(_skysphere, u, v);
+    }
+    else if (_render_settings.enable_skybox)
+        return _skybox.sample(ray._direction);
+    else
+        return Renderer::BACKGROUND_COLOR;
+}
+
+void Renderer::trace_packet(const Ray rays[BVH::PACKET_SIZE], int ray_count, Color colors[BVH::PACKET_SIZE], HitInfo hit_infos[BVH::PACKET_SIZE], bool intersections_found[BVH::PACKET_SIZE]) const
+{
+    int rays_mask = (1 << ray_count) - 1;
+    int triangle_hits_mask = _bvh.intersect_packet(rays, rays_mask, hit_infos);
+
+    int shaded_mask = 0;
+    Point inter_points[BVH::PACKET_SIZE];
+    Vector normals[BVH::PACKET_SIZE];
+    float us[BVH::PACKET_SIZE], vs[BVH::PACKET_SIZE];
+    for (int i = 0; i < ray_count; i++)
     {
-        if (_render_settings.enable_skysphere)
-        {
-            float u = 0.5 + std::atan2(-ray._direction.z, -ray._direction.x) / (2 * M_PI);
-            float v = 0.5 + std::asin(-ray._direction.y) / M_PI;
+        complete_closest_hit(rays[i], hit_infos[i], triangle_hits_mask & (1 << i));
 
-            return sample_texture(_skysphere, u, v);
-        }
-        else if (_render_settings.enable_skybox)
-            return _skybox.sample(ray._direction);
+        float min_t = 0.1;//Same as trace_ray()
+        intersections_found[i] = hit_infos[i].t > min_t;
+        if (!intersections_found[i])
+            continue;
+
+        prepare_shading(rays[i], hit_infos[i], us[i], vs[i]);
+        inter_points[i] = rays[i]._origin + rays[i]._direction * hit_infos[i].t;
+        normals[i] = hit_infos[i].normal_at_intersection;
+        shaded_mask |= 1 << i;
+    }
+
+    int shadowed_mask = 0;
+    if (_render_settings.shading_method == RenderSettings::ShadingMethod::RT_SHADING)
+        shadowed_mask = is_shadowed_packet(inter_points, normals, _scene._point_light._position, shaded_mask);
+
+    for (int i = 0; i < ray_count; i++)
+    {
+        if (intersections_found[i])
+            colors[i] = shade_ray_inter_point(rays[i], hit_infos[i], us[i], vs[i], shadowed_mask & (1 << i), 0);
         else
-            return Renderer::BACKGROUND_COLOR;
+            colors[i] = background_color(rays[i]);
     }
 }
 
 void Renderer::ray_trace()
 {
+    _bvh.reset_traversal_counters(_render_settings.enable_bvh_statistics);
+
     int render_width, render_height;
     get_render_width_height(_render_settings, render_width, render_height);
 
@@ -1079,23 +1408,68 @@ void Renderer::ray_trace()
     if (_render_settings.enable_ssaa)
         _image = QImage(render_width, render_height, QImage::Format_ARGB32);
 
-#pragma omp parallel for schedule(dynamic)
-    for (int py = 0; py < render_height; py++)
-    {
+    //The primary rays of 8 consecutive pixels of a tile are traced together. The rays
+    //of neighboring pixels are coherent so they traverse the BVH through mostly the same nodes
+    bool use_ray_packets = _render_settings.enable_ray_packets && _render_settings.enable_bvh && _render_settings.max_recursion_depth >= 0;
+
+    Point camera_position = _scene._camera._position;
+    auto primary_ray = [&](int px, int py) {
         //Adding 0.5 to consider the center of the pixel
+        float x_world = ((float)px + 0.5f) / render_width * 2 - 1;
         float y_world = ((float)py + 0.5f) / render_height * 2 - 1;
 
-        for (int px = 0; px < render_width; px++)
+        Point image_plane_point_vs = _scene._camera._perspective_proj_mat_inv(Point(x_world, y_world, -1));//View space
+        Point image_plane_point_ws = _scene._camera._camera_to_world_mat(image_plane_point_vs); //World space
+
+        return Ray(camera_position, normalize(image_plane_point_ws - camera_position));
+    };
+
+    TileScheduler scheduler(render_width, render_height, _render_settings);
+    scheduler.for_each_tile([&](const TileScheduler::Tile& tile) {
+        if (use_ray_packets)
         {
-            //Adding 0.5 to consider the center of the pixel
-            float x_world = ((float)px + 0.5f) / render_width * 2 - 1;
+            Ray rays[BVH::PACKET_SIZE];
+            int pixels_x[BVH::PACKET_SIZE], pixels_y[BVH::PACKET_SIZE];
+            int ray_count = 0;
+
+            auto trace_rays = [&]() {
+                Color colors[BVH::PACKET_SIZE];
+                HitInfo hit_infos[BVH::PACKET_SIZE];
+                bool intersections_found[BVH::PACKET_SIZE];
+                trace_packet(rays, ray_count, colors, hit_infos, intersections_found);
+
+                for (int i = 0; i < ray_count; i++)
+                {
+                    if (intersections_found[i] && _render_settings.enable_ssao)
+                    {
+                        _z_buffer(pixels_y[i], pixels_x[i]) = -(rays[i]._origin.z + rays[i]._direction.z * hit_infos[i].t);
+                        _normal_buffer(pixels_y[i], pixels_x[i]) = hit_infos[i].normal_at_intersection;
+                    }
+
+                    _image.setPixel(pixels_x[i], pixels_y[i], ImageUtils::gkit_color_to_Qt_ARGB32_uint(colors[i]));
+                }
+
+                ray_count = 0;
+            };
+
+            scheduler.for_each_pixel(tile, [&](int px, int py) {
+                rays[ray_count] = primary_ray(px, py);
+                pixels_x[ray_count] = px;
+                pixels_y[ray_count] = py;
+
+                if (++ray_count == BVH::PACKET_SIZE)
+                    trace_rays();
+            });
 
-            Point image_plane_point_vs = _scene._camera._perspective_proj_mat_inv(Point(x_world, y_world, -1));//View space
-            Point image_plane_point_ws = _scene._camera._camera_to_world_mat(image_plane_point_vs); //World space
+            //Last pixels of the tiles whose pixel count isn't a multiple of the packet size
+            if (ray_count > 0)
+                trace_rays();
 
-            Point camera_position = _scene._camera._position;
-            Vector ray_direction = normalize(image_plane_point_ws - camera_position);
-            Ray ray(camera_position, ray_direction);
+            return;
+        }
+
+        scheduler.for_each_pixel(tile, [&](int px, int py) {
+            Ray ray = primary_ray(px, py);
 
             bool intersection_found = false;
             HitInfo hit_info;
@@ -1111,8 +1485,8 @@ void Renderer::ray_trace()
             }
 
             _image.setPixel(px, py, ImageUtils::gkit_color_to_Qt_ARGB32_uint(pixel_color));
-        }
-    }
+        });
+    });
 }
 
 void Renderer::post_process()
@@ -1142,86 +1516,91 @@ void Renderer::post_process_ssao_scalar()
     short int* ao_buffer = new short int[render_height * render_width];
     std::memset(ao_buffer, 0, sizeof(short int) * render_height * render_width);
 
+    TileScheduler scheduler(render_width, render_height, _render_settings);
+
     XorShiftGenerator rand_generator;
 #pragma omp parallel private(rand_generator)
     {
         rand_generator = XorShiftGenerator(omp_get_thread_num() * 24183 + rand());
-#pragma omp for
-        for (int y = 0; y < render_height; y++)
-        {
-            for (int x = 0; x < render_width; x++)
+        scheduler.process_tiles([&](const TileScheduler::Tile& tile) {
+            for (int y = tile._y; y < tile._y + tile._height; y++)
             {
-                //No information here, there's no pixel to shade: background at this pixel on the image
-                if (_z_buffer(y, x) == INFINITY)
-                    continue;
-
-                float x_ndc = (float)x / render_width * 2 - 1;
-                float y_ndc = (float)y / render_height * 2 - 1;
-
-                float view_z = _z_buffer(y, x);
-                float view_ray_x = x_ndc * _scene._camera._aspect_ratio * std::tan(radians(_scene._camera._fov / 2));
-                float view_ray_y = y_ndc * std::tan(radians(_scene._camera._fov / 2));
-                Point camera_space_point = Point(view_ray_x * view_z, view_ray_y * view_z, -view_z);
-
-                Vector normal = normalize(_normal_buffer(y, x));
-
-                short int pixel_occlusion = 0;
-                for (int i = 0; i < _render_settings.ssao_sample_count; i++)
+                for (int x = tile._x; x < tile._x + tile._width; x++)
                 {
-                    float rand_x = rand_generator.get_rand_bilateral();
-                    float rand_y = rand_generator.get_rand_bilateral();
-                    float rand_z = rand_generator.get_rand_bilateral();
+                    //No information here, there's no pixel to shade: background at this pixel on the image
+                    if (_z_buffer(y, x) == INFINITY)
+                        continue;
 
-                    Point random_sample = Point(normalize(Vector(rand_x, rand_y, rand_z)));
-                    random_sample = random_sample * (rand_generator.get_rand_lateral() + 0.0001f);
-                    random_sample = random_sample * _render_settings.ssao_radius;
-                    random_sample = random_sample + camera_space_point;
-                    if (dot(random_sample - camera_space_point, normal) < 0)//The point is not in front of the normal
-                        random_sample = random_sample + 2 * (camera_space_point - random_sample);
+                    float x_ndc = (float)x / render_width * 2 - 1;
+                    float y_ndc = (float)y / render_height * 2 - 1;
 
-                    Point random_sample_ndc = _scene._camera._perspective_proj_mat(random_sample);
-                    int random_point_pixel_x = (int)((random_sample_ndc.x + 1) * 0.5 * render_width);
-                    int random_point_pixel_y = (int)((random_sample_ndc.y + 1) * 0.5 * render_height);
+                    float view_z = _z_buffer(y, x);
+                    float view_ray_x = x_ndc * _scene._camera._aspect_ratio * std::tan(radians(_scene._camera._fov / 2));
+                    float view_ray_y = y_ndc * std::tan(radians(_scene._camera._fov / 2));
+                    Point camera_space_point = Point(view_ray_x * view_z, view_ray_y * view_z, -view_z);
 
-                    random_point_pixel_x = std::min(std::max(0, random_point_pixel_x), render_width - 1);
-                    random_point_pixel_y = std::min(std::max(0, random_point_pixel_y), render_height - 1);
+                    Vector normal = normalize(_normal_buffer(y, x));
 
-                    float sample_geometry_depth = -_z_buffer(random_point_pixel_y, random_point_pixel_x);
+                    short int pixel_occlusion = 0;
+                    for (int i = 0; i < _render_settings.ssao_sample_count; i++)
+                    {
+                        float rand_x = rand_generator.get_rand_bilateral();
+                        float rand_y = rand_generator.get_rand_bilateral();
+                        float rand_z = rand_generator.get_rand_bilateral();
+
+                        Point random_sample = Point(normalize(Vector(rand_x, rand_y, rand_z)));
+                        random_sample = random_sample * (rand_generator.get_rand_lateral() + 0.0001f);
+                        random_sample = random_sample * _render_settings.ssao_radius;
+                        random_sample = random_sample + camera_space_point;
+                        if (dot(random_sample - camera_space_point, normal) < 0)//The point is not in front of the normal
+                            random_sample = random_sample + 2 * (camera_space_point - random_sample);
+
+                        Point random_sample_ndc = _scene._camera._perspective_proj_mat(random_sample);
+                        int random_point_pixel_x = (int)((random_sample_ndc.x + 1) * 0.5 * render_width);
+                        int random_point_pixel_y = (int)((random_sample_ndc.y + 1) * 0.5 * render_height);
+
+                        random_point_pixel_x = std::min(std::max(0, random_point_pixel_x), render_width - 1);
+                        random_point_pixel_y = std::min(std::max(0, random_point_pixel_y), render_height - 1);
+
+                        float sample_geometry_depth = -_z_buffer(random_point_pixel_y, random_point_pixel_x);
+
+                        //Range check
+                        if (std::abs(sample_geometry_depth - camera_space_point.z) > _render_settings.ssao_radius)
+                            continue;
+                        if (random_sample.z < sample_geometry_depth)
+                            pixel_occlusion++;
+                    }
 
-                    //Range check
-                    if (std::abs(sample_geometry_depth - camera_space_point.z) > _render_settings.ssao_radius)
-                        continue;
-                    if (random_sample.z < sample_geometry_depth)
-                        pixel_occlusion++;
+                    ao_buffer[y * render_width + x] = pixel_occlusion;
                 }
-
-                ao_buffer[y * render_width + x] = pixel_occlusion;
             }
-        }
+        });
     }
 
     //Blurring the AO
     int blur_size = 7;
     int half_blur_size = blur_size / 2;
-#pragma omp parallel for
-    for (int y = half_blur_size; y < render_height - half_blur_size; y++)
-    {
-        for (int x = half_blur_size; x < render_width - half_blur_size; x++)
+    scheduler.reset();
+    scheduler.for_each_tile([&](const TileScheduler::Tile& tile) {
+        for (int y = std::max(tile._y, half_blur_size); y < std::min(tile._y + tile._height, render_height - half_blur_size); y++)
         {
-            if (_z_buffer(y, x) == INFINITY)//Background pixel, we're not blurring it
-                continue;
+            for (int x = std::max(tile._x, half_blur_size); x < std::min(tile._x + tile._width, render_width - half_blur_size); x++)
+            {
+                if (_z_buffer(y, x) == INFINITY)//Background pixel, we're not blurring it
+                    continue;
 
-            int sum = 0;
-            for (int offset_y = -half_blur_size; offset_y <= half_blur_size; offset_y++)
-                for (int offset_x = -half_blur_size; offset_x <= half_blur_size; offset_x++)
-                    sum += ao_buffer[(y + offset_y) * render_width + x + offset_x];
+                int sum = 0;
+                for (int offset_y = -half_blur_size; offset_y <= half_blur_size; offset_y++)
+                    for (int offset_x = -half_blur_size; offset_x <= half_blur_size; offset_x++)
+                        sum += ao_buffer[(y + offset_y) * render_width + x + offset_x];
 
-            //Applying directly on the image
-            float color_multiplier = 1 - ((float)sum / (float)(blur_size * blur_size) / (float)_render_settings.ssao_sample_count * (float)_render_settings.ssao_amount);
-            QColor pixel_color = _image.pixelColor(x, y);
-            _image.setPixelColor(x, y, QColor(pixel_color.red() * color_multiplier, pixel_color.green() * color_multiplier, pixel_color.blue() * color_multiplier));
+                //Applying directly on the image
+                float color_multiplier = 1 - ((float)sum / (float)(blur_size * blur_size) / (float)_render_settings.ssao_sample_count * (float)_render_settings.ssao_amount);
+                QColor pixel_color = _image.pixelColor(x, y);
+                _image.setPixelColor(x, y, QColor(pixel_color.red() * color_multiplier, pixel_color.green() * color_multiplier, pixel_color.blue() * color_multiplier));
+            }
         }
-    }
+    });
 
     delete[] ao_buffer;
 }
@@ -1245,9 +1624,11 @@ void Renderer::post_process_ssao_SIMD()
     float fov_multiplier_value = (float)std::tan(_scene._camera._fov / 2 / 180 * M_PI);
     __m256 fov_multiplier = _mm256_set1_ps(fov_multiplier_value);
 
+    TileScheduler scheduler(render_width, render_height, _render_settings);
+
     __m256_XorShiftGenerator rand_generator;
     XorShiftGenerator rand_generator_scalar;
-#pragma omp parallel private(rand_generator)
+#pragma omp parallel private(rand_generator, rand_generator_scalar)
     {
         rand_generator = __m256_XorShiftGenerator(_mm256_set_epi32(omp_get_thread_num() * 24183 + rand(),
                                                                    omp_get_thread_num() * 24183 + rand(),
@@ -1259,176 +1640,180 @@ void Renderer::post_process_ssao_SIMD()
                                                                    omp_get_thread_num() * 24183 + rand()));
 
         rand_generator_scalar = XorShiftGenerator(omp_get_thread_num() * 24183 + rand());
-#pragma omp for
-        for (int y = 0; y < render_height; y++)
-        {
-            __m256 y_vec = _mm256_set1_ps((float)y);
-            __m256 y_ndc = _mm256_div_ps(y_vec, render_height_vec);
-            y_ndc = _mm256_mul_ps(y_ndc, twos);
-            y_ndc = _mm256_sub_ps(y_ndc, ones);
-
-            for (int x = 0; x < render_width; x += 8)
+        scheduler.process_tiles([&](const TileScheduler::Tile& tile) {
+            for (int y = tile._y; y < tile._y + tile._height; y++)
             {
-                __m256 view_z = _mm256_loadu_ps(_z_buffer.row(y) + x);
-                __m256 infinity = _mm256_set1_ps(INFINITY);
-                __m256 infinity_mask = _mm256_cmp_ps(view_z, infinity, _CMP_NEQ_OQ);
-
-                float sum = _mm256_reduction_ps(infinity_mask);
-                if (sum == 0.0)//We have no _z_buffer information on any pixels i.e. all pixels are background pixels
-                    continue;//Skipping all these pixels
-
-                __m256 x_vec = _mm256_set1_ps((float)x);
-
-                __m256 xs = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
-                xs = _mm256_add_ps(xs, x_vec);
-
-                __m256 x_ndc = _mm256_div_ps(xs, render_width_vec);
-                x_ndc = _mm256_mul_ps(x_ndc, twos);
-                x_ndc = _mm256_sub_ps(x_ndc, ones);
+                __m256 y_vec = _mm256_set1_ps((float)y);
+                __m256 y_ndc = _mm256_div_ps(y_vec, render_height_vec);
+                y_ndc = _mm256_mul_ps(y_ndc, twos);
+                y_ndc = _mm256_sub_ps(y_ndc, ones);
+
+                //The pixels at the end of the rows of the tile that don't fill a whole vector are processed one by one
+                int x = tile._x;
+                for (; x + 8 <= tile._x + tile._width; x += 8)
+                {
+                    __m256 view_z = _mm256_loadu_ps(_z_buffer.row(y) + x);
+                    __m256 infinity = _mm256_set1_ps(INFINITY);
+                    __m256 infinity_mask = _mm256_cmp_ps(view_z, infinity, _CMP_NEQ_OQ);
 
-                __m256 view_ray_x = _mm256_mul_ps(x_ndc, _mm256_mul_ps(fov_multiplier, _mm256_set1_ps(_scene._camera._aspect_ratio)));
-                __m256 view_ray_y = _mm256_mul_ps(y_ndc, fov_multiplier);
+                    float sum = _mm256_reduction_ps(infinity_mask);
+                    if (sum == 0.0)//We have no _z_buffer information on any pixels i.e. all pixels are background pixels
+                        continue;//Skipping all these pixels
 
-                __m256Point camera_space_point = __m256Point(_mm256_mul_ps(view_z, view_ray_x), _mm256_mul_ps(view_z, view_ray_y), _mm256_mul_ps(view_z, _mm256_set1_ps(-1)));
+                    __m256 x_vec = _mm256_set1_ps((float)x);
 
-                __m256Vector normal = _mm256_normalize(__m256Vector(_normal_buffer.row(y) + x));
+                    __m256 xs = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+                    xs = _mm256_add_ps(xs, x_vec);
 
-                __m256i pixel_occlusion = _mm256_setzero_si256();
-                for (int i = 0; i < _render_settings.ssao_sample_count; i++)
-                {
-                    __m256 rand_x = rand_generator.get_rand_bilateral();
-                    __m256 rand_y = rand_generator.get_rand_bilateral();
-                    __m256 rand_z = rand_generator.get_rand_bilateral();
+                    __m256 x_ndc = _mm256_div_ps(xs, render_width_vec);
+                    x_ndc = _mm256_mul_ps(x_ndc, twos);
+                    x_ndc = _mm256_sub_ps(x_ndc, ones);
 
-                    __m256Point random_sample = __m256Point(_mm256_normalize(__m256Vector(rand_x, rand_y, rand_z)));
-                    random_sample = random_sample * _mm256_add_ps(rand_generator.get_rand_lateral(), _mm256_set1_ps(0.0001f));
-                    random_sample = random_sample * _mm256_set1_ps(_render_settings.ssao_radius);
-                    random_sample = random_sample + camera_space_point;
+                    __m256 view_ray_x = _mm256_mul_ps(x_ndc, _mm256_mul_ps(fov_multiplier, _mm256_set1_ps(_scene._camera._aspect_ratio)));
+                    __m256 view_ray_y = _mm256_mul_ps(y_ndc, fov_multiplier);
 
-                    //Flipping the random smaple if the dot product with the normal is negative, i.e., the sample
-                    //is below the surface of the hemisphere and we're thus flipping the point back into the hemisphere
-                    //IN FRONT of the normal
-                    __m256Vector vec_dot = random_sample - camera_space_point;
-                    __m256 dot_result = _mm256_dot_product(vec_dot, normal);
-                    __m256 dot_mask = _mm256_and_ps(_mm256_cmp_ps(dot_result, _mm256_setzero_ps(), _CMP_LT_OQ), ones);
-                    __m256Vector backflip_vec = 2 * (camera_space_point - random_sample);
+                    __m256Point camera_space_point = __m256Point(_mm256_mul_ps(view_z, view_ray_x), _mm256_mul_ps(view_z, view_ray_y), _mm256_mul_ps(view_z, _mm256_set1_ps(-1)));
 
-                    //+ 2 * (camera_space_point - random_sample) if dot < 0
-                    random_sample = random_sample + backflip_vec * dot_mask;
+                    __m256Vector normal = _mm256_normalize(__m256Vector(_normal_buffer.row(y) + x));
 
-                    __m256Point random_sample_ndc = random_sample.transform(_scene._camera._perspective_proj_mat);
+                    __m256i pixel_occlusion = _mm256_setzero_si256();
+                    for (int i = 0; i < _render_settings.ssao_sample_count; i++)
+                    {
+                        __m256 rand_x = rand_generator.get_rand_bilateral();
+                        __m256 rand_y = rand_generator.get_rand_bilateral();
+                        __m256 rand_z = rand_generator.get_rand_bilateral();
 
-                    __m256 zero_point_five = _mm256_set1_ps(0.5);
-                    __m256i random_point_pixel_x = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(random_sample_ndc._x, ones), zero_point_five), render_width_vec));
-                    __m256i random_point_pixel_y = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(random_sample_ndc._y, ones), zero_point_five), render_height_vec));
+                        __m256Point random_sample = __m256Point(_mm256_normalize(__m256Vector(rand_x, rand_y, rand_z)));
+                        random_sample = random_sample * _mm256_add_ps(rand_generator.get_rand_lateral(), _mm256_set1_ps(0.0001f));
+                        random_sample = random_sample * _mm256_set1_ps(_render_settings.ssao_radius);
+                        random_sample = random_sample + camera_space_point;
 
-                    //Clamping between 0 and render_width - 1
-                    random_point_pixel_x = _mm256_min_epi32(random_point_pixel_x, _mm256_cvtps_epi32(_mm256_sub_ps(render_width_vec, ones)));
-                    random_point_pixel_x = _mm256_max_epi32(random_point_pixel_x, _mm256_set1_epi32(0));
+                        //Flipping the random smaple if the dot product with the normal is negative, i.e., the sample
+                        //is below the surface of the hemisphere and we're thus flipping the point back into the hemisphere
+                        //IN FRONT of the normal
+                        __m256Vector vec_dot = random_sample - camera_space_point;
+                        __m256 dot_result = _mm256_dot_product(vec_dot, normal);
+                        __m256 dot_mask = _mm256_and_ps(_mm256_cmp_ps(dot_result, _mm256_setzero_ps(), _CMP_LT_OQ), ones);
+                        __m256Vector backflip_vec = 2 * (camera_space_point - random_sample);
 
-                    random_point_pixel_y = _mm256_min_epi32(random_point_pixel_y, _mm256_cvtps_epi32(_mm256_sub_ps(render_height_vec, ones)));
-                    random_point_pixel_y = _mm256_max_epi32(random_point_pixel_y, _mm256_set1_epi32(0));
+                        //+ 2 * (camera_space_point - random_sample) if dot < 0
+                        random_sample = random_sample + backflip_vec * dot_mask;
 
-                    __m256i z_buffer_address_offset = random_point_pixel_x;
-                    z_buffer_address_offset = _mm256_add_epi32(z_buffer_address_offset, _mm256_mullo_epi32(random_point_pixel_y, _mm256_cvtps_epi32(render_width_vec)));
+                        __m256Point random_sample_ndc = random_sample.transform(_scene._camera._perspective_proj_mat);
 
-                    __m256 sample_geometry_depth = _mm256_mul_ps(_mm256_set1_ps(-1.0f), _mm256_i32gather_ps(_z_buffer.data(), z_buffer_address_offset, sizeof(float)));
+                        __m256 zero_point_five = _mm256_set1_ps(0.5);
+                        __m256i random_point_pixel_x = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(random_sample_ndc._x, ones), zero_point_five), render_width_vec));
+                        __m256i random_point_pixel_y = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(random_sample_ndc._y, ones), zero_point_five), render_height_vec));
 
-                    __m256 occluded_mask = _mm256_set1_ps(1);
+                        //Clamping between 0 and render_width - 1
+                        random_point_pixel_x = _mm256_min_epi32(random_point_pixel_x, _mm256_cvtps_epi32(_mm256_sub_ps(render_width_vec, ones)));
+                        random_point_pixel_x = _mm256_max_epi32(random_point_pixel_x, _mm256_set1_epi32(0));
 
-                    //Range check
-                    __m256 absolute_value_range_check = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(sample_geometry_depth, camera_space_point._z));
-                    __m256 range_check_mask = _mm256_cmp_ps(absolute_value_range_check, _mm256_set1_ps(_render_settings.ssao_radius), _CMP_LE_OQ);
-                    occluded_mask = _mm256_and_ps(occluded_mask, range_check_mask);
+                        random_point_pixel_y = _mm256_min_epi32(random_point_pixel_y, _mm256_cvtps_epi32(_mm256_sub_ps(render_height_vec, ones)));
+                        random_point_pixel_y = _mm256_max_epi32(random_point_pixel_y, _mm256_set1_epi32(0));
 
-                    __m256 sample_depth_mask = _mm256_cmp_ps(random_sample._z, sample_geometry_depth, _CMP_LT_OQ);
-                    occluded_mask = _mm256_and_ps(occluded_mask, sample_depth_mask);
+                        __m256i z_buffer_address_offset = random_point_pixel_x;
+                        z_buffer_address_offset = _mm256_add_epi32(z_buffer_address_offset, _mm256_mullo_epi32(random_point_pixel_y, _mm256_cvtps_epi32(render_width_vec)));
 
-                    //Some of the 8 pixels being processed may not have _z_buffer information. i.e. some 
-                    //of the pixels being processed are background pixels. We're going to mask those out
-                    //to avoid occluding them
-                    occluded_mask = _mm256_and_ps(occluded_mask, infinity_mask);
+                        __m256 sample_geometry_depth = _mm256_mul_ps(_mm256_set1_ps(-1.0f), _mm256_i32gather_ps(_z_buffer.data(), z_buffer_address_offset, sizeof(float)));
 
-                    pixel_occlusion = _mm256_add_epi32(pixel_occlusion, _mm256_cvtps_epi32(occluded_mask));
-                }
+                        __m256 occluded_mask = _mm256_set1_ps(1);
 
-                _mm256_storeu_si256((__m256i*) & ao_buffer[y * render_width + x], pixel_occlusion);
-            }
+                        //Range check
+                        __m256 absolute_value_range_check = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(sample_geometry_depth, camera_space_point._z));
+                        __m256 range_check_mask = _mm256_cmp_ps(absolute_value_range_check, _mm256_set1_ps(_render_settings.ssao_radius), _CMP_LE_OQ);
+                        occluded_mask = _mm256_and_ps(occluded_mask, range_check_mask);
 
-            int leftover = render_width % 8;
-            for (int x = render_width - leftover; x < render_width; x++)
-            {
-                //No information here, there's no pixel to shade: background at this pixel on the image
-                if (_z_buffer(y, x) == INFINITY)
-                    continue;
+                        __m256 sample_depth_mask = _mm256_cmp_ps(random_sample._z, sample_geometry_depth, _CMP_LT_OQ);
+                        occluded_mask = _mm256_and_ps(occluded_mask, sample_depth_mask);
 
-                float x_ndc = (float)x / render_width * 2 - 1;
-                float y_ndc = (float)y / render_height * 2 - 1;
+                        //Some of the 8 pixels being processed may not have _z_buffer information. i.e. some 
+                        //of the pixels being processed are background pixels. We're going to mask those out
+                        //to avoid occluding them
+                        occluded_mask = _mm256_and_ps(occluded_mask, infinity_mask);
 
-                float view_z = _z_buffer(y, x);
-                float view_ray_x = x_ndc * _scene._camera._aspect_ratio * std::tan(radians(_scene._camera._fov / 2));
-                float view_ray_y = y_ndc * std::tan(radians(_scene._camera._fov / 2));
-                Point camera_space_point = Point(view_ray_x * view_z, view_ray_y * view_z, -view_z);
+                        pixel_occlusion = _mm256_add_epi32(pixel_occlusion, _mm256_cvtps_epi32(occluded_mask));
+                    }
 
-                Vector normal = normalize(_normal_buffer(y, x));
+                    _mm256_storeu_si256((__m256i*) & ao_buffer[y * render_width + x], pixel_occlusion);
+                }
 
-                short int pixel_occlusion = 0;
-                for (int i = 0; i < _render_settings.ssao_sample_count; i++)
+                for (; x < tile._x + tile._width; x++)
                 {
-                    float rand_x = rand_generator_scalar.get_rand_bilateral();
-                    float rand_y = rand_generator_scalar.get_rand_bilateral();
-                    float rand_z = rand_generator_scalar.get_rand_bilateral();
+                    //No information here, there's no pixel to shade: background at this pixel on the image
+                    if (_z_buffer(y, x) == INFINITY)
+                        continue;
 
-                    Point random_sample = Point(normalize(Vector(rand_x, rand_y, rand_z)));
-                    random_sample = random_sample * (rand_generator_scalar.get_rand_lateral() + 0.0001f);
-                    random_sample = random_sample * _render_settings.ssao_radius;
-                    random_sample = random_sample + camera_space_point;
-                    if (dot(random_sample - camera_space_point, normal) < 0)//The point is not in front of the normal
-                        random_sample = random_sample + 2 * (camera_space_point - random_sample);
+                    float x_ndc = (float)x / render_width * 2 - 1;
+                    float y_ndc = (float)y / render_height * 2 - 1;
 
-                    Point random_sample_ndc = _scene._camera._perspective_proj_mat(random_sample);
-                    int random_point_pixel_x = (int)((random_sample_ndc.x + 1) * 0.5 * render_width);
-                    int random_point_pixel_y = (int)((random_sample_ndc.y + 1) * 0.5 * render_height);
+                    float view_z = _z_buffer(y, x);
+                    float view_ray_x = x_ndc * _scene._camera._aspect_ratio * std::tan(radians(_scene._camera._fov / 2));
+                    float view_ray_y = y_ndc * std::tan(radians(_scene._camera._fov / 2));
+                    Point camera_space_point = Point(view_ray_x * view_z, view_ray_y * view_z, -view_z);
 
-                    random_point_pixel_x = std::min(std::max(0, random_point_pixel_x), render_width - 1);
-                    random_point_pixel_y = std::min(std::max(0, random_point_pixel_y), render_height - 1);
+                    Vector normal = normalize(_normal_buffer(y, x));
 
-                    float sample_geometry_depth = -_z_buffer(random_point_pixel_y, random_point_pixel_x);
+                    short int pixel_occlusion = 0;
+                    for (int i = 0; i < _render_settings.ssao_sample_count; i++)
+                    {
+                        float rand_x = rand_generator_scalar.get_rand_bilateral();
+                        float rand_y = rand_generator_scalar.get_rand_bilateral();
+                        float rand_z = rand_generator_scalar.get_rand_bilateral();
+
+                        Point random_sample = Point(normalize(Vector(rand_x, rand_y, rand_z)));
+                        random_sample = random_sample * (rand_generator_scalar.get_rand_lateral() + 0.0001f);
+                        random_sample = random_sample * _render_settings.ssao_radius;
+                        random_sample = random_sample + camera_space_point;
+                        if (dot(random_sample - camera_space_point, normal) < 0)//The point is not in front of the normal
+                            random_sample = random_sample + 2 * (camera_space_point - random_sample);
+
+                        Point random_sample_ndc = _scene._camera._perspective_proj_mat(random_sample);
+                        int random_point_pixel_x = (int)((random_sample_ndc.x + 1) * 0.5 * render_width);
+                        int random_point_pixel_y = (int)((random_sample_ndc.y + 1) * 0.5 * render_height);
+
+                        random_point_pixel_x = std::min(std::max(0, random_point_pixel_x), render_width - 1);
+                        random_point_pixel_y = std::min(std::max(0, random_point_pixel_y), render_height - 1);
+
+                        float sample_geometry_depth = -_z_buffer(random_point_pixel_y, random_point_pixel_x);
+
+                        //Range check
+                        if (std::abs(sample_geometry_depth - camera_space_point.z) > _render_settings.ssao_radius)
+                            continue;
+                        if (random_sample.z < sample_geometry_depth)
+                            pixel_occlusion++;
+                    }
 
-                    //Range check
-                    if (std::abs(sample_geometry_depth - camera_space_point.z) > _render_settings.ssao_radius)
-                        continue;
-                    if (random_sample.z < sample_geometry_depth)
-                        pixel_occlusion++;
+                    ao_buffer[y * render_width + x] = pixel_occlusion;
                 }
-
-                ao_buffer[y * render_width + x] = pixel_occlusion;
             }
-        }
+        });
     }
 
     //Blurring the AO
     int blur_size = 7;
     int half_blur_size = blur_size / 2;
-#pragma omp parallel for
-    for (int y = half_blur_size; y < render_height - half_blur_size; y++)
-    {
-        for (int x = half_blur_size; x < render_width - half_blur_size; x++)
+    scheduler.reset();
+    scheduler.for_each_tile([&](const TileScheduler::Tile& tile) {
+        for (int y = std::max(tile._y, half_blur_size); y < std::min(tile._y + tile._height, render_height - half_blur_size); y++)
         {
-            if (_z_buffer(y, x) == INFINITY)//Background pixel, we're not blurring it
-                continue;
+            for (int x = std::max(tile._x, half_blur_size); x < std::min(tile._x + tile._width, render_width - half_blur_size); x++)
+            {
+                if (_z_buffer(y, x) == INFINITY)//Background pixel, we're not blurring it
+                    continue;
 
-            int sum = 0;
-            for (int offset_y = -half_blur_size; offset_y <= half_blur_size; offset_y++)
-                for (int offset_x = -half_blur_size; offset_x <= half_blur_size; offset_x++)
-                    sum += ao_buffer[(y + offset_y) * render_width + x + offset_x];
+                int sum = 0;
+                for (int offset_y = -half_blur_size; offset_y <= half_blur_size; offset_y++)
+                    for (int offset_x = -half_blur_size; offset_x <= half_blur_size; offset_x++)
+                        sum += ao_buffer[(y + offset_y) * render_width + x + offset_x];
 
-            //Applying directly on the image
-            float color_multiplier = 1 - ((float)sum / (float)(blur_size * blur_size) / (float)_render_settings.ssao_sample_count * (float)_render_settings.ssao_amount);
-            QColor pixel_color = _image.pixelColor(x, y);
-            _image.setPixelColor(x, y, QColor(pixel_color.red() * color_multiplier, pixel_color.green() * color_multiplier, pixel_color.blue() * color_multiplier));
+                //Applying directly on the image
+                float color_multiplier = 1 - ((float)sum / (float)(blur_size * blur_size) / (float)_render_settings.ssao_sample_count * (float)_render_settings.ssao_amount);
+                QColor pixel_color = _image.pixelColor(x, y);
+                _image.setPixelColor(x, y, QColor(pixel_color.red() * color_multiplier, pixel_color.green() * color_multiplier, pixel_color.blue() * color_multiplier));
+            }
         }
-    }
+    });
 
     delete[] ao_buffer;
 }
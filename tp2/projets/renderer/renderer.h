@@ -4,17 +4,21 @@
 #include <QImage>
 
 #include <array>
+#include <cstdint>
 #include <mutex>
 #include <omp.h>
 
 #include "analyticShape.h"
+#include "analyticShapesBVH.h"
 #include "buffer.h"
 #include "bvh.h"
 #include "image.h"
+#include "indexedMesh.h"
 #include "materials.h"
 #include "rendererSettings.h"
 #include "scene/scene.h"
 #include "skybox.h"
+#include "topLevelBVH.h"
 #include "xorshift.h"
 
 class Renderer
@@ -45,6 +49,8 @@ public:
 
 	RenderSettings& render_settings();
 
+    const BVH& get_bvh() const;
+
     /**
      * @brief Computes the effective render height and width (accounting for SSAA for example)
      *  based on the given render settings and stores the output in render_width and render_height
@@ -54,10 +60,53 @@ public:
      */
     void get_render_width_height(const RenderSettings& settings, int& render_width, int& render_height);
 
+    /**
+     * @brief Replaces the triangles of the renderer with the given mesh and builds the BVH over it
+     */
+    void set_mesh(const IndexedMesh& mesh);
+    /**
+     * @brief Same as set_mesh(mesh) but the BVH is built with the builder and the treelet optimization
+     * of the given settings instead of the ones of the render settings. The BVH is then interactive
+     * if they differ, see is_bvh_interactive()
+     */
+    void set_mesh(const IndexedMesh& mesh, const RenderSettings& bvh_settings);
+
+    /**
+     * @brief Same as set_mesh() with the mesh of the given triangles, see IndexedMesh
+     */
     void set_triangles(const std::vector<Triangle>& triangles);
+    void set_triangles(const std::vector<Triangle>& triangles, const RenderSettings& bvh_settings);
+
+    /**
+     * @brief Replaces the mesh and the BVH of the renderer with the ones
+     * saved in the BVH cache under the given key (see BVHCache)
+     * @return True if the cache held a BVH for this key. The mesh
+     * and the BVH of the renderer are left untouched otherwise
+     */
+    bool load_bvh_from_cache(uint64_t cache_key);
+    /**
+     * @brief Same as load_bvh_from_cache(cache_key) for a BVH that was built by set_mesh(mesh, bvh_settings)
+     */
+    bool load_bvh_from_cache(uint64_t cache_key, const RenderSettings& bvh_settings);
+    /**
+     * @brief Saves the mesh and the BVH of the renderer in the BVH cache under the given key
+     */
+    bool save_bvh_to_cache(uint64_t cache_key) const;
 
     void add_analytic_shape(const AnalyticShapesTypes& shape);
 
+    /**
+     * @brief Adds an instance of the given mesh to the scene. The instances share the triangles
+     * and the BVH of the mesh. They are only ray traced, the hybrid rasterization
+     * only rasterizes the triangles of the renderer
+     * @return The index of the instance
+     */
+    int add_mesh_instance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world);
+    /**
+     * @brief Moves an instance without touching the triangles of its mesh
+     */
+    void set_instance_transform(int instance_index, const Transform& object_to_world);
+
     Materials& get_materials();
     void set_materials(Materials materials);
 
@@ -93,7 +142,13 @@ public:
     
     void reset_previous_transform();
 
-    void set_object_transform(const Transform& object_transform);
+    /**
+     * @brief Transforms the vertices of the mesh of the renderer and refits the BVH to them. The BVH
+     * is built again with the interactive builder of the render settings if refitting it
+     * degraded it too much
+     * @return True if the BVH had to be built again
+     */
+    bool set_object_transform(const Transform& object_transform);
     void set_camera_transform(const Transform& camera_transform);
     void apply_transformation_to_camera(const Transform& additional_transformation);
 
@@ -103,6 +158,20 @@ public:
      */
     void reconstruct_bvh_new();
 
+    /**
+     * @brief Whether or not the BVH was built with the interactive builder of the render
+     * settings or without the treelet optimization they ask for (new triangles loaded, object
+     * transform the BVH couldn't be refitted to). It should be built again with
+     * reconstruct_bvh_new() before a final render
+     */
+    bool is_bvh_interactive() const;
+
+    /**
+     * @brief Changes the ray-triangle intersection algorithm of the render settings and of the
+     * BVH of the renderer. The BVH of the instanced meshes keep the kernel they were built with
+     */
+    void set_triangle_intersection_kernel(RenderSettings::TriangleIntersectionKernel kernel);
+
     /**
      * @brief Destroys the BVH
      */
@@ -143,6 +212,16 @@ public:
      */
     Color trace_ray(const Ray& ray, HitInfo& hit_info, int current_recursion_depth, bool& intersection_found) const;
 
+    /**
+     * @brief Same as trace_ray() for the primary rays of neighboring pixels. The rays
+     * traverse the BVH together as a packet, their shadow rays too
+     * @param rays The rays of the packet. Only the first ray_count rays are traced
+     * @param [out] colors The color of each ray
+     * @param [out] hit_infos The hit information of each ray. Only relevant if an intersection was found
+     * @param [out] intersections_found Whether or not an intersection was found by each ray
+     */
+    void trace_packet(const Ray rays[BVH::PACKET_SIZE], int ray_count, Color colors[BVH::PACKET_SIZE], HitInfo hit_infos[BVH::PACKET_SIZE], bool intersections_found[BVH::PACKET_SIZE]) const;
+
     /**
      * @brief Renders the image full ray tracing
      */
@@ -186,6 +265,29 @@ private:
      * according to the given light position, false otherwise.
 	 */
     bool is_shadowed(const Point& inter_point, const Vector& normal_at_intersection, const Point& light_position) const;
+    /**
+     * @brief Same as is_shadowed() for the points of a ray packet
+     * @param points_mask Only the points whose bit is set in the mask are tested
+     * @return Mask whose i-th bit is set if the i-th point is shadowed
+     */
+    int is_shadowed_packet(const Point inter_points[BVH::PACKET_SIZE], const Vector normals_at_intersection[BVH::PACKET_SIZE], const Point& light_position, int points_mask) const;
+    /**
+     * @brief Computes the ray from the intersection point to the light source
+     * @param [out] t_max Distance to the light along the ray
+     */
+    Ray shadow_ray(const Point& inter_point, const Vector& normal_at_intersection, const Point& light_position, float& t_max) const;
+
+    /**
+     * @brief Completes the closest hit of a ray found against the triangles of the renderer
+     * with the instances and the analytic shapes, and computes the attributes of the hit
+     * @param triangle_hit_found Whether or not hit_info is an intersection with a triangle of the renderer
+     */
+    void complete_closest_hit(const Ray& ray, HitInfo& hit_info, bool triangle_hit_found) const;
+
+    /**
+     * @brief Color of the rays that don't hit anything
+     */
+    Color background_color(const Ray& ray) const;
 
     /**
      * @brief Returns the color based on the given normalized normal vector
@@ -212,12 +314,12 @@ private:
     /**
      * @brief Shades a given intersection point (contained in hit_info) with a technique
      * that helps visualizing ambient occlusion
-     * @param triangle The intersected triangle
+     * @param hit_info The intersection
      * @param u The u coordinate on the triangle at the intersection point
      * @param v The u coordinate on the triangle at the intersection point
      * @return The color at the shaded point
      */
-    Color shade_visualize_ao(const Triangle& triangle, float u, float v) const;
+    Color shade_visualize_ao(const HitInfo& hit_info, float u, float v) const;
 
     /**
      * @brief This function basically interpolates the tex coords at the intersection
@@ -225,13 +327,13 @@ private:
      * interpolated u and v in \param tex_coord_u and \param tex_coord_v. If the intersected
      * shape isn't a triangle, \param tex_coord_u and \param tex_coord_v are set to
      * \param u and \param v respectively
-     * @param triangle The intersected triangle. nullptr if an object other than a triangle was intersected
+     * @param hit_info The intersection, see HitInfo::interpolate_tex_coords()
      * @param u Input u coordinate to interpolate
      * @param v Input v coordinate to interpolate
      * @param [out] tex_coord_u The computed u texcoord
      * @param [out] tex_coord_v The computed v texcoord
      */
-    void get_tex_coords(const Triangle* triangle, float u, float v, float& tex_coord_u, float& tex_coord_v) const;
+    void get_tex_coords(const HitInfo& hit_info, float u, float v, float& tex_coord_u, float& tex_coord_v) const;
 
     /**
      * @brief Computes the ambient occlusion at the intersection point given
@@ -270,9 +372,9 @@ private:
      */
     Vector normal_mapping(const HitInfo& hit_info, float u, float v) const;
 
-    void parallax_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
-    void steep_parallax_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
-    void parallax_occlusion_mapping(const Triangle* triangle, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
+    void parallax_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
+    void steep_parallax_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
+    void parallax_occlusion_mapping(const HitInfo& hit_info, float u, float v, const Point& original_inter_point, const Vector& view_dir, float& new_u, float& new_v) const;
 
     /**
      * @brief Computes the color of the point intersection of a ray and the scene
@@ -285,6 +387,18 @@ private:
      * shading method set in the renderer settings
      */
     Color shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, int current_recursion_depth) const;
+    /**
+     * @brief Same as above once the intersection has been prepared by prepare_shading()
+     * @param u, v The texture coordinates given by prepare_shading()
+     * @param shadowed Whether or not the point is shadowed
+     */
+    Color shade_ray_inter_point(const Ray& ray, HitInfo& hit_info, float u, float v, bool shadowed, int current_recursion_depth) const;
+    /**
+     * @brief Applies the displacement mapping and the normal mapping to the intersection
+     * so that the shadow ray of the point can be cast before it is shaded
+     * @param [out] u, v The texture coordinates of the intersection after the displacement mapping
+     */
+    void prepare_shading(const Ray& ray, HitInfo& hit_info, float& u, float& v) const;
 
     /**
 	 * Clips triangles given in @to_clip against the plane defined by the given @plane_index and @plane_sign and
@@ -315,24 +429,53 @@ private:
      * @return The transformed z coordinate of the given vertex
      */
     float matrix_transform_z(const Transform& matrix, const Point& vertex);
+
+    /**
+     * @brief Precomputes the transforms of the triangles of the mesh read by the intersection
+     * kernel when the triangles are intersected without a BVH. The BVH keeps its own transforms
+     * so nothing is precomputed if the BVH of the renderer is built
+     */
+    void update_brute_force_transforms();
+
+    /**
+     * @brief Whether or not a BVH built with the builder and the treelet optimization of the
+     * given settings differs from the one the render settings ask for, see is_bvh_interactive()
+     */
+    bool is_interactive_build(const RenderSettings& bvh_settings) const;
+
+    /**
+     * @brief Precomputed transform of the given triangle of the mesh for the brute force
+     * intersections, nullptr if the kernel doesn't read them
+     */
+    const BaldwinWeberTriangle* brute_force_transform(int triangle_index) const;
 private:
     Buffer<float> _z_buffer;
     Buffer<Vector> _normal_buffer;//2D-Array of pointer to Vector.
 	//The pointer to Vector trick allows us to store a normal for 8 bytes
 	//(64 bit pointer) instead of 12 (3*4 floats)
 
-    std::vector<Triangle> _triangles;
+    //Triangles of the scene with their shared vertices stored only once. The BVH is
+    //built over this mesh and the transforms are applied to its vertices
+    IndexedMesh _mesh;
+    //Transforms of the triangles of the mesh for the kernels that read them when the
+    //triangles are intersected without a BVH. Empty if the BVH is built, see update_brute_force_transforms()
+    std::vector<BaldwinWeberTriangle> _brute_force_transforms;
+    //See is_bvh_interactive()
+    bool _bvh_interactive = false;
     //Last transform used to transform the triangles. It is used to avoid
     //"stacking" transforms on top of each other by inverting the previous
     //transformation that was applied
     Transform _previous_object_transform = Identity();
     Materials _materials;//Materials
 
-    std::vector<AnalyticShapesTypes> _analytic_shapes;
+    //Spheres indexed by their own hierarchy and unbounded planes
+    AnalyticShapesBVH _analytic_shapes;
 	 
 	RenderSettings _render_settings;
 
 	BVH _bvh;
+    //Hierarchy over the instanced meshes of the scene
+    TopLevelBVH _top_level_bvh;
 
     //Mutex used when the image buffer is being harsly modifier by the renderer
     //such as a memory move at the end of the SSAA downscale method for example
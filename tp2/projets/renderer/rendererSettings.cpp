@@ -1,4 +1,37 @@
 #include "rendererSettings.h"
+#include "triangleIntersection.h"
+
+const char* RenderSettings::bvh_builder_name(BVHBuilder builder)
+{
+    switch (builder)
+    {
+    case BINNED_SAH_BUILDER:
+        return "SAH";
+    case SPATIAL_SPLIT_SAH_BUILDER:
+        return "SBVH";
+    case LBVH_BUILDER:
+        return "LBVH";
+    default:
+        return "Octree";
+    }
+}
+
+const char* RenderSettings::bvh_layout_name(BVHLayout layout)
+{
+    switch (layout)
+    {
+    case WIDE_KDOP_BVH_LAYOUT:
+        return "Wide k-DOP";
+    case WIDE_AABB_BVH_LAYOUT:
+        return "Wide AABB";
+    case QUANTIZED_WIDE_KDOP_BVH_LAYOUT:
+        return "Quantized wide k-DOP";
+    case QUANTIZED_WIDE_AABB_BVH_LAYOUT:
+        return "Quantized wide AABB";
+    default:
+        return "Scalar";
+    }
+}
 
 std::ostream& operator << (std::ostream& os, const RenderSettings& settings)
 {
@@ -6,7 +39,20 @@ std::ostream& operator << (std::ostream& os, const RenderSettings& settings)
     if (settings.enable_ssaa)
         os << ", " << "SSAAx" << settings.ssaa_factor;
     if (settings.enable_bvh)
-        os << ", " << "BVH[LObjC=" << settings.bvh_leaf_object_count << ", maxDepth=" << settings.bvh_max_depth;
+    {
+        os << ", " << "BVH[";
+        os << RenderSettings::bvh_builder_name(settings.bvh_builder);
+        if (settings.bvh_layout != RenderSettings::SCALAR_BVH_LAYOUT)
+            os << ", " << RenderSettings::bvh_layout_name(settings.bvh_layout);
+        if (settings.bvh_optimize_treelets)
+            os << ", Treelets";
+        if (settings.bvh_quads)
+            os << ", Quads";
+        os << ", LObjC=" << settings.bvh_leaf_object_count << ", maxDepth=" << settings.bvh_max_depth << "]";
+    }
+
+    if (settings.triangle_intersection_kernel != RenderSettings::MOLLER_TRUMBORE_KERNEL)
+        os << ", " << TriangleIntersection::kernel(settings.triangle_intersection_kernel)._name;
 
     os << "]";
 
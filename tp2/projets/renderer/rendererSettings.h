@@ -24,6 +24,91 @@ struct RenderSettings
         VISUALIZE_AO,
     };
 
+    enum BVHBuilder
+    {
+        //Recursively splits space in octants at the midpoint of the node
+        //and inserts the triangles by their bounding box centroid
+        OCTREE_BUILDER,
+
+        //Binary hierarchy built top-down by evaluating the surface area heuristic
+        //on a fixed number of bins along each axis
+        BINNED_SAH_BUILDER,
+
+        //Same as the binned SAH builder but a triangle can also be split between
+        //the two children of a node (spatial split) when this lowers the cost of the node.
+        //Better suited to long and thin triangles at the cost of referencing
+        //some triangles from several leaves
+        SPATIAL_SPLIT_SAH_BUILDER,
+
+        //Linear BVH: the triangles are sorted along a Morton curve and the hierarchy is
+        //emitted from the bits of their Morton codes. Much faster to build than the other
+        //builders but the hierarchy is of lower quality
+        LBVH_BUILDER,
+
+        BVH_BUILDER_COUNT
+    };
+
+    enum BVHLayout
+    {
+        //Every node of the hierarchy stores its own bounding volume
+        //and the children of a node are intersected one by one
+        SCALAR_BVH_LAYOUT,
+
+        //The hierarchy is collapsed into nodes of up to 8 children whose
+        //7-plane bounding volumes are intersected at once with AVX2
+        WIDE_KDOP_BVH_LAYOUT,
+
+        //Same as WIDE_KDOP_BVH_LAYOUT but the children are bounded by
+        //axis aligned bounding boxes which are cheaper to intersect
+        WIDE_AABB_BVH_LAYOUT,
+
+        //Same as WIDE_KDOP_BVH_LAYOUT and WIDE_AABB_BVH_LAYOUT but the bounds of the children
+        //are quantized relative to their parent (see BVH_QUANTIZED_NODE_BITS) to save memory
+        QUANTIZED_WIDE_KDOP_BVH_LAYOUT,
+        QUANTIZED_WIDE_AABB_BVH_LAYOUT,
+
+        BVH_LAYOUT_COUNT
+    };
+
+    //Ray-triangle intersection algorithms, see TriangleIntersection
+    enum TriangleIntersectionKernel
+    {
+        //Cramer's rule on the edges of the triangle. The only kernel that intersects
+        //the 8-wide triangle packs of the leaves of the BVH at once, which makes it
+        //the fastest kernel inside the BVH. Slower than BALDWIN_WEBER_KERNEL when
+        //the triangles are tested one by one
+        MOLLER_TRUMBORE_KERNEL,
+
+        //Never lets a ray through the edges shared by two triangles. Removes
+        //the black dots that can appear between the triangles of very big models
+        WATERTIGHT_KERNEL,
+
+        //The ray is intersected with the unit triangle after being transformed by a matrix
+        //precomputed for each triangle. Uses more memory than the other kernels
+        BALDWIN_WEBER_KERNEL,
+
+        //Intersection with the plane of the triangle and barycentric
+        //coordinates of the intersection point
+        BARYCENTRIC_KERNEL,
+
+        TRIANGLE_INTERSECTION_KERNEL_COUNT
+    };
+
+    //Orders of the tiles of the image and of the pixels of a tile, see TileScheduler
+    enum TileOrder
+    {
+        //Left to right then top to bottom
+        SCANLINE_TILE_ORDER,
+
+        //Z-order curve: the bits of the x and y coordinates are interleaved.
+        //Every aligned square block of 4^n tiles or pixels is consecutive
+        MORTON_TILE_ORDER,
+
+        //Hilbert curve: same locality as the Morton order but two consecutive
+        //tiles or pixels are always next to each other
+        HILBERT_TILE_ORDER,
+    };
+
     RenderSettings() {}
     RenderSettings(int width, int height) : image_width(width), image_height(height) {}
 
@@ -54,6 +139,13 @@ struct RenderSettings
     //Maximum recursion depth allowed for reflections / refractions / ...
     int max_recursion_depth = 5;
 
+    //Size in pixels of the square tiles the image is split into to be rendered
+    //and post-processed in parallel, see TileScheduler
+    int tile_size = 16;
+    //Order in which the tiles are rendered and in which the pixels of a tile are traced.
+    //The primary rays of the packets are consecutive pixels in this order
+    TileOrder tile_order = MORTON_TILE_ORDER;
+
     //Whether or not to use a BVH to intersect the scene
     bool enable_bvh = true;
     //Maximum depth of the BVH tree
@@ -61,6 +153,31 @@ struct RenderSettings
     //Maximum number of objects per leaf of the BVH tree if the maximum recursion depth
     //defined by bvh_max_depth hasn't been reached
     int bvh_leaf_object_count = 40;
+    //Algorithm used to build the BVH
+    BVHBuilder bvh_builder = OCTREE_BUILDER;
+    //Algorithm used to build the BVH again when the geometry is edited from the UI
+    //(new triangles loaded, object transform the BVH couldn't be refitted to).
+    //The rebuild latency matters more than the quality of the hierarchy there
+    BVHBuilder bvh_interactive_builder = LBVH_BUILDER;
+    //Layout of the nodes of the BVH once built
+    BVHLayout bvh_layout = SCALAR_BVH_LAYOUT;
+    //Whether or not to restructure the treelets of the BVH once built to lower its SAH
+    //cost, see BVH::optimize_treelets(). The build takes longer but the traversals are
+    //cheaper which pays off for the final renders of static scenes
+    bool bvh_optimize_treelets = false;
+    //Whether or not the pairs of triangles that come from the quad faces of the models are built
+    //and intersected as a single primitive, see BVH::is_quad(). Fewer references in the leaves
+    //and fewer intersection tests per ray on models made of quads
+    bool bvh_quads = false;
+    //Whether or not to count the nodes visited and the triangles tested by the
+    //rays traversing the BVH during a render, see BVH::statistics()
+    bool enable_bvh_statistics = false;
+    //Whether or not to trace the primary rays of 8 neighboring pixels (and their shadow rays)
+    //through the BVH together, see BVH::intersect_packet(). The image is the same either way
+    bool enable_ray_packets = true;
+    //Algorithm used to intersect the rays with the triangles. Any kernel other than
+    //Moller-Trumbore intersects the triangles of the leaves of the BVH one by one
+    TriangleIntersectionKernel triangle_intersection_kernel = MOLLER_TRUMBORE_KERNEL;
 
     //Whether or not to enable post-processing-screen-space ambient occlusion
     bool enable_ssao = false;
@@ -101,6 +218,9 @@ struct RenderSettings
     bool enable_skysphere = false;//Mapping from equirectangular image to skysphere
     bool enable_skybox = false;//Mapping from cube map to skybox
 
+    static const char* bvh_builder_name(BVHBuilder builder);
+    static const char* bvh_layout_name(BVHLayout layout);
+
     friend std::ostream& operator << (std::ostream& os, const RenderSettings& settings);
 };
 
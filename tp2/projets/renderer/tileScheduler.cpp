@@ -0,0 +1,202 @@
+#include "tileScheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+TileScheduler::TileScheduler(int width, int height, int tile_size, RenderSettings::TileOrder order) : _tile_size(std::max(1, tile_size)), _thread_ranges(omp_get_max_threads())
+{
+    _tile_count_x = (width + _tile_size - 1) / _tile_size;
+    _tile_count_y = (height + _tile_size - 1) / _tile_size;
+
+    for (int index : curve_order(_tile_count_x, _tile_count_y, order))
+    {
+        Tile tile;
+        tile._index = index;
+        tile._x = index % _tile_count_x * _tile_size;
+        tile._y = index / _tile_count_x * _tile_size;
+        tile._width = std::min(_tile_size, width - tile._x);
+        tile._height = std::min(_tile_size, height - tile._y);
+
+        _tiles.push_back(tile);
+    }
+
+    _pixel_order = curve_order(_tile_size, _tile_size, order);
+
+    reset();
+}
+
+TileScheduler::TileScheduler(int width, int height, const RenderSettings& settings) : TileScheduler(width, height, settings.tile_size, settings.tile_order) {}
+
+int TileScheduler::tile_size() const { return _tile_size; }
+int TileScheduler::tile_count() const { return _tiles.size(); }
+int TileScheduler::tile_count_x() const { return _tile_count_x; }
+int TileScheduler::tile_count_y() const { return _tile_count_y; }
+
+void TileScheduler::reset()
+{
+    //Every thread starts with an equal part of the curve
+    int thread_count = _thread_ranges.size();
+    for (int i = 0; i < thread_count; i++)
+    {
+        uint32_t first = (uint64_t)_tiles.size() * i / thread_count;
+        uint32_t end = (uint64_t)_tiles.size() * (i + 1) / thread_count;
+
+        _thread_ranges[i]._range.store(pack_range(first, end), std::memory_order_relaxed);
+    }
+}
+
+uint64_t TileScheduler::pack_range(uint32_t first, uint32_t end)
+{
+    return (uint64_t)end << 32 | first;
+}
+
+void TileScheduler::unpack_range(uint64_t range, uint32_t& first, uint32_t& end)
+{
+    first = (uint32_t)range;
+    end = (uint32_t)(range >> 32);
+}
+
+bool TileScheduler::pop_tile(int thread_index, int& tile)
+{
+    //The team of the parallel region may be larger than the number of threads
+    //the scheduler was built for. These threads only steal
+    if (thread_index >= (int)_thread_ranges.size())
+        return false;
+
+    std::atomic<uint64_t>& range = _thread_ranges[thread_index]._range;
+    uint64_t current = range.load(std::memory_order_relaxed);
+    while (true)
+    {
+        uint32_t first, end;
+        unpack_range(current, first, end);
+        if (first >= end)
+            return false;
+
+        //The CAS only fails if a thief took the back of the range in the meantime
+        if (range.compare_exchange_weak(current, pack_range(first + 1, end), std::memory_order_relaxed))
+        {
+            tile = first;
+
+            return true;
+        }
+    }
+}
+
+bool TileScheduler::steal_tile(int thread_index, int& tile)
+{
+    int thread_count = _thread_ranges.size();
+    bool has_range = thread_index < thread_count;
+    for (int i = 1; i <= thread_count; i++)
+    {
+        //Visiting the other threads starting from the next one spreads the thieves over the victims
+        int victim = (thread_index + i) % thread_count;
+        if (victim == thread_index)
+            continue;
+
+        std::atomic<uint64_t>& range = _thread_ranges[victim]._range;
+        uint64_t current = range.load(std::memory_order_relaxed);
+        while (true)
+        {
+            uint32_t first, end;
+            unpack_range(current, first, end);
+            if (first >= end)
+                break;
+
+            //The victim keeps the first half of its tiles and the thief takes the other half,
+            //including the last tile left. The threads without a range only take one tile
+            uint32_t middle = has_range ? first + (end - first) / 2 : end - 1;
+            if (range.compare_exchange_weak(current, pack_range(first, middle), std::memory_order_relaxed))
+            {
+                tile = middle;
+                //A tile is never given back to a range so the emptied range of the thief
+                //can't be mistaken for an older value by the CAS of another thief
+                if (has_range)
+                    _thread_ranges[thread_index]._range.store(pack_range(middle + 1, end), std::memory_order_relaxed);
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+namespace
+{
+    //Bits 0, 2, 4, ... of the given value packed in the lower bits
+    int compact_bits(uint32_t value)
+    {
+        value &= 0x55555555;
+        value = (value | (value >> 1)) & 0x33333333;
+        value = (value | (value >> 2)) & 0x0F0F0F0F;
+        value = (value | (value >> 4)) & 0x00FF00FF;
+        value = (value | (value >> 8)) & 0x0000FFFF;
+
+        return value;
+    }
+
+    //Point at the distance d along the Hilbert curve that covers a size * size grid, size being a power of 2.
+    //"Programming the Hilbert curve", Skilling, 2004
+    void hilbert_point(int size, int d, int& x, int& y)
+    {
+        x = y = 0;
+        for (int s = 1; s < size; s *= 2)
+        {
+            int rx = 1 & (d / 2);
+            int ry = 1 & (d ^ rx);
+
+            //Rotating the quadrant
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+
+                std::swap(x, y);
+            }
+
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+    }
+}
+
+std::vector<int> TileScheduler::curve_order(int width, int height, RenderSettings::TileOrder order)
+{
+    std::vector<int> cells;
+    cells.reserve(width * height);
+
+    if (order == RenderSettings::SCANLINE_TILE_ORDER)
+    {
+        for (int i = 0; i < width * height; i++)
+            cells.push_back(i);
+
+        return cells;
+    }
+
+    //The curves cover a square grid whose side is a power of 2. The
+    //cells of that grid that aren't in the width * height grid are skipped
+    int size = 1;
+    while (size < width || size < height)
+        size *= 2;
+
+    for (int d = 0; d < size * size; d++)
+    {
+        int x, y;
+        if (order == RenderSettings::MORTON_TILE_ORDER)
+        {
+            x = compact_bits(d);
+            y = compact_bits(d >> 1);
+        }
+        else
+            hilbert_point(size, d, x, y);
+
+        if (x < width && y < height)
+            cells.push_back(x + y * width);
+    }
+
+    return cells;
+}
@@ -0,0 +1,146 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <omp.h>
+#include <vector>
+
+#include "rendererSettings.h"
+
+/*
+ * Splits the image into square tiles and distributes them to the threads of an OpenMP team.
+ *
+ * The tiles are sorted along the curve given by RenderSettings::tile_order and each thread
+ * starts with its own contiguous range of that curve, i.e. a compact region of the image.
+ * The range of a thread is a deque: its owner takes the tiles from the front and a thread
+ * that has no tiles left steals the back half of the tiles left to another thread. The threads
+ * that are stuck on expensive regions of the image (reflections, dense geometry, ...) are
+ * thus helped by the others while neighboring tiles are still mostly rendered by the same thread.
+ *
+ * The pixels of a tile can be iterated in the same order as the tiles, see for_each_pixel()
+ */
+class TileScheduler
+{
+public:
+    struct Tile
+    {
+        //Index of the tile in the row major grid of the tiles of the image
+        int _index;
+
+        //Pixel coordinates of the top left corner of the tile
+        int _x, _y;
+        //Size of the tile in pixels, smaller than the tile size for the tiles on the borders of the image
+        int _width, _height;
+    };
+
+    TileScheduler(int width, int height, int tile_size, RenderSettings::TileOrder order);
+    TileScheduler(int width, int height, const RenderSettings& settings);
+
+    int tile_size() const;
+    int tile_count() const;
+    //Number of columns and rows of the grid of the tiles
+    int tile_count_x() const;
+    int tile_count_y() const;
+
+    /*
+     * Gives the tiles back to the threads so that the image can be processed again
+     */
+    void reset();
+
+    /*
+     * Calls function(const Tile&) once for every tile of the image. Must be called
+     * by all the threads of an OpenMP parallel region, the function returns when all
+     * the tiles have been taken. The thread private variables of the region can
+     * thus be initialized before the tiles are processed
+     */
+    template <typename Function>
+    void process_tiles(Function&& function);
+
+    /*
+     * Same as process_tiles() in its own parallel region
+     */
+    template <typename Function>
+    void for_each_tile(Function&& function);
+
+    /*
+     * Calls function(int x, int y) for every pixel of the given tile
+     * in the order of RenderSettings::tile_order
+     */
+    template <typename Function>
+    void for_each_pixel(const Tile& tile, Function&& function) const;
+
+    /*
+     * @return The cells of a width * height grid in the given order. The cell (x, y) is x + y * width
+     */
+    static std::vector<int> curve_order(int width, int height, RenderSettings::TileOrder order);
+
+private:
+    /*
+     * Takes the next tile of the range of the given thread
+     * @return False if the range of the thread is empty
+     */
+    bool pop_tile(int thread_index, int& tile);
+
+    /*
+     * Takes the back half of the tiles left to another thread. The first of these
+     * tiles is returned, the others become the range of the given thread
+     * @return False if all the ranges are empty
+     */
+    bool steal_tile(int thread_index, int& tile);
+
+    //Packs the range [first, end) of the tiles left to a thread in a single
+    //word so that its owner and the thieves can update it with a single CAS
+    static uint64_t pack_range(uint32_t first, uint32_t end);
+    static void unpack_range(uint64_t range, uint32_t& first, uint32_t& end);
+
+    struct alignas(64) ThreadRange
+    {
+        std::atomic<uint64_t> _range;
+    };
+
+    int _tile_size;
+    int _tile_count_x, _tile_count_y;
+
+    //Tiles in the order of the curve
+    std::vector<Tile> _tiles;
+    //Offsets of the pixels of a tile in the order of the curve, packed as x + y * _tile_size
+    std::vector<int> _pixel_order;
+
+    //Range of the tiles left to each thread, one cache line each. The
+    //threads only write to the range of another thread to steal from it
+    std::vector<ThreadRange> _thread_ranges;
+};
+
+template <typename Function>
+void TileScheduler::process_tiles(Function&& function)
+{
+    int thread_index = omp_get_thread_num();
+
+    int tile;
+    while (pop_tile(thread_index, tile) || steal_tile(thread_index, tile))
+        function(_tiles[tile]);
+}
+
+template <typename Function>
+void TileScheduler::for_each_tile(Function&& function)
+{
+#pragma omp parallel
+    process_tiles(function);
+}
+
+template <typename Function>
+void TileScheduler::for_each_pixel(const Tile& tile, Function&& function) const
+{
+    for (int offset : _pixel_order)
+    {
+        int x = offset % _tile_size;
+        int y = offset / _tile_size;
+
+        //The tiles on the borders of the image are only partially covered
+        if (x < tile._width && y < tile._height)
+            function(tile._x + x, tile._y + y);
+    }
+}
+
+#endif
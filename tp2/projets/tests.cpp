@@ -1,14 +1,24 @@
+#include <algorithm>
 #include <ctime>
 #include <iostream>
+#include <string>
 #include <vector>
 
+#include "analyticShapesBVH.h"
+#include "bvh.h"
+#include "bvhCache.h"
+#include "indexedMesh.h"
+#include "topLevelBVH.h"
 #include "mat.h"
 #include "mesh_io.h"
 #include "meshIOUtils.h"
 #include "objUtils.h"
+#include "tileScheduler.h"
 #include "triangle.h"
+#include "triangleIntersection.h"
 #include "m256Triangles.h"
 #include "m256Vector.h"
+#include "m256Utils.h"
 
 #define EPSILON 1.0e-5f
 
@@ -29,6 +39,11 @@ bool vector_equal(const Vector & a, const Vector & b, float threshold)
     return float_equal(a.x, b.x, threshold) && float_equal(a.y, b.y, threshold) && float_equal(a.z, b.z, threshold);
 }
 
+bool point_identical(const Point& a, const Point& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
 void testBarycentric(Triangle triangle, Point point, float expected_u, float expected_v, bool expected_in_triangle)
 {
     float u, v;
@@ -123,6 +138,487 @@ void triangle_intersections_tests()
     std::cout << "OK!" << std::endl;
 }
 
+void triangle_intersection_kernels_tests()
+{
+    std::cout << "Testing triangle intersection kernels... ";
+
+    //Two triangles sharing the edge AC. A ray going through the edge must hit at least one of them
+    Point A(-1.3f, -0.7f, -5.1f), B(1.1f, -0.9f, -4.7f), C(0.9f, 1.2f, -5.3f), D(-1.2f, 1.0f, -4.9f);
+    Triangle triangleABC(A, B, C), triangleACD(A, C, D);
+    //The ends of the edge are left out, a ray going through a vertex on the border of the two triangles may miss them
+    for (int i = 50; i < 950; i++)
+    {
+        Point edge_point = A + (C - A) * (i / 1000.0f);
+        Ray ray(Point(0, 0, 0), normalize(edge_point - Point(0, 0, 0)));
+
+        float t, u, v;
+        assert_true(TriangleIntersection::watertight(triangleABC, nullptr, ray, t, u, v) || TriangleIntersection::watertight(triangleACD, nullptr, ray, t, u, v), "The watertight kernel let " << ray << " through the shared edge of " << triangleABC << " and " << triangleACD << std::endl);
+    }
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot_mesh = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+    std::vector<Triangle> robot = robot_mesh.triangles();
+
+    for (int kernel_index = 1; kernel_index < RenderSettings::TRIANGLE_INTERSECTION_KERNEL_COUNT; kernel_index++)
+    {
+        RenderSettings::TriangleIntersectionKernel kernel = (RenderSettings::TriangleIntersectionKernel)kernel_index;
+        const char* kernel_name = TriangleIntersection::kernel(kernel)._name;
+
+        BVH bvh(&robot_mesh, 12, 8, RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT);
+        bvh.set_intersection_kernel(kernel);
+
+        int disagreements = 0;
+        for (int y = 0; y < 32; y++)
+        {
+            for (int x = 0; x < 32; x++)
+            {
+                Ray ray(Point(0, 0, 0), normalize(Vector(x / 31.0f * 2 - 1, y / 31.0f * 2 - 1, -1)));
+
+                float closest_t = INFINITY, kernel_closest_t = INFINITY;
+                for (const Triangle& triangle : robot)
+                {
+                    float t, u, v;
+                    if (triangle.intersect(ray, t, u, v))
+                        closest_t = std::min(closest_t, t);
+                    if (TriangleIntersection::intersect(kernel, triangle, nullptr, ray, t, u, v))
+                        kernel_closest_t = std::min(kernel_closest_t, t);
+                }
+
+                //The kernels may disagree on the rays grazing an edge
+                if ((closest_t == INFINITY) != (kernel_closest_t == INFINITY))
+                    disagreements++;
+                else if (closest_t != INFINITY)
+                    assert_true(float_equal(closest_t, kernel_closest_t, EPSILON * closest_t), "The " << kernel_name << " kernel found the intersection t=" << kernel_closest_t << " for the ray " << ray << " instead of t=" << closest_t << std::endl);
+
+                HitInfo bvh_hit_info;
+                bool bvh_intersection = bvh.intersect(ray, bvh_hit_info);
+                assert_true(bvh_intersection == (kernel_closest_t != INFINITY) && (!bvh_intersection || bvh_hit_info.t == kernel_closest_t), "The BVH using the " << kernel_name << " kernel and the brute force intersection disagree on " << ray << std::endl);
+                assert_true(bvh.intersect_any(ray, INFINITY) == bvh_intersection, "The any-hit query of the BVH using the " << kernel_name << " kernel disagrees with its closest hit query on " << ray << std::endl);
+            }
+        }
+
+        assert_true(disagreements <= 32 * 32 / 100, "The " << kernel_name << " kernel and the Moller-Trumbore kernel disagree on " << disagreements << " rays" << std::endl);
+    }
+
+    std::cout << "OK!" << std::endl;
+}
+
+/*
+ * Ray (x, y) of the grid_size * grid_size grid of rays shot from the origin toward -z by the BVH tests
+ */
+Ray grid_ray(int x, int y, int grid_size)
+{
+    return Ray(Point(0, 0, 0), normalize(Vector(x / (grid_size - 1.0f) * 2 - 1, y / (grid_size - 1.0f) * 2 - 1, -1)));
+}
+
+/*
+ * Closest intersection of the ray with the triangles intersected one by one. t is -1 if there is none
+ */
+HitInfo brute_force_intersection(const std::vector<Triangle>& triangles, const Ray& ray)
+{
+    HitInfo brute_force_hit_info;
+    for (const Triangle& triangle : triangles)
+    {
+        HitInfo local_hit_info;
+        if (triangle.intersect(ray, local_hit_info))
+            if (local_hit_info.t < brute_force_hit_info.t || brute_force_hit_info.t == -1)
+                brute_force_hit_info = local_hit_info;
+    }
+
+    return brute_force_hit_info;
+}
+
+void assert_same_intersection(const std::string& name, const Ray& ray, bool intersection, const HitInfo& hit_info, const HitInfo& brute_force_hit_info)
+{
+    assert_true(intersection == (brute_force_hit_info.t != -1), "The " << name << " and the brute force intersection disagree on " << ray << std::endl);
+    if (intersection)
+        assert_true(float_equal(hit_info.t, brute_force_hit_info.t, EPSILON), "The " << name << " found the intersection t=" << hit_info.t << " for the ray " << ray << " but the closest intersection is at t=" << brute_force_hit_info.t << std::endl);
+}
+
+/*
+ * Checks the closest hit and any-hit queries of the BVH against the brute force intersection of the triangles
+ */
+void assert_bvh_matches_brute_force(const BVH& bvh, const std::vector<Triangle>& triangles, int grid_size, const std::string& name)
+{
+    for (int y = 0; y < grid_size; y++)
+    {
+        for (int x = 0; x < grid_size; x++)
+        {
+            Ray ray = grid_ray(x, y, grid_size);
+
+            HitInfo bvh_hit_info;
+            bool bvh_intersection = bvh.intersect(ray, bvh_hit_info);
+            assert_same_intersection(name, ray, bvh_intersection, bvh_hit_info, brute_force_intersection(triangles, ray));
+            assert_true(bvh.intersect_any(ray, INFINITY) == bvh_intersection, "The " << name << " any-hit query disagrees with the closest hit query on " << ray << std::endl);
+        }
+    }
+}
+
+void bvh_intersections_tests(RenderSettings::BVHBuilder builder, RenderSettings::BVHLayout layout, const char* builder_name, bool optimize_treelets = false, bool quads = false)
+{
+    std::cout << "Testing " << builder_name << " BVH intersections... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+
+    BVH bvh(&robot, 12, 8, builder, layout, optimize_treelets, quads);
+    if (optimize_treelets)
+        assert_true(bvh._treelet_optimization._sah_cost_after <= bvh._treelet_optimization._sah_cost_before, "The treelet optimization of the " << builder_name << " BVH increased its SAH cost: " << bvh._treelet_optimization << std::endl);
+    assert_bvh_matches_brute_force(bvh, robot.triangles(), 64, std::string(builder_name) + " BVH");
+
+    std::cout << "OK!" << std::endl;
+}
+
+void bvh_refit_tests(RenderSettings::BVHBuilder builder, RenderSettings::BVHLayout layout, const char* builder_name)
+{
+    std::cout << "Testing " << builder_name << " BVH refit... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+
+    BVH bvh(&robot, 12, 8, builder, layout);
+
+    //Rotating the robot around itself
+    robot.transform(Translation(Vector(0, -2, -4))(RotationY(30)(Translation(Vector(0, 2, 4)))));
+    assert_true(bvh.refit(), "The " << builder_name << " BVH should not need to be built again after a rotation" << std::endl);
+    assert_bvh_matches_brute_force(bvh, robot.triangles(), 32, "refitted " + std::string(builder_name) + " BVH");
+
+    std::cout << "OK!" << std::endl;
+}
+
+void bvh_statistics_tests(RenderSettings::BVHLayout layout, const char* layout_name)
+{
+    std::cout << "Testing " << layout_name << " BVH statistics... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+
+    BVH bvh(&robot, 12, 8, RenderSettings::BINNED_SAH_BUILDER, layout);
+
+    BVH::Statistics statistics = bvh.statistics();
+    int leaf_count = 0, leaf_triangle_count = 0;
+    for (int size = 0; size < (int)statistics._leaf_sizes.size(); size++)
+    {
+        leaf_count += statistics._leaf_sizes[size];
+        leaf_triangle_count += size * statistics._leaf_sizes[size];
+    }
+    assert_true(leaf_count == statistics._leaf_count, "The leaf size histogram of the " << layout_name << " BVH has " << leaf_count << " leaves instead of " << statistics._leaf_count << std::endl);
+    assert_true(leaf_triangle_count == robot.triangle_count(), "The leaves of the " << layout_name << " BVH hold " << leaf_triangle_count << " triangles instead of " << robot.triangle_count() << std::endl);
+    assert_true(statistics._traversal_counters._rays == 0, "The traversal counters of the " << layout_name << " BVH should be disabled by default" << std::endl);
+
+    bvh.reset_traversal_counters(true);
+    for (int x = 0; x < 16; x++)
+    {
+        Ray ray(Point(0, 0, 0), normalize(Vector(x / 15.0f * 2 - 1, 0, -1)));
+
+        HitInfo hit_info;
+        bvh.intersect(ray, hit_info);
+        bvh.intersect_any(ray, INFINITY);
+    }
+
+    BVH::TraversalCounters counters = bvh.traversal_counters();
+    assert_true(counters._rays == 32, "The " << layout_name << " BVH counted " << counters._rays << " rays instead of 32" << std::endl);
+    assert_true(counters._nodes_visited >= 32 && counters._triangles_tested > 0, "The " << layout_name << " BVH didn't count the nodes visited or the triangles tested" << std::endl);
+
+    //The octree doesn't create children for its empty octants
+    IndexedMesh octree_robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+    BVH octree(&octree_robot, 12, 8, RenderSettings::OCTREE_BUILDER, layout);
+    BVH::Statistics octree_statistics = octree.statistics();
+    assert_true(octree_statistics._leaf_sizes.empty() || octree_statistics._leaf_sizes[0] == 0, "The " << layout_name << " octree BVH has " << octree_statistics._leaf_sizes[0] << " empty leaves" << std::endl);
+
+    std::cout << "OK!" << std::endl;
+}
+
+void bvh_packet_tests(RenderSettings::BVHBuilder builder, const char* builder_name)
+{
+    std::cout << "Testing " << builder_name << " BVH ray packets... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+
+    BVH bvh(&robot, 12, 8, builder, RenderSettings::SCALAR_BVH_LAYOUT);
+    Point light_position(2, 2, 2);
+    for (int y = 0; y < 64; y++)
+    {
+        for (int x = 0; x < 64; x += BVH::PACKET_SIZE)
+        {
+            //Some of the packets have inactive rays
+            int active_mask = (x / BVH::PACKET_SIZE) % 2 ? 0b10110101 : 0b11111111;
+
+            Ray rays[BVH::PACKET_SIZE];
+            for (int i = 0; i < BVH::PACKET_SIZE; i++)
+                rays[i] = Ray(Point(0, 0, 0), normalize(Vector((x + i) / 63.0f * 2 - 1, y / 63.0f * 2 - 1, -1)));
+
+            HitInfo packet_hit_infos[BVH::PACKET_SIZE];
+            int hit_mask = bvh.intersect_packet(rays, active_mask, packet_hit_infos);
+            assert_true((hit_mask & ~active_mask) == 0, "The " << builder_name << " BVH packet hit with inactive rays" << std::endl);
+
+            Ray shadow_rays[BVH::PACKET_SIZE];
+            float shadow_t_max[BVH::PACKET_SIZE];
+            int shadow_mask = 0;
+            bool occluded[BVH::PACKET_SIZE];
+            for (int i = 0; i < BVH::PACKET_SIZE; i++)
+            {
+                if (!(active_mask & (1 << i)))
+                    continue;
+
+                HitInfo hit_info;
+                bool intersection = bvh.intersect(rays[i], hit_info);
+                assert_true(intersection == bool(hit_mask & (1 << i)), "The " << builder_name << " BVH packet and single ray intersections disagree on " << rays[i] << std::endl);
+                if (!intersection)
+                    continue;
+
+                //The rays of a packet go through the same computations as the rays alone so the hits are exactly the same
+                bool same_hit = hit_info.t == packet_hit_infos[i].t && hit_info.u == packet_hit_infos[i].u && hit_info.v == packet_hit_infos[i].v && hit_info.triangle_index == packet_hit_infos[i].triangle_index;
+                assert_true(same_hit, "The " << builder_name << " BVH packet found the intersection t=" << packet_hit_infos[i].t << " for the ray " << rays[i] << " instead of t=" << hit_info.t << std::endl);
+
+                Point inter_point = rays[i]._origin + rays[i]._direction * hit_info.t;
+                shadow_rays[i] = Ray(inter_point + normalize(hit_info.hit_triangle()._normal) * 1.0e-3f, normalize(light_position - inter_point));
+                shadow_t_max[i] = length(light_position - shadow_rays[i]._origin);
+                occluded[i] = bvh.intersect_any(shadow_rays[i], shadow_t_max[i]);
+                shadow_mask |= 1 << i;
+            }
+
+            int occluded_mask = bvh.intersect_any_packet(shadow_rays, shadow_t_max, shadow_mask);
+            for (int i = 0; i < BVH::PACKET_SIZE; i++)
+                if (shadow_mask & (1 << i))
+                    assert_true(occluded[i] == bool(occluded_mask & (1 << i)), "The " << builder_name << " BVH packet and single ray any-hit queries disagree on " << shadow_rays[i] << std::endl);
+            assert_true((occluded_mask & ~shadow_mask) == 0, "The " << builder_name << " BVH packet any-hit query hit with inactive rays" << std::endl);
+        }
+    }
+
+    std::cout << "OK!" << std::endl;
+}
+
+void top_level_bvh_tests()
+{
+    std::cout << "Testing top level BVH intersections... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Identity());
+
+    RenderSettings settings;
+    settings.bvh_builder = RenderSettings::BINNED_SAH_BUILDER;
+    std::shared_ptr<const InstancedMesh> robot_mesh = std::make_shared<InstancedMesh>(robot, settings);
+
+    Transform transforms[3] = { Translation(Vector(-1.5f, -2, -4)), Translation(Vector(1.5f, -2, -5))(RotationY(90)), Translation(Vector(0, -1, -8))(Scale(2)) };
+
+    TopLevelBVH top_level_bvh;
+    std::vector<Triangle> world_triangles;
+    for (const Transform& transform : transforms)
+    {
+        top_level_bvh.add_instance(robot_mesh, transform);
+        for (const Triangle& triangle : robot.triangles())
+            world_triangles.push_back(transform(triangle));
+    }
+
+    for (int y = 0; y < 32; y++)
+    {
+        for (int x = 0; x < 32; x++)
+        {
+            Ray ray = grid_ray(x, y, 32);
+            HitInfo brute_force_hit_info = brute_force_intersection(world_triangles, ray);
+
+            HitInfo hit_info;
+            int instance_index;
+            bool intersection = top_level_bvh.intersect(ray, hit_info, instance_index);
+            assert_same_intersection("top level BVH", ray, intersection, hit_info, brute_force_hit_info);
+            assert_true(top_level_bvh.intersect_any(ray, INFINITY) == intersection, "The top level BVH any-hit query disagrees with the closest hit query on " << ray << std::endl);
+            if (intersection)
+            {
+                top_level_bvh.compute_hit_attributes(instance_index, hit_info);
+                assert_true(dot(hit_info.normal_at_intersection, brute_force_hit_info.normal_at_intersection) > 0.999f, "The normal of the intersection of the ray " << ray << " with the top level BVH isn't in world space" << std::endl);
+            }
+        }
+    }
+
+    std::cout << "OK!" << std::endl;
+}
+
+void analytic_shapes_bvh_tests()
+{
+    std::cout << "Testing analytic shapes BVH intersections... ";
+
+    std::srand(42);
+
+    std::vector<AnalyticShapesTypes> shapes;
+    shapes.push_back(Plane(Point(0, -2, 0), Vector(0, 1, 0)));
+    for (int i = 0; i < 200; i++)
+        shapes.push_back(Sphere(Point((std::rand() / (float)RAND_MAX * 2 - 1) * 5, -1.8f, std::rand() / (float)RAND_MAX * -11), 0.2f, i));
+
+    AnalyticShapesBVH shapes_bvh;
+    for (const AnalyticShapesTypes& shape : shapes)
+        shapes_bvh.add_shape(shape);
+
+    for (int y = 0; y < 32; y++)
+    {
+        for (int x = 0; x < 32; x++)
+        {
+            Ray ray(Point(0, 0, 0), normalize(Vector(x / 31.0f * 2 - 1, y / 31.0f * 2 - 1, -1)));
+
+            HitInfo brute_force_hit_info;
+            for (const AnalyticShapesTypes& shape : shapes)
+            {
+                HitInfo hit_info;
+                bool hit = std::visit([&](const auto& analytic_shape) { return analytic_shape.intersect(ray, hit_info); }, shape);
+                if (hit && (hit_info.t < brute_force_hit_info.t || brute_force_hit_info.t == -1))
+                    brute_force_hit_info = hit_info;
+            }
+
+            HitInfo bvh_hit_info;
+            bool bvh_intersection = shapes_bvh.intersect(ray, bvh_hit_info);
+            assert_true(bvh_intersection == (brute_force_hit_info.t != -1), "The analytic shapes BVH and the brute force intersection disagree on " << ray << std::endl);
+            if (bvh_intersection)
+            {
+                assert_true(float_equal(bvh_hit_info.t, brute_force_hit_info.t, EPSILON) && bvh_hit_info.mat_index == brute_force_hit_info.mat_index, "The analytic shapes BVH found the intersection t=" << bvh_hit_info.t << " for the ray " << ray << " but the closest intersection is at t=" << brute_force_hit_info.t << std::endl);
+                assert_true(shapes_bvh.intersect_any(ray, bvh_hit_info.t + EPSILON), "The analytic shapes BVH didn't find any intersection closer than t=" << bvh_hit_info.t + EPSILON << " for the ray " << ray << std::endl);
+            }
+        }
+    }
+
+    std::cout << "OK!" << std::endl;
+}
+
+void bvh_cache_tests()
+{
+    std::cout << "Testing BVH cache... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    IndexedMesh robot = MeshIOUtils::create_indexed_mesh(robotData, 0, Translation(Vector(0, -2, -4)));
+
+    BVH bvh(&robot, 12, 8, RenderSettings::BINNED_SAH_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT);
+    std::string cache_filepath = BVHCache::cache_filepath(42);
+    assert_true(BVHCache::save(cache_filepath, 42, bvh), "The BVH couldn't be saved to " << cache_filepath << std::endl);
+
+    IndexedMesh cached_robot;
+    BVH cached_bvh;
+    assert_true(!BVHCache::load(cache_filepath, 43, cached_robot, cached_bvh), "A cached BVH was loaded with the wrong key" << std::endl);
+    assert_true(BVHCache::load(cache_filepath, 42, cached_robot, cached_bvh), "The cached BVH couldn't be loaded from " << cache_filepath << std::endl);
+    std::remove(cache_filepath.c_str());
+    assert_true(cached_robot._indices == robot._indices && cached_robot._vertices.size() == robot._vertices.size(), "The cached mesh isn't the mesh the BVH was built over" << std::endl);
+
+    for (int y = 0; y < 32; y++)
+    {
+        for (int x = 0; x < 32; x++)
+        {
+            Ray ray(Point(0, 0, 0), normalize(Vector(x / 31.0f * 2 - 1, y / 31.0f * 2 - 1, -1)));
+
+            HitInfo hit_info, cached_hit_info;
+            bool intersection = bvh.intersect(ray, hit_info);
+            assert_true(intersection == cached_bvh.intersect(ray, cached_hit_info), "The cached BVH and the built BVH disagree on " << ray << std::endl);
+            if (intersection)
+                assert_true(hit_info.t == cached_hit_info.t && cached_hit_info.triangle_index == hit_info.triangle_index, "The cached BVH found another intersection than the built BVH for " << ray << std::endl);
+        }
+    }
+
+    //Files with a valid header but whose arrays are indexed out of their bounds are rejected
+    robot._indices[0] = (uint32_t)robot._vertices.size();
+    assert_true(BVHCache::save(cache_filepath, 42, bvh) && !BVHCache::load(cache_filepath, 42, cached_robot, cached_bvh), "A cached mesh indexing vertices out of its bounds was loaded" << std::endl);
+    robot._indices[0] = cached_robot._indices[0];
+
+    bvh._wide_kdop_nodes[0]._first[0] = 1 << 30;
+    assert_true(BVHCache::save(cache_filepath, 42, bvh) && !BVHCache::load(cache_filepath, 42, cached_robot, cached_bvh), "A cached node indexing a child out of the bounds of the hierarchy was loaded" << std::endl);
+    std::remove(cache_filepath.c_str());
+
+    std::cout << "OK!" << std::endl;
+}
+
+void indexed_mesh_tests()
+{
+    std::cout << "Testing indexed meshes... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    Transform transform = Translation(Vector(0, -2, -4)) * RotationY(30);
+    std::vector<Triangle> robot = MeshIOUtils::create_triangles(robotData, 0, Identity());
+    IndexedMesh mesh = MeshIOUtils::create_indexed_mesh(robotData, 0, Identity());
+
+    assert_true(mesh.triangle_count() == (int)robot.size(), "The indexed mesh has " << mesh.triangle_count() << " triangles instead of " << robot.size() << std::endl);
+    assert_true(mesh._vertices.size() < robot.size() * 3, "The vertices of the indexed mesh aren't shared" << std::endl);
+
+    IndexedMesh welded_mesh(robot);
+    assert_true(welded_mesh._vertices.size() <= mesh._vertices.size(), "Welding the triangles produced more vertices than the mesh data" << std::endl);
+
+    mesh.transform(transform);
+    welded_mesh.transform(transform);
+    for (int i = 0; i < (int)robot.size(); i++)
+    {
+        Triangle expected = transform(robot[i]);
+        Triangle triangles[2] = { mesh.triangle(i), welded_mesh.triangle(i) };
+        for (const Triangle& triangle : triangles)
+            assert_true(point_identical(triangle._a, expected._a) && point_identical(triangle._b, expected._b) && point_identical(triangle._c, expected._c)
+                        && vector_equal(triangle._normal, expected._normal, EPSILON) && triangle._materialIndex == expected._materialIndex
+                        && point_identical(triangle._tex_coords_u, expected._tex_coords_u) && point_identical(triangle._tex_coords_v, expected._tex_coords_v),
+                        "The triangle " << i << " of the indexed mesh is " << triangle << " instead of " << expected << std::endl);
+    }
+
+    //The BVH only reorders the triangles of the mesh it is built over
+    std::vector<Point> vertices = mesh._vertices;
+    BVH bvh(&mesh, 12, 8, RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT);
+    assert_true(mesh._vertices.size() == vertices.size() && std::equal(vertices.begin(), vertices.end(), mesh._vertices.begin(), point_identical), "Building the BVH modified the vertices of the mesh" << std::endl);
+    assert_true(mesh.triangle_count() == (int)robot.size(), "The mesh has " << mesh.triangle_count() << " triangles instead of " << robot.size() << " once the BVH is built" << std::endl);
+
+    std::cout << "OK!" << std::endl;
+}
+
+void bvh_quads_tests()
+{
+    std::cout << "Testing BVH quads pairing... ";
+
+    MeshIOData robotData = read_meshio_data("data/Robot/robot.obj");
+    std::vector<Triangle> robot = MeshIOUtils::create_triangles(robotData, 0, Translation(Vector(0, -2, -4)));
+    assert_true(BVH::is_quad(robot[0], robot[1]), "The first face of the robot wasn't split into the two triangles of a quad" << std::endl);
+
+    //The two triangles of the quads aren't consecutive anymore and must be paired again by the BVH
+    std::reverse(robot.begin(), robot.end());
+    IndexedMesh robot_mesh(robot);
+
+    BVH bvh(&robot_mesh, 12, 8, RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, false, true);
+    assert_true(!bvh._quad_packs.empty() && bvh._triangle_packs.empty(), "The BVH didn't pack its leaves as quads" << std::endl);
+    assert_bvh_matches_brute_force(bvh, robot, 32, "paired quads BVH");
+
+    std::cout << "OK!" << std::endl;
+}
+
+void tile_scheduler_tests()
+{
+    std::cout << "Testing tile scheduler... ";
+
+    RenderSettings::TileOrder orders[3] = { RenderSettings::SCANLINE_TILE_ORDER, RenderSettings::MORTON_TILE_ORDER, RenderSettings::HILBERT_TILE_ORDER };
+    for (RenderSettings::TileOrder order : orders)
+    {
+        //Consecutive cells of the Hilbert curve are neighbors
+        std::vector<int> cells = TileScheduler::curve_order(16, 16, order);
+        assert_true(cells.size() == 16 * 16, "The curve of order " << order << " has " << cells.size() << " cells instead of " << 16 * 16 << std::endl);
+        if (order == RenderSettings::HILBERT_TILE_ORDER)
+            for (int i = 1; i < (int)cells.size(); i++)
+                assert_true(std::abs(cells[i] % 16 - cells[i - 1] % 16) + std::abs(cells[i] / 16 - cells[i - 1] / 16) == 1, "The cells " << i - 1 << " and " << i << " of the Hilbert curve aren't neighbors" << std::endl);
+
+        //Tiles that don't divide the image, the tiles on the borders are partial
+        int width = 101, height = 37;
+        int tile_sizes[3] = { 1, 16, 40 };
+        for (int tile_size : tile_sizes)
+        {
+            std::vector<int> pixel_visits(width * height, 0);
+
+            TileScheduler scheduler(width, height, tile_size, order);
+            for (int pass = 0; pass < 2; pass++)
+            {
+                scheduler.reset();
+                scheduler.for_each_tile([&](const TileScheduler::Tile& tile) {
+                    scheduler.for_each_pixel(tile, [&](int x, int y) {
+                        pixel_visits[x + y * width]++;
+                    });
+                });
+            }
+
+            for (int i = 0; i < width * height; i++)
+                assert_true(pixel_visits[i] == 2, "The pixel (" << i % width << ", " << i / width << ") was visited " << pixel_visits[i] << " times instead of 2 with tiles of size " << tile_size << " in the order " << order << std::endl);
+        }
+    }
+
+    std::cout << "OK!" << std::endl;
+}
+
 void SIMD_implementations_tests()
 {
     Vector a = Vector(1, 0, 0);
@@ -217,6 +713,60 @@ void SIMD_implementations_tests()
     for (int i = 0; i < 8; i++) {
         assert_true(vector_equal(crossProd[i], cross(__a[i], __b[i]), EPSILON), "SIMD Dot Product wasn't equal to reference dot product at index " << i << ". Was " << crossProd[i] << " but expected " << cross(__a[i], __b[i]) << std::endl);
     };
+    std::cout << "OK!" << std::endl;
+    // --------------- //
+    // -------------------------------------------------------------------- //
+    // -------------------------------------------------------------------- //
+    // --------------- //
+    std::cout << "Testing SIMD reductions... ";
+    __m256 to_reduce[8];
+    float expected_max[8], expected_min[8];
+    for (int i = 0; i < 8; i++)
+    {
+        alignas(32) float values[8];
+        for (int j = 0; j < 8; j++)
+            values[j] = (float)((i * 5 + j * 3) % 8) - i;
+        to_reduce[i] = _mm256_load_ps(values);
+
+        expected_max[i] = *std::max_element(values, values + 8);
+        expected_min[i] = *std::min_element(values, values + 8);
+        assert_true(_mm256_max_reduction_ps(to_reduce[i]) == expected_max[i], "SIMD max reduction of vector " << i << " was " << _mm256_max_reduction_ps(to_reduce[i]) << " but expected " << expected_max[i] << std::endl);
+        assert_true(_mm256_min_reduction_ps(to_reduce[i]) == expected_min[i], "SIMD min reduction of vector " << i << " was " << _mm256_min_reduction_ps(to_reduce[i]) << " but expected " << expected_min[i] << std::endl);
+    }
+
+    alignas(32) float max_reductions[8], min_reductions[8];
+    _mm256_store_ps(max_reductions, _mm256_max_reduction8_ps(to_reduce));
+    _mm256_store_ps(min_reductions, _mm256_min_reduction8_ps(to_reduce));
+    for (int i = 0; i < 8; i++)
+    {
+        assert_true(max_reductions[i] == expected_max[i], "SIMD 8 vectors max reduction wasn't equal to the reference at index " << i << ". Was " << max_reductions[i] << " but expected " << expected_max[i] << std::endl);
+        assert_true(min_reductions[i] == expected_min[i], "SIMD 8 vectors min reduction wasn't equal to the reference at index " << i << ". Was " << min_reductions[i] << " but expected " << expected_min[i] << std::endl);
+    }
+    std::cout << "OK!" << std::endl;
+    // --------------- //
+    // -------------------------------------------------------------------- //
+    // -------------------------------------------------------------------- //
+    // --------------- //
+    std::cout << "Testing SIMD triangle intersections... ";
+    //5 triangles facing the camera at different depths, the 3 remaining lanes are empty
+    float depths[5] = { -5, -3, -7, -2, -9 };
+    Triangle triangles[5];
+    for (int i = 0; i < 5; i++)
+        triangles[i] = Triangle(Point(-1, -1, depths[i]), Point(1, -1, depths[i]), Point(0, 1, depths[i]));
+    __m256Triangles packed_triangles(triangles, 5);
+
+    Ray ray(Point(0.1f, 0.2f, 0), Vector(0, 0, -1));
+    float t = INFINITY, u, v;
+    int lane = packed_triangles.intersect(ray, t, u, v);
+    float expected_t, expected_u, expected_v;
+    triangles[3].intersect(ray, expected_t, expected_u, expected_v);
+    assert_true(lane == 3, "SIMD triangle intersection returned the lane " << lane << " but the closest triangle is in lane 3" << std::endl);
+    assert_true(float_equal(t, expected_t, EPSILON) && float_equal(u, expected_u, EPSILON) && float_equal(v, expected_v, EPSILON), "SIMD triangle intersection found (t, u, v) = (" << t << ", " << u << ", " << v << ") but expected (" << expected_t << ", " << expected_u << ", " << expected_v << ")" << std::endl);
+
+    t = 1.5f;
+    assert_true(packed_triangles.intersect(ray, t, u, v) == -1, "SIMD triangle intersection found an intersection farther than the given maximum distance" << std::endl);
+    t = INFINITY;
+    assert_true(packed_triangles.intersect(Ray(Point(0.1f, 0.2f, 0), Vector(0, 0, 1)), t, u, v) == -1, "SIMD triangle intersection found an intersection behind the ray" << std::endl);
     std::cout << "OK!" << std::endl << std::endl;
     // --------------- //
     // -------------------------------------------------------------------- //
@@ -231,6 +781,38 @@ int main()
     inside_outside_2D_tests();
     //-------------------------------------------------------------
     triangle_intersections_tests();
+    triangle_intersection_kernels_tests();
+    //-------------------------------------------------------------
+    bvh_intersections_tests(RenderSettings::OCTREE_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "octree");
+    bvh_intersections_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "binned SAH");
+    bvh_intersections_tests(RenderSettings::OCTREE_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP octree");
+    bvh_intersections_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP binned SAH");
+    bvh_intersections_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::WIDE_AABB_BVH_LAYOUT, "wide AABB binned SAH");
+    bvh_intersections_tests(RenderSettings::SPATIAL_SPLIT_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "spatial split SAH");
+    bvh_intersections_tests(RenderSettings::SPATIAL_SPLIT_SAH_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP spatial split SAH");
+    bvh_intersections_tests(RenderSettings::LBVH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "LBVH");
+    bvh_intersections_tests(RenderSettings::LBVH_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP LBVH");
+    bvh_intersections_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT, "quantized wide k-DOP binned SAH");
+    bvh_intersections_tests(RenderSettings::SPATIAL_SPLIT_SAH_BUILDER, RenderSettings::QUANTIZED_WIDE_AABB_BVH_LAYOUT, "quantized wide AABB spatial split SAH");
+    bvh_intersections_tests(RenderSettings::LBVH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "treelet optimized LBVH", true);
+    bvh_intersections_tests(RenderSettings::OCTREE_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "treelet optimized wide k-DOP octree", true);
+    bvh_intersections_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "binned SAH quads", false, true);
+    bvh_intersections_tests(RenderSettings::SPATIAL_SPLIT_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "spatial split SAH quads", false, true);
+    bvh_intersections_tests(RenderSettings::LBVH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "LBVH quads", false, true);
+    bvh_refit_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "binned SAH");
+    bvh_refit_tests(RenderSettings::OCTREE_BUILDER, RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP octree");
+    bvh_refit_tests(RenderSettings::LBVH_BUILDER, RenderSettings::SCALAR_BVH_LAYOUT, "LBVH");
+    bvh_refit_tests(RenderSettings::BINNED_SAH_BUILDER, RenderSettings::QUANTIZED_WIDE_KDOP_BVH_LAYOUT, "quantized wide k-DOP binned SAH");
+    bvh_packet_tests(RenderSettings::BINNED_SAH_BUILDER, "binned SAH");
+    bvh_packet_tests(RenderSettings::SPATIAL_SPLIT_SAH_BUILDER, "spatial split SAH");
+    bvh_statistics_tests(RenderSettings::SCALAR_BVH_LAYOUT, "scalar");
+    bvh_statistics_tests(RenderSettings::WIDE_KDOP_BVH_LAYOUT, "wide k-DOP");
+    top_level_bvh_tests();
+    analytic_shapes_bvh_tests();
+    bvh_cache_tests();
+    bvh_quads_tests();
+    indexed_mesh_tests();
+    tile_scheduler_tests();
 
     std::cout << std::endl;
     //-------------------------------------------------------------
@@ -0,0 +1,133 @@
+#include "topLevelBVH.h"
+
+//Maximum number of instances in a leaf of the top level hierarchy
+static constexpr int TOP_LEVEL_LEAF_MAX_INSTANCES = 2;
+
+InstancedMesh::InstancedMesh(const IndexedMesh& mesh, const RenderSettings& settings) : _mesh(mesh)
+{
+    _min = Point(INFINITY, INFINITY, INFINITY);
+    _max = Point(-INFINITY, -INFINITY, -INFINITY);
+    for (int i = 0; i < _mesh.triangle_count(); i++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+        {
+            _min = min(_min, _mesh.vertex(i, corner));
+            _max = max(_max, _mesh.vertex(i, corner));
+        }
+    }
+
+    _bvh = BVH(&_mesh, settings);
+}
+
+MeshInstance::MeshInstance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world) : _mesh(mesh)
+{
+    set_transform(object_to_world);
+}
+
+void MeshInstance::set_transform(const Transform& object_to_world)
+{
+    _object_to_world = object_to_world;
+    _world_to_object = object_to_world.inverse();
+    _normal_to_world = object_to_world.normal();
+
+    //Bounding volume of the transformed corners of the box of the mesh
+    _world_volume = BVH::BoundingVolume();
+    if (_mesh->_mesh.triangle_count() == 0)
+        return;
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        Point object_corner((corner & 1) ? _mesh->_max.x : _mesh->_min.x,
+                            (corner & 2) ? _mesh->_max.y : _mesh->_min.y,
+                            (corner & 4) ? _mesh->_max.z : _mesh->_min.z);
+
+        _world_volume.extend_volume(_object_to_world(object_corner));
+    }
+}
+
+int TopLevelBVH::add_instance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world)
+{
+    _instances.emplace_back(mesh, object_to_world);
+    build();
+
+    return (int)_instances.size() - 1;
+}
+
+void TopLevelBVH::set_instance_transform(int instance_index, const Transform& object_to_world)
+{
+    _instances[instance_index].set_transform(object_to_world);
+    build();
+}
+
+const MeshInstance& TopLevelBVH::get_instance(int instance_index) const { return _instances[instance_index]; }
+int TopLevelBVH::instance_count() const { return (int)_instances.size(); }
+
+void TopLevelBVH::clear()
+{
+    _instances.clear();
+    _nodes.clear();
+    _instance_indices.clear();
+}
+
+void TopLevelBVH::build()
+{
+    std::vector<BVH::BoundingVolume> volumes;
+    volumes.reserve(_instances.size());
+    for (const MeshInstance& instance : _instances)
+        volumes.push_back(instance._world_volume);
+
+    BVH::build_median_split(volumes, TOP_LEVEL_LEAF_MAX_INSTANCES, _nodes, _instance_indices);
+}
+
+Ray TopLevelBVH::ray_to_object_space(const Ray& ray, const MeshInstance& instance) const
+{
+    //The direction isn't normalized to keep the same distances in both spaces
+    return Ray(instance._world_to_object(ray._origin), instance._world_to_object(ray._direction));
+}
+
+bool TopLevelBVH::intersect(const Ray& ray, HitInfo& hit_info, int& instance_index) const
+{
+    if (_instances.empty())
+        return false;
+
+    float closest_t = hit_info.t == -1 ? INFINITY : hit_info.t;
+    bool hit_found = false;
+
+    BVH::traverse_median_split(_nodes, _instance_indices, ray, closest_t, [&](int index, float& closest_hit_t) {
+        const MeshInstance& instance = _instances[index];
+
+        HitInfo instance_hit_info;
+        instance_hit_info.t = closest_hit_t == INFINITY ? -1 : closest_hit_t;
+        if (instance._mesh->_bvh.intersect(ray_to_object_space(ray, instance), instance_hit_info))
+        {
+            closest_hit_t = instance_hit_info.t;
+            hit_info = instance_hit_info;
+            instance_index = index;
+            hit_found = true;
+        }
+    });
+
+    return hit_found;
+}
+
+bool TopLevelBVH::intersect_any(const Ray& ray, float t_max) const
+{
+    if (_instances.empty())
+        return false;
+
+    return BVH::traverse_any_median_split(_nodes, _instance_indices, ray, t_max, [&](int index) {
+        const MeshInstance& instance = _instances[index];
+
+        return instance._mesh->_bvh.intersect_any(ray_to_object_space(ray, instance), t_max);
+    });
+}
+
+void TopLevelBVH::compute_hit_attributes(int instance_index, HitInfo& hit_info) const
+{
+    const MeshInstance& instance = _instances[instance_index];
+
+    hit_info.hit_triangle().compute_hit_attributes(hit_info);
+    hit_info.normal_at_intersection = normalize(instance._normal_to_world(hit_info.normal_at_intersection));
+    if (length2(hit_info.tangent) > 0)
+        hit_info.tangent = normalize(instance._object_to_world(hit_info.tangent));
+}
@@ -0,0 +1,108 @@
+#ifndef TOP_LEVEL_BVH_H
+#define TOP_LEVEL_BVH_H
+
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "indexedMesh.h"
+#include "mat.h"
+#include "rendererSettings.h"
+#include "triangle.h"
+
+/*
+ * Mesh that can be instanced any number of times in the scene. The triangles
+ * are in the object space of the mesh and their BVH is only built once,
+ * whatever the number of instances of the mesh
+ */
+struct InstancedMesh
+{
+    InstancedMesh(const IndexedMesh& mesh, const RenderSettings& settings);
+
+    //The BVH holds a pointer to the indexed mesh, the instanced mesh cannot be copied
+    InstancedMesh(const InstancedMesh& other) = delete;
+    InstancedMesh& operator=(const InstancedMesh& other) = delete;
+
+    IndexedMesh _mesh;
+    BVH _bvh;
+
+    //Axis aligned bounding box of the mesh in object space
+    Point _min, _max;
+};
+
+/*
+ * Placement of an instanced mesh in the scene
+ */
+struct MeshInstance
+{
+    MeshInstance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world);
+
+    /*
+     * Moves the instance. Only the bounding volume of the instance is updated,
+     * the triangles of the mesh and its BVH are left untouched
+     */
+    void set_transform(const Transform& object_to_world);
+
+    std::shared_ptr<const InstancedMesh> _mesh;
+
+    Transform _object_to_world;
+    Transform _world_to_object;
+    //Transforms the normals from object space to world space
+    Transform _normal_to_world;
+
+    //Bounding volume of the transformed mesh in world space
+    BVH::BoundingVolume _world_volume;
+};
+
+/*
+ * Hierarchy over the instances of the scene. Each instance is intersected by
+ * transforming the ray into the object space of its mesh and traversing the BVH of the mesh.
+ * The direction of the ray isn't normalized after the transformation so that the
+ * distance of an intersection is the same in world space and in object space.
+ *
+ * The hierarchy is a binary tree built by splitting the instances at the median of
+ * their centroids. There usually are much fewer instances than triangles, it is
+ * thus cheap to build it again every time an instance is added or moved
+ */
+class TopLevelBVH
+{
+public:
+    /*
+     * @return The index of the instance
+     */
+    int add_instance(std::shared_ptr<const InstancedMesh> mesh, const Transform& object_to_world);
+    void set_instance_transform(int instance_index, const Transform& object_to_world);
+    const MeshInstance& get_instance(int instance_index) const;
+    int instance_count() const;
+
+    void clear();
+
+    /*
+     * Same as BVH::intersect. hit_info.mesh is the mesh of the instance
+     * in object space, compute_hit_attributes() must be used to get the attributes of the
+     * hit in world space
+     *
+     * @param[out] instance_index The index of the instance that was hit
+     */
+    bool intersect(const Ray& ray, HitInfo& hit_info, int& instance_index) const;
+    bool intersect_any(const Ray& ray, float t_max) const;
+
+    /*
+     * Computes the attributes of the hit (see Triangle::compute_hit_attributes())
+     * with the normal and tangent in world space
+     */
+    void compute_hit_attributes(int instance_index, HitInfo& hit_info) const;
+
+private:
+    void build();
+
+    Ray ray_to_object_space(const Ray& ray, const MeshInstance& instance) const;
+
+    std::vector<MeshInstance> _instances;
+
+    std::vector<BVH::FlatNode> _nodes;
+    //The leaves of the hierarchy index this array, the instances of a leaf are contiguous
+    std::vector<int> _instance_indices;
+};
+
+#endif
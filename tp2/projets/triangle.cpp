@@ -1,4 +1,6 @@
+#include "hitInfo.h"
 #include "triangle.h"
+#include "triangleIntersection.h"
 
 Triangle::Triangle() :  _a(Point(0, 0, 0)),
                         _b(Point(1, 0, 0)),
@@ -24,82 +26,38 @@ Triangle::Triangle(const Triangle4& triangle, int material_index, const Point& t
 
 bool Triangle::intersect(const Ray& ray, HitInfo& hitInfo) const
 {
-    //Common variables to both algorithms
     float t, u, v;
-
-    //TODO investigate muller trumbore black dots on very big 3d models
-#if MOLLER_TRUMBORE
-    Vector ab = _b - _a;
-    Vector ac = _c - _a;
-    Vector OA = ray._origin - _a;
-    Vector minusDcrossOA = cross(-ray._direction, OA);
-
-    float Mdet = dot(_normal, -ray._direction);
-#if BACKFACE_CULLING
-    if (Mdet <= 0)//If Mdet < 0, triangle back-facing. If == 0, ray parallel to triangle
-        return false;
-#else
-    if (Mdet == 0)//If == 0, ray parallel to triangle
-        return false;
-#endif
-
-    Mdet = 1 / Mdet;//Inverting the determinant once and for all
-
-    //Cramer's rule
-    u = dot(minusDcrossOA, ac) * Mdet;
-    if (u < 0 || u > 1)
+    if (!intersect(ray, t, u, v))
         return false;
 
-    v = dot(minusDcrossOA, -ab) * Mdet;
-    if (v < 0 || u + v > 1)
-        return false;
-
-    //Intersection point in the triangle at this point, computing t
-    t = dot(_normal, OA) * Mdet;
-    if (t < 0)
-        return false;
-
-#else
-    //Is there an intersection with the plane of the triangle ?
-    float denom = dot(_normal, ray._direction);
-    if (denom == 0)
-        return false;
+    fill_hit_info(t, u, v, hitInfo);
 
-    t = dot(_normal, _a - ray._origin) / denom;
-    //We have an intersection with the plane of the 
-    //triangle but it's behind the origin of the ray
-    if (t < 0)
-        return false;
+    return true;
+}
 
-    //Now testing if the point is in the triangle
-    Point inter_point = ray._origin + ray._direction * t;
-    if (!barycentric_coordinates(inter_point, u, v))
-        return false;//We have an intersection with the plane of the triangle but the point isn't in the triangle
-#endif
+bool Triangle::intersect(const Ray& ray, float& t, float& u, float& v) const
+{
+    return TriangleIntersection::moller_trumbore(*this, nullptr, ray, t, u, v);
+}
 
-    //Common operations to both algorithms
+void Triangle::fill_hit_info(float t, float u, float v, HitInfo& hitInfo) const
+{
     hitInfo.t = t;
     //Barycentric coordinates are: P = (1 - u - v)A + uB + vC
     hitInfo.u = u;
     hitInfo.v = v;
-    hitInfo.tangent = get_tangent(ab, ac);
-    hitInfo.mat_index = _materialIndex;
-    hitInfo.normal_at_intersection = normalize(_normal);
     hitInfo.triangle = this;
+    hitInfo.mesh = nullptr;
+    hitInfo.triangle_index = -1;
 
-    return true;
+    compute_hit_attributes(hitInfo);
 }
 
-bool Triangle::intersect(const Ray& ray, float& t, float& u, float& v) const
+void Triangle::compute_hit_attributes(HitInfo& hitInfo) const
 {
-    HitInfo hitInfo;
-
-    bool returned = intersect(ray, hitInfo);
-    t = hitInfo.t;
-    u = hitInfo.u;
-    v = hitInfo.v;
-
-    return returned;
+    hitInfo.tangent = get_tangent(_b - _a, _c - _a);
+    hitInfo.mat_index = _materialIndex;
+    hitInfo.normal_at_intersection = normalize(_normal);
 }
 
 bool Triangle::barycentric_coordinates(const Point& point, float& u, float& v) const
@@ -212,6 +170,19 @@ const Point& Triangle::operator[] (int i) const
     return *((&_a) + i);
 }
 
+void HitInfo::interpolate_tex_coords(float u, float v, float& tex_coord_u, float& tex_coord_v) const
+{
+    if (triangle != nullptr)
+        triangle->interpolate_texcoords(u, v, tex_coord_u, tex_coord_v);
+    else if (mesh != nullptr)
+        mesh->interpolate_tex_coords(triangle_index, u, v, tex_coord_u, tex_coord_v);
+    else
+    {
+        tex_coord_u = u;
+        tex_coord_v = v;
+    }
+}
+
 std::ostream& operator <<(std::ostream& os, const HitInfo& infos)
 {
     os << "HitInfo[t="<< infos.t << ", u, v=(" << infos.u << ", " << infos.v << "), normal=" << infos.normal_at_intersection << "]";
@@ -1,13 +1,10 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
-#include "hitInfo.h"
 #include "ray.h"
 #include "vec.h"
 
-//1 to use the Moller Trumbore ray-triangle intersection algorithm. 
-//0 to use the naive (barycentric coordinates) ray-triangle intersection algorithm
-#define MOLLER_TRUMBORE 1
+struct HitInfo;
 
 //Whether or not to render triangles that are facing away from the camera
 #define BACKFACE_CULLING 1
@@ -54,8 +51,26 @@ public:
     Triangle(const Triangle4& triangle, int material_index = -1, const Point& tex_coords_u = Point(-1, -1, -1), const Point& tex_coords_v = Point(-1, -1, -1));
 
     bool intersect(const Ray& ray, HitInfo& hitInfo) const;
+    /*
+     * Only computes the distance and the barycentric coordinates of the intersection.
+     * t, u and v are only meaningful if the function returns true.
+     * Uses the Moller-Trumbore algorithm, see TriangleIntersection for the other algorithms
+     */
     bool intersect(const Ray& ray, float& t, float& u, float& v) const;
 
+    /*
+     * Fills the given hit info with the intersection of distance t and barycentric
+     * coordinates u and v and its attributes (see compute_hit_attributes())
+     */
+    void fill_hit_info(float t, float u, float v, HitInfo& hitInfo) const;
+
+    /*
+     * Computes the attributes (tangent, normalized normal, material) of an intersection
+     * with this triangle. Those are only needed for the intersection that is shaded
+     * and are thus not computed during the traversal of the scene
+     */
+    void compute_hit_attributes(HitInfo& hitInfo) const;
+
     /*
      * Inside/outside test considering the triangle's vertices to all have equal z coordinates.
      * This test essentially ignores the z coordinates of the triangle's vertices
@@ -0,0 +1,233 @@
+#include "triangleIntersection.h"
+
+#include <cmath>
+#include <utility>
+
+BaldwinWeberTriangle::BaldwinWeberTriangle(const Triangle& triangle)
+{
+    Vector e1 = triangle._b - triangle._a;
+    Vector e2 = triangle._c - triangle._a;
+    Vector normal = cross(e1, e2);
+
+    Vector a = Vector(triangle._a);
+    Vector ca = cross(Vector(triangle._c), a);
+    Vector ba = cross(Vector(triangle._b), a);
+
+    //The transform is divided by the largest component of the normal
+    //which keeps it as well conditioned as possible
+    float* T = _transform;
+    if (std::abs(normal.x) > std::abs(normal.y) && std::abs(normal.x) > std::abs(normal.z))
+    {
+        float inv = 1.0f / normal.x;
+
+        T[0] = 0;               T[1] = e2.z * inv;          T[2] = -e2.y * inv;         T[3] = ca.x * inv;
+        T[4] = 0;               T[5] = -e1.z * inv;         T[6] = e1.y * inv;          T[7] = -ba.x * inv;
+        T[8] = 1;               T[9] = normal.y * inv;      T[10] = normal.z * inv;     T[11] = -dot(a, normal) * inv;
+
+        _normal_component = normal.x;
+    }
+    else if (std::abs(normal.y) > std::abs(normal.z))
+    {
+        float inv = 1.0f / normal.y;
+
+        T[0] = -e2.z * inv;     T[1] = 0;                   T[2] = e2.x * inv;          T[3] = ca.y * inv;
+        T[4] = e1.z * inv;      T[5] = 0;                   T[6] = -e1.x * inv;         T[7] = -ba.y * inv;
+        T[8] = normal.x * inv;  T[9] = 1;                   T[10] = normal.z * inv;     T[11] = -dot(a, normal) * inv;
+
+        _normal_component = normal.y;
+    }
+    else if (normal.z != 0)
+    {
+        float inv = 1.0f / normal.z;
+
+        T[0] = e2.y * inv;      T[1] = -e2.x * inv;         T[2] = 0;                   T[3] = ca.z * inv;
+        T[4] = -e1.y * inv;     T[5] = e1.x * inv;          T[6] = 0;                   T[7] = -ba.z * inv;
+        T[8] = normal.x * inv;  T[9] = normal.y * inv;      T[10] = 1;                  T[11] = -dot(a, normal) * inv;
+
+        _normal_component = normal.z;
+    }
+    else
+    {
+        //Degenerate triangle, the null third row makes every ray parallel to it
+        for (int i = 0; i < 12; i++)
+            T[i] = 0;
+
+        _normal_component = 0;
+    }
+}
+
+const TriangleIntersection::KernelEntry TriangleIntersection::KERNELS[RenderSettings::TRIANGLE_INTERSECTION_KERNEL_COUNT] =
+{
+    { "Moller-Trumbore", TriangleIntersection::moller_trumbore, false },
+    { "Watertight", TriangleIntersection::watertight, false },
+    { "Baldwin-Weber", TriangleIntersection::baldwin_weber, true },
+    { "Barycentric", TriangleIntersection::barycentric, false },
+};
+
+const TriangleIntersection::KernelEntry& TriangleIntersection::kernel(RenderSettings::TriangleIntersectionKernel kernel)
+{
+    return KERNELS[kernel];
+}
+
+bool TriangleIntersection::moller_trumbore(const Triangle& triangle, const BaldwinWeberTriangle*, const Ray& ray, float& t, float& u, float& v)
+{
+    Vector ab = triangle._b - triangle._a;
+    Vector ac = triangle._c - triangle._a;
+    Vector OA = ray._origin - triangle._a;
+    Vector minusDcrossOA = cross(-ray._direction, OA);
+
+    float Mdet = dot(triangle._normal, -ray._direction);
+#if BACKFACE_CULLING
+    if (Mdet <= 0)//If Mdet < 0, triangle back-facing. If == 0, ray parallel to triangle
+        return false;
+#else
+    if (Mdet == 0)//If == 0, ray parallel to triangle
+        return false;
+#endif
+
+    Mdet = 1 / Mdet;//Inverting the determinant once and for all
+
+    //Cramer's rule
+    u = dot(minusDcrossOA, ac) * Mdet;
+    if (u < 0 || u > 1)
+        return false;
+
+    v = dot(minusDcrossOA, -ab) * Mdet;
+    if (v < 0 || u + v > 1)
+        return false;
+
+    //Intersection point in the triangle at this point, computing t
+    t = dot(triangle._normal, OA) * Mdet;
+    if (t < 0)
+        return false;
+
+    return true;
+}
+
+bool TriangleIntersection::watertight(const Triangle& triangle, const BaldwinWeberTriangle*, const Ray& ray, float& t, float& u, float& v)
+{
+    //The largest component of the direction becomes the z axis. x and y are swapped
+    //if that component is negative to keep the winding of the triangle
+    Vector abs_direction(std::abs(ray._direction.x), std::abs(ray._direction.y), std::abs(ray._direction.z));
+    int kz = abs_direction.x > abs_direction.y ? (abs_direction.x > abs_direction.z ? 0 : 2) : (abs_direction.y > abs_direction.z ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (ray._direction(kz) < 0)
+        std::swap(kx, ky);
+
+    //Shear that aligns the direction of the ray with the z axis
+    float Sx = ray._direction(kx) / ray._direction(kz);
+    float Sy = ray._direction(ky) / ray._direction(kz);
+    float Sz = 1.0f / ray._direction(kz);
+
+    Vector A = triangle._a - ray._origin;
+    Vector B = triangle._b - ray._origin;
+    Vector C = triangle._c - ray._origin;
+
+    float Ax = A(kx) - Sx * A(kz);
+    float Ay = A(ky) - Sy * A(kz);
+    float Bx = B(kx) - Sx * B(kz);
+    float By = B(ky) - Sy * B(kz);
+    float Cx = C(kx) - Sx * C(kz);
+    float Cy = C(ky) - Sy * C(kz);
+
+    //Edge functions, U, V and W are the barycentric coordinates of A, B and C respectively.
+    //The products of floats are exact in double precision, the edge function of an edge shared by two
+    //triangles is thus exactly the opposite in the other triangle so the ray can't go through both of them.
+    //This also holds if the compiler contracts the products and the subtraction into a FMA,
+    //which breaks this symmetry in single precision
+    float U = (float)((double)Cx * (double)By - (double)Cy * (double)Bx);
+    float V = (float)((double)Ax * (double)Cy - (double)Ay * (double)Cx);
+    float W = (float)((double)Bx * (double)Ay - (double)By * (double)Ax);
+
+#if BACKFACE_CULLING
+    //The edge functions of a front-facing triangle are all positive
+    if (U < 0 || V < 0 || W < 0)
+        return false;
+#else
+    if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+        return false;
+#endif
+
+    float det = U + V + W;
+    if (det == 0)
+        return false;
+
+    float Az = Sz * A(kz);
+    float Bz = Sz * B(kz);
+    float Cz = Sz * C(kz);
+    float T = U * Az + V * Bz + W * Cz;
+
+    float inv_det = 1.0f / det;
+    t = T * inv_det;
+    if (t < 0)
+        return false;
+
+    u = V * inv_det;
+    v = W * inv_det;
+
+    return true;
+}
+
+bool TriangleIntersection::baldwin_weber(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v)
+{
+    BaldwinWeberTriangle computed_transform;
+    if (transform == nullptr)
+    {
+        computed_transform = BaldwinWeberTriangle(triangle);
+        transform = &computed_transform;
+    }
+
+    const float* T = transform->_transform;
+    const Point& o = ray._origin;
+    const Vector& d = ray._direction;
+
+    //Only the z coordinates are needed to find the intersection with the plane of the unit triangle
+    float transformed_origin_z = T[8] * o.x + T[9] * o.y + T[10] * o.z + T[11];
+    float transformed_direction_z = T[8] * d.x + T[9] * d.y + T[10] * d.z;
+
+    //transformed_direction_z * _normal_component is dot(normal, direction)
+#if BACKFACE_CULLING
+    if (transformed_direction_z * transform->_normal_component >= 0)
+        return false;
+#else
+    if (transformed_direction_z == 0)
+        return false;
+#endif
+
+    t = -transformed_origin_z / transformed_direction_z;
+    if (t < 0)
+        return false;
+
+    Point hit_point = o + d * t;
+    u = T[0] * hit_point.x + T[1] * hit_point.y + T[2] * hit_point.z + T[3];
+    if (u < 0 || u > 1)
+        return false;
+
+    v = T[4] * hit_point.x + T[5] * hit_point.y + T[6] * hit_point.z + T[7];
+    if (v < 0 || u + v > 1)
+        return false;
+
+    return true;
+}
+
+bool TriangleIntersection::barycentric(const Triangle& triangle, const BaldwinWeberTriangle*, const Ray& ray, float& t, float& u, float& v)
+{
+    //Is there an intersection with the plane of the triangle ?
+    float denom = dot(triangle._normal, ray._direction);
+    if (denom == 0)
+        return false;
+
+    t = dot(triangle._normal, triangle._a - ray._origin) / denom;
+    //We have an intersection with the plane of the
+    //triangle but it's behind the origin of the ray
+    if (t < 0)
+        return false;
+
+    //Now testing if the point is in the triangle
+    Point inter_point = ray._origin + ray._direction * t;
+    if (!triangle.barycentric_coordinates(inter_point, u, v))
+        return false;//We have an intersection with the plane of the triangle but the point isn't in the triangle
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef TRIANGLE_INTERSECTION_H
+#define TRIANGLE_INTERSECTION_H
+
+#include "ray.h"
+#include "rendererSettings.h"
+#include "triangle.h"
+
+/*
+ * Affine transform that maps a triangle to the unit triangle (0, 0, 0), (1, 0, 0), (0, 1, 0).
+ * Precomputed once per triangle for the Baldwin-Weber intersection kernel
+ * ("Fast Ray-Triangle Intersections by Coordinate Transformation", Baldwin & Weber, 2016)
+ */
+struct BaldwinWeberTriangle
+{
+    BaldwinWeberTriangle() {}
+    BaldwinWeberTriangle(const Triangle& triangle);
+
+    //3x4 row major matrix. The first two rows give the barycentric coordinates
+    //of B and C, the third one the distance to the plane of the triangle
+    float _transform[12];
+
+    //Largest component of the normal of the triangle, the third row of the
+    //transform is the normal divided by this component. 0 for degenerate triangles
+    float _normal_component;
+};
+
+/*
+ * Registry of the ray-triangle intersection kernels that can be selected at runtime
+ * with RenderSettings::triangle_intersection_kernel.
+ *
+ * All the kernels follow the conventions of Triangle::intersect(): P = (1 - u - v)A + uB + vC,
+ * back-facing triangles are culled if BACKFACE_CULLING is 1 and only the intersections in
+ * front of the origin of the ray are found
+ */
+class TriangleIntersection
+{
+public:
+    /*
+     * Intersects the given ray with the given triangle. transform is the precomputed
+     * transform of the triangle, only read by the Baldwin-Weber kernel which computes it
+     * on the fly if transform is nullptr
+     */
+    typedef bool (*Kernel)(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v);
+
+    struct KernelEntry
+    {
+        const char* _name;
+        Kernel _intersect;
+
+        //Whether or not the kernel reads the precomputed BaldwinWeberTriangle of the triangles
+        bool _needs_transforms;
+    };
+
+    static const KernelEntry& kernel(RenderSettings::TriangleIntersectionKernel kernel);
+
+    static inline bool intersect(RenderSettings::TriangleIntersectionKernel kernel, const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v)
+    {
+        return TriangleIntersection::kernel(kernel)._intersect(triangle, transform, ray, t, u, v);
+    }
+
+    /*
+     * Moller-Trumbore algorithm: the intersection is solved with Cramer's rule.
+     * Default kernel, this is also the algorithm of the SIMD triangle packs of the BVH
+     */
+    static bool moller_trumbore(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v);
+
+    /*
+     * Watertight algorithm ("Watertight Ray/Triangle Intersection", Woop et al., 2013).
+     * The triangle is projected in a space where the ray is the z axis and the edge functions
+     * are evaluated in double precision. A ray going through an edge or a vertex
+     * shared by several triangles always hits at least one of them, which isn't guaranteed by the
+     * other kernels and shows as black dots on very big models
+     */
+    static bool watertight(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v);
+
+    /*
+     * Baldwin-Weber algorithm: the ray is transformed by the precomputed
+     * transform of the triangle and intersected with the unit triangle
+     */
+    static bool baldwin_weber(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v);
+
+    /*
+     * Intersection with the plane of the triangle followed by
+     * the computation of the barycentric coordinates of the point
+     */
+    static bool barycentric(const Triangle& triangle, const BaldwinWeberTriangle* transform, const Ray& ray, float& t, float& u, float& v);
+
+private:
+    static const KernelEntry KERNELS[RenderSettings::TRIANGLE_INTERSECTION_KERNEL_COUNT];
+};
+
+#endif
@@ -3,30 +3,31 @@
 
 std::vector<Triangle> MeshIOUtils::create_triangles(const MeshIOData& meshData, int current_material_count, const Transform& meshTransform)
 {
-	std::vector<Triangle> _triangles;
-	_triangles.reserve(meshData.indices.size() / 3);
+    return MeshIOUtils::create_indexed_mesh(meshData, current_material_count, meshTransform).triangles();
+}
 
-	for (size_t i = 0; i < meshData.indices.size(); i += 3)
-	{
-		int index0 = meshData.indices[i + 0];
-		int index1 = meshData.indices[i + 1];
-		int index2 = meshData.indices[i + 2];
+IndexedMesh MeshIOUtils::create_indexed_mesh(const MeshIOData& meshData, int current_material_count, const Transform& meshTransform)
+{
+    IndexedMesh mesh;
+    mesh._vertices.reserve(meshData.positions.size());
+    mesh._tex_coords.reserve(meshData.positions.size());
 
-		Triangle triangle(Point(meshTransform(meshData.positions[index0])),
-						  Point(meshTransform(meshData.positions[index1])),
-						  Point(meshTransform(meshData.positions[index2])));
-        triangle._materialIndex = meshData.material_indices[i / 3] + current_material_count;
+    for (size_t i = 0; i < meshData.positions.size(); i++)
+    {
+        mesh._vertices.push_back(meshTransform(meshData.positions[i]));
 
         if (meshData.texcoords.size() > 0)//If texcoords exist
-        {
-            triangle._tex_coords_u = Point(meshData.texcoords[index0].x, meshData.texcoords[index1].x, meshData.texcoords[index2].x);
-            triangle._tex_coords_v = Point(meshData.texcoords[index0].y, meshData.texcoords[index1].y, meshData.texcoords[index2].y);
-        }
+            mesh._tex_coords.push_back(vec2(meshData.texcoords[i].x, meshData.texcoords[i].y));
+        else
+            mesh._tex_coords.push_back(vec2(-1, -1));
+    }
 
-		_triangles.push_back(triangle);
-	}
+    mesh._indices.assign(meshData.indices.begin(), meshData.indices.end());
+    mesh._material_indices.reserve(meshData.indices.size() / 3);
+    for (size_t i = 0; i < meshData.indices.size(); i += 3)
+        mesh._material_indices.push_back(meshData.material_indices[i / 3] + current_material_count);
 
-	return _triangles;
+    return mesh;
 }
 
 std::vector<Triangle> MeshIOUtils::create_triangles(const MeshIOData& meshData)
@@ -1,6 +1,7 @@
 #ifndef MESH_IO_UTILS_H
 #define MESH_IO_UTILS_H
 
+#include "indexedMesh.h"
 #include "mat.h"
 #include "mesh_io.h"
 #include "triangle.h"
@@ -19,9 +20,18 @@ public:
      * a renderer that already has materials of previous objects. Leave at 0
      * if no material already exists in the renderer when calling this function
      * @param meshTransform The transform to apply to each triangle
-     * @return
+     * @return The triangles in the order of the faces of the mesh. A quad face ABCD
+     * gives the triangles ABC and ACD, one after the other, which the BVH can intersect
+     * as a single quad (see RenderSettings::bvh_quads)
      */
     static std::vector<Triangle> create_triangles(const MeshIOData& meshData, int current_material_count, const Transform& meshTransform);
+
+    /**
+     * @brief Same as create_triangles() but the vertices shared by several
+     * triangles are kept shared: the mesh data is only transformed once per
+     * vertex and the indices of the mesh data are kept as they are
+     */
+    static IndexedMesh create_indexed_mesh(const MeshIOData& meshData, int current_material_count, const Transform& meshTransform);
 };
 
 #endif